@@ -273,6 +273,10 @@ int blk_ioctl(kdev_t dev, unsigned int cmd, unsigned long arg)
 		case BLKELVSET:
 			return blkelvset_ioctl(&blk_get_queue(dev)->elevator,
 					       (blkelv_ioctl_arg_t *) arg);
+		case BLKELVSEL:
+			if (!capable(CAP_SYS_ADMIN))
+				return -EACCES;
+			return blkelvsel_ioctl(blk_get_queue(dev), (int) arg);
 
 		default:
 			return -EINVAL;
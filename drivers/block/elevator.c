@@ -18,6 +18,11 @@
  * Removed tests for max-bomb-segments, which was breaking elvtune
  *  when run without -bN
  *
+ * Deadline elevator: requests are sorted like elevator_linus does, and
+ * kept on per-direction expiry lists besides. When the oldest request
+ * has waited too long it is moved to the front of the queue, instead
+ * of limiting how often new requests may be sorted in ahead of it.
+ *
  */
 
 #include <linux/fs.h>
@@ -25,8 +30,14 @@
 #include <linux/elevator.h>
 #include <linux/blk.h>
 #include <linux/module.h>
+#include <linux/init.h>
 #include <asm/uaccess.h>
 
+/*
+ * Elevator set up by blk_init_queue(), chosen with elevator= at boot
+ */
+static int elevator_default = ELEVATOR_ID_LINUS;
+
 /*
  * This is a bit tricky. It's given that bh and rq are for the same
  * device, but the next request might of course not be. Run through
@@ -181,6 +192,132 @@ void elevator_noop_merge_cleanup(request_queue_t *q, struct request *req, int co
 
 void elevator_noop_merge_req(struct request *req, struct request *next) {}
 
+/*
+ * Like elevator_linus_merge(), but a request never stops new ones from
+ * being merged or sorted in ahead of it. Its deadline takes care of it.
+ */
+int elevator_deadline_merge(request_queue_t *q, struct request **req,
+			    struct list_head * head,
+			    struct buffer_head *bh, int rw,
+			    int max_sectors)
+{
+	struct list_head *entry = &q->queue_head;
+	unsigned int count = bh->b_size >> 9;
+
+	while ((entry = entry->prev) != head) {
+		struct request *__rq = blkdev_entry_to_request(entry);
+
+		if (__rq->waiting)
+			continue;
+		if (__rq->rq_dev != bh->b_rdev)
+			continue;
+		if (!*req && bh_rq_in_between(bh, __rq, &q->queue_head))
+			*req = __rq;
+		if (__rq->cmd != rw)
+			continue;
+		if (__rq->nr_sectors + count > max_sectors)
+			continue;
+		if (__rq->sector + __rq->nr_sectors == bh->b_rsector) {
+			*req = __rq;
+			return ELEVATOR_BACK_MERGE;
+		} else if (__rq->sector - count == bh->b_rsector) {
+			*req = __rq;
+			return ELEVATOR_FRONT_MERGE;
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+/*
+ * next is merged into req and about to be freed, req inherits its
+ * place on the expiry list if next was due earlier
+ */
+void elevator_deadline_merge_req(struct request *req, struct request *next)
+{
+	if (list_empty(&next->fifo))
+		return;
+	if (!list_empty(&req->fifo) && time_before(req->deadline, next->deadline))
+		return;
+
+	list_del(&req->fifo);
+	list_add(&req->fifo, &next->fifo);
+	req->deadline = next->deadline;
+}
+
+/*
+ * A new request was put on the queue. read_latency and write_latency
+ * are the expiry times in milliseconds.
+ */
+void elevator_deadline_add_req(request_queue_t *q, struct request *req)
+{
+	elevator_t *elevator = &q->elevator;
+	unsigned long expire;
+
+	expire = elevator_request_latency(elevator, req->cmd);
+	req->deadline = jiffies + expire * HZ / 1000;
+	list_add_tail(&req->fifo, &elevator->fifo[req->cmd]);
+}
+
+static inline struct request *deadline_expired(elevator_t *elevator, int rw)
+{
+	struct request *rq;
+
+	if (list_empty(&elevator->fifo[rw]))
+		return NULL;
+
+	rq = list_entry(elevator->fifo[rw].next, struct request, fifo);
+	if (time_before(jiffies, rq->deadline))
+		return NULL;
+	return rq;
+}
+
+/*
+ * The driver is taking req off the queue. Once the current batch has
+ * been started, look for an expired request, reads first, and move it
+ * to the front of the queue together with the requests that follow it
+ * in sector order, at most elevator->batch of them. The drive then
+ * goes on from there instead of seeking back and forth.
+ */
+void elevator_deadline_dequeue(request_queue_t *q, struct request *req)
+{
+	elevator_t *elevator = &q->elevator;
+	struct list_head *entry, batch;
+	struct request *rq, *next;
+	int nr = 0;
+
+	list_del_init(&req->fifo);
+
+	if (elevator->batch_left > 0 && --elevator->batch_left)
+		return;
+	/* the head may be active, unless req is the head itself */
+	if (q->head_active && !q->plugged && req->queue.prev != &q->queue_head)
+		return;
+
+	rq = deadline_expired(elevator, READ);
+	if (!rq)
+		rq = deadline_expired(elevator, WRITE);
+	if (!rq)
+		return;
+
+	INIT_LIST_HEAD(&batch);
+	for (;;) {
+		entry = rq->queue.next;
+		list_del(&rq->queue);
+		list_add_tail(&rq->queue, &batch);
+		if (++nr >= elevator->batch || entry == &q->queue_head)
+			break;
+		next = blkdev_entry_to_request(entry);
+		if (next == req)
+			break;
+		if (next->rq_dev != rq->rq_dev || next->sector < rq->sector)
+			break;
+		rq = next;
+	}
+	list_splice(&batch, &q->queue_head);
+	elevator->batch_left = nr;
+}
+
 int blkelvget_ioctl(elevator_t * elevator, blkelv_ioctl_arg_t * arg)
 {
 	blkelv_ioctl_arg_t output;
@@ -188,7 +325,7 @@ int blkelvget_ioctl(elevator_t * elevator, blkelv_ioctl_arg_t * arg)
 	output.queue_ID			= elevator->queue_ID;
 	output.read_latency		= elevator->read_latency;
 	output.write_latency		= elevator->write_latency;
-	output.max_bomb_segments	= 0;
+	output.max_bomb_segments	= elevator->batch;
 
 	if (copy_to_user(arg, &output, sizeof(blkelv_ioctl_arg_t)))
 		return -EFAULT;
@@ -210,6 +347,68 @@ int blkelvset_ioctl(elevator_t * elevator, const blkelv_ioctl_arg_t * arg)
 
 	elevator->read_latency		= input.read_latency;
 	elevator->write_latency		= input.write_latency;
+	/* only elevators that batch have a batch size to tune */
+	if (elevator->batch && input.max_bomb_segments > 0)
+		elevator->batch		= input.max_bomb_segments;
+	return 0;
+}
+
+static int elevator_type(int id, elevator_t * type)
+{
+	switch (id) {
+		case ELEVATOR_ID_LINUS:
+			*type = ELEVATOR_LINUS;
+			return 0;
+		case ELEVATOR_ID_NOOP:
+			*type = ELEVATOR_NOOP;
+			return 0;
+		case ELEVATOR_ID_DEADLINE:
+			*type = ELEVATOR_DEADLINE;
+			return 0;
+	}
+	return -EINVAL;
+}
+
+/*
+ * Switch the queue to another elevator. The requests already queued
+ * stay where they are, the new elevator is told about them as if they
+ * had just been added.
+ */
+int blkelvsel_ioctl(request_queue_t *q, int id)
+{
+	elevator_t *elevator = &q->elevator, type;
+	struct list_head *entry;
+	unsigned int queue_ID;
+	unsigned long flags;
+
+	if (elevator_type(id, &type))
+		return -EINVAL;
+	/* no request_fn, no blk_init_queue(): the elevator is never used */
+	if (!q->request_fn)
+		return -EINVAL;
+
+	spin_lock_irqsave(&io_request_lock, flags);
+	while (!list_empty(&elevator->fifo[READ]))
+		list_del_init(elevator->fifo[READ].next);
+	while (!list_empty(&elevator->fifo[WRITE]))
+		list_del_init(elevator->fifo[WRITE].next);
+
+	queue_ID = elevator->queue_ID;
+	*elevator = type;
+	elevator->queue_ID = queue_ID;
+	INIT_LIST_HEAD(&elevator->fifo[READ]);
+	INIT_LIST_HEAD(&elevator->fifo[WRITE]);
+
+	if (elevator->elevator_add_req_fn) {
+		entry = &q->queue_head;
+		while ((entry = entry->next) != &q->queue_head) {
+			struct request *rq = blkdev_entry_to_request(entry);
+
+			if (rq->q == q)
+				elevator->elevator_add_req_fn(q, rq);
+		}
+	}
+	spin_unlock_irqrestore(&io_request_lock, flags);
 	return 0;
 }
 
@@ -219,4 +418,29 @@ void elevator_init(elevator_t * elevator, elevator_t type)
 
 	*elevator = type;
 	elevator->queue_ID = queue_ID++;
+	INIT_LIST_HEAD(&elevator->fifo[READ]);
+	INIT_LIST_HEAD(&elevator->fifo[WRITE]);
 }
+
+void elevator_init_default(elevator_t * elevator)
+{
+	elevator_t type;
+
+	elevator_type(elevator_default, &type);
+	elevator_init(elevator, type);
+}
+
+static int __init elevator_setup(char *str)
+{
+	if (!strcmp(str, "linus"))
+		elevator_default = ELEVATOR_ID_LINUS;
+	else if (!strcmp(str, "noop"))
+		elevator_default = ELEVATOR_ID_NOOP;
+	else if (!strcmp(str, "deadline"))
+		elevator_default = ELEVATOR_ID_DEADLINE;
+	else
+		printk(KERN_WARNING "elevator: unknown elevator %s\n", str);
+	return 1;
+}
+
+__setup("elevator=", elevator_setup);
@@ -0,0 +1,252 @@
+/*
+ *  linux/drivers/block/elvtest.c
+ *
+ *  Elevator latency test. Loading the module streams writes to the
+ *  first half of a block device and meanwhile reads single blocks at
+ *  random from the second half, one at a time, the way a process
+ *  waiting for its reads would. When the time is up it reports how
+ *  long the reads took and how much was written.
+ *
+ *  THE DEVICE IS OVERWRITTEN. Use a scratch disk or partition that is
+ *  not mounted, e.g.
+ *
+ *	insmod elvtest dev=0x0341 seconds=30
+ *
+ *  Everything runs in the context of insmod, which polls the buffers
+ *  once per tick, so the latencies are measured in jiffies.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/locks.h>
+#include <linux/blkdev.h>
+#include <linux/tqueue.h>
+#include <linux/init.h>
+
+static int dev;
+static int seconds = 30;
+static int depth = 1024;
+
+MODULE_PARM(dev, "i");
+MODULE_PARM_DESC(dev, "device to test, as major*256+minor; it is overwritten");
+MODULE_PARM(seconds, "i");
+MODULE_PARM_DESC(seconds, "how long to run");
+MODULE_PARM(depth, "i");
+MODULE_PARM_DESC(depth, "number of block writes kept in flight");
+
+#define ELVTEST_BUCKETS	8
+
+/* upper bounds of the read latency histogram buckets, in ms */
+static int elvtest_bucket_ms[ELVTEST_BUCKETS - 1] = {
+	10, 50, 100, 250, 500, 1000, 5000
+};
+
+struct elvtest {
+	kdev_t dev;
+	int blocksize;
+	unsigned long half;		/* blocks in each half */
+	unsigned long seed;
+
+	struct buffer_head **wring;	/* writes in flight */
+	unsigned long wblock;
+	int wslot;
+	unsigned long writes;
+
+	struct buffer_head *rbh;	/* read in flight */
+	unsigned long rstart;
+	unsigned long reads;
+	unsigned long rtotal, rmax;	/* jiffies */
+	unsigned long hist[ELVTEST_BUCKETS];
+};
+
+static unsigned long elvtest_random(struct elvtest *et)
+{
+	et->seed = et->seed * 1103515245 + 12345;
+	return et->seed >> 8;
+}
+
+/*
+ * Refill the write slots whose I/O is done, going round the ring at
+ * most once. The data is whatever the buffers hold,
+ * and they are marked dirty by hand rather than with mark_buffer_dirty()
+ * so that bdflush is neither woken nor waited for.
+ */
+static void elvtest_write(struct elvtest *et)
+{
+	struct buffer_head *bh;
+	int n;
+
+	for (n = 0; n < depth; n++) {
+		bh = et->wring[et->wslot];
+		if (bh && buffer_locked(bh))
+			break;
+		if (bh)
+			brelse(bh);
+		bh = getblk(et->dev, et->wblock, et->blocksize);
+		mark_buffer_uptodate(bh, 1);
+		set_bit(BH_Dirty, &bh->b_state);
+		ll_rw_block(WRITE, 1, &bh);
+		et->wring[et->wslot] = bh;
+		et->writes++;
+
+		if (++et->wblock == et->half)
+			et->wblock = 0;
+		if (++et->wslot == depth)
+			et->wslot = 0;
+	}
+}
+
+static void elvtest_read_start(struct elvtest *et)
+{
+	struct buffer_head *bh;
+
+	bh = getblk(et->dev, et->half + elvtest_random(et) % et->half,
+		    et->blocksize);
+	/* make it go to the disk even if it was read before */
+	mark_buffer_uptodate(bh, 0);
+	et->rbh = bh;
+	et->rstart = jiffies;
+	ll_rw_block(READ, 1, &bh);
+}
+
+static void elvtest_read_done(struct elvtest *et)
+{
+	unsigned long lat = jiffies - et->rstart;
+	int i;
+
+	brelse(et->rbh);
+	et->rbh = NULL;
+
+	et->reads++;
+	et->rtotal += lat;
+	if (lat > et->rmax)
+		et->rmax = lat;
+	for (i = 0; i < ELVTEST_BUCKETS - 1; i++)
+		if (lat * 1000 / HZ < elvtest_bucket_ms[i])
+			break;
+	et->hist[i]++;
+}
+
+static void elvtest_report(struct elvtest *et, unsigned long elapsed)
+{
+	unsigned long kb;
+	int i;
+
+	printk(KERN_INFO "elvtest: %s: %lu reads, latency avg %lu ms, max %lu ms\n",
+	       kdevname(et->dev), et->reads,
+	       et->reads ? et->rtotal * 1000 / HZ / et->reads : 0,
+	       et->rmax * 1000 / HZ);
+	for (i = 0; i < ELVTEST_BUCKETS; i++) {
+		if (i < ELVTEST_BUCKETS - 1)
+			printk(KERN_INFO "elvtest:   < %5d ms %8lu\n",
+			       elvtest_bucket_ms[i], et->hist[i]);
+		else
+			printk(KERN_INFO "elvtest:  >= %5d ms %8lu\n",
+			       elvtest_bucket_ms[i - 1], et->hist[i]);
+	}
+	kb = et->writes * et->blocksize >> 10;
+	printk(KERN_INFO "elvtest: %s: %lu KB written, %lu KB/s\n",
+	       kdevname(et->dev), kb, kb * HZ / (elapsed ? elapsed : 1));
+}
+
+static int elvtest_run(struct elvtest *et)
+{
+	unsigned long start, end;
+	int i;
+
+	et->wring = kmalloc(depth * sizeof(struct buffer_head *), GFP_KERNEL);
+	if (!et->wring)
+		return -ENOMEM;
+	memset(et->wring, 0, depth * sizeof(struct buffer_head *));
+
+	start = jiffies;
+	end = start + seconds * HZ;
+	while (time_before(jiffies, end) && !signal_pending(current)) {
+		if (!et->rbh)
+			elvtest_read_start(et);
+		elvtest_write(et);
+		run_task_queue(&tq_disk);
+
+		if (!buffer_locked(et->rbh)) {
+			elvtest_read_done(et);
+			continue;
+		}
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_timeout(1);
+	}
+
+	if (et->rbh) {
+		wait_on_buffer(et->rbh);
+		elvtest_read_done(et);
+	}
+	for (i = 0; i < depth; i++) {
+		if (et->wring[i]) {
+			wait_on_buffer(et->wring[i]);
+			brelse(et->wring[i]);
+		}
+	}
+	kfree(et->wring);
+
+	elvtest_report(et, jiffies - start);
+	return 0;
+}
+
+static int __init elvtest_init(void)
+{
+	struct block_device *bdev;
+	struct elvtest *et;
+	int major, minor, err;
+
+	if (!dev)
+		return 0;
+	if (seconds <= 0 || depth <= 0)
+		return -EINVAL;
+
+	et = kmalloc(sizeof(*et), GFP_KERNEL);
+	if (!et)
+		return -ENOMEM;
+	memset(et, 0, sizeof(*et));
+	et->dev = to_kdev_t(dev);
+	et->seed = jiffies;
+	major = MAJOR(et->dev);
+	minor = MINOR(et->dev);
+
+	err = -ENODEV;
+	bdev = bdget(kdev_t_to_nr(et->dev));
+	if (!bdev)
+		goto out;
+	err = blkdev_get(bdev, FMODE_READ | FMODE_WRITE, 0, BDEV_RAW);
+	if (err)
+		goto out_bdput;
+
+	et->blocksize = BLOCK_SIZE;
+	if (blksize_size[major] && blksize_size[major][minor])
+		et->blocksize = blksize_size[major][minor];
+	err = -ENOSPC;
+	if (blk_size[major])
+		et->half = ((unsigned long) blk_size[major][minor] << 10) /
+			et->blocksize / 2;
+	if (!et->half)
+		goto out_put;
+
+	err = elvtest_run(et);
+	invalidate_buffers(et->dev);
+out_put:
+	blkdev_put(bdev, BDEV_RAW);
+out_bdput:
+	bdput(bdev);
+out:
+	kfree(et);
+	return err;
+}
+
+static void __exit elvtest_exit(void)
+{
+}
+
+module_init(elvtest_init);
+module_exit(elvtest_exit);
@@ -28,6 +28,7 @@
 #include <asm/io.h>
 #include <linux/blk.h>
 #include <linux/highmem.h>
+#include <linux/bio.h>
 #include <linux/raid/md.h>
 
 #include <linux/module.h>
@@ -268,6 +269,25 @@ void blk_queue_make_request(request_queue_t * q, make_request_fn * mfn)
 	q->make_request_fn = mfn;
 }
 
+/**
+ * blk_queue_make_bio - let a device take whole bios
+ * @q:  the request queue for the device to be affected
+ * @bfn: the function that takes a &struct bio
+ *
+ * Description:
+ *    A bio submitted to a device without a make_bio_fn is split into
+ *    one &struct buffer_head per block, which go through its
+ *    make_request_fn one by one. A device that can handle all the
+ *    pages of a bio in one go, typically one with a make_request_fn
+ *    of its own, says so by giving @bfn here. It has to complete the
+ *    bio with bio_endio(), or can hand it to bio_submit_bh() after all.
+ **/
+
+void blk_queue_make_bio(request_queue_t * q, make_bio_fn * bfn)
+{
+	q->make_bio_fn = bfn;
+}
+
 static inline int ll_new_segment(request_queue_t *q, struct request *req, int max_segments)
 {
 	if (req->nr_segments < max_segments) {
@@ -411,6 +431,10 @@ static int __make_request(request_queue_t * q, int rw, struct buffer_head * bh);
  *    whenever the given queue is unplugged. This behaviour can be changed with
  *    blk_queue_headactive().
  *
+ *    The queue gets the elevator chosen with the elevator= boot option,
+ *    elevator_linus if there was none. A driver can call elevator_init()
+ *    afterwards to pick another one, and BLKELVSEL changes it at run time.
+ *
  * Note:
  *    blk_init_queue() must be paired with a blk_cleanup_queue() call
  *    when the block device is deactivated (such as at module unload).
@@ -418,13 +442,14 @@ static int __make_request(request_queue_t * q, int rw, struct buffer_head * bh);
 void blk_init_queue(request_queue_t * q, request_fn_proc * rfn)
 {
 	INIT_LIST_HEAD(&q->queue_head);
-	elevator_init(&q->elevator, ELEVATOR_LINUS);
+	elevator_init_default(&q->elevator);
 	blk_init_free_list(q);
 	q->request_fn     	= rfn;
 	q->back_merge_fn       	= ll_back_merge_fn;
 	q->front_merge_fn      	= ll_front_merge_fn;
 	q->merge_requests_fn	= ll_merge_requests_fn;
 	q->make_request_fn	= __make_request;
+	q->make_bio_fn		= NULL;
 	q->plug_tq.sync		= 0;
 	q->plug_tq.routine	= &generic_unplug_device;
 	q->plug_tq.data		= q;
@@ -454,6 +479,7 @@ static inline struct request *get_request(request_queue_t *q, int rw)
 		rq->rq_status = RQ_ACTIVE;
 		rq->special = NULL;
 		rq->q = q;
+		INIT_LIST_HEAD(&rq->fifo);
 	}
 
 	return rq;
@@ -564,6 +590,8 @@ static inline void add_request(request_queue_t * q, struct request * req,
 	 * inserted at elevator_merge time
 	 */
 	list_add(&req->queue, insert_here);
+	if (q->elevator.elevator_add_req_fn)
+		q->elevator.elevator_add_req_fn(q, req);
 }
 
 inline void blk_refill_freelist(request_queue_t *q, int rw)
@@ -591,6 +619,8 @@ inline void blkdev_release_request(struct request *req)
 	 * asumme it has free buffers and check waiters
 	 */
 	if (q) {
+		list_del_init(&req->fifo);
+
 		/*
 		 * we've released enough buffers to start I/O again
 		 */
@@ -828,6 +858,35 @@ end_io:
 	return 0;
 }
 
+/*
+ * Test device size, when known. Returns 0 if the I/O does not fit.
+ */
+static int blk_check_size(int rw, kdev_t dev, unsigned long sector,
+			  unsigned int count)
+{
+	int major = MAJOR(dev);
+	int minorsize = 0;
+
+	if (blk_size[major])
+		minorsize = blk_size[major][MINOR(dev)];
+	if (minorsize) {
+		unsigned long maxsector = (minorsize << 1) + 1;
+
+		if (maxsector < count || maxsector - count < sector) {
+			/* This may well happen - the kernel calls bread()
+			   without checking the size of the device, e.g.,
+			   when mounting a device. */
+			printk(KERN_INFO
+			       "attempt to access beyond end of device\n");
+			printk(KERN_INFO "%s: rw=%d, want=%ld, limit=%d\n",
+			       kdevname(dev), rw,
+			       (sector + count)>>1, minorsize);
+			return 0;
+		}
+	}
+	return 1;
+}
+
 /**
  * generic_make_request: hand a buffer head to it's device driver for I/O
  * @rw:  READ, WRITE, or READA - what sort of I/O is desired.
@@ -864,38 +923,16 @@ end_io:
  * */
 void generic_make_request (int rw, struct buffer_head * bh)
 {
-	int major = MAJOR(bh->b_rdev);
-	int minorsize = 0;
 	request_queue_t *q;
 
 	if (!bh->b_end_io)
 		BUG();
 
-	/* Test device size, when known. */
-	if (blk_size[major])
-		minorsize = blk_size[major][MINOR(bh->b_rdev)];
-	if (minorsize) {
-		unsigned long maxsector = (minorsize << 1) + 1;
-		unsigned long sector = bh->b_rsector;
-		unsigned int count = bh->b_size >> 9;
-
-		if (maxsector < count || maxsector - count < sector) {
-			/* Yecch */
-			bh->b_state &= (1 << BH_Lock) | (1 << BH_Mapped);
-
-			/* This may well happen - the kernel calls bread()
-			   without checking the size of the device, e.g.,
-			   when mounting a device. */
-			printk(KERN_INFO
-			       "attempt to access beyond end of device\n");
-			printk(KERN_INFO "%s: rw=%d, want=%ld, limit=%d\n",
-			       kdevname(bh->b_rdev), rw,
-			       (sector + count)>>1, minorsize);
-
-			/* Yecch again */
-			bh->b_end_io(bh, 0);
-			return;
-		}
+	if (!blk_check_size(rw, bh->b_rdev, bh->b_rsector, bh->b_size >> 9)) {
+		/* Yecch */
+		bh->b_state &= (1 << BH_Lock) | (1 << BH_Mapped);
+		bh->b_end_io(bh, 0);
+		return;
 	}
 
 	/*
@@ -961,6 +998,60 @@ void submit_bh(int rw, struct buffer_head * bh)
 	}
 }
 
+/**
+ * submit_bio: submit a bio to the block device layer for I/O
+ * @rw: whether to %READ or %WRITE, or maybe to %READA (read ahead)
+ * @bio: The &struct bio which describes the I/O
+ *
+ * submit_bio() is the multi-page counterpart of submit_bh(). The caller
+ * sets bi_dev, bi_sector and bi_end_io and adds the pages, in segments
+ * that are multiples of 512 bytes. bi_end_io is called once, when all
+ * of the I/O is done, and may be called before submit_bio() returns.
+ *
+ * A queue that has a make_bio_fn gets the bio as it is; like with
+ * make_request_fn, a non-zero return means that the bio was remapped
+ * to another device and has to be resubmitted. Other queues get it
+ * cut into buffer_heads by bio_submit_bh().
+ */
+void submit_bio(int rw, struct bio *bio)
+{
+	int count = bio_sectors(bio);
+	request_queue_t *q;
+
+	if (!bio->bi_end_io || !bio->bi_vcnt)
+		BUG();
+
+	switch (rw) {
+		case WRITE:
+			kstat.pgpgout += count;
+			break;
+		default:
+			kstat.pgpgin += count;
+			break;
+	}
+
+	if (!blk_check_size(rw, bio->bi_dev, bio->bi_sector, count)) {
+		bio_endio(bio, 0);
+		return;
+	}
+
+	do {
+		q = blk_get_queue(bio->bi_dev);
+		if (!q) {
+			printk(KERN_ERR
+			       "submit_bio: Trying to access "
+			       "nonexistent block-device %s (%ld)\n",
+			       kdevname(bio->bi_dev), bio->bi_sector);
+			bio_endio(bio, 0);
+			return;
+		}
+		if (!q->make_bio_fn) {
+			bio_submit_bh(rw, bio);
+			return;
+		}
+	} while (q->make_bio_fn(q, rw, bio));
+}
+
 /**
  * ll_rw_block: low-level access to block devices
  * @rw: whether to %READ or %WRITE or maybe %READA (readahead)
@@ -1321,6 +1412,8 @@ EXPORT_SYMBOL(__blk_get_queue);
 EXPORT_SYMBOL(blk_cleanup_queue);
 EXPORT_SYMBOL(blk_queue_headactive);
 EXPORT_SYMBOL(blk_queue_make_request);
+EXPORT_SYMBOL(blk_queue_make_bio);
+EXPORT_SYMBOL(submit_bio);
 EXPORT_SYMBOL(generic_make_request);
 EXPORT_SYMBOL(blkdev_release_request);
 EXPORT_SYMBOL(generic_unplug_device);
@@ -60,6 +60,8 @@
 #include <linux/init.h>
 #include <linux/devfs_fs_kernel.h>
 #include <linux/smp_lock.h>
+#include <linux/highmem.h>
+#include <linux/bio.h>
 
 #include <asm/system.h>
 #include <asm/uaccess.h>
@@ -243,6 +245,71 @@ static int rd_make_request(request_queue_t * q, int rw, struct buffer_head *sbh)
 	return 0;
 } 
 
+/*
+ * Whole bios are copied block by block to or from the buffers that
+ * hold the ramdisk, without a buffer_head for each block on the way.
+ * A bio that does not line up with the block size goes the old way.
+ */
+static int rd_make_bio(request_queue_t * q, int rw, struct bio *bio)
+{
+	unsigned int minor;
+	unsigned long offset;
+	struct buffer_head *rbh;
+	struct bio_vec *bv;
+	unsigned int size, len;
+	char *bdata;
+	int i;
+
+	minor = MINOR(bio->bi_dev);
+
+	if (minor >= NUM_RAMDISKS)
+		goto fail;
+
+	offset = bio->bi_sector << 9;
+	if ((offset + bio->bi_size) > rd_length[minor])
+		goto fail;
+
+	if (rw==READA)
+		rw=READ;
+	if ((rw != READ) && (rw != WRITE)) {
+		printk(KERN_INFO "RAMDISK: bad command: %d\n", rw);
+		goto fail;
+	}
+
+	size = rd_blocksizes[minor] ? rd_blocksizes[minor] : BLOCK_SIZE;
+	if (offset & (size - 1))
+		goto split;
+	for (i = 0, bv = bio->bi_io_vec; i < bio->bi_vcnt; i++, bv++)
+		if ((bv->bv_len | bv->bv_offset) & (size - 1))
+			goto split;
+
+	for (i = 0, bv = bio->bi_io_vec; i < bio->bi_vcnt; i++, bv++) {
+		bdata = kmap(bv->bv_page) + bv->bv_offset;
+		for (len = 0; len < bv->bv_len; len += size) {
+			rbh = getblk(bio->bi_dev, offset / size, size);
+			if (rbh->b_data != bdata + len) {
+				if (rw == READ)
+					memcpy(bdata + len, rbh->b_data, size);
+				else
+					memcpy(rbh->b_data, bdata + len, size);
+			}
+			mark_buffer_protected(rbh);
+			brelse(rbh);
+			offset += size;
+		}
+		kunmap(bv->bv_page);
+	}
+
+	bio_endio(bio, 1);
+	return 0;
+ split:
+	bio_submit_bh(rw, bio);
+	return 0;
+ fail:
+	bio_endio(bio, 0);
+	return 0;
+}
+
 static int rd_ioctl(struct inode *inode, struct file *file, unsigned int cmd, unsigned long arg)
 {
 	unsigned int minor;
@@ -406,6 +473,7 @@ int __init rd_init (void)
 	}
 
 	blk_queue_make_request(BLK_DEFAULT_QUEUE(MAJOR_NR), &rd_make_request);
+	blk_queue_make_bio(BLK_DEFAULT_QUEUE(MAJOR_NR), &rd_make_bio);
 
 	for (i = 0; i < NUM_RAMDISKS; i++) {
 		/* rd_size is given in kB */
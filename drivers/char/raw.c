@@ -15,6 +15,9 @@
 #include <linux/raw.h>
 #include <linux/capability.h>
 #include <linux/smp_lock.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/aio.h>
 #include <asm/uaccess.h>
 
 #define dprintk(x...) 
@@ -33,6 +36,8 @@ static ssize_t rw_raw_dev(int rw, struct file *, char *, size_t, loff_t *);
 
 ssize_t	raw_read(struct file *, char *, size_t, loff_t *);
 ssize_t	raw_write(struct file *, const char *, size_t, loff_t *);
+ssize_t	raw_aio_read(struct kiocb *, const struct iovec *, unsigned long, loff_t);
+ssize_t	raw_aio_write(struct kiocb *, const struct iovec *, unsigned long, loff_t);
 int	raw_open(struct inode *, struct file *);
 int	raw_release(struct inode *, struct file *);
 int	raw_ctl_ioctl(struct inode *, struct file *, unsigned int, unsigned long);
@@ -43,6 +48,8 @@ static struct file_operations raw_fops = {
 	write:		raw_write,
 	open:		raw_open,
 	release:	raw_release,
+	aio_read:	raw_aio_read,
+	aio_write:	raw_aio_write,
 };
 
 static struct file_operations raw_ctl_fops = {
@@ -276,6 +283,14 @@ ssize_t	raw_write(struct file *filp, const char *buf,
 #define SECTOR_SIZE (1U << SECTOR_BITS)
 #define SECTOR_MASK (SECTOR_SIZE - 1)
 
+/* Size of the bound device, in sectors of sector_bits */
+static unsigned long raw_limit(kdev_t dev, int sector_bits)
+{
+	if (blk_size[MAJOR(dev)])
+		return (((loff_t) blk_size[MAJOR(dev)][MINOR(dev)]) << BLOCK_SIZE_BITS) >> sector_bits;
+	return INT_MAX;
+}
+
 ssize_t	rw_raw_dev(int rw, struct file *filp, char *buf, 
 		   size_t size, loff_t *offp)
 {
@@ -318,10 +333,7 @@ ssize_t	rw_raw_dev(int rw, struct file *filp, char *buf,
 	sector_mask = sector_size- 1;
 	max_sectors = KIO_MAX_SECTORS >> (sector_bits - 9);
 	
-	if (blk_size[MAJOR(dev)])
-		limit = (((loff_t) blk_size[MAJOR(dev)][MINOR(dev)]) << BLOCK_SIZE_BITS) >> sector_bits;
-	else
-		limit = INT_MAX;
+	limit = raw_limit(dev, sector_bits);
 	dprintk ("rw_raw_dev: dev %d:%d (+%d)\n",
 		 MAJOR(dev), MINOR(dev), limit);
 	
@@ -390,3 +402,138 @@ ssize_t	rw_raw_dev(int rw, struct file *filp, char *buf,
  out:	
 	return err;
 }
+
+/*
+ * Asynchronous raw IO: every iovec segment is mapped into a kiobuf of
+ * its own and all of them are started at once. The last kiobuf to
+ * complete completes the iocb; the pages are released by the dtor,
+ * from process context.
+ */
+
+struct raw_aio {
+	struct kiocb *	iocb;
+	atomic_t	pending;	/* kiobufs in flight, + 1 while starting */
+	ssize_t		size;		/* bytes started */
+	int		error;
+	int		rw;
+	int		nr;
+	struct kiobuf *	iobuf[0];
+};
+
+static void raw_aio_done(struct raw_aio *ra)
+{
+	if (atomic_dec_and_test(&ra->pending))
+		aio_complete(ra->iocb, ra->error ? ra->error : ra->size, 0);
+}
+
+static void raw_aio_end_io(struct kiobuf *iobuf)
+{
+	struct raw_aio *ra = iobuf->private;
+
+	if (iobuf->errno)
+		ra->error = iobuf->errno;
+	raw_aio_done(ra);
+}
+
+static void raw_aio_dtor(struct kiocb *iocb)
+{
+	struct raw_aio *ra = iocb->ki_private;
+	struct kiobuf *iobuf;
+	int i;
+
+	for (i = 0; i < ra->nr; i++) {
+		iobuf = ra->iobuf[i];
+		if (ra->rw == READ && !iobuf->errno)
+			mark_dirty_kiobuf(iobuf, iobuf->length);
+		unmap_kiobuf(iobuf);
+	}
+	free_kiovec(ra->nr, ra->iobuf);
+	kfree(ra);
+}
+
+static ssize_t raw_aio_rw(int rw, struct kiocb *iocb, const struct iovec *iov,
+			  unsigned long nr_segs, loff_t pos)
+{
+	struct raw_aio *ra;
+	struct kiobuf *iobuf;
+	kdev_t dev;
+	unsigned long limit, blocknr, blocks;
+	int minor, sector_size, sector_bits, sector_mask;
+	unsigned long i;
+	int err;
+
+	minor = MINOR(iocb->ki_filp->f_dentry->d_inode->i_rdev);
+	dev = to_kdev_t(raw_devices[minor].binding->bd_dev);
+	sector_size = raw_devices[minor].sector_size;
+	sector_bits = raw_devices[minor].sector_bits;
+	sector_mask = sector_size - 1;
+	limit = raw_limit(dev, sector_bits);
+
+	/* The user buffers go to the disk as they are */
+	if (pos & sector_mask)
+		return -EINVAL;
+	for (i = 0; i < nr_segs; i++)
+		if (((unsigned long) iov[i].iov_base & sector_mask) ||
+		    (iov[i].iov_len & sector_mask))
+			return -EINVAL;
+	blocknr = pos >> sector_bits;
+	if (blocknr >= limit)
+		return -ENXIO;
+
+	ra = kmalloc(sizeof(*ra) + nr_segs * sizeof(struct kiobuf *), GFP_KERNEL);
+	if (!ra)
+		return -ENOMEM;
+	memset(ra, 0, sizeof(*ra));
+	ra->iocb = iocb;
+	atomic_set(&ra->pending, 1);
+	ra->rw = rw;
+	iocb->ki_private = ra;
+	iocb->ki_dtor = raw_aio_dtor;
+
+	err = 0;
+	for (i = 0; i < nr_segs && blocknr < limit; i++) {
+		blocks = iov[i].iov_len >> sector_bits;
+		if (blocks > limit - blocknr)
+			blocks = limit - blocknr;
+		if (!blocks)
+			continue;
+
+		err = alloc_kiovec(1, &iobuf);
+		if (err)
+			break;
+		ra->iobuf[ra->nr++] = iobuf;
+		err = map_user_kiobuf(rw, iobuf, (unsigned long) iov[i].iov_base,
+				      blocks << sector_bits);
+		if (err)
+			break;
+
+		iobuf->end_io = raw_aio_end_io;
+		iobuf->private = ra;
+		atomic_inc(&ra->pending);
+		err = brw_kiobuf_async(rw, iobuf, dev, blocknr, sector_size);
+		if (err) {
+			atomic_dec(&ra->pending);
+			break;
+		}
+		ra->size += blocks << sector_bits;
+		blocknr += blocks;
+	}
+
+	/* What was started completes the iocb, or the error does */
+	if (err && !ra->size)
+		ra->error = err;
+	raw_aio_done(ra);
+	return -EIOCBQUEUED;
+}
+
+ssize_t	raw_aio_read(struct kiocb *iocb, const struct iovec *iov,
+		     unsigned long nr_segs, loff_t pos)
+{
+	return raw_aio_rw(READ, iocb, iov, nr_segs, pos);
+}
+
+ssize_t	raw_aio_write(struct kiocb *iocb, const struct iovec *iov,
+		      unsigned long nr_segs, loff_t pos)
+{
+	return raw_aio_rw(WRITE, iocb, iov, nr_segs, pos);
+}
@@ -613,6 +613,7 @@ static int rtl8139_start_xmit (struct sk_buff *skb,
 			       struct net_device *dev);
 static void rtl8139_interrupt (int irq, void *dev_instance,
 			       struct pt_regs *regs);
+static int rtl8139_poll (struct net_device *dev, int *budget);
 static int rtl8139_close (struct net_device *dev);
 static int netdev_ioctl (struct net_device *dev, struct ifreq *rq, int cmd);
 static struct net_device_stats *rtl8139_get_stats (struct net_device *dev);
@@ -682,6 +683,11 @@ static const u16 rtl8139_intr_mask =
 	PCIErr | PCSTimeout | RxUnderrun | RxOverflow | RxFIFOOver |
 	TxErr | TxOK | RxErr | RxOK;
 
+/* while rtl8139_poll() is scheduled */
+static const u16 rtl8139_norx_intr_mask =
+	PCIErr | PCSTimeout | RxUnderrun |
+	TxErr | TxOK | RxErr ;
+
 static const unsigned int rtl8139_rx_config =
 	  (RX_EARLY_THRESH << RxCfgEarlyRxShift) | RxCfgRcv32K | RxNoWrap |
 	  (RX_FIFO_THRESH << RxCfgFIFOShift) |
@@ -959,6 +965,8 @@ static int __devinit rtl8139_init_one (struct pci_dev *pdev,
 	dev->do_ioctl = netdev_ioctl;
 	dev->tx_timeout = rtl8139_tx_timeout;
 	dev->watchdog_timeo = TX_TIMEOUT;
+	dev->poll = rtl8139_poll;
+	dev->weight = 64;
 
 	dev->irq = pdev->irq;
 
@@ -1887,11 +1895,29 @@ static void rtl8139_rx_err (u32 rx_status, struct net_device *dev,
 }
 
 
-static void rtl8139_rx_interrupt (struct net_device *dev,
-				  struct rtl8139_private *tp, void *ioaddr)
+/* Acknowledge the receive events, once the ring has been emptied */
+static void rtl8139_rx_ack (struct rtl8139_private *tp, void *ioaddr)
+{
+	u16 status = RTL_R16 (IntrStatus) & RxAckBits;
+
+	if (status == 0)
+		return;
+	if (status & (RxOverflow | RxFIFOOver)) {
+		tp->stats.rx_errors++;
+		if (status & RxFIFOOver)
+			tp->stats.rx_fifo_errors++;
+	}
+	RTL_W16_F (IntrStatus, RxAckBits);
+}
+
+/* Take up to 'budget' frames off the receive ring, returns the number done */
+static int rtl8139_rx (struct net_device *dev, struct rtl8139_private *tp,
+		       int budget)
 {
+	void *ioaddr = tp->mmio_addr;
 	unsigned char *rx_ring;
 	u16 cur_rx;
+	int received = 0;
 
 	assert (dev != NULL);
 	assert (tp != NULL);
@@ -1905,7 +1931,8 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 		 RTL_R16 (RxBufAddr),
 		 RTL_R16 (RxBufPtr), RTL_R8 (ChipCmd));
 
-	while ((RTL_R8 (ChipCmd) & RxBufEmpty) == 0) {
+	while (netif_running (dev) && received < budget &&
+	       (RTL_R8 (ChipCmd) & RxBufEmpty) == 0) {
 		int ring_offset = cur_rx % RX_BUF_LEN;
 		u32 rx_status;
 		unsigned int rx_size;
@@ -1947,18 +1974,12 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 		    (rx_size < 8) ||
 		    (!(rx_status & RxStatusOK))) {
 			rtl8139_rx_err (rx_status, dev, tp, ioaddr);
-			return;
+			return received;
 		}
 
 		/* Malloc up new buffer, compatible with net-2e. */
 		/* Omit the four octet CRC from the length. */
 
-		/* TODO: consider allocating skb's outside of
-		 * interrupt context, both to speed interrupt processing,
-		 * and also to reduce the chances of having to
-		 * drop packets here under memory pressure.
-		 */
-
 		skb = dev_alloc_skb (pkt_size + 2);
 		if (skb) {
 			skb->dev = dev;
@@ -1968,7 +1989,7 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 			skb_put (skb, pkt_size);
 
 			skb->protocol = eth_type_trans (skb, dev);
-			netif_rx (skb);
+			netif_receive_skb (skb);
 			dev->last_rx = jiffies;
 			tp->stats.rx_bytes += pkt_size;
 			tp->stats.rx_packets++;
@@ -1979,11 +2000,12 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 			tp->stats.rx_dropped++;
 		}
 
+		received++;
+
 		cur_rx = (cur_rx + rx_size + 4 + 3) & ~3;
 		RTL_W16 (RxBufPtr, cur_rx - 16);
 
-		if (RTL_R16 (IntrStatus) & RxAckBits)
-			RTL_W16_F (IntrStatus, RxAckBits);
+		rtl8139_rx_ack (tp, ioaddr);
 	}
 
 	DPRINTK ("%s: Done rtl8139_rx(), current %4.4x BufAddr %4.4x,"
@@ -1993,9 +2015,38 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 
 	tp->cur_rx = cur_rx;
 
-	if ((RTL_R8 (ChipCmd) & RxBufEmpty) &&
-	    (RTL_R16 (IntrStatus) & RxAckBits))
-		RTL_W16_F (IntrStatus, RxAckBits);
+	if (RTL_R8 (ChipCmd) & RxBufEmpty)
+		rtl8139_rx_ack (tp, ioaddr);
+	return received;
+}
+
+
+/*
+ * Called from net_rx_action() while the receive interrupts are masked.
+ * When the ring has been emptied within the budget, the interrupts are
+ * unmasked again; a frame that arrived in between raises one at once.
+ */
+static int rtl8139_poll (struct net_device *dev, int *budget)
+{
+	struct rtl8139_private *tp = dev->priv;
+	void *ioaddr = tp->mmio_addr;
+	int limit = *budget;
+	int work;
+
+	if (limit > dev->quota)
+		limit = dev->quota;
+
+	work = rtl8139_rx (dev, tp, limit);
+	*budget -= work;
+	dev->quota -= work;
+	if (work >= limit)
+		return 1;
+
+	spin_lock_irq (&tp->lock);
+	netif_rx_complete (dev);
+	RTL_W16_F (IntrMask, rtl8139_intr_mask);
+	spin_unlock_irq (&tp->lock);
+	return 0;
 }
 
 
@@ -2033,13 +2084,13 @@ static void rtl8139_weird_interrupt (struct net_device *dev,
 	}
 
 	/* XXX along with rtl8139_rx_err, are we double-counting errors? */
-	if (status &
-	    (RxUnderrun | RxOverflow | RxErr | RxFIFOOver))
+	/* RxOverflow and RxFIFOOver are counted by rtl8139_rx_ack() */
+	if (status & (RxUnderrun | RxErr))
 		tp->stats.rx_errors++;
 
 	if (status & (PCSTimeout))
 		tp->stats.rx_length_errors++;
-	if (status & (RxUnderrun | RxFIFOOver))
+	if (status & RxUnderrun)
 		tp->stats.rx_fifo_errors++;
 	if (status & PCIErr) {
 		u16 pci_cmd_status;
@@ -2051,8 +2102,8 @@ static void rtl8139_weird_interrupt (struct net_device *dev,
 }
 
 
-/* The interrupt handler does all of the Rx thread work and cleans up
-   after the Tx thread. */
+/* The interrupt handler schedules rtl8139_poll() for the Rx work and
+   cleans up after the Tx thread. */
 static void rtl8139_interrupt (int irq, void *dev_instance,
 			       struct pt_regs *regs)
 {
@@ -2072,13 +2123,19 @@ static void rtl8139_interrupt (int irq, void *dev_instance,
 		if (status == 0xFFFF)
 			break;
 
+		/* Being closed: nobody will poll the Rx events away */
+		if (!netif_running (dev)) {
+			RTL_W16 (IntrMask, 0);
+			break;
+		}
+
 		/* Acknowledge all of the current interrupt sources ASAP, but
 		   an first get an additional status bit from CSCR. */
 		if (status & RxUnderrun)
 			link_changed = RTL_R16 (CSCR) & CSCR_LinkChangeBit;
 
 		/* The chip takes special action when we clear RxAckBits,
-		 * so we clear them later in rtl8139_rx_interrupt
+		 * so we clear them later in rtl8139_rx
 		 */
 		ackstat = status & ~RxAckBits;
 		RTL_W16 (IntrStatus, ackstat);
@@ -2086,21 +2143,25 @@ static void rtl8139_interrupt (int irq, void *dev_instance,
 		DPRINTK ("%s: interrupt  status=%#4.4x ackstat=%#4.4x new intstat=%#4.4x.\n",
 			 dev->name, ackstat, status, RTL_R16 (IntrStatus));
 
-		if ((status &
-		     (PCIErr | PCSTimeout | RxUnderrun | RxOverflow |
-		      RxFIFOOver | TxErr | TxOK | RxErr | RxOK)) == 0)
-			break;
+		/* Mask the Rx events until rtl8139_poll() has emptied
+		 * the ring, they stay pending until then. */
+		if (status & RxAckBits) {
+			RTL_W16_F (IntrMask, rtl8139_norx_intr_mask);
+			if (netif_rx_schedule_prep (dev))
+				__netif_rx_schedule (dev);
+		}
 
-		if (netif_running (dev) && (status & RxAckBits))
-			rtl8139_rx_interrupt (dev, tp, ioaddr);
+		if ((ackstat &
+		     (PCIErr | PCSTimeout | RxUnderrun | TxErr | TxOK |
+		      RxErr)) == 0)
+			break;
 
 		/* Check uncommon events with one test. */
-		if (status & (PCIErr | PCSTimeout | RxUnderrun | RxOverflow |
-		  	      RxFIFOOver | TxErr | RxErr))
+		if (ackstat & (PCIErr | PCSTimeout | RxUnderrun | TxErr | RxErr))
 			rtl8139_weird_interrupt (dev, tp, ioaddr,
-						 status, link_changed);
+						 ackstat, link_changed);
 
-		if (netif_running (dev) && (status & (TxOK | TxErr)))
+		if (status & (TxOK | TxErr))
 			rtl8139_tx_interrupt (dev, tp, ioaddr);
 
 		boguscnt--;
@@ -363,6 +363,9 @@ enum SCBCmdBits {
 	SCBMaskCmdDone=0x8000, SCBMaskRxDone=0x4000, SCBMaskCmdIdle=0x2000,
 	SCBMaskRxSuspend=0x1000, SCBMaskEarlyRx=0x0800, SCBMaskFlowCtl=0x0400,
 	SCBTriggerIntr=0x0200, SCBMaskAll=0x0100,
+	/* The normal mask, and the one used while speedo_poll() is scheduled */
+	SCBMaskRxOn=SCBMaskEarlyRx|SCBMaskFlowCtl,
+	SCBMaskRxOff=SCBMaskRxOn|SCBMaskRxDone|SCBMaskRxSuspend,
 	/* The rest are Rx and Tx commands. */
 	CUStart=0x0010, CUResume=0x0020, CUStatsAddr=0x0040, CUShowStats=0x0050,
 	CUCmdBase=0x0060,	/* CU Base address (set to zero) . */
@@ -480,6 +483,8 @@ struct speedo_private {
 	struct speedo_mc_block *mc_setup_head;/* Multicast setup frame list head. */
 	struct speedo_mc_block *mc_setup_tail;/* Multicast setup frame list tail. */
 	long in_interrupt;					/* Word-aligned dev->interrupt */
+	int reset_pending;					/* Tx timeout, left to speedo_poll() */
+	int rx_suspended;					/* RNR event, left to speedo_poll() */
 	unsigned char acpi_pwr;
 	signed char rx_mode;					/* Current PROMISC/ALLMULTI setting. */
 	unsigned int tx_full:1;				/* The Tx queue is full. */
@@ -536,7 +541,9 @@ static void speedo_init_rx_ring(struct net_device *dev);
 static void speedo_tx_timeout(struct net_device *dev);
 static int speedo_start_xmit(struct sk_buff *skb, struct net_device *dev);
 static void speedo_refill_rx_buffers(struct net_device *dev, int force);
-static int speedo_rx(struct net_device *dev);
+static int speedo_rx(struct net_device *dev, int budget);
+static int speedo_poll(struct net_device *dev, int *budget);
+static void speedo_reset(struct net_device *dev);
 static void speedo_tx_buffer_gc(struct net_device *dev);
 static void speedo_interrupt(int irq, void *dev_instance, struct pt_regs *regs);
 static int speedo_close(struct net_device *dev);
@@ -834,6 +841,8 @@ static int speedo_found1(struct pci_dev *pdev,
 	dev->get_stats = &speedo_get_stats;
 	dev->set_multicast_list = &set_rx_mode;
 	dev->do_ioctl = &speedo_ioctl;
+	dev->poll = &speedo_poll;
+	dev->weight = 64;
 
 	return 0;
 }
@@ -930,6 +939,8 @@ speedo_open(struct net_device *dev)
 	sp->tx_full = 0;
 	spin_lock_init(&sp->lock);
 	sp->in_interrupt = 0;
+	sp->reset_pending = 0;
+	sp->rx_suspended = 0;
 
 	/* .. we can safely take handler calls during init. */
 	retval = request_irq(dev->irq, &speedo_interrupt, SA_SHIRQ, dev->name, dev);
@@ -1058,7 +1069,7 @@ static void speedo_resume(struct net_device *dev)
 		 ioaddr + SCBPointer);
 	/* We are not ACK-ing FCP and ER in the interrupt handler yet so they should
 	   remain masked --Dragan */
-	outw(CUStart | SCBMaskEarlyRx | SCBMaskFlowCtl, ioaddr + SCBCmd);
+	outw(CUStart | SCBMaskRxOn, ioaddr + SCBCmd);
 }
 
 /* Media monitoring and control. */
@@ -1263,6 +1274,43 @@ static void reset_mii(struct net_device *dev)
 	}
 }
 
+/* Reset the chip and restart both units.  The caller owns the Rx ring:
+   it either holds the poll bit or is speedo_poll() itself. */
+static void speedo_reset(struct net_device *dev)
+{
+	struct speedo_private *sp = (struct speedo_private *)dev->priv;
+	long ioaddr = dev->base_addr;
+	unsigned long flags;
+
+	del_timer_sync(&sp->timer);
+	/* Reset the Tx and Rx units. */
+	outl(PortReset, ioaddr + SCBPort);
+	/* We may get spurious interrupts here.  But I don't think that they
+	   may do much harm.  1999/12/09 SAW */
+	udelay(10);
+	/* Disable interrupts. */
+	outw(SCBMaskAll, ioaddr + SCBCmd);
+	synchronize_irq();
+	speedo_tx_buffer_gc(dev);
+	/* Free as much as possible.
+	   It helps to recover from a hang because of out-of-memory.
+	   It also simplifies speedo_resume() in case TX ring is full or
+	   close-to-be full. */
+	speedo_purge_tx(dev);
+	speedo_refill_rx_buffers(dev, 1);
+	spin_lock_irqsave(&sp->lock, flags);
+	speedo_resume(dev);
+	sp->rx_mode = -1;
+	dev->trans_start = jiffies;
+	spin_unlock_irqrestore(&sp->lock, flags);
+	set_rx_mode(dev); /* it takes the spinlock itself --SAW */
+	/* Reset MII transceiver.  Do it before starting the timer to serialize
+	   mdio_xxx operations.  Yes, it's a paranoya :-)  2000/05/09 SAW */
+	reset_mii(dev);
+	sp->timer.expires = RUN_AT(2*HZ);
+	add_timer(&sp->timer);
+}
+
 static void speedo_tx_timeout(struct net_device *dev)
 {
 	struct speedo_private *sp = (struct speedo_private *)dev->priv;
@@ -1291,33 +1339,21 @@ static void speedo_tx_timeout(struct net_device *dev)
 #else
 	{
 #endif
-		del_timer_sync(&sp->timer);
-		/* Reset the Tx and Rx units. */
-		outl(PortReset, ioaddr + SCBPort);
-		/* We may get spurious interrupts here.  But I don't think that they
-		   may do much harm.  1999/12/09 SAW */
-		udelay(10);
-		/* Disable interrupts. */
-		outw(SCBMaskAll, ioaddr + SCBCmd);
-		synchronize_irq();
-		speedo_tx_buffer_gc(dev);
-		/* Free as much as possible.
-		   It helps to recover from a hang because of out-of-memory.
-		   It also simplifies speedo_resume() in case TX ring is full or
-		   close-to-be full. */
-		speedo_purge_tx(dev);
-		speedo_refill_rx_buffers(dev, 1);
-		spin_lock_irqsave(&sp->lock, flags);
-		speedo_resume(dev);
-		sp->rx_mode = -1;
-		dev->trans_start = jiffies;
-		spin_unlock_irqrestore(&sp->lock, flags);
-		set_rx_mode(dev); /* it takes the spinlock itself --SAW */
-		/* Reset MII transceiver.  Do it before starting the timer to serialize
-		   mdio_xxx operations.  Yes, it's a paranoya :-)  2000/05/09 SAW */
-		reset_mii(dev);
-		sp->timer.expires = RUN_AT(2*HZ);
-		add_timer(&sp->timer);
+		/* The Rx ring belongs to speedo_poll() while it is scheduled;
+		   the reset is then left to it. */
+		if (test_and_set_bit(__LINK_STATE_RX_SCHED, &dev->state)) {
+			sp->reset_pending = 1;
+			return;
+		}
+		speedo_reset(dev);
+		netif_poll_enable(dev);
+		/* Collect what came in while the interrupts were off. */
+		if (netif_rx_schedule_prep(dev)) {
+			spin_lock_irqsave(&sp->lock, flags);
+			outb(SCBMaskRxOff >> 8, ioaddr + SCBCmd + 1);
+			spin_unlock_irqrestore(&sp->lock, flags);
+			__netif_rx_schedule(dev);
+		}
 	}
 	return;
 }
@@ -1444,8 +1480,8 @@ static void speedo_tx_buffer_gc(struct net_device *dev)
 	sp->dirty_tx = dirty_tx;
 }
 
-/* The interrupt handler does all of the Rx thread work and cleans up
-   after the Tx thread. */
+/* The interrupt handler schedules speedo_poll() for the Rx thread work and
+   cleans up after the Tx thread. */
 static void speedo_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 {
 	struct net_device *dev = (struct net_device *)dev_instance;
@@ -1487,77 +1523,18 @@ static void speedo_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 		if ((status & 0xfc00) == 0)
 			break;
 
-		/* Always check if all rx buffers are allocated.  --SAW */
-		speedo_refill_rx_buffers(dev, 0);
-
-		if ((status & 0x5000) ||	/* Packet received, or Rx error. */
-			(sp->rx_ring_state&(RrNoMem|RrPostponed)) == RrPostponed)
-									/* Need to gather the postponed packet. */
-			speedo_rx(dev);
-
-		if (status & 0x1000) {
+		/* Packet received, Rx error, or a ring that needs attention:
+		   leave it to speedo_poll(), with the Rx interrupts masked
+		   until it is done. */
+		if ((status & 0x5000) ||
+			(sp->rx_ring_state & (RrNoMem|RrPostponed))) {
 			spin_lock(&sp->lock);
-			if ((status & 0x003c) == 0x0028) {		/* No more Rx buffers. */
-				struct RxFD *rxf;
-				printk(KERN_WARNING "%s: card reports no RX buffers.\n",
-						dev->name);
-				rxf = sp->rx_ringp[sp->cur_rx % RX_RING_SIZE];
-				if (rxf == NULL) {
-					if (speedo_debug > 2)
-						printk(KERN_DEBUG
-								"%s: NULL cur_rx in speedo_interrupt().\n",
-								dev->name);
-					sp->rx_ring_state |= RrNoMem|RrNoResources;
-				} else if (rxf == sp->last_rxf) {
-					if (speedo_debug > 2)
-						printk(KERN_DEBUG
-								"%s: cur_rx is last in speedo_interrupt().\n",
-								dev->name);
-					sp->rx_ring_state |= RrNoMem|RrNoResources;
-				} else
-					outb(RxResumeNoResources, ioaddr + SCBCmd);
-			} else if ((status & 0x003c) == 0x0008) { /* No resources. */
-				struct RxFD *rxf;
-				printk(KERN_WARNING "%s: card reports no resources.\n",
-						dev->name);
-				rxf = sp->rx_ringp[sp->cur_rx % RX_RING_SIZE];
-				if (rxf == NULL) {
-					if (speedo_debug > 2)
-						printk(KERN_DEBUG
-								"%s: NULL cur_rx in speedo_interrupt().\n",
-								dev->name);
-					sp->rx_ring_state |= RrNoMem|RrNoResources;
-				} else if (rxf == sp->last_rxf) {
-					if (speedo_debug > 2)
-						printk(KERN_DEBUG
-								"%s: cur_rx is last in speedo_interrupt().\n",
-								dev->name);
-					sp->rx_ring_state |= RrNoMem|RrNoResources;
-				} else {
-					/* Restart the receiver. */
-					outl(sp->rx_ring_dma[sp->cur_rx % RX_RING_SIZE],
-						 ioaddr + SCBPointer);
-					outb(RxStart, ioaddr + SCBCmd);
-				}
-			}
-			sp->stats.rx_errors++;
-			spin_unlock(&sp->lock);
-		}
-
-		if ((sp->rx_ring_state&(RrNoMem|RrNoResources)) == RrNoResources) {
-			printk(KERN_WARNING
-					"%s: restart the receiver after a possible hang.\n",
-					dev->name);
-			spin_lock(&sp->lock);
-			/* Restart the receiver.
-			   I'm not sure if it's always right to restart the receiver
-			   here but I don't know another way to prevent receiver hangs.
-			   1999/12/25 SAW */
-			outl(sp->rx_ring_dma[sp->cur_rx % RX_RING_SIZE],
-				 ioaddr + SCBPointer);
-			outb(RxStart, ioaddr + SCBCmd);
-			sp->rx_ring_state &= ~RrNoResources;
+			if (status & 0x1000)
+				sp->rx_suspended = 1;
+			outb(SCBMaskRxOff >> 8, ioaddr + SCBCmd + 1);
 			spin_unlock(&sp->lock);
+			if (netif_rx_schedule_prep(dev))
+				__netif_rx_schedule(dev);
 		}
 
 		/* User interrupt, Command/Tx unit interrupt or CU not active. */
@@ -1683,12 +1660,16 @@ static void speedo_refill_rx_buffers(struct net_device *dev, int force)
 }
 
 static int
-speedo_rx(struct net_device *dev)
+speedo_rx(struct net_device *dev, int budget)
 {
 	struct speedo_private *sp = (struct speedo_private *)dev->priv;
 	int entry = sp->cur_rx % RX_RING_SIZE;
 	int rx_work_limit = sp->dirty_rx + RX_RING_SIZE - sp->cur_rx;
 	int alloc_ok = 1;
+	int received = 0;
+
+	if (rx_work_limit > budget)
+		rx_work_limit = budget;
 
 	if (speedo_debug > 4)
 		printk(KERN_DEBUG " In speedo_rx().\n");
@@ -1770,10 +1751,11 @@ speedo_rx(struct net_device *dev)
 						PKT_BUF_SZ + sizeof(struct RxFD), PCI_DMA_FROMDEVICE);
 			}
 			skb->protocol = eth_type_trans(skb, dev);
-			netif_rx(skb);
+			netif_receive_skb(skb);
 			sp->stats.rx_packets++;
 			sp->stats.rx_bytes += pkt_len;
 		}
+		received++;
 		entry = (++sp->cur_rx) % RX_RING_SIZE;
 		sp->rx_ring_state &= ~RrPostponed;
 		/* Refill the recently taken buffers.
@@ -1787,6 +1769,113 @@ speedo_rx(struct net_device *dev)
 
 	sp->last_rx_time = jiffies;
 
+	return received;
+}
+
+/* Restart a receiver that ran out of buffers, or that may be hung. */
+static void speedo_rx_restart(struct net_device *dev)
+{
+	struct speedo_private *sp = (struct speedo_private *)dev->priv;
+	long ioaddr = dev->base_addr;
+	struct RxFD *rxf;
+
+	spin_lock_irq(&sp->lock);
+	if (sp->rx_suspended) {
+		int status = inw(ioaddr + SCBStatus);
+
+		sp->rx_suspended = 0;
+		if ((status & 0x003c) == 0x0028) {		/* No more Rx buffers. */
+			printk(KERN_WARNING "%s: card reports no RX buffers.\n",
+					dev->name);
+			rxf = sp->rx_ringp[sp->cur_rx % RX_RING_SIZE];
+			if (rxf == NULL) {
+				if (speedo_debug > 2)
+					printk(KERN_DEBUG
+							"%s: NULL cur_rx in speedo_rx_restart().\n",
+							dev->name);
+				sp->rx_ring_state |= RrNoMem|RrNoResources;
+			} else if (rxf == sp->last_rxf) {
+				if (speedo_debug > 2)
+					printk(KERN_DEBUG
+							"%s: cur_rx is last in speedo_rx_restart().\n",
+							dev->name);
+				sp->rx_ring_state |= RrNoMem|RrNoResources;
+			} else
+				outb(RxResumeNoResources, ioaddr + SCBCmd);
+		} else if ((status & 0x003c) == 0x0008) { /* No resources. */
+			printk(KERN_WARNING "%s: card reports no resources.\n",
+					dev->name);
+			rxf = sp->rx_ringp[sp->cur_rx % RX_RING_SIZE];
+			if (rxf == NULL) {
+				if (speedo_debug > 2)
+					printk(KERN_DEBUG
+							"%s: NULL cur_rx in speedo_rx_restart().\n",
+							dev->name);
+				sp->rx_ring_state |= RrNoMem|RrNoResources;
+			} else if (rxf == sp->last_rxf) {
+				if (speedo_debug > 2)
+					printk(KERN_DEBUG
+							"%s: cur_rx is last in speedo_rx_restart().\n",
+							dev->name);
+				sp->rx_ring_state |= RrNoMem|RrNoResources;
+			} else {
+				/* Restart the receiver. */
+				outl(sp->rx_ring_dma[sp->cur_rx % RX_RING_SIZE],
+					 ioaddr + SCBPointer);
+				outb(RxStart, ioaddr + SCBCmd);
+			}
+		}
+		sp->stats.rx_errors++;
+	}
+
+	if ((sp->rx_ring_state&(RrNoMem|RrNoResources)) == RrNoResources) {
+		printk(KERN_WARNING
+				"%s: restart the receiver after a possible hang.\n",
+				dev->name);
+		/* Restart the receiver.
+		   I'm not sure if it's always right to restart the receiver
+		   here but I don't know another way to prevent receiver hangs.
+		   1999/12/25 SAW */
+		outl(sp->rx_ring_dma[sp->cur_rx % RX_RING_SIZE],
+			 ioaddr + SCBPointer);
+		outb(RxStart, ioaddr + SCBCmd);
+		sp->rx_ring_state &= ~RrNoResources;
+	}
+	spin_unlock_irq(&sp->lock);
+}
+
+/* Called from net_rx_action() with the Rx interrupts masked.  The Rx ring
+   belongs to whoever holds the device's poll bit, so a transmit timeout
+   that finds us scheduled leaves the chip reset to this function. */
+static int speedo_poll(struct net_device *dev, int *budget)
+{
+	struct speedo_private *sp = (struct speedo_private *)dev->priv;
+	long ioaddr = dev->base_addr;
+	int limit = *budget;
+	int work;
+
+	if (sp->reset_pending) {
+		sp->reset_pending = 0;
+		speedo_reset(dev);
+	}
+
+	if (limit > dev->quota)
+		limit = dev->quota;
+
+	/* Always check if all rx buffers are allocated.  --SAW */
+	speedo_refill_rx_buffers(dev, 0);
+	work = speedo_rx(dev, limit);
+	speedo_rx_restart(dev);
+
+	*budget -= work;
+	dev->quota -= work;
+	if (work >= limit && netif_running(dev))
+		return 1;
+
+	spin_lock_irq(&sp->lock);
+	netif_rx_complete(dev);
+	outb(SCBMaskRxOn >> 8, ioaddr + SCBCmd + 1);
+	spin_unlock_irq(&sp->lock);
 	return 0;
 }
 
@@ -100,7 +100,7 @@ int tulip_refill_rx(struct net_device *dev)
 }
 
 
-static int tulip_rx(struct net_device *dev)
+static int tulip_rx(struct net_device *dev, int budget)
 {
 	struct tulip_private *tp = (struct tulip_private *)dev->priv;
 	int entry = tp->cur_rx % RX_RING_SIZE;
@@ -116,6 +116,9 @@ static int tulip_rx(struct net_device *dev)
         if (rx_work_limit >=RX_RING_SIZE) rx_work_limit--;
 #endif
 
+	if (rx_work_limit > budget)
+		rx_work_limit = budget;
+
 	if (tulip_debug > 4)
 		printk(KERN_DEBUG " In tulip_rx(), entry %d %8.8x.\n", entry,
 			   tp->rx_ring[entry].status);
@@ -212,7 +215,7 @@ static int tulip_rx(struct net_device *dev)
 #ifdef CONFIG_NET_HW_FLOWCONTROL
                         mit_sel = 
 #endif
-			netif_rx(skb);
+			netif_receive_skb(skb);
 
 #ifdef CONFIG_NET_HW_FLOWCONTROL
                         switch (mit_sel) {
@@ -285,27 +288,82 @@ throttle:
                 }
         }
 
-        return RX_RING_SIZE+1; /* maxrx+1 */      
-#else
+#endif
 	return received;
+}
+
+/* Called from net_rx_action() with the Rx interrupts masked. */
+int tulip_poll(struct net_device *dev, int *budget)
+{
+	struct tulip_private *tp = (struct tulip_private *)dev->priv;
+	long ioaddr = dev->base_addr;
+	int limit = *budget;
+	int work = 0;
+
+	if (limit > dev->quota)
+		limit = dev->quota;
+
+	do {
+		/* Ack first, so that a packet arriving while we empty the
+		   ring shows up in CSR5 again. */
+		outl(RxIntr | RxNoBuf, ioaddr + CSR5);
+		work += tulip_rx(dev, limit - work);
+		tulip_refill_rx(dev);
+#ifdef CONFIG_NET_HW_FLOWCONTROL
+		if (tp->fc_bit && test_bit(tp->fc_bit, &netdev_fc_xoff))
+			break;
 #endif
+	} while (work < limit && (inl(ioaddr + CSR5) & RxIntr));
+
+	*budget -= work;
+	dev->quota -= work;
+	if (work >= limit)
+		return 1;
+
+	/* Out of memory with no buffers on the ring: the chip can not
+	   receive, and has nothing to interrupt for. Keep the Rx
+	   interrupts masked and try again a little later. */
+	if (tp->rx_buffers[tp->dirty_rx % RX_RING_SIZE].skb == NULL) {
+		if (tulip_debug > 1)
+			printk(KERN_WARNING "%s: no Rx buffers, polling again soon.\n",
+			       dev->name);
+		netif_rx_complete(dev);
+		mod_timer(&tp->oom_timer, RUN_AT(1));
+		return 0;
+	}
+
+	spin_lock_irq(&tp->lock);
+	netif_rx_complete(dev);
+#ifdef CONFIG_NET_HW_FLOWCONTROL
+	if (tp->flags & HAS_INTR_MITIGATION && tp->mit_change) {
+		outl(mit_table[tp->mit_sel], ioaddr + CSR11);
+		tp->mit_change = 0;
+	}
+	/* tulip_xon() reschedules us when the backlog drained */
+	if (!tp->fc_bit || !test_bit(tp->fc_bit, &netdev_fc_xoff))
+#endif
+		outl(tulip_tbl[tp->chip_id].valid_intrs, ioaddr + CSR7);
+	spin_unlock_irq(&tp->lock);
+	return 0;
 }
 
+void tulip_oom_timer(unsigned long data)
+{
+	netif_rx_schedule((struct net_device *)data);
+}
 
-/* The interrupt handler does all of the Rx thread work and cleans up
-   after the Tx thread. */
+
+/* The interrupt handler schedules tulip_poll() for the Rx work and
+   cleans up after the Tx thread. */
 void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 {
 	struct net_device *dev = (struct net_device *)dev_instance;
 	struct tulip_private *tp = (struct tulip_private *)dev->priv;
 	long ioaddr = dev->base_addr;
 	int csr5;
-	int entry;
 	int missed;
-	int rx = 0;
 	int tx = 0;
 	int oi = 0;
-	int maxrx = RX_RING_SIZE;
 	int maxtx = TX_RING_SIZE;
 	int maxoi = TX_RING_SIZE;
 	unsigned int work_count = tulip_max_interrupt_work;
@@ -331,8 +389,16 @@ void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
                         if ((!tp->fc_bit) ||
 			    (!test_bit(tp->fc_bit, &netdev_fc_xoff)))
 #endif
-				rx += tulip_rx(dev);
-			tulip_refill_rx(dev);
+			{
+				/* Mask the Rx sources until tulip_poll()
+				   has emptied the ring. */
+				spin_lock(&tp->lock);
+				outl(tulip_tbl[tp->chip_id].valid_intrs & ~(RxIntr | RxNoBuf),
+				     ioaddr + CSR7);
+				spin_unlock(&tp->lock);
+				if (netif_rx_schedule_prep(dev))
+					__netif_rx_schedule(dev);
+			}
 		}
 
 		if (csr5 & (TxNoBuf | TxDied | TxIntr | TimerInt)) {
@@ -481,14 +547,16 @@ void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
                         if (tp->fc_bit && (test_bit(tp->fc_bit, &netdev_fc_xoff)))
                           if (net_ratelimit()) printk("BUG!! enabling interupt when FC off (timerintr.) \n");
 #endif
-			outl(tulip_tbl[tp->chip_id].valid_intrs, ioaddr + CSR7);
+			spin_lock(&tp->lock);
+			outl(tulip_intr_mask(dev), ioaddr + CSR7);
+			spin_unlock(&tp->lock);
 			tp->ttimer = 0;
 			oi++;
 		}
-		if (tx > maxtx || rx > maxrx || oi > maxoi) {
+		if (tx > maxtx || oi > maxoi) {
 			if (tulip_debug > 1)
 				printk(KERN_WARNING "%s: Too much work during an interrupt, "
-					   "csr5=0x%8.8x. (%lu) (%d,%d,%d)\n", dev->name, csr5, tp->nir, tx, rx, oi);
+					   "csr5=0x%8.8x. (%lu) (%d,%d)\n", dev->name, csr5, tp->nir, tx, oi);
 
                        /* Acknowledge all interrupt sources. */
                         outl(0x8001ffff, ioaddr + CSR5);
@@ -511,7 +579,9 @@ void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
                           /* Mask all interrupting sources, set timer to
 				re-enable. */
 #ifndef CONFIG_NET_HW_FLOWCONTROL
-                                outl(((~csr5) & 0x0001ebef) | AbnormalIntr | TimerInt, ioaddr + CSR7);
+                                spin_lock(&tp->lock);
+                                outl(((~csr5) & 0x0001ebef & tulip_intr_mask(dev)) | AbnormalIntr | TimerInt, ioaddr + CSR7);
+                                spin_unlock(&tp->lock);
                                 outl(0x0012, ioaddr + CSR11);
 #endif
                         }
@@ -525,29 +595,6 @@ void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 		csr5 = inl(ioaddr + CSR5);
 	} while ((csr5 & (NormalIntr|AbnormalIntr)) != 0);
 
-	tulip_refill_rx(dev);
-
-	/* check if the card is in suspend mode */
-	entry = tp->dirty_rx % RX_RING_SIZE;
-	if (tp->rx_buffers[entry].skb == NULL) {
-		if (tulip_debug > 1)
-			printk(KERN_WARNING "%s: in rx suspend mode: (%lu) (tp->cur_rx = %u, ttimer = %d, rx = %d) go/stay in suspend mode\n", dev->name, tp->nir, tp->cur_rx, tp->ttimer, rx);
-		if (tp->chip_id == LC82C168) {
-			outl(0x00, ioaddr + CSR7);
-			mod_timer(&tp->timer, RUN_AT(HZ/50));
-		} else {
-			if (tp->ttimer == 0 || (inl(ioaddr + CSR11) & 0xffff) == 0) {
-				if (tulip_debug > 1)
-					printk(KERN_WARNING "%s: in rx suspend mode: (%lu) set timer\n", dev->name, tp->nir);
-				outl(tulip_tbl[tp->chip_id].valid_intrs | TimerInt,
-					ioaddr + CSR7);
-				outl(TimerInt, ioaddr + CSR5);
-				outl(12, ioaddr + CSR11);
-				tp->ttimer = 1;
-			}
-		}
-	}
-
 	if ((missed = inl(ioaddr + CSR8) & 0x1ffff)) {
 		tp->stats.rx_dropped += missed & 0x10000 ? 0x10000 : missed;
 	}
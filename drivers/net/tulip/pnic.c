@@ -163,9 +163,8 @@ too_good_connection:
 	if(!inl(ioaddr + CSR7)) {
 		if (tulip_debug > 1)
 			printk(KERN_INFO "%s: sw timer wakeup.\n", dev->name);
-		disable_irq(dev->irq);
-		tulip_refill_rx(dev);
-		enable_irq(dev->irq);
-		outl(tulip_tbl[tp->chip_id].valid_intrs, ioaddr + CSR7);
+		spin_lock_irq(&tp->lock);
+		outl(tulip_intr_mask(dev), ioaddr + CSR7);
+		spin_unlock_irq(&tp->lock);
 	}
 }
@@ -351,6 +351,7 @@ struct tulip_private {
 	int flags;
 	struct net_device_stats stats;
 	struct timer_list timer;	/* Media selection timer. */
+	struct timer_list oom_timer;	/* Rx poll retry when out of memory. */
 	u32 mc_filter[2];
 	spinlock_t lock;
 	spinlock_t mii_lock;
@@ -416,6 +417,8 @@ extern unsigned int tulip_max_interrupt_work;
 extern int tulip_rx_copybreak;
 void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs);
 int tulip_refill_rx(struct net_device *dev);
+int tulip_poll(struct net_device *dev, int *budget);
+void tulip_oom_timer(unsigned long data);
 
 /* media.c */
 int tulip_mdio_read(struct net_device *dev, int phy_id, int location);
@@ -488,4 +491,16 @@ static inline void tulip_restart_rxtx(struct tulip_private *tp)
 	tulip_start_rxtx(tp);
 }
 
+/* The CSR7 interrupt mask for normal operation. The Rx sources stay
+   masked while tulip_poll() is scheduled; call with tp->lock held. */
+static inline int tulip_intr_mask(struct net_device *dev)
+{
+	struct tulip_private *tp = (struct tulip_private *)dev->priv;
+	int mask = tulip_tbl[tp->chip_id].valid_intrs;
+
+	if (test_bit(__LINK_STATE_RX_SCHED, &dev->state))
+		mask &= ~(RxIntr | RxNoBuf);
+	return mask;
+}
+
 #endif /* __NET_TULIP_H__ */
@@ -487,11 +487,8 @@ void tulip_xon(struct net_device *dev)
         struct tulip_private *tp = (struct tulip_private *)dev->priv;
 
         clear_bit(tp->fc_bit, &netdev_fc_xoff);
-        if (netif_running(dev)){
-
-                tulip_refill_rx(dev);
-                outl(tulip_tbl[tp->chip_id].valid_intrs,  dev->base_addr+CSR7);
-        }
+        /* tulip_poll() refills the ring and unmasks the Rx interrupts */
+        netif_rx_schedule(dev);
 }
 #endif
 
@@ -785,6 +782,7 @@ static void tulip_down (struct net_device *dev)
 	unsigned long flags;
 
 	del_timer_sync (&tp->timer);
+	del_timer_sync (&tp->oom_timer);
 
 	spin_lock_irqsave (&tp->lock, flags);
 
@@ -1493,6 +1491,10 @@ static int __devinit tulip_init_one (struct pci_dev *pdev,
 	tp->timer.data = (unsigned long)dev;
 	tp->timer.function = tulip_tbl[tp->chip_id].media_timer;
 
+	init_timer(&tp->oom_timer);
+	tp->oom_timer.data = (unsigned long)dev;
+	tp->oom_timer.function = tulip_oom_timer;
+
 	dev->base_addr = ioaddr;
 	dev->irq = irq;
 
@@ -1659,6 +1661,8 @@ static int __devinit tulip_init_one (struct pci_dev *pdev,
 	dev->hard_start_xmit = tulip_start_xmit;
 	dev->tx_timeout = tulip_tx_timeout;
 	dev->watchdog_timeo = TX_TIMEOUT;
+	dev->poll = tulip_poll;
+	dev->weight = 16;
 	dev->stop = tulip_close;
 	dev->get_stats = tulip_get_stats;
 	dev->do_ioctl = private_ioctl;
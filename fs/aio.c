@@ -0,0 +1,785 @@
+/*
+ *  linux/fs/aio.c
+ *
+ *  Asynchronous I/O contexts.
+ *
+ *  read() and write() keep the caller waiting until the data is there,
+ *  so a process that wants many I/Os in flight needs as many threads.
+ *  io_setup() instead creates a context, whose completion ring of
+ *  io_events is mapped into the process and pinned with a kiobuf, so
+ *  that completions can be written into it from interrupts and read
+ *  from user space without a system call. io_submit() hands each iocb
+ *  to the file's ->aio_read() or ->aio_write(), which starts the I/O
+ *  and returns -EIOCBQUEUED, and calls aio_complete() when it is done.
+ *  Files without those methods are read or written synchronously at
+ *  submit time and complete at once.
+ *
+ *  A ring slot is reserved for every request at submit time, so the
+ *  ring never overflows: io_submit() returns -EAGAIN when the events
+ *  in the ring and the requests in flight would not fit.
+ *
+ *  Pages can't be released in interrupts, so aio_complete() only puts
+ *  the request on the context's done list, and keventd frees it.
+ *
+ *  Locking:
+ *	mm->ioctx_list_lock	the contexts of an mm
+ *	ctx->lock		irq safe: request lists, reqs_active,
+ *				the ring
+ */
+
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/iobuf.h>
+#include <linux/highmem.h>
+#include <linux/dnotify.h>
+#include <linux/time.h>
+#include <linux/aio.h>
+
+#include <asm/uaccess.h>
+
+/*
+ * The ring header is as big as an event, so event i lives in slot
+ * i + 1 of the ring pages.
+ */
+#define AIO_EVENTS_PER_PAGE	(PAGE_SIZE / sizeof(struct io_event))
+#define AIO_RING_SLOT(i)	((i) + 1)
+
+int aio_nr;			/* ring slots of all contexts */
+int aio_max_nr = 0x10000;
+static spinlock_t aio_nr_lock = SPIN_LOCK_UNLOCKED;
+static unsigned aio_serial;
+
+static kmem_cache_t *kioctx_cachep;
+static kmem_cache_t *kiocb_cachep;
+
+static void __put_ioctx(struct kioctx *ctx)
+{
+	unmap_kiobuf(ctx->ring);
+	free_kiovec(1, &ctx->ring);
+	spin_lock(&aio_nr_lock);
+	aio_nr -= ctx->nr;
+	spin_unlock(&aio_nr_lock);
+	kmem_cache_free(kioctx_cachep, ctx);
+}
+
+#define get_ioctx(ctx)	atomic_inc(&(ctx)->users)
+#define put_ioctx(ctx)	do {					\
+	if (atomic_dec_and_test(&(ctx)->users))			\
+		__put_ioctx(ctx);				\
+} while (0)
+
+/*
+ * Ring access, with ctx->lock held and interrupts off. head is written
+ * by user space, so it is only ever used modulo nr.
+ */
+static struct io_event *aio_ring_event(struct kioctx *ctx, unsigned i)
+{
+	unsigned slot = AIO_RING_SLOT(i);
+	struct io_event *page;
+
+	page = kmap_atomic(ctx->ring->maplist[slot / AIO_EVENTS_PER_PAGE], KM_IRQ0);
+	return page + slot % AIO_EVENTS_PER_PAGE;
+}
+
+#define aio_ring_event_done(ev)	\
+	kunmap_atomic((void *) ((unsigned long) (ev) & PAGE_MASK), KM_IRQ0)
+
+static unsigned aio_ring_head(struct kioctx *ctx)
+{
+	struct aio_ring *ring;
+	unsigned head;
+
+	ring = kmap_atomic(ctx->ring->maplist[0], KM_IRQ0);
+	head = ring->head % ctx->nr;
+	kunmap_atomic(ring, KM_IRQ0);
+	return head;
+}
+
+static void aio_ring_set(struct kioctx *ctx, unsigned head, unsigned tail)
+{
+	struct aio_ring *ring;
+
+	ring = kmap_atomic(ctx->ring->maplist[0], KM_IRQ0);
+	if (head != -1U)
+		ring->head = head;
+	if (tail != -1U)
+		ring->tail = tail;
+	kunmap_atomic(ring, KM_IRQ0);
+}
+
+static inline unsigned aio_ring_avail(struct kioctx *ctx, unsigned head)
+{
+	return (ctx->tail + ctx->nr - head) % ctx->nr;
+}
+
+/*
+ * A request has moved to done_reqs, with ctx->lock held. The queued
+ * reap holds its own reference: ctx may otherwise be gone by the time
+ * keventd runs it, once an earlier run has freed the last request.
+ */
+static void aio_schedule_reap(struct kioctx *ctx)
+{
+	if (schedule_task(&ctx->reap))
+		get_ioctx(ctx);
+	wake_up(&ctx->wait);
+}
+
+/**
+ * aio_complete - report the completion of a request
+ * @iocb: the request
+ * @res: what the io_event's res should say, bytes done or -errno
+ * @res2: and its res2
+ *
+ * Adds the event to the ring and wakes io_getevents(). May be called
+ * from interrupts. The request must not be touched afterwards: it is
+ * freed by keventd.
+ */
+void aio_complete(struct kiocb *iocb, long res, long res2)
+{
+	struct kioctx *ctx = iocb->ki_ctx;
+	struct io_event *ev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	ev = aio_ring_event(ctx, ctx->tail);
+	ev->data = iocb->ki_data;
+	ev->obj = (unsigned long) iocb->ki_obj;
+	ev->res = res;
+	ev->res2 = res2;
+	aio_ring_event_done(ev);
+
+	/* The event must be there before the new tail is */
+	smp_wmb();
+	ctx->tail = (ctx->tail + 1) % ctx->nr;
+	aio_ring_set(ctx, -1U, ctx->tail);
+
+	list_del(&iocb->ki_list);
+	list_add_tail(&iocb->ki_list, &ctx->done_reqs);
+	ctx->reqs_active--;
+
+	aio_schedule_reap(ctx);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+}
+
+static void aio_free_req(struct kiocb *iocb)
+{
+	struct kioctx *ctx = iocb->ki_ctx;
+
+	if (iocb->ki_dtor)
+		iocb->ki_dtor(iocb);
+	fput(iocb->ki_filp);
+	kmem_cache_free(kiocb_cachep, iocb);
+	put_ioctx(ctx);
+}
+
+/* keventd: free the completed requests of a context */
+static void aio_reap(void *data)
+{
+	struct kioctx *ctx = data;
+	struct kiocb *iocb;
+	LIST_HEAD(list);
+
+	spin_lock_irq(&ctx->lock);
+	list_splice(&ctx->done_reqs, &list);
+	INIT_LIST_HEAD(&ctx->done_reqs);
+	spin_unlock_irq(&ctx->lock);
+
+	while (!list_empty(&list)) {
+		iocb = list_entry(list.next, struct kiocb, ki_list);
+		list_del(&iocb->ki_list);
+		aio_free_req(iocb);
+	}
+	put_ioctx(ctx);
+}
+
+/*
+ * Allocate a request and reserve a ring slot for its event. Returns
+ * NULL if there is no memory or no room.
+ */
+static struct kiocb *aio_get_req(struct kioctx *ctx, struct file *file)
+{
+	struct kiocb *iocb;
+	unsigned used;
+
+	iocb = kmem_cache_alloc(kiocb_cachep, GFP_KERNEL);
+	if (!iocb)
+		return NULL;
+	memset(iocb, 0, sizeof(*iocb));
+	iocb->ki_ctx = ctx;
+	iocb->ki_filp = file;
+
+	spin_lock_irq(&ctx->lock);
+	used = aio_ring_avail(ctx, aio_ring_head(ctx)) + ctx->reqs_active;
+	if (used + 1 >= ctx->nr || ctx->dead) {
+		spin_unlock_irq(&ctx->lock);
+		kmem_cache_free(kiocb_cachep, iocb);
+		return NULL;
+	}
+	ctx->reqs_active++;
+	list_add(&iocb->ki_list, &ctx->active_reqs);
+	get_ioctx(ctx);
+	spin_unlock_irq(&ctx->lock);
+	return iocb;
+}
+
+static struct kioctx *ioctx_alloc(unsigned nr_events)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	struct kioctx *ctx;
+	struct aio_ring *ring;
+	unsigned long size, addr;
+	unsigned nr;
+	int err;
+
+	/* One slot stays empty, and whole pages are used */
+	size = (AIO_RING_SLOT(nr_events + 1) + AIO_EVENTS_PER_PAGE - 1) /
+		AIO_EVENTS_PER_PAGE * PAGE_SIZE;
+	nr = size / sizeof(struct io_event) - AIO_RING_SLOT(0);
+
+	err = -EAGAIN;
+	spin_lock(&aio_nr_lock);
+	if (aio_nr + nr > aio_max_nr || aio_nr + nr < aio_nr) {
+		spin_unlock(&aio_nr_lock);
+		goto out;
+	}
+	aio_nr += nr;
+	spin_unlock(&aio_nr_lock);
+
+	err = -ENOMEM;
+	ctx = kmem_cache_alloc(kioctx_cachep, GFP_KERNEL);
+	if (!ctx)
+		goto out_nr;
+	memset(ctx, 0, sizeof(*ctx));
+	atomic_set(&ctx->users, 1);
+	init_waitqueue_head(&ctx->wait);
+	spin_lock_init(&ctx->lock);
+	INIT_LIST_HEAD(&ctx->active_reqs);
+	INIT_LIST_HEAD(&ctx->done_reqs);
+	INIT_TQUEUE(&ctx->reap, aio_reap, ctx);
+	ctx->nr = nr;
+	ctx->ring_size = size;
+	err = alloc_kiovec(1, &ctx->ring);
+	if (err)
+		goto out_ctx;
+
+	down_write(&mm->mmap_sem);
+	addr = do_mmap(NULL, 0, size, PROT_READ | PROT_WRITE,
+		       MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (!IS_ERR((void *) addr)) {
+		/* A child must not see completions land in its copy */
+		vma = find_vma(mm, addr);
+		vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND;
+	}
+	up_write(&mm->mmap_sem);
+	err = addr;
+	if (IS_ERR((void *) addr))
+		goto out_kiobuf;
+
+	err = map_user_kiobuf(READ, ctx->ring, addr, size);
+	if (err)
+		goto out_unmap;
+	ctx->user_id = addr;
+
+	ring = kmap(ctx->ring->maplist[0]);
+	ring->id = ++aio_serial;
+	ring->nr = nr;
+	ring->head = ring->tail = 0;
+	ring->magic = AIO_RING_MAGIC;
+	ring->compat_features = 0;
+	ring->incompat_features = 0;
+	ring->header_length = sizeof(struct aio_ring);
+	kunmap(ctx->ring->maplist[0]);
+
+	write_lock(&mm->ioctx_list_lock);
+	ctx->next = mm->ioctx_list;
+	mm->ioctx_list = ctx;
+	write_unlock(&mm->ioctx_list_lock);
+	return ctx;
+
+out_unmap:
+	down_write(&mm->mmap_sem);
+	do_munmap(mm, addr, size);
+	up_write(&mm->mmap_sem);
+out_kiobuf:
+	free_kiovec(1, &ctx->ring);
+out_ctx:
+	kmem_cache_free(kioctx_cachep, ctx);
+out_nr:
+	spin_lock(&aio_nr_lock);
+	aio_nr -= nr;
+	spin_unlock(&aio_nr_lock);
+out:
+	return ERR_PTR(err);
+}
+
+static struct kioctx *lookup_ioctx(aio_context_t ctx_id)
+{
+	struct mm_struct *mm = current->mm;
+	struct kioctx *ctx;
+
+	read_lock(&mm->ioctx_list_lock);
+	for (ctx = mm->ioctx_list; ctx; ctx = ctx->next) {
+		if (ctx->user_id == ctx_id && !ctx->dead) {
+			get_ioctx(ctx);
+			break;
+		}
+	}
+	read_unlock(&mm->ioctx_list_lock);
+	return ctx;
+}
+
+static void wait_for_all_aios(struct kioctx *ctx)
+{
+	DECLARE_WAITQUEUE(wait, current);
+
+	add_wait_queue(&ctx->wait, &wait);
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!ctx->reqs_active)
+			break;
+		run_task_queue(&tq_disk);
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	remove_wait_queue(&ctx->wait, &wait);
+}
+
+/*
+ * Take ctx off its mm's list and wait for its requests. Returns 0 if
+ * somebody else was already doing that.
+ */
+static int kill_ioctx(struct mm_struct *mm, struct kioctx *ctx)
+{
+	struct kioctx **p;
+
+	write_lock(&mm->ioctx_list_lock);
+	for (p = &mm->ioctx_list; *p; p = &(*p)->next) {
+		if (*p == ctx) {
+			*p = ctx->next;
+			break;
+		}
+	}
+	write_unlock(&mm->ioctx_list_lock);
+
+	spin_lock_irq(&ctx->lock);
+	if (ctx->dead) {
+		spin_unlock_irq(&ctx->lock);
+		return 0;
+	}
+	ctx->dead = 1;
+	spin_unlock_irq(&ctx->lock);
+
+	wait_for_all_aios(ctx);
+	return 1;
+}
+
+/*
+ * Called from mmput() for the last user of an mm: the ring goes away
+ * with the address space, requests in flight are waited for.
+ */
+void exit_aio(struct mm_struct *mm)
+{
+	struct kioctx *ctx;
+
+	while ((ctx = mm->ioctx_list) != NULL) {
+		if (kill_ioctx(mm, ctx))
+			put_ioctx(ctx);
+	}
+}
+
+/*
+ * Synchronous fallback for files without ->aio_read()/->aio_write().
+ */
+typedef ssize_t (*io_fn_t)(struct file *, char *, size_t, loff_t *);
+typedef ssize_t (*iov_fn_t)(struct file *, const struct iovec *, unsigned long, loff_t *);
+
+static ssize_t aio_sync_rw(int rw, struct file *file, struct iovec *iov,
+	unsigned long nr_segs, loff_t pos)
+{
+	io_fn_t fn;
+	iov_fn_t fnv;
+	ssize_t ret, n;
+
+	if (rw == READ) {
+		fn = file->f_op->read;
+		fnv = file->f_op->readv;
+	} else {
+		fn = (io_fn_t) file->f_op->write;
+		fnv = file->f_op->writev;
+	}
+	if (fnv) {
+		ret = fnv(file, iov, nr_segs, &pos);
+		goto out;
+	}
+	if (!fn)
+		return -EINVAL;
+
+	ret = 0;
+	for (; nr_segs; iov++, nr_segs--) {
+		n = fn(file, iov->iov_base, iov->iov_len, &pos);
+		if (n < 0) {
+			if (!ret)
+				ret = n;
+			break;
+		}
+		ret += n;
+		if (n != iov->iov_len)
+			break;
+	}
+out:
+	if (ret > 0)
+		inode_dir_notify(file->f_dentry->d_parent->d_inode,
+			rw == READ ? DN_ACCESS : DN_MODIFY);
+	return ret;
+}
+
+static int io_submit_one(struct kioctx *ctx, struct iocb *user_iocb,
+	struct iocb *iocb)
+{
+	struct iovec iovstack[UIO_FASTIOV];
+	struct iovec *iov = iovstack;
+	unsigned long nr_segs, i;
+	struct kiocb *req;
+	struct file *file;
+	ssize_t tot_len;
+	loff_t pos;
+	int rw, ret;
+
+	if (iocb->aio_reserved1 || iocb->aio_reserved2 ||
+	    iocb->aio_reserved3 || iocb->aio_reqprio)
+		return -EINVAL;
+	if (iocb->aio_buf != (unsigned long) iocb->aio_buf ||
+	    iocb->aio_nbytes != (size_t) iocb->aio_nbytes ||
+	    (ssize_t) iocb->aio_nbytes < 0)
+		return -EINVAL;
+	pos = iocb->aio_offset;
+	if (pos < 0)
+		return -EINVAL;
+
+	switch (iocb->aio_lio_opcode) {
+	case IOCB_CMD_PREAD:
+	case IOCB_CMD_PREADV:
+		rw = READ;
+		break;
+	case IOCB_CMD_PWRITE:
+	case IOCB_CMD_PWRITEV:
+		rw = WRITE;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	file = fget(iocb->aio_fildes);
+	if (!file)
+		return -EBADF;
+	ret = -EBADF;
+	if (!(file->f_mode & (rw == READ ? FMODE_READ : FMODE_WRITE)))
+		goto out_fput;
+	ret = -EINVAL;
+	if (!file->f_op)
+		goto out_fput;
+
+	if (iocb->aio_lio_opcode == IOCB_CMD_PREAD ||
+	    iocb->aio_lio_opcode == IOCB_CMD_PWRITE) {
+		iov->iov_base = (void *) (unsigned long) iocb->aio_buf;
+		iov->iov_len = iocb->aio_nbytes;
+		nr_segs = 1;
+	} else {
+		nr_segs = iocb->aio_nbytes;
+		ret = -EINVAL;
+		if (nr_segs > UIO_MAXIOV)
+			goto out_fput;
+		if (nr_segs > UIO_FASTIOV) {
+			ret = -ENOMEM;
+			iov = kmalloc(nr_segs * sizeof(struct iovec), GFP_KERNEL);
+			if (!iov)
+				goto out_fput;
+		}
+		ret = -EFAULT;
+		if (copy_from_user(iov, (void *) (unsigned long) iocb->aio_buf,
+				   nr_segs * sizeof(struct iovec)))
+			goto out_iov;
+	}
+
+	/* Same checks as readv() and writev() */
+	tot_len = 0;
+	ret = -EINVAL;
+	for (i = 0; i < nr_segs; i++) {
+		ssize_t len = (ssize_t) iov[i].iov_len;
+		if (len < 0)
+			goto out_iov;
+		tot_len += len;
+		if (tot_len < 0)
+			goto out_iov;
+	}
+	ret = locks_verify_area(rw == READ ? FLOCK_VERIFY_READ : FLOCK_VERIFY_WRITE,
+				file->f_dentry->d_inode, file, pos, tot_len);
+	if (ret)
+		goto out_iov;
+
+	ret = -EAGAIN;
+	req = aio_get_req(ctx, file);
+	if (!req)
+		goto out_iov;
+	req->ki_obj = user_iocb;
+	req->ki_data = iocb->aio_data;
+
+	/* From here on the file belongs to req */
+	if (rw == READ && file->f_op->aio_read)
+		ret = file->f_op->aio_read(req, iov, nr_segs, pos);
+	else if (rw == WRITE && file->f_op->aio_write)
+		ret = file->f_op->aio_write(req, iov, nr_segs, pos);
+	else
+		ret = aio_sync_rw(rw, file, iov, nr_segs, pos);
+	if (ret != -EIOCBQUEUED)
+		aio_complete(req, ret, 0);
+
+	if (iov != iovstack)
+		kfree(iov);
+	return 0;
+
+out_iov:
+	if (iov != iovstack)
+		kfree(iov);
+out_fput:
+	fput(file);
+	return ret;
+}
+
+/*
+ * Copy up to nr events out of the ring. Returns how many, or -EFAULT
+ * if none could be copied.
+ */
+static long aio_read_events(struct kioctx *ctx, long nr, struct io_event *events)
+{
+	struct io_event *ev, tmp;
+	unsigned head;
+	long i;
+
+	for (i = 0; i < nr; i++) {
+		spin_lock_irq(&ctx->lock);
+		head = aio_ring_head(ctx);
+		if (!aio_ring_avail(ctx, head)) {
+			spin_unlock_irq(&ctx->lock);
+			break;
+		}
+		ev = aio_ring_event(ctx, head);
+		tmp = *ev;
+		aio_ring_event_done(ev);
+		aio_ring_set(ctx, (head + 1) % ctx->nr, -1U);
+		spin_unlock_irq(&ctx->lock);
+
+		if (copy_to_user(events + i, &tmp, sizeof(tmp)))
+			return i ? i : -EFAULT;
+	}
+	return i;
+}
+
+static int aio_events_pending(struct kioctx *ctx)
+{
+	int ret;
+
+	spin_lock_irq(&ctx->lock);
+	ret = aio_ring_avail(ctx, aio_ring_head(ctx)) != 0;
+	spin_unlock_irq(&ctx->lock);
+	return ret;
+}
+
+asmlinkage long sys_io_setup(unsigned nr_events, aio_context_t *ctxp)
+{
+	struct kioctx *ctx;
+	aio_context_t ctx_id;
+
+	if (get_user(ctx_id, ctxp))
+		return -EFAULT;
+	if (ctx_id || !nr_events || nr_events > (unsigned) aio_max_nr)
+		return -EINVAL;
+
+	ctx = ioctx_alloc(nr_events);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+	if (put_user(ctx->user_id, ctxp)) {
+		if (kill_ioctx(current->mm, ctx))
+			put_ioctx(ctx);
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/*
+ * Waits for the requests in flight, then unmaps the ring.
+ */
+asmlinkage long sys_io_destroy(aio_context_t ctx_id)
+{
+	struct mm_struct *mm = current->mm;
+	struct kioctx *ctx;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (!ctx)
+		return -EINVAL;
+	if (kill_ioctx(mm, ctx)) {
+		down_write(&mm->mmap_sem);
+		do_munmap(mm, ctx->user_id, ctx->ring_size);
+		up_write(&mm->mmap_sem);
+		put_ioctx(ctx);
+	}
+	put_ioctx(ctx);
+	return 0;
+}
+
+/*
+ * Returns how many iocbs were submitted; the first one that could not
+ * be gives the error if none were. -EAGAIN means the ring is full.
+ */
+asmlinkage long sys_io_submit(aio_context_t ctx_id, long nr, struct iocb **iocbpp)
+{
+	struct kioctx *ctx;
+	struct iocb *user_iocb, tmp;
+	long i;
+	int ret = 0;
+
+	if (nr < 0)
+		return -EINVAL;
+	ctx = lookup_ioctx(ctx_id);
+	if (!ctx)
+		return -EINVAL;
+
+	for (i = 0; i < nr; i++) {
+		if (get_user(user_iocb, iocbpp + i) ||
+		    copy_from_user(&tmp, user_iocb, sizeof(tmp))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = io_submit_one(ctx, user_iocb, &tmp);
+		if (ret)
+			break;
+	}
+
+	/* Let the queued I/O start */
+	run_task_queue(&tq_disk);
+	put_ioctx(ctx);
+	return i ? i : ret;
+}
+
+/*
+ * Cancel a request that is still in flight. Only requests whose file
+ * set ki_cancel can be cancelled, the others get -EAGAIN. A cancelled
+ * request puts its event into *result instead of the ring.
+ */
+asmlinkage long sys_io_cancel(aio_context_t ctx_id, struct iocb *iocb,
+			      struct io_event *result)
+{
+	struct kioctx *ctx;
+	struct kiocb *req;
+	struct list_head *p;
+	struct io_event ev;
+	int ret;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (!ctx)
+		return -EINVAL;
+
+	ret = -EINVAL;
+	spin_lock_irq(&ctx->lock);
+	list_for_each(p, &ctx->active_reqs) {
+		req = list_entry(p, struct kiocb, ki_list);
+		if (req->ki_obj != iocb)
+			continue;
+		ret = -EAGAIN;
+		if (!req->ki_cancel || req->ki_cancel(req, &ev))
+			break;
+		list_del(&req->ki_list);
+		list_add_tail(&req->ki_list, &ctx->done_reqs);
+		ctx->reqs_active--;
+		aio_schedule_reap(ctx);
+		ret = 0;
+		break;
+	}
+	spin_unlock_irq(&ctx->lock);
+
+	if (!ret && copy_to_user(result, &ev, sizeof(ev)))
+		ret = -EFAULT;
+	put_ioctx(ctx);
+	return ret;
+}
+
+/*
+ * Wait until at least min_nr events are there, or for the timeout, and
+ * copy up to nr of them. A NULL timeout waits for ever.
+ */
+asmlinkage long sys_io_getevents(aio_context_t ctx_id, long min_nr, long nr,
+				 struct io_event *events, struct timespec *timeout)
+{
+	DECLARE_WAITQUEUE(wait, current);
+	long jiffies_left = MAX_SCHEDULE_TIMEOUT;
+	struct kioctx *ctx;
+	struct timespec ts;
+	long ret, n;
+
+	if (min_nr < 0 || nr < 0 || min_nr > nr)
+		return -EINVAL;
+	if (timeout) {
+		if (copy_from_user(&ts, timeout, sizeof(ts)))
+			return -EFAULT;
+		if (ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000L || ts.tv_sec < 0)
+			return -EINVAL;
+		jiffies_left = 0;
+		if (ts.tv_sec || ts.tv_nsec)
+			jiffies_left = timespec_to_jiffies(&ts) + 1;
+	}
+	ctx = lookup_ioctx(ctx_id);
+	if (!ctx)
+		return -EINVAL;
+
+	ret = 0;
+	while (ret < nr) {
+		n = aio_read_events(ctx, nr - ret, events + ret);
+		if (n < 0) {
+			if (!ret)
+				ret = n;
+			break;
+		}
+		ret += n;
+		if (ret >= min_nr || !jiffies_left)
+			break;
+		if (signal_pending(current)) {
+			if (!ret)
+				ret = -EINTR;
+			break;
+		}
+
+		add_wait_queue(&ctx->wait, &wait);
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!aio_events_pending(ctx))
+			jiffies_left = schedule_timeout(jiffies_left);
+		__set_current_state(TASK_RUNNING);
+		remove_wait_queue(&ctx->wait, &wait);
+	}
+	put_ioctx(ctx);
+	return ret;
+}
+
+static int __init aio_setup(void)
+{
+	kioctx_cachep = kmem_cache_create("kioctx", sizeof(struct kioctx),
+					  0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	kiocb_cachep = kmem_cache_create("kiocb", sizeof(struct kiocb),
+					 0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!kioctx_cachep || !kiocb_cachep)
+		panic("aio: cannot create slab caches");
+	return 0;
+}
+
+__initcall(aio_setup);
+
+EXPORT_SYMBOL(aio_complete);
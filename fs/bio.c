@@ -0,0 +1,255 @@
+/*
+ *  linux/fs/bio.c
+ *
+ *  Multi-page block I/O descriptors.
+ *
+ *  A bio carries a whole transfer, possibly many pages, from the code
+ *  that starts the I/O to the driver, instead of one buffer_head per
+ *  block. Drivers that have not been taught about bios get the I/O
+ *  split into buffer_heads here; the bio completes when the last of
+ *  them has.
+ */
+
+#include <linux/config.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/locks.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+
+static kmem_cache_t *bio_cachep;
+
+/*
+ * Allocate with the vector in the same object when it is small, which
+ * it is for single page I/O, and separately otherwise.
+ */
+#define BIO_INLINE_VECS	4
+
+struct bio_inline {
+	struct bio	bio;
+	struct bio_vec	vecs[BIO_INLINE_VECS];
+};
+
+/*
+ * Allocation that may not fail: the caller has to be able to sleep.
+ * Waiting for I/O to complete gives back memory, like for the bounce
+ * buffers.
+ */
+static void *bio_alloc_wait(kmem_cache_t *cachep, size_t size, int gfp_mask)
+{
+	void *p;
+
+	for (;;) {
+		if (cachep)
+			p = kmem_cache_alloc(cachep, gfp_mask);
+		else
+			p = kmalloc(size, gfp_mask);
+		if (p || !(gfp_mask & __GFP_WAIT))
+			return p;
+
+		wakeup_bdflush(0);
+		run_task_queue(&tq_disk);
+		current->policy |= SCHED_YIELD;
+		__set_current_state(TASK_RUNNING);
+		schedule();
+	}
+}
+
+/**
+ * bio_alloc - allocate a bio
+ * @gfp_mask: allocation flags; with __GFP_WAIT set this does not fail
+ * @nr_vecs: number of page segments it may hold, at most BIO_MAX_VECS
+ *
+ * The bio is returned with all fields cleared. The caller sets bi_dev,
+ * bi_sector, bi_end_io and maybe bi_private, and adds the pages with
+ * bio_add_page().
+ */
+struct bio *bio_alloc(int gfp_mask, int nr_vecs)
+{
+	struct bio_inline *bi;
+	struct bio *bio;
+	struct bio_vec *bv;
+
+	if (nr_vecs <= 0 || nr_vecs > BIO_MAX_VECS)
+		BUG();
+
+	bi = bio_alloc_wait(bio_cachep, 0, gfp_mask);
+	if (!bi)
+		return NULL;
+	bio = &bi->bio;
+	memset(bio, 0, sizeof(*bio));
+	bv = bi->vecs;
+	if (nr_vecs > BIO_INLINE_VECS) {
+		bv = bio_alloc_wait(NULL, nr_vecs * sizeof(struct bio_vec),
+				    gfp_mask);
+		if (!bv) {
+			kmem_cache_free(bio_cachep, bi);
+			return NULL;
+		}
+	}
+	bio->bi_io_vec = bv;
+	bio->bi_max = nr_vecs;
+	return bio;
+}
+
+/**
+ * bio_put - free a bio
+ * @bio: the bio, which is not under I/O any more
+ */
+void bio_put(struct bio *bio)
+{
+	struct bio_inline *bi = (struct bio_inline *) bio;
+
+	if (bio->bi_io_vec != bi->vecs)
+		kfree(bio->bi_io_vec);
+	kmem_cache_free(bio_cachep, bi);
+}
+
+/**
+ * bio_add_page - add a page segment to a bio
+ * @bio: the bio, not submitted yet
+ * @page: the page
+ * @len: number of bytes, a multiple of 512
+ * @offset: where in the page they start
+ *
+ * A segment that continues the last one in the same page just makes
+ * that one longer. Returns @len, or 0 if the bio is full.
+ */
+int bio_add_page(struct bio *bio, struct page *page, unsigned int len,
+		 unsigned int offset)
+{
+	struct bio_vec *bv;
+
+	if (bio->bi_vcnt) {
+		bv = &bio->bi_io_vec[bio->bi_vcnt - 1];
+		if (bv->bv_page == page && bv->bv_offset + bv->bv_len == offset) {
+			bv->bv_len += len;
+			bio->bi_size += len;
+			return len;
+		}
+	}
+	if (bio->bi_vcnt == bio->bi_max)
+		return 0;
+
+	bv = &bio->bi_io_vec[bio->bi_vcnt++];
+	bv->bv_page = page;
+	bv->bv_len = len;
+	bv->bv_offset = offset;
+	bio->bi_size += len;
+	return len;
+}
+
+/**
+ * bio_endio - end I/O on a bio
+ * @bio: the bio
+ * @uptodate: 1 for success, 0 for an error
+ *
+ * Called by the driver, once, when all of the bio is done. May be
+ * called from interrupt context.
+ */
+void bio_endio(struct bio *bio, int uptodate)
+{
+	if (uptodate)
+		set_bit(BIO_UPTODATE, &bio->bi_flags);
+	else
+		clear_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio->bi_end_io(bio, uptodate);
+}
+
+static void end_bio_bh_io(struct buffer_head *bh, int uptodate)
+{
+	struct bio *bio = bh->b_private;
+
+	if (!uptodate)
+		set_bit(BIO_SPLIT_ERR, &bio->bi_flags);
+	kmem_cache_free(bh_cachep, bh);
+
+	if (atomic_dec_and_test(&bio->bi_pending))
+		bio_endio(bio, !test_bit(BIO_SPLIT_ERR, &bio->bi_flags));
+}
+
+/*
+ * The largest block size, at most a page, that the start of the bio
+ * and all its segments are aligned to.
+ */
+static unsigned int bio_bh_size(struct bio *bio)
+{
+	unsigned long mask = PAGE_SIZE | (bio->bi_sector << 9);
+	int i;
+
+	for (i = 0; i < bio->bi_vcnt; i++)
+		mask |= bio->bi_io_vec[i].bv_offset | bio->bi_io_vec[i].bv_len;
+	return mask & -mask;
+}
+
+/**
+ * bio_submit_bh - submit a bio as buffer_heads
+ * @rw: %READ, %WRITE or %READA
+ * @bio: the bio
+ *
+ * For queues that take buffer_heads only. The bio is cut into blocks
+ * as large as its alignment allows, each of which is passed on with
+ * generic_make_request(). A driver's make_bio_fn can also use this
+ * for a bio it can not handle itself.
+ */
+void bio_submit_bh(int rw, struct bio *bio)
+{
+	unsigned long sector = bio->bi_sector;
+	unsigned int size, done;
+	struct buffer_head *bh;
+	struct bio_vec *bv;
+	int i;
+
+	size = bio_bh_size(bio);
+	clear_bit(BIO_SPLIT_ERR, &bio->bi_flags);
+	/* one extra, so that it can not complete before all are sent */
+	atomic_set(&bio->bi_pending, 1);
+
+	for (i = 0, bv = bio->bi_io_vec; i < bio->bi_vcnt; i++, bv++) {
+		for (done = 0; done < bv->bv_len; done += size) {
+			bh = bio_alloc_wait(bh_cachep, 0, SLAB_NOIO);
+
+			init_buffer(bh, end_bio_bh_io, bio);
+			init_waitqueue_head(&bh->b_wait);
+			bh->b_next = NULL;
+			bh->b_dev = bio->bi_dev;
+			bh->b_rdev = bio->bi_dev;
+			bh->b_rsector = sector;
+			bh->b_blocknr = sector / (size >> 9);
+			bh->b_size = size;
+			set_bh_page(bh, bv->bv_page, bv->bv_offset + done);
+			bh->b_this_page = bh;
+			bh->b_reqnext = NULL;
+			bh->b_inode = NULL;
+			atomic_set(&bh->b_count, 1);
+			bh->b_state = (1 << BH_Mapped) | (1 << BH_Lock) | (1 << BH_Req);
+			if (rw == WRITE)
+				set_bit(BH_Uptodate, &bh->b_state);
+
+			atomic_inc(&bio->bi_pending);
+			generic_make_request(rw, bh);
+			sector += size >> 9;
+		}
+	}
+
+	if (atomic_dec_and_test(&bio->bi_pending))
+		bio_endio(bio, !test_bit(BIO_SPLIT_ERR, &bio->bi_flags));
+}
+
+void __init bio_init(void)
+{
+	bio_cachep = kmem_cache_create("bio", sizeof(struct bio_inline), 0,
+				       SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!bio_cachep)
+		panic("Cannot create bio SLAB cache");
+}
+
+EXPORT_SYMBOL(bio_alloc);
+EXPORT_SYMBOL(bio_put);
+EXPORT_SYMBOL(bio_add_page);
+EXPORT_SYMBOL(bio_endio);
+EXPORT_SYMBOL(bio_submit_bh);
@@ -46,11 +46,15 @@
 #include <linux/iobuf.h>
 #include <linux/highmem.h>
 #include <linux/completion.h>
+#include <linux/bio.h>
+#include <linux/proc_fs.h>
 
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include <asm/bitops.h>
 #include <asm/mmu_context.h>
+#include <asm/timex.h>
+#include <asm/div64.h>
 
 #define NR_SIZES 7
 static char buffersize_index[65] =
@@ -67,24 +71,200 @@ static char buffersize_index[65] =
 					     number of unused buffer heads */
 
 /* Anti-deadlock ordering:
- *	lru_list_lock > hash_table_lock > free_list_lock > unused_list_lock
+ *	lru locks (in list order) > hash locks (in stripe order) >
+ *	inode_queue_lock > free_list_lock > unused_list_lock
+ *
+ * A buffer's b_list and its lru linkage are protected by the lock of
+ * the list it is on, so moving it to another list takes both. A lower
+ * list's lock is only ever trylocked while a higher one is held.
  */
 
 #define BH_ENTRY(list) list_entry((list), struct buffer_head, b_inode_buffers)
 
+/*
+ * The locks keep count of how often they are taken, how often that
+ * meant spinning (not known for the hash locks), and for how long
+ * they are held, in get_cycles() units. See /proc/fs/buffer_locks.
+ */
+struct bh_lock_stat {
+	unsigned long		acquired;
+	unsigned long		contended;
+	unsigned long long	hold;
+	cycles_t		start;
+};
+
+static inline void bh_lock_stat_start(struct bh_lock_stat *st, int contended)
+{
+	st->acquired++;
+	st->contended += contended;
+	st->start = get_cycles();
+}
+
+static inline void bh_lock_stat_end(struct bh_lock_stat *st)
+{
+	st->hold += get_cycles() - st->start;
+}
+
 /*
  * Hash table gook..
+ *
+ * The hash chains are protected by NR_BH_HASH_LOCKS rwlocks, each of
+ * which covers every NR_BH_HASH_LOCKS'th chain.
  */
+#define NR_BH_HASH_LOCKS	64
+
 static unsigned int bh_hash_mask;
 static unsigned int bh_hash_shift;
 static struct buffer_head **hash_table;
-static rwlock_t hash_table_lock = RW_LOCK_UNLOCKED;
+
+struct bh_hash_lock {
+	rwlock_t		lock;
+	struct bh_lock_stat	write;		/* under the write lock */
+} ____cacheline_aligned;
+
+static struct bh_hash_lock bh_hash_locks[NR_BH_HASH_LOCKS];
+
+/* readers share the lock, so they are accounted per CPU */
+static union {
+	struct bh_lock_stat	stat;
+	char			__pad[SMP_CACHE_BYTES];
+} bh_hash_read_stat[NR_CPUS] __cacheline_aligned;
+
+static inline void hash_read_lock(struct bh_hash_lock *hl)
+{
+	read_lock(&hl->lock);
+	bh_lock_stat_start(&bh_hash_read_stat[smp_processor_id()].stat, 0);
+}
+
+static inline void hash_read_unlock(struct bh_hash_lock *hl)
+{
+	bh_lock_stat_end(&bh_hash_read_stat[smp_processor_id()].stat);
+	read_unlock(&hl->lock);
+}
+
+static inline void hash_write_lock(struct bh_hash_lock *hl)
+{
+	write_lock(&hl->lock);
+	bh_lock_stat_start(&hl->write, 0);
+}
+
+static inline void hash_write_unlock(struct bh_hash_lock *hl)
+{
+	bh_lock_stat_end(&hl->write);
+	write_unlock(&hl->lock);
+}
 
 static struct buffer_head *lru_list[NR_LIST];
-static spinlock_t lru_list_lock = SPIN_LOCK_UNLOCKED;
 static int nr_buffers_type[NR_LIST];
 static unsigned long size_buffers_type[NR_LIST];
 
+struct bh_lru_lock {
+	spinlock_t		lock;
+	struct bh_lock_stat	stat;
+} ____cacheline_aligned;
+
+static struct bh_lru_lock lru_locks[NR_LIST];
+
+static inline void lru_lock(int list)
+{
+	struct bh_lru_lock *ll = &lru_locks[list];
+	int contended = 0;
+
+	if (!spin_trylock(&ll->lock)) {
+		spin_lock(&ll->lock);
+		contended = 1;
+	}
+	bh_lock_stat_start(&ll->stat, contended);
+}
+
+static inline int lru_trylock(int list)
+{
+	struct bh_lru_lock *ll = &lru_locks[list];
+
+	if (!spin_trylock(&ll->lock))
+		return 0;
+	bh_lock_stat_start(&ll->stat, 0);
+	return 1;
+}
+
+static inline void lru_unlock(int list)
+{
+	struct bh_lru_lock *ll = &lru_locks[list];
+
+	bh_lock_stat_end(&ll->stat);
+	spin_unlock(&ll->lock);
+}
+
+static void lru_lock_all(void)
+{
+	int i;
+
+	for (i = 0; i < NR_LIST; i++)
+		lru_lock(i);
+}
+
+static void lru_unlock_all(void)
+{
+	int i;
+
+	for (i = NR_LIST; --i >= 0; )
+		lru_unlock(i);
+}
+
+/*
+ * Lock the list the buffer is on. Returns the list, which can not
+ * change until it is unlocked again.
+ */
+static int lru_lock_bh(struct buffer_head *bh)
+{
+	int list;
+
+	for (;;) {
+		list = bh->b_list;
+		lru_lock(list);
+		if (list == bh->b_list)
+			return list;
+		lru_unlock(list);
+	}
+}
+
+/* protects the b_inode_buffers lists */
+static spinlock_t inode_queue_lock = SPIN_LOCK_UNLOCKED;
+
+/*
+ * Every device that has dirty buffers gets its own flusher thread,
+ * so that a slow device can not hold up writeback to the others.
+ * The dirty buffers of a device are also kept on a list of their own,
+ * oldest first, besides the global BUF_DIRTY lru list. All of this is
+ * protected by the lock of the BUF_DIRTY list.
+ */
+struct bdflush_dev {
+	struct bdflush_dev *	next;		/* hash chain */
+	kdev_t			dev;
+	struct list_head	dirty;		/* b_flush_list of the buffers */
+	int			nr_dirty;
+	unsigned long		size_dirty;
+	unsigned long		last_dirty;	/* jiffies */
+	int			users;		/* references outside the lock */
+	int			kicked;		/* write a batch, even if young */
+	int			starting;	/* its thread is being started */
+	struct task_struct *	task;
+	wait_queue_head_t	wait;
+};
+
+#define BDFLUSH_HASH_SIZE	32
+#define BDFLUSH_IDLE		(60*HZ)	/* flusher exits when idle this long */
+#define bdflush_hashfn(dev) \
+	((kdev_t_to_nr(dev) ^ (kdev_t_to_nr(dev) >> 5)) & (BDFLUSH_HASH_SIZE - 1))
+
+static struct bdflush_dev *bdflush_hash[BDFLUSH_HASH_SIZE];
+/* flushed by bdflush itself, for when no bdflush_dev could be allocated */
+static struct bdflush_dev bdflush_default;
+static int nr_bdflush_active;	/* bdflush_devs with dirty buffers */
+static int bdflush_kick_all;	/* wakeup_bdflush(0) wants a batch from each */
+
+DECLARE_WAIT_QUEUE_HEAD(bdflush_wait);
+
 static struct buffer_head * unused_list;
 static int nr_unused_buffer_heads;
 static spinlock_t unused_list_lock = SPIN_LOCK_UNLOCKED;
@@ -98,6 +278,7 @@ static struct bh_free_head free_list[NR_SIZES];
 
 static int grow_buffers(int size);
 static void __refile_buffer(struct buffer_head *);
+static int flush_dirty_buffers(struct bdflush_dev *, int);
 
 /* This is used by some architectures to estimate available memory. */
 atomic_t buffermem_pages = ATOMIC_INIT(0);
@@ -211,7 +392,7 @@ static void write_unlocked_buffers(kdev_t dev)
 	int nr;
 
 repeat:
-	spin_lock(&lru_list_lock);
+	lru_lock(BUF_DIRTY);
 	next = lru_list[BUF_DIRTY];
 	nr = nr_buffers_type[BUF_DIRTY] * 2;
 	count = 0;
@@ -230,14 +411,14 @@ repeat:
 			if (count < NRSYNC)
 				continue;
 
-			spin_unlock(&lru_list_lock);
+			lru_unlock(BUF_DIRTY);
 			write_locked_buffers(array, count);
 			goto repeat;
 		}
 		unlock_buffer(bh);
 		put_bh(bh);
 	}
-	spin_unlock(&lru_list_lock);
+	lru_unlock(BUF_DIRTY);
 
 	if (count)
 		write_locked_buffers(array, count);
@@ -249,7 +430,7 @@ static int wait_for_locked_buffers(kdev_t dev, int index, int refile)
 	int nr;
 
 repeat:
-	spin_lock(&lru_list_lock);
+	lru_lock(index);
 	next = lru_list[index];
 	nr = nr_buffers_type[index] * 2;
 	while (next && --nr >= 0) {
@@ -265,12 +446,12 @@ repeat:
 			continue;
 
 		get_bh(bh);
-		spin_unlock(&lru_list_lock);
+		lru_unlock(index);
 		wait_on_buffer (bh);
 		put_bh(bh);
 		goto repeat;
 	}
-	spin_unlock(&lru_list_lock);
+	lru_unlock(index);
 	return 0;
 }
 
@@ -299,6 +480,8 @@ static int sync_buffers(kdev_t dev, int wait)
 		err = wait_for_locked_buffers(dev, BUF_DIRTY, 0);
 		write_unlocked_buffers(dev);
 		err |= wait_for_locked_buffers(dev, BUF_LOCKED, 1);
+		/* buffers that could not be refiled right away */
+		err |= wait_for_locked_buffers(dev, BUF_DIRTY, 0);
 	}
 	return err;
 }
@@ -447,7 +630,10 @@ out:
 	((((dev)<<(bh_hash_shift - 6)) ^ ((dev)<<(bh_hash_shift - 9))) ^ \
 	 (((block)<<(bh_hash_shift - 6)) ^ ((block) >> 13) ^ \
 	  ((block) << (bh_hash_shift - 12))))
-#define hash(dev,block) hash_table[(_hashfn(HASHDEV(dev),block) & bh_hash_mask)]
+#define hash_index(dev,block) (_hashfn(HASHDEV(dev),block) & bh_hash_mask)
+#define hash(dev,block) hash_table[hash_index(dev,block)]
+#define hash_lock(dev,block) \
+	(&bh_hash_locks[hash_index(dev,block) & (NR_BH_HASH_LOCKS - 1)])
 
 static __inline__ void __hash_link(struct buffer_head *bh, struct buffer_head **head)
 {
@@ -467,9 +653,57 @@ static __inline__ void __hash_unlink(struct buffer_head *bh)
 	}
 }
 
+static struct bdflush_dev *__find_bdflush_dev(kdev_t dev)
+{
+	struct bdflush_dev *bd;
+
+	for (bd = bdflush_hash[bdflush_hashfn(dev)]; bd; bd = bd->next)
+		if (bd->dev == dev)
+			return bd;
+	return NULL;
+}
+
+/*
+ * Find the bdflush_dev for a buffer that becomes dirty, or set up a
+ * new one and have bdflush start a thread for it. We may be called
+ * from places that can not sleep, so if the allocation fails the
+ * buffer goes to the default list that bdflush flushes itself.
+ */
+static struct bdflush_dev *__get_bdflush_dev(kdev_t dev)
+{
+	struct bdflush_dev *bd, **bdp;
+
+	if (dev == NODEV)
+		return &bdflush_default;
+	bd = __find_bdflush_dev(dev);
+	if (bd)
+		return bd;
+
+	bd = kmalloc(sizeof(*bd), GFP_ATOMIC);
+	if (!bd)
+		return &bdflush_default;
+	memset(bd, 0, sizeof(*bd));
+	bd->dev = dev;
+	INIT_LIST_HEAD(&bd->dirty);
+	init_waitqueue_head(&bd->wait);
+	bdp = &bdflush_hash[bdflush_hashfn(dev)];
+	bd->next = *bdp;
+	*bdp = bd;
+	wake_up_interruptible(&bdflush_wait);
+	return bd;
+}
+
+static void put_bdflush_dev(struct bdflush_dev *bd)
+{
+	lru_lock(BUF_DIRTY);
+	bd->users--;
+	lru_unlock(BUF_DIRTY);
+}
+
 static void __insert_into_lru_list(struct buffer_head * bh, int blist)
 {
 	struct buffer_head **bhp = &lru_list[blist];
+	struct bdflush_dev *bd;
 
 	if(!*bhp) {
 		*bhp = bh;
@@ -481,6 +715,16 @@ static void __insert_into_lru_list(struct buffer_head * bh, int blist)
 	(*bhp)->b_prev_free = bh;
 	nr_buffers_type[blist]++;
 	size_buffers_type[blist] += bh->b_size;
+
+	if (blist == BUF_DIRTY) {
+		bd = __get_bdflush_dev(bh->b_dev);
+		bh->b_flushdev = bd;
+		list_add_tail(&bh->b_flush_list, &bd->dirty);
+		if (!bd->nr_dirty++)
+			nr_bdflush_active++;
+		bd->size_dirty += bh->b_size;
+		bd->last_dirty = jiffies;
+	}
 }
 
 static void __remove_from_lru_list(struct buffer_head * bh, int blist)
@@ -495,6 +739,15 @@ static void __remove_from_lru_list(struct buffer_head * bh, int blist)
 		bh->b_next_free = bh->b_prev_free = NULL;
 		nr_buffers_type[blist]--;
 		size_buffers_type[blist] -= bh->b_size;
+
+		if (blist == BUF_DIRTY) {
+			struct bdflush_dev *bd = bh->b_flushdev;
+
+			list_del(&bh->b_flush_list);
+			if (!--bd->nr_dirty)
+				nr_bdflush_active--;
+			bd->size_dirty -= bh->b_size;
+		}
 	}
 }
 
@@ -511,8 +764,8 @@ static void __remove_from_free_list(struct buffer_head * bh, int index)
 	bh->b_next_free = bh->b_prev_free = NULL;
 }
 
-/* must be called with both the hash_table_lock and the lru_list_lock
-   held */
+/* must be called with both the hash lock and the lru lock of the
+   buffer held */
 static void __remove_from_queues(struct buffer_head *bh)
 {
 	__hash_unlink(bh);
@@ -575,26 +828,27 @@ static inline struct buffer_head * __get_hash_table(kdev_t dev, int block, int s
 struct buffer_head * get_hash_table(kdev_t dev, int block, int size)
 {
 	struct buffer_head *bh;
+	struct bh_hash_lock *hl = hash_lock(dev, block);
 
-	read_lock(&hash_table_lock);
+	hash_read_lock(hl);
 	bh = __get_hash_table(dev, block, size);
-	read_unlock(&hash_table_lock);
+	hash_read_unlock(hl);
 
 	return bh;
 }
 
 void buffer_insert_inode_queue(struct buffer_head *bh, struct inode *inode)
 {
-	spin_lock(&lru_list_lock);
+	spin_lock(&inode_queue_lock);
 	if (bh->b_inode)
 		list_del(&bh->b_inode_buffers);
 	bh->b_inode = inode;
 	list_add(&bh->b_inode_buffers, &inode->i_dirty_buffers);
-	spin_unlock(&lru_list_lock);
+	spin_unlock(&inode_queue_lock);
 }
 
-/* The caller must have the lru_list lock before calling the 
-   remove_inode_queue functions.  */
+/* The caller must have the inode_queue_lock before calling
+   __remove_inode_queue.  */
 static void __remove_inode_queue(struct buffer_head *bh)
 {
 	bh->b_inode = NULL;
@@ -603,17 +857,21 @@ static void __remove_inode_queue(struct buffer_head *bh)
 
 static inline void remove_inode_queue(struct buffer_head *bh)
 {
-	if (bh->b_inode)
-		__remove_inode_queue(bh);
+	if (bh->b_inode) {
+		spin_lock(&inode_queue_lock);
+		if (bh->b_inode)
+			__remove_inode_queue(bh);
+		spin_unlock(&inode_queue_lock);
+	}
 }
 
 int inode_has_buffers(struct inode *inode)
 {
 	int ret;
 	
-	spin_lock(&lru_list_lock);
+	spin_lock(&inode_queue_lock);
 	ret = !list_empty(&inode->i_dirty_buffers);
-	spin_unlock(&lru_list_lock);
+	spin_unlock(&inode_queue_lock);
 	
 	return ret;
 }
@@ -643,14 +901,15 @@ void __invalidate_buffers(kdev_t dev, int destroy_dirty_buffers)
 {
 	int i, nlist, slept;
 	struct buffer_head * bh, * bh_next;
+	struct bh_hash_lock * hl;
 
  retry:
-	slept = 0;
-	spin_lock(&lru_list_lock);
 	for(nlist = 0; nlist < NR_LIST; nlist++) {
+		slept = 0;
+		lru_lock(nlist);
 		bh = lru_list[nlist];
 		if (!bh)
-			continue;
+			goto out;
 		for (i = nr_buffers_type[nlist]; i > 0 ; bh = bh_next, i--) {
 			bh_next = bh->b_next_free;
 
@@ -662,14 +921,18 @@ void __invalidate_buffers(kdev_t dev, int destroy_dirty_buffers)
 				continue;
 			if (buffer_locked(bh)) {
 				get_bh(bh);
-				spin_unlock(&lru_list_lock);
+				lru_unlock(nlist);
 				wait_on_buffer(bh);
 				slept = 1;
-				spin_lock(&lru_list_lock);
+				lru_lock(nlist);
 				put_bh(bh);
+				/* refiled while we slept? */
+				if (bh->b_list != nlist)
+					goto out;
 			}
 
-			write_lock(&hash_table_lock);
+			hl = hash_lock(bh->b_dev, bh->b_blocknr);
+			hash_write_lock(hl);
 			if (!atomic_read(&bh->b_count) &&
 			    (destroy_dirty_buffers || !buffer_dirty(bh))) {
 				remove_inode_queue(bh);
@@ -678,22 +941,23 @@ void __invalidate_buffers(kdev_t dev, int destroy_dirty_buffers)
 			}
 			/* else complain loudly? */
 
-			write_unlock(&hash_table_lock);
+			hash_write_unlock(hl);
 			if (slept)
 				goto out;
 		}
+	out:
+		lru_unlock(nlist);
+		if (slept)
+			goto retry;
 	}
-out:
-	spin_unlock(&lru_list_lock);
-	if (slept)
-		goto retry;
 }
 
 void set_blocksize(kdev_t dev, int size)
 {
 	extern int *blksize_size[];
-	int i, nlist, slept;
+	int i, nlist, slept, refile;
 	struct buffer_head * bh, * bh_next;
+	struct bh_hash_lock * hl;
 
 	if (!blksize_size[MAJOR(dev)])
 		return;
@@ -712,12 +976,12 @@ void set_blocksize(kdev_t dev, int size)
 	blksize_size[MAJOR(dev)][MINOR(dev)] = size;
 
  retry:
-	slept = 0;
-	spin_lock(&lru_list_lock);
 	for(nlist = 0; nlist < NR_LIST; nlist++) {
+		slept = 0;
+		lru_lock(nlist);
 		bh = lru_list[nlist];
 		if (!bh)
-			continue;
+			goto out;
 		for (i = nr_buffers_type[nlist]; i > 0 ; bh = bh_next, i--) {
 			bh_next = bh->b_next_free;
 			if (bh->b_dev != dev || bh->b_size == size)
@@ -727,14 +991,19 @@ void set_blocksize(kdev_t dev, int size)
 				continue;
 			if (buffer_locked(bh)) {
 				get_bh(bh);
-				spin_unlock(&lru_list_lock);
+				lru_unlock(nlist);
 				wait_on_buffer(bh);
 				slept = 1;
-				spin_lock(&lru_list_lock);
+				lru_lock(nlist);
 				put_bh(bh);
+				/* refiled while we slept? */
+				if (bh->b_list != nlist)
+					goto out;
 			}
 
-			write_lock(&hash_table_lock);
+			refile = 0;
+			hl = hash_lock(bh->b_dev, bh->b_blocknr);
+			hash_write_lock(hl);
 			if (!atomic_read(&bh->b_count)) {
 				if (buffer_dirty(bh))
 					printk(KERN_WARNING
@@ -744,8 +1013,7 @@ void set_blocksize(kdev_t dev, int size)
 				__remove_from_queues(bh);
 				put_last_free(bh);
 			} else {
-				if (atomic_set_buffer_clean(bh))
-					__refile_buffer(bh);
+				refile = atomic_set_buffer_clean(bh);
 				clear_bit(BH_Uptodate, &bh->b_state);
 				printk(KERN_WARNING
 				       "set_blocksize: "
@@ -753,15 +1021,18 @@ void set_blocksize(kdev_t dev, int size)
 				       atomic_read(&bh->b_count), bdevname(bh->b_dev),
 				       bh->b_blocknr, __builtin_return_address(0));
 			}
-			write_unlock(&hash_table_lock);
+			hash_write_unlock(hl);
+			/* not under the hash lock, it may take another lru lock */
+			if (refile)
+				__refile_buffer(bh);
 			if (slept)
 				goto out;
 		}
+	out:
+		lru_unlock(nlist);
+		if (slept)
+			goto retry;
 	}
- out:
-	spin_unlock(&lru_list_lock);
-	if (slept)
-		goto retry;
 }
 
 /*
@@ -884,7 +1155,7 @@ int fsync_inode_buffers(struct inode *inode)
 	
 	INIT_LIST_HEAD(&tmp.i_dirty_buffers);
 	
-	spin_lock(&lru_list_lock);
+	spin_lock(&inode_queue_lock);
 
 	while (!list_empty(&inode->i_dirty_buffers)) {
 		bh = BH_ENTRY(inode->i_dirty_buffers.next);
@@ -896,27 +1167,27 @@ int fsync_inode_buffers(struct inode *inode)
 			list_add(&bh->b_inode_buffers, &tmp.i_dirty_buffers);
 			if (buffer_dirty(bh)) {
 				get_bh(bh);
-				spin_unlock(&lru_list_lock);
+				spin_unlock(&inode_queue_lock);
 				ll_rw_block(WRITE, 1, &bh);
 				brelse(bh);
-				spin_lock(&lru_list_lock);
+				spin_lock(&inode_queue_lock);
 			}
 		}
 	}
 
 	while (!list_empty(&tmp.i_dirty_buffers)) {
 		bh = BH_ENTRY(tmp.i_dirty_buffers.prev);
-		remove_inode_queue(bh);
+		__remove_inode_queue(bh);
 		get_bh(bh);
-		spin_unlock(&lru_list_lock);
+		spin_unlock(&inode_queue_lock);
 		wait_on_buffer(bh);
 		if (!buffer_uptodate(bh))
 			err = -EIO;
 		brelse(bh);
-		spin_lock(&lru_list_lock);
+		spin_lock(&inode_queue_lock);
 	}
 	
-	spin_unlock(&lru_list_lock);
+	spin_unlock(&inode_queue_lock);
 	err2 = osync_inode_buffers(inode);
 
 	if (err)
@@ -943,7 +1214,7 @@ int osync_inode_buffers(struct inode *inode)
 	struct list_head *list;
 	int err = 0;
 
-	spin_lock(&lru_list_lock);
+	spin_lock(&inode_queue_lock);
 	
  repeat:
 	
@@ -952,17 +1223,17 @@ int osync_inode_buffers(struct inode *inode)
 	     list = bh->b_inode_buffers.prev) {
 		if (buffer_locked(bh)) {
 			get_bh(bh);
-			spin_unlock(&lru_list_lock);
+			spin_unlock(&inode_queue_lock);
 			wait_on_buffer(bh);
 			if (!buffer_uptodate(bh))
 				err = -EIO;
 			brelse(bh);
-			spin_lock(&lru_list_lock);
+			spin_lock(&inode_queue_lock);
 			goto repeat;
 		}
 	}
 
-	spin_unlock(&lru_list_lock);
+	spin_unlock(&inode_queue_lock);
 	return err;
 }
 
@@ -976,14 +1247,14 @@ void invalidate_inode_buffers(struct inode *inode)
 {
 	struct list_head *list, *next;
 	
-	spin_lock(&lru_list_lock);
+	spin_lock(&inode_queue_lock);
 	list = inode->i_dirty_buffers.next; 
 	while (list != &inode->i_dirty_buffers) {
 		next = list->next;
-		remove_inode_queue(BH_ENTRY(list));
+		__remove_inode_queue(BH_ENTRY(list));
 		list = next;
 	}
-	spin_unlock(&lru_list_lock);
+	spin_unlock(&inode_queue_lock);
 }
 
 
@@ -1000,11 +1271,22 @@ void invalidate_inode_buffers(struct inode *inode)
 struct buffer_head * getblk(kdev_t dev, int block, int size)
 {
 	struct buffer_head * bh;
+	struct bh_hash_lock * hl = hash_lock(dev, block);
 	int isize;
 
+	/* Most of the time it is there already: only look. */
+	hash_read_lock(hl);
+	bh = __get_hash_table(dev, block, size);
+	hash_read_unlock(hl);
+	if (bh) {
+		touch_buffer(bh);
+		return bh;
+	}
+
 repeat:
-	spin_lock(&lru_list_lock);
-	write_lock(&hash_table_lock);
+	/* new buffers go to BUF_CLEAN, see init_buffer() */
+	lru_lock(BUF_CLEAN);
+	hash_write_lock(hl);
 	bh = __get_hash_table(dev, block, size);
 	if (bh)
 		goto out;
@@ -1032,8 +1314,8 @@ repeat:
 		/* Insert the buffer into the regular lists */
 		__insert_into_queues(bh);
 	out:
-		write_unlock(&hash_table_lock);
-		spin_unlock(&lru_list_lock);
+		hash_write_unlock(hl);
+		lru_unlock(BUF_CLEAN);
 		touch_buffer(bh);
 		return bh;
 	}
@@ -1042,8 +1324,8 @@ repeat:
 	 * If we block while refilling the free list, somebody may
 	 * create the buffer first ... search the hashes again.
 	 */
-	write_unlock(&hash_table_lock);
-	spin_unlock(&lru_list_lock);
+	hash_write_unlock(hl);
+	lru_unlock(BUF_CLEAN);
 	refill_freelist(size);
 	/* FIXME: getblk should fail if there's no enough memory */
 	goto repeat;
@@ -1051,10 +1333,18 @@ repeat:
 
 /* -1 -> no need to flush
     0 -> async flush
-    1 -> sync flush (wait for I/O completion) */
+    1 -> sync flush (wait for I/O completion)
+
+   For a device, the limits are first checked for all dirty buffers
+   and then for the device's share of them: a device that holds no
+   more than its part of the dirty buffers is not flushed, nor are
+   the processes that write to it throttled. */
 int balance_dirty_state(kdev_t dev)
 {
 	unsigned long dirty, tot, hard_dirty_limit, soft_dirty_limit;
+	unsigned long dev_dirty = 0;
+	struct bdflush_dev *bd;
+	int nr = 0;
 
 	dirty = size_buffers_type[BUF_DIRTY] >> PAGE_SHIFT;
 	tot = nr_free_buffer_pages();
@@ -1064,29 +1354,65 @@ int balance_dirty_state(kdev_t dev)
 	hard_dirty_limit = tot * bdf_prm.b_un.nfract_sync;
 
 	/* First, check for the "real" dirty limit. */
-	if (dirty > soft_dirty_limit) {
-		if (dirty > hard_dirty_limit)
+	if (dirty <= soft_dirty_limit)
+		return -1;
+
+	if (dev != NODEV) {
+		lru_lock(BUF_DIRTY);
+		bd = __find_bdflush_dev(dev);
+		if (bd) {
+			dev_dirty = (bd->size_dirty >> PAGE_SHIFT) * 100;
+			nr = nr_bdflush_active;
+		}
+		lru_unlock(BUF_DIRTY);
+	}
+	if (nr > 1) {
+		if (dev_dirty <= soft_dirty_limit / nr)
+			return -1;
+		if (dirty > hard_dirty_limit && dev_dirty > hard_dirty_limit / nr)
 			return 1;
 		return 0;
 	}
 
-	return -1;
+	if (dirty > hard_dirty_limit)
+		return 1;
+	return 0;
 }
 
 /*
  * if a new dirty buffer is created we need to balance bdflush.
  *
- * in the future we might want to make bdflush aware of different
- * pressures on different devices - thus the (currently unused)
- * 'dev' parameter.
+ * The flusher of the device is woken, and if the device holds too
+ * much of the dirty data the caller writes some of it out itself.
+ * Writers to other devices are not held up by that.
  */
 void balance_dirty(kdev_t dev)
 {
+	struct bdflush_dev *bd = NULL;
 	int state = balance_dirty_state(dev);
 
 	if (state < 0)
 		return;
-	wakeup_bdflush(state);
+
+	if (dev != NODEV) {
+		lru_lock(BUF_DIRTY);
+		bd = __find_bdflush_dev(dev);
+		if (bd)
+			bd->users++;
+		lru_unlock(BUF_DIRTY);
+	}
+	if (!bd) {
+		wakeup_bdflush(state);
+		return;
+	}
+
+	if (bd->task)
+		wake_up_interruptible(&bd->wait);
+	else
+		wake_up_interruptible(&bdflush_wait);
+	if (state > 0)
+		flush_dirty_buffers(bd, 0);
+	put_bdflush_dev(bd);
 }
 
 static __inline__ void __mark_dirty(struct buffer_head *bh)
@@ -1115,7 +1441,7 @@ void mark_buffer_dirty(struct buffer_head *bh)
  * A buffer may need to be moved from one buffer list to another
  * (e.g. in case it is not shared any more). Handle this.
  */
-static void __refile_buffer(struct buffer_head *bh)
+static inline int buffer_dispose(struct buffer_head *bh)
 {
 	int dispose = BUF_CLEAN;
 	if (buffer_locked(bh))
@@ -1124,20 +1450,61 @@ static void __refile_buffer(struct buffer_head *bh)
 		dispose = BUF_DIRTY;
 	if (buffer_protected(bh))
 		dispose = BUF_PROTECTED;
-	if (dispose != bh->b_list) {
-		__remove_from_lru_list(bh, bh->b_list);
-		bh->b_list = dispose;
-		if (dispose == BUF_CLEAN)
-			remove_inode_queue(bh);
-		__insert_into_lru_list(bh, dispose);
-	}
+	return dispose;
+}
+
+/* both lists locked */
+static void __move_buffer(struct buffer_head *bh, int dispose)
+{
+	__remove_from_lru_list(bh, bh->b_list);
+	bh->b_list = dispose;
+	if (dispose == BUF_CLEAN)
+		remove_inode_queue(bh);
+	__insert_into_lru_list(bh, dispose);
+}
+
+/*
+ * Called with the lock of the buffer's list held, usually while walking
+ * that list. A lower list can only be trylocked then; if that fails the
+ * buffer stays where it is for now. That is harmless, it is only ever
+ * a clean or unlocked buffer left on a later list, and the walkers of
+ * those lists refile what they find there.
+ */
+static void __refile_buffer(struct buffer_head *bh)
+{
+	int list = bh->b_list;
+	int dispose = buffer_dispose(bh);
+
+	if (dispose == list)
+		return;
+	if (dispose > list)
+		lru_lock(dispose);
+	else if (!lru_trylock(dispose))
+		return;
+	__move_buffer(bh, dispose);
+	lru_unlock(dispose);
 }
 
 void refile_buffer(struct buffer_head *bh)
 {
-	spin_lock(&lru_list_lock);
-	__refile_buffer(bh);
-	spin_unlock(&lru_list_lock);
+	int list, dispose;
+
+	for (;;) {
+		list = bh->b_list;
+		dispose = buffer_dispose(bh);
+		if (dispose == list)
+			return;
+		/* take both locks in list order */
+		lru_lock(dispose < list ? dispose : list);
+		lru_lock(dispose < list ? list : dispose);
+		if (list == bh->b_list && dispose == buffer_dispose(bh))
+			break;
+		lru_unlock(dispose < list ? list : dispose);
+		lru_unlock(dispose < list ? dispose : list);
+	}
+	__move_buffer(bh, dispose);
+	lru_unlock(dispose < list ? list : dispose);
+	lru_unlock(dispose < list ? dispose : list);
 }
 
 /*
@@ -1160,22 +1527,25 @@ void __brelse(struct buffer_head * buf)
  */
 void __bforget(struct buffer_head * buf)
 {
+	struct bh_hash_lock * hl = hash_lock(buf->b_dev, buf->b_blocknr);
+	int list;
+
 	/* grab the lru lock here to block bdflush. */
-	spin_lock(&lru_list_lock);
-	write_lock(&hash_table_lock);
+	list = lru_lock_bh(buf);
+	hash_write_lock(hl);
 	if (!atomic_dec_and_test(&buf->b_count) || buffer_locked(buf) || buffer_protected(buf))
 		goto in_use;
 	__hash_unlink(buf);
 	remove_inode_queue(buf);
-	write_unlock(&hash_table_lock);
-	__remove_from_lru_list(buf, buf->b_list);
-	spin_unlock(&lru_list_lock);
+	hash_write_unlock(hl);
+	__remove_from_lru_list(buf, list);
+	lru_unlock(list);
 	put_last_free(buf);
 	return;
 
  in_use:
-	write_unlock(&hash_table_lock);
-	spin_unlock(&lru_list_lock);
+	hash_write_unlock(hl);
+	lru_unlock(list);
 }
 
 /*
@@ -1434,7 +1804,7 @@ int block_flushpage(struct page *page, unsigned long offset)
 	return 1;
 }
 
-static void create_empty_buffers(struct page *page, kdev_t dev, unsigned long blocksize)
+void create_empty_buffers(struct page *page, kdev_t dev, unsigned long blocksize)
 {
 	struct buffer_head *bh, *head, *tail;
 
@@ -1468,7 +1838,7 @@ static void create_empty_buffers(struct page *page, kdev_t dev, unsigned long bl
  * anyone who might pick it with bread() afterwards...
  */
 
-static void unmap_underlying_metadata(struct buffer_head * bh)
+void unmap_underlying_metadata(struct buffer_head * bh)
 {
 	struct buffer_head *old_bh;
 
@@ -1677,12 +2047,71 @@ static int __block_commit_write(struct inode *inode, struct page *page,
 	return 0;
 }
 
+static void end_bio_read_page(struct bio *bio, int uptodate)
+{
+	struct page *page = bio->bi_private;
+
+	if (uptodate)
+		SetPageUptodate(page);
+	else
+		SetPageError(page);
+	UnlockPage(page);
+	bio_put(bio);
+}
+
+/*
+ * Read a page that has no buffers and whose blocks are all allocated
+ * and contiguous on disk with a single bio, so that no buffer_heads
+ * are set up for it at all. Returns nonzero if the page does not
+ * qualify; it is left alone then.
+ */
+static int block_read_page_bio(struct page *page, get_block_t *get_block)
+{
+	struct inode *inode = page->mapping->host;
+	unsigned long iblock, lblock, first = 0;
+	struct buffer_head tmp;
+	unsigned int blocksize, blocks;
+	struct bio *bio;
+	int i;
+
+	blocksize = inode->i_sb->s_blocksize;
+	blocks = PAGE_CACHE_SIZE >> inode->i_sb->s_blocksize_bits;
+	iblock = page->index << (PAGE_CACHE_SHIFT - inode->i_sb->s_blocksize_bits);
+	lblock = (inode->i_size+blocksize-1) >> inode->i_sb->s_blocksize_bits;
+	if (iblock + blocks > lblock)
+		return 1;
+
+	for (i = 0; i < blocks; i++) {
+		tmp.b_state = 0;
+		tmp.b_blocknr = 0;
+		if (get_block(inode, iblock + i, &tmp, 0))
+			return 1;
+		if (!buffer_mapped(&tmp) || buffer_new(&tmp) ||
+		    buffer_uptodate(&tmp))
+			return 1;
+		if (!i)
+			first = tmp.b_blocknr;
+		else if (tmp.b_blocknr != first + i)
+			return 1;
+	}
+
+	bio = bio_alloc(GFP_NOFS, 1);
+	bio->bi_dev = inode->i_dev;
+	bio->bi_sector = first * (blocksize >> 9);
+	bio->bi_end_io = end_bio_read_page;
+	bio->bi_private = page;
+	bio_add_page(bio, page, PAGE_CACHE_SIZE, 0);
+	submit_bio(READ, bio);
+	return 0;
+}
+
 /*
  * Generic "read page" function for block devices that have the normal
  * get_block functionality. This is most of the block device filesystems.
  * Reads the page asynchronously --- the unlock_buffer() and
  * mark_buffer_uptodate() functions propagate buffer state into the
- * page struct once IO has completed.
+ * page struct once IO has completed. A page without buffers whose
+ * blocks are contiguous is read with a single bio instead.
  */
 int block_read_full_page(struct page *page, get_block_t *get_block)
 {
@@ -1695,8 +2124,11 @@ int block_read_full_page(struct page *page, get_block_t *get_block)
 	if (!PageLocked(page))
 		PAGE_BUG(page);
 	blocksize = inode->i_sb->s_blocksize;
-	if (!page->buffers)
+	if (!page->buffers) {
+		if (!block_read_page_bio(page, get_block))
+			return 0;
 		create_empty_buffers(page, inode->i_dev, blocksize);
+	}
 	head = page->buffers;
 
 	blocks = PAGE_CACHE_SIZE >> inode->i_sb->s_blocksize_bits;
@@ -1988,51 +2420,43 @@ int generic_block_bmap(struct address_space *mapping, long block, get_block_t *g
 }
 
 /*
- * IO completion routine for a buffer_head being used for kiobuf IO: we
+ * IO completion routine for a bio being used for kiobuf IO: we
  * can't dispatch the kiobuf callback until io_count reaches 0.  
  */
 
-static void end_buffer_io_kiobuf(struct buffer_head *bh, int uptodate)
+static void end_bio_io_kiobuf(struct bio *bio, int uptodate)
 {
-	struct kiobuf *kiobuf;
-	
-	mark_buffer_uptodate(bh, uptodate);
-
-	kiobuf = bh->b_private;
-	unlock_buffer(bh);
-	end_kio_request(kiobuf, uptodate);
+	end_kio_request(bio->bi_private, uptodate);
 }
 
 /*
- * For brw_kiovec: submit a set of buffer_head temporary IOs and wait
- * for them to complete.  Clean up the buffer_heads afterwards.  
+ * For brw_kiovec: wait for the IO on a set of kiobufs to complete
+ * and free the bios that were used for it.
  */
 
-static int wait_kio(int rw, int nr, struct buffer_head *bh[], int size)
+static int wait_kio(int nr, struct kiobuf *iovec[], struct bio *bio)
 {
 	int iosize, err;
 	int i;
-	struct buffer_head *tmp;
+	struct bio *next;
+
+	for (i = 0; i < nr; i++)
+		kiobuf_wait_for_io(iovec[i]);
 
 	iosize = 0;
 	err = 0;
 
-	for (i = nr; --i >= 0; ) {
-		iosize += size;
-		tmp = bh[i];
-		if (buffer_locked(tmp)) {
-			wait_on_buffer(tmp);
-		}
-		
-		if (!buffer_uptodate(tmp)) {
-			/* We are traversing bh'es in reverse order so
-                           clearing iosize on error calculates the
-                           amount of IO before the first error. */
-			iosize = 0;
+	/* The bios are in the order they were submitted: count the
+	   amount of IO before the first error. */
+	for (; bio; bio = next) {
+		next = bio->bi_next;
+		if (!bio_uptodate(bio))
 			err = -EIO;
-		}
+		else if (!err)
+			iosize += bio->bi_size;
+		bio_put(bio);
 	}
-	
+
 	if (iosize)
 		return iosize;
 	return err;
@@ -2042,9 +2466,9 @@ static int wait_kio(int rw, int nr, struct buffer_head *bh[], int size)
  * Start I/O on a physical range of kernel memory, defined by a vector
  * of kiobuf structs (much like a user-space iovec list).
  *
- * The kiobuf must already be locked for IO.  IO is submitted
- * asynchronously: you need to check page->locked, page->uptodate, and
- * maybe wait on page->wait.
+ * The kiobuf must already be locked for IO.  Each run of blocks that
+ * is contiguous on disk goes to the driver as one bio, and all of the
+ * IO is waited for before we return.
  *
  * It is up to the caller to make sure that there are enough blocks
  * passed in to completely map the iobufs to disk.
@@ -2059,12 +2483,12 @@ int brw_kiovec(int rw, int nr, struct kiobuf *iovec[],
 	int		i;
 	int		bufind;
 	int		pageind;
-	int		bhind;
 	int		offset;
-	unsigned long	blocknr;
+	int		nr_vecs;
+	unsigned long	blocknr, lastblock = 0;
 	struct kiobuf *	iobuf = NULL;
 	struct page *	map;
-	struct buffer_head *tmp, **bhs = NULL;
+	struct bio *	bio = NULL, *head = NULL, **tail = &head;
 
 	if (!nr)
 		return 0;
@@ -2084,60 +2508,50 @@ int brw_kiovec(int rw, int nr, struct kiobuf *iovec[],
 	/* 
 	 * OK to walk down the iovec doing page IO on each page we find. 
 	 */
-	bufind = bhind = transferred = err = 0;
+	bufind = err = 0;
 	for (i = 0; i < nr; i++) {
 		iobuf = iovec[i];
 		offset = iobuf->offset;
 		length = iobuf->length;
 		iobuf->errno = 0;
-		if (!bhs)
-			bhs = iobuf->bh;
 		
 		for (pageind = 0; pageind < iobuf->nr_pages; pageind++) {
 			map  = iobuf->maplist[pageind];
 			if (!map) {
 				err = -EFAULT;
-				goto finished;
+				goto wait;
 			}
 			
 			while (length > 0) {
 				blocknr = b[bufind++];
-				tmp = bhs[bhind++];
-
-				tmp->b_dev = B_FREE;
-				tmp->b_size = size;
-				set_bh_page(tmp, map, offset);
-				tmp->b_this_page = tmp;
 
-				init_buffer(tmp, end_buffer_io_kiobuf, iobuf);
-				tmp->b_dev = dev;
-				tmp->b_blocknr = blocknr;
-				tmp->b_state = (1 << BH_Mapped) | (1 << BH_Lock) | (1 << BH_Req);
-
-				if (rw == WRITE) {
-					set_bit(BH_Uptodate, &tmp->b_state);
-					clear_bit(BH_Dirty, &tmp->b_state);
-				} else
-					set_bit(BH_Uptodate, &tmp->b_state);
+				/*
+				 * Extend the current bio if the block follows
+				 * the last one on disk and there is room.
+				 */
+				if (!bio || bio->bi_private != iobuf ||
+				    blocknr != lastblock + 1 ||
+				    !bio_add_page(bio, map, size, offset)) {
+					if (bio)
+						submit_bio(rw, bio);
+					nr_vecs = iobuf->nr_pages - pageind;
+					if (nr_vecs > BIO_MAX_VECS)
+						nr_vecs = BIO_MAX_VECS;
+					bio = bio_alloc(GFP_NOIO, nr_vecs);
+					bio->bi_dev = dev;
+					bio->bi_sector = blocknr * (size >> 9);
+					bio->bi_end_io = end_bio_io_kiobuf;
+					bio->bi_private = iobuf;
+					bio_add_page(bio, map, size, offset);
+					*tail = bio;
+					tail = &bio->bi_next;
+					atomic_inc(&iobuf->io_count);
+				}
+				lastblock = blocknr;
 
 				length -= size;
 				offset += size;
 
-				atomic_inc(&iobuf->io_count);
-				submit_bh(rw, tmp);
-				/* 
-				 * Wait for IO if we have got too much 
-				 */
-				if (bhind >= KIO_MAX_SECTORS) {
-					kiobuf_wait_for_io(iobuf); /* wake-one */
-					err = wait_kio(rw, bhind, bhs, size);
-					if (err >= 0)
-						transferred += err;
-					else
-						goto finished;
-					bhind = 0;
-				}
-				
 				if (offset >= PAGE_SIZE) {
 					offset = 0;
 					break;
@@ -2146,22 +2560,101 @@ int brw_kiovec(int rw, int nr, struct kiobuf *iovec[],
 		} /* End of page loop */		
 	} /* End of iovec loop */
 
+ wait:
 	/* Is there any IO still left to submit? */
-	if (bhind) {
-		kiobuf_wait_for_io(iobuf); /* wake-one */
-		err = wait_kio(rw, bhind, bhs, size);
-		if (err >= 0)
-			transferred += err;
-		else
-			goto finished;
-	}
-
- finished:
-	if (transferred)
+	if (bio)
+		submit_bio(rw, bio);
+	transferred = wait_kio(i < nr ? i + 1 : nr, iovec, head);
+	if (transferred > 0 || !err)
 		return transferred;
 	return err;
 }
 
+/*
+ * IO completion for brw_kiobuf_async(): this may be the last reference
+ * to the kiobuf, so nobody waits on it and the bio goes first.
+ */
+
+static void end_bio_io_kiobuf_async(struct bio *bio, int uptodate)
+{
+	struct kiobuf *iobuf = bio->bi_private;
+
+	bio_put(bio);
+	if (!uptodate)
+		iobuf->errno = -EIO;
+	if (atomic_dec_and_test(&iobuf->io_count))
+		iobuf->end_io(iobuf);
+}
+
+/*
+ * Start I/O on one kiobuf to the blocks starting at blocknr, and
+ * return without waiting for it. iobuf->end_io is called, possibly
+ * from an interrupt, when all of it is done; iobuf->errno tells
+ * whether it failed.
+ *
+ * Returns an error, and end_io is not called, only if no I/O was
+ * started.
+ */
+
+int brw_kiobuf_async(int rw, struct kiobuf *iobuf, kdev_t dev,
+		     unsigned long blocknr, int size)
+{
+	int		length;
+	int		pageind;
+	int		offset;
+	int		nr_vecs;
+	struct page *	map;
+	struct bio *	bio = NULL;
+
+	if ((iobuf->offset & (size-1)) || (iobuf->length & (size-1)) ||
+	    !iobuf->length)
+		return -EINVAL;
+	if (!iobuf->nr_pages)
+		panic("brw_kiobuf_async: iobuf not initialised");
+	for (pageind = 0; pageind < iobuf->nr_pages; pageind++)
+		if (!iobuf->maplist[pageind])
+			return -EFAULT;
+
+	/* Hold io_count up until the last bio has been submitted */
+	iobuf->errno = 0;
+	atomic_set(&iobuf->io_count, 1);
+
+	offset = iobuf->offset;
+	length = iobuf->length;
+	for (pageind = 0; length > 0; pageind++) {
+		map = iobuf->maplist[pageind];
+		while (length > 0) {
+			if (!bio || !bio_add_page(bio, map, size, offset)) {
+				if (bio)
+					submit_bio(rw, bio);
+				nr_vecs = iobuf->nr_pages - pageind;
+				if (nr_vecs > BIO_MAX_VECS)
+					nr_vecs = BIO_MAX_VECS;
+				bio = bio_alloc(GFP_NOIO, nr_vecs);
+				bio->bi_dev = dev;
+				bio->bi_sector = blocknr * (size >> 9);
+				bio->bi_end_io = end_bio_io_kiobuf_async;
+				bio->bi_private = iobuf;
+				bio_add_page(bio, map, size, offset);
+				atomic_inc(&iobuf->io_count);
+			}
+			blocknr++;
+			length -= size;
+			offset += size;
+
+			if (offset >= PAGE_SIZE) {
+				offset = 0;
+				break;
+			}
+		}
+	}
+	submit_bio(rw, bio);
+
+	if (atomic_dec_and_test(&iobuf->io_count))
+		iobuf->end_io(iobuf);
+	return 0;
+}
+
 /*
  * Start I/O on a page.
  * This function expects the page to be locked and may return
@@ -2350,15 +2843,53 @@ static void sync_page_buffers(struct buffer_head *bh, unsigned int gfp_mask)
  *       obtain a reference to a buffer head within a page.  So we must
  *	 lock out all of these paths to cleanly toss the page.
  */
+/*
+ * Take the hash locks of all the buffers of a page, in stripe order.
+ * The lru locks are held, so none of the buffers can be hashed or
+ * unhashed meanwhile.
+ */
+static int lock_page_hashes(struct buffer_head *bh, struct bh_hash_lock **locks)
+{
+	struct buffer_head *tmp = bh;
+	struct bh_hash_lock *hl;
+	int i, j, nr = 0;
+
+	do {
+		/* free buffers are not hashed */
+		if (tmp->b_dev != B_FREE) {
+			hl = hash_lock(tmp->b_dev, tmp->b_blocknr);
+			for (i = 0; i < nr && locks[i] < hl; i++)
+				;
+			if (i == nr || locks[i] != hl) {
+				for (j = nr++; j > i; j--)
+					locks[j] = locks[j - 1];
+				locks[i] = hl;
+			}
+		}
+		tmp = tmp->b_this_page;
+	} while (tmp != bh);
+
+	for (i = 0; i < nr; i++)
+		hash_write_lock(locks[i]);
+	return nr;
+}
+
+static void unlock_page_hashes(struct bh_hash_lock **locks, int nr)
+{
+	while (--nr >= 0)
+		hash_write_unlock(locks[nr]);
+}
+
 int try_to_free_buffers(struct page * page, unsigned int gfp_mask)
 {
 	struct buffer_head * tmp, * bh = page->buffers;
+	struct bh_hash_lock * locks[MAX_BUF_PER_PAGE];
 	int index = BUFSIZE_INDEX(bh->b_size);
-	int loop = 0;
+	int loop = 0, nr_locks;
 
 cleaned_buffers_try_again:
-	spin_lock(&lru_list_lock);
-	write_lock(&hash_table_lock);
+	lru_lock_all();
+	nr_locks = lock_page_hashes(bh, locks);
 	spin_lock(&free_list[index].lock);
 	tmp = bh;
 	do {
@@ -2392,15 +2923,15 @@ cleaned_buffers_try_again:
 	page->buffers = NULL;
 	page_cache_release(page);
 	spin_unlock(&free_list[index].lock);
-	write_unlock(&hash_table_lock);
-	spin_unlock(&lru_list_lock);
+	unlock_page_hashes(locks, nr_locks);
+	lru_unlock_all();
 	return 1;
 
 busy_buffer_page:
 	/* Uhhuh, start writeback so that we don't end up with all dirty pages */
 	spin_unlock(&free_list[index].lock);
-	write_unlock(&hash_table_lock);
-	spin_unlock(&lru_list_lock);
+	unlock_page_hashes(locks, nr_locks);
+	lru_unlock_all();
 	if (gfp_mask & __GFP_IO) {
 		sync_page_buffers(bh, gfp_mask);
 		/* We waited synchronously, so we can free the buffers. */
@@ -2419,6 +2950,7 @@ void show_buffers(void)
 {
 #ifdef CONFIG_SMP
 	struct buffer_head * bh;
+	struct bdflush_dev * bd;
 	int found = 0, locked = 0, dirty = 0, used = 0, lastused = 0;
 	int protected = 0;
 	int nlist;
@@ -2429,12 +2961,15 @@ void show_buffers(void)
 			atomic_read(&buffermem_pages) << (PAGE_SHIFT-10));
 
 #ifdef CONFIG_SMP /* trylock does nothing on UP and so we could deadlock */
-	if (!spin_trylock(&lru_list_lock))
-		return;
 	for(nlist = 0; nlist < NR_LIST; nlist++) {
+		if (!lru_trylock(nlist))
+			continue;
 		found = locked = dirty = used = lastused = protected = 0;
 		bh = lru_list[nlist];
-		if(!bh) continue;
+		if(!bh) {
+			lru_unlock(nlist);
+			continue;
+		}
 
 		do {
 			found++;
@@ -2458,11 +2993,76 @@ void show_buffers(void)
 		       "%d locked, %d protected, %d dirty\n",
 		       buf_types[nlist], found, size_buffers_type[nlist]>>10,
 		       used, lastused, locked, protected, dirty);
+		lru_unlock(nlist);
 	}
-	spin_unlock(&lru_list_lock);
+	if (!lru_trylock(BUF_DIRTY))
+		return;
+	for (nlist = 0; nlist < BDFLUSH_HASH_SIZE; nlist++)
+		for (bd = bdflush_hash[nlist]; bd; bd = bd->next)
+			printk("%9s: %d dirty buffers, %lu kbyte%s\n",
+			       kdevname(bd->dev), bd->nr_dirty,
+			       bd->size_dirty>>10, bd->task ? "" : ", no flusher");
+	lru_unlock(BUF_DIRTY);
 #endif
 }
 
+#ifdef CONFIG_PROC_FS
+static int buffer_lock_line(char *buf, char *name, struct bh_lock_stat *st)
+{
+	unsigned long long avg = st->hold;
+
+	if (st->acquired)
+		do_div(avg, st->acquired);
+	return sprintf(buf, "%-14s %12lu %12lu %20Lu %8Lu\n", name,
+		       st->acquired, st->contended, st->hold, avg);
+}
+
+/*
+ * /proc/fs/buffer_locks: per lock, or kind of lock, how often it was
+ * taken, how often the taker had to spin, and the cycles it was held
+ * in total and on average.
+ */
+static int buffer_locks_read_proc(char *page, char **start, off_t off,
+				  int count, int *eof, void *data)
+{
+	static char *names[NR_LIST] = { "lru clean", "lru locked", "lru dirty", "lru protected" };
+	struct bh_lock_stat sum;
+	int i, len;
+
+	len = sprintf(page, "%-14s %12s %12s %20s %8s\n", "lock",
+		      "acquired", "contended", "hold", "avg");
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < smp_num_cpus; i++) {
+		struct bh_lock_stat *st = &bh_hash_read_stat[cpu_logical_map(i)].stat;
+
+		sum.acquired += st->acquired;
+		sum.hold += st->hold;
+	}
+	len += buffer_lock_line(page + len, "hash read", &sum);
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < NR_BH_HASH_LOCKS; i++) {
+		sum.acquired += bh_hash_locks[i].write.acquired;
+		sum.hold += bh_hash_locks[i].write.hold;
+	}
+	len += buffer_lock_line(page + len, "hash write", &sum);
+
+	for (i = 0; i < NR_LIST; i++)
+		len += buffer_lock_line(page + len, names[i], &lru_locks[i].stat);
+
+	if (len <= off+count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+	return len;
+}
+#endif
+
 /* ===================== Init ======================= */
 
 /*
@@ -2519,8 +3119,16 @@ void __init buffer_init(unsigned long mempages)
 	}
 
 	/* Setup lru lists. */
-	for(i = 0; i < NR_LIST; i++)
+	for(i = 0; i < NR_LIST; i++) {
 		lru_list[i] = NULL;
+		spin_lock_init(&lru_locks[i].lock);
+	}
+	for(i = 0; i < NR_BH_HASH_LOCKS; i++)
+		rwlock_init(&bh_hash_locks[i].lock);
+
+	bdflush_default.dev = NODEV;
+	INIT_LIST_HEAD(&bdflush_default.dirty);
+	init_waitqueue_head(&bdflush_default.wait);
 
 }
 
@@ -2534,22 +3142,21 @@ void __init buffer_init(unsigned long mempages)
 
 /* This is the _only_ function that deals with flushing async writes
    to disk.
-   NOTENOTENOTENOTE: we _only_ need to browse the DIRTY lru list
-   as all dirty buffers lives _only_ in the DIRTY lru list.
-   As we never browse the LOCKED and CLEAN lru lists they are infact
-   completly useless. */
-static int flush_dirty_buffers(int check_flushtime)
+   NOTENOTENOTENOTE: we _only_ need to browse the dirty list of the
+   device, as all its dirty buffers live _only_ in there, oldest first.
+   The caller holds a reference to the bdflush_dev. */
+static int flush_dirty_buffers(struct bdflush_dev *bd, int check_flushtime)
 {
-	struct buffer_head * bh, *next;
+	struct buffer_head * bh;
+	struct list_head * p, *next;
 	int flushed = 0, i;
 
  restart:
-	spin_lock(&lru_list_lock);
-	bh = lru_list[BUF_DIRTY];
-	if (!bh)
-		goto out_unlock;
-	for (i = nr_buffers_type[BUF_DIRTY]; i-- > 0; bh = next) {
-		next = bh->b_next_free;
+	lru_lock(BUF_DIRTY);
+	p = bd->dirty.next;
+	for (i = bd->nr_dirty; i-- > 0 && p != &bd->dirty; p = next) {
+		bh = list_entry(p, struct buffer_head, b_flush_list);
+		next = p->next;
 
 		if (!buffer_dirty(bh)) {
 			__refile_buffer(bh);
@@ -2572,7 +3179,7 @@ static int flush_dirty_buffers(int check_flushtime)
 
 		/* OK, now we are committed to write it out. */
 		get_bh(bh);
-		spin_unlock(&lru_list_lock);
+		lru_unlock(BUF_DIRTY);
 		ll_rw_block(WRITE, 1, &bh);
 		put_bh(bh);
 
@@ -2581,20 +3188,61 @@ static int flush_dirty_buffers(int check_flushtime)
 		goto restart;
 	}
  out_unlock:
-	spin_unlock(&lru_list_lock);
+	lru_unlock(BUF_DIRTY);
 
 	return flushed;
 }
 
-DECLARE_WAIT_QUEUE_HEAD(bdflush_wait);
+/*
+ * Kick the flushers of all devices with dirty buffers, and return the
+ * one with the most dirty data, with a reference held.
+ */
+static struct bdflush_dev *bdflush_kick_devices(void)
+{
+	struct bdflush_dev *bd, *max = &bdflush_default;
+	int i;
+
+	lru_lock(BUF_DIRTY);
+	for (i = 0; i < BDFLUSH_HASH_SIZE; i++) {
+		for (bd = bdflush_hash[i]; bd; bd = bd->next) {
+			if (!bd->nr_dirty)
+				continue;
+			bd->kicked = 1;
+			if (waitqueue_active(&bd->wait))
+				wake_up_interruptible(&bd->wait);
+			if (bd->size_dirty > max->size_dirty)
+				max = bd;
+		}
+	}
+	max->users++;
+	lru_unlock(BUF_DIRTY);
+	return max;
+}
 
+/*
+ * Wake up all the flushers to write out a batch each. If block is set,
+ * the caller then writes out a batch itself, from the device that has
+ * the most dirty data.
+ *
+ * Without block we may be called from an interrupt (SysRq), so take no
+ * locks: bdflush kicks the device flushers for us.
+ */
 void wakeup_bdflush(int block)
 {
+	struct bdflush_dev *max;
+
+	if (!block) {
+		bdflush_kick_all = 1;
+		wake_up_interruptible(&bdflush_wait);
+		return;
+	}
+
 	if (waitqueue_active(&bdflush_wait))
 		wake_up_interruptible(&bdflush_wait);
 
-	if (block)
-		flush_dirty_buffers(0);
+	max = bdflush_kick_devices();
+	flush_dirty_buffers(max, 0);
+	put_bdflush_dev(max);
 }
 
 /* 
@@ -2612,7 +3260,8 @@ static int sync_old_buffers(void)
 	sync_unlocked_inodes();
 	unlock_kernel();
 
-	flush_dirty_buffers(1);
+	/* the other devices age their buffers in their own flusher */
+	flush_dirty_buffers(&bdflush_default, 1);
 	/* must really sync all the active I/O request to disk here */
 	run_task_queue(&tq_disk);
 	return 0;
@@ -2677,10 +3326,113 @@ asmlinkage long sys_bdflush(int func, long data)
 	return 0;
 }
 
+/*
+ * The flusher of one device. It writes out the buffers that are older
+ * than age_buffer every interval, and batches of ndirty buffers while
+ * the device has more than its share of the dirty data. It goes away
+ * when the device had no dirty buffers for a while.
+ */
+static int bdflush_dev_thread(void *data)
+{
+	struct bdflush_dev *bd = data;
+	struct task_struct *tsk = current;
+	int interval, flushed;
+
+	tsk->session = 1;
+	tsk->pgrp = 1;
+	sprintf(tsk->comm, "bdflush/%s", kdevname(bd->dev));
+
+	spin_lock_irq(&tsk->sigmask_lock);
+	flush_signals(tsk);
+	sigfillset(&tsk->blocked);
+	recalc_sigpending(tsk);
+	spin_unlock_irq(&tsk->sigmask_lock);
+
+	lru_lock(BUF_DIRTY);
+	bd->task = tsk;
+	bd->starting = 0;
+	bd->users--;
+	lru_unlock(BUF_DIRTY);
+
+	for (;;) {
+		interval = bdf_prm.b_un.interval;
+		if (interval)
+			flush_dirty_buffers(bd, 1);
+
+		if (xchg(&bd->kicked, 0) || balance_dirty_state(bd->dev) >= 0) {
+			do
+				flushed = flush_dirty_buffers(bd, 0);
+			while (flushed && balance_dirty_state(bd->dev) >= 0);
+		}
+		run_task_queue(&tq_disk);
+
+		lru_lock(BUF_DIRTY);
+		if (!bd->nr_dirty && !bd->users &&
+		    time_after(jiffies, bd->last_dirty + BDFLUSH_IDLE)) {
+			struct bdflush_dev **bdp = &bdflush_hash[bdflush_hashfn(bd->dev)];
+
+			while (*bdp != bd)
+				bdp = &(*bdp)->next;
+			*bdp = bd->next;
+			lru_unlock(BUF_DIRTY);
+			kfree(bd);
+			/* have bdflush reap us */
+			wake_up_interruptible(&bdflush_wait);
+			return 0;
+		}
+		lru_unlock(BUF_DIRTY);
+
+		interruptible_sleep_on_timeout(&bd->wait,
+					       interval ? interval : BDFLUSH_IDLE);
+	}
+}
+
+/*
+ * Start the flushers of the devices that got dirty buffers, and reap
+ * the ones that exited.
+ */
+static void bdflush_start_threads(void)
+{
+	struct bdflush_dev *bd;
+	int i, pid;
+
+	while (sys_wait4(-1, NULL, __WALL | WNOHANG, NULL) > 0)
+		;
+
+ restart:
+	lru_lock(BUF_DIRTY);
+	for (i = 0; i < BDFLUSH_HASH_SIZE; i++) {
+		for (bd = bdflush_hash[i]; bd; bd = bd->next) {
+			if (bd->task || bd->starting)
+				continue;
+			/* the thread drops this reference when it is up */
+			bd->starting = 1;
+			bd->users++;
+			lru_unlock(BUF_DIRTY);
+
+			pid = kernel_thread(bdflush_dev_thread, bd,
+					    CLONE_FS | CLONE_FILES);
+			if (pid < 0) {
+				lru_lock(BUF_DIRTY);
+				bd->starting = 0;
+				bd->users--;
+				lru_unlock(BUF_DIRTY);
+				/* try again the next time we run */
+				return;
+			}
+			goto restart;
+		}
+	}
+	lru_unlock(BUF_DIRTY);
+}
+
 /*
  * This is the actual bdflush daemon itself. It used to be started from
  * the syscall above, but now we launch it ourselves internally with
  * kernel_thread(...)  directly after the first thread in init/main.c
+ *
+ * The devices are flushed by threads of their own, which bdflush
+ * starts. It flushes only the buffers that did not get a device.
  */
 int bdflush(void *startup)
 {
@@ -2708,14 +3460,20 @@ int bdflush(void *startup)
 	for (;;) {
 		CHECK_EMERGENCY_SYNC
 
-		flushed = flush_dirty_buffers(0);
+		bdflush_start_threads();
+
+		if (xchg(&bdflush_kick_all, 0))
+			put_bdflush_dev(bdflush_kick_devices());
+
+		flushed = flush_dirty_buffers(&bdflush_default, 0);
 
 		/*
 		 * If there are still a lot of dirty buffers around,
 		 * skip the sleep and flush some more. Otherwise, we
 		 * go to sleep waiting a wakeup.
 		 */
-		if (!flushed || balance_dirty_state(NODEV) < 0) {
+		if ((!flushed || balance_dirty_state(NODEV) < 0) &&
+		    !bdflush_kick_all) {
 			run_task_queue(&tq_disk);
 			interruptible_sleep_on(&bdflush_wait);
 		}
@@ -2785,6 +3543,9 @@ static int __init bdflush_init(void)
 	wait_for_completion(&startup);
 	kernel_thread(kupdate, &startup, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
 	wait_for_completion(&startup);
+#ifdef CONFIG_PROC_FS
+	create_proc_read_entry("fs/buffer_locks", 0, 0, buffer_locks_read_proc, NULL);
+#endif
 	return 0;
 }
 
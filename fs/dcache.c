@@ -31,6 +31,23 @@
 
 spinlock_t dcache_lock = SPIN_LOCK_UNLOCKED;
 
+/*
+ * d_lookup() walks the hash chains without dcache_lock, see there.
+ * What it needs from everybody else:
+ *
+ *  - dentries are only freed after an RCU grace period (d_free());
+ *  - d_count only goes from 0 to 1 there under dentry->d_lock, and
+ *    only for a hashed dentry. Whoever gets rid of or empties a
+ *    dentry because it has no references checks d_count and unhashes
+ *    it under d_lock as well. The lock order is dcache_lock, d_lock;
+ *  - such a dentry may be picked up while it is on the unused list
+ *    and stays there. prune_dcache() drops it from the list when it
+ *    finds it in use, dput() does not put it there twice;
+ *  - d_move() bumps dcache_rename_seq before and after it changes
+ *    names and parents, so that d_lookup() can tell.
+ */
+static unsigned int dcache_rename_seq;
+
 /* Right now the dcache depends on the kernel lock */
 #define check_lock()	if (!kernel_locked()) BUG()
 
@@ -55,21 +72,31 @@ static LIST_HEAD(dentry_unused);
 /* Statistics gathering. */
 struct dentry_stat_t dentry_stat = {0, 0, 45, 0,};
 
-/* no dcache_lock, please */
+static void d_callback(void *arg)
+{
+	struct dentry *dentry = arg;
+
+	if (dname_external(dentry))
+		kfree(dentry->d_name.name);
+	kmem_cache_free(dentry_cache, dentry);
+}
+
+/*
+ * no dcache_lock, please. The memory goes back only after a grace
+ * period, a lockless d_lookup() may still be looking at it.
+ */
 static inline void d_free(struct dentry *dentry)
 {
 	if (dentry->d_op && dentry->d_op->d_release)
 		dentry->d_op->d_release(dentry);
-	if (dname_external(dentry)) 
-		kfree(dentry->d_name.name);
-	kmem_cache_free(dentry_cache, dentry); 
+	call_rcu(&dentry->d_rcu, d_callback, dentry);
 	dentry_stat.nr_dentry--;
 }
 
 /*
  * Release the dentry's inode, using the fileystem
  * d_iput() operation if defined.
- * Called with dcache_lock held, drops it.
+ * Called with dcache_lock and dentry->d_lock held, drops both.
  */
 static inline void dentry_iput(struct dentry * dentry)
 {
@@ -77,13 +104,16 @@ static inline void dentry_iput(struct dentry * dentry)
 	if (inode) {
 		dentry->d_inode = NULL;
 		list_del_init(&dentry->d_alias);
+		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
 		if (dentry->d_op && dentry->d_op->d_iput)
 			dentry->d_op->d_iput(dentry, inode);
 		else
 			iput(inode);
-	} else
+	} else {
+		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
+	}
 }
 
 /* 
@@ -124,9 +154,13 @@ repeat:
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
-	/* dput on a free dentry? */
-	if (!list_empty(&dentry->d_lru))
-		BUG();
+	/* Picked up again by d_lookup() meanwhile? */
+	spin_lock(&dentry->d_lock);
+	if (atomic_read(&dentry->d_count)) {
+		spin_unlock(&dentry->d_lock);
+		spin_unlock(&dcache_lock);
+		return;
+	}
 	/*
 	 * AV: ->d_delete() is _NOT_ allowed to block now.
 	 */
@@ -137,8 +171,12 @@ repeat:
 	/* Unreachable? Get rid of it */
 	if (list_empty(&dentry->d_hash))
 		goto kill_it;
-	list_add(&dentry->d_lru, &dentry_unused);
-	dentry_stat.nr_unused++;
+	/* still there if d_lookup() picked it up from the list */
+	if (list_empty(&dentry->d_lru)) {
+		list_add(&dentry->d_lru, &dentry_unused);
+		dentry_stat.nr_unused++;
+	}
+	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
 	return;
 
@@ -147,8 +185,12 @@ unhash_it:
 
 kill_it: {
 		struct dentry *parent;
+		if (!list_empty(&dentry->d_lru)) {
+			list_del(&dentry->d_lru);
+			dentry_stat.nr_unused--;
+		}
 		list_del(&dentry->d_child);
-		/* drops the lock, at that point nobody can reach this dentry */
+		/* drops the locks, at that point nobody can reach this dentry */
 		dentry_iput(dentry);
 		parent = dentry->d_parent;
 		d_free(dentry);
@@ -201,24 +243,30 @@ int d_invalidate(struct dentry * dentry)
 	 * we might still populate it if it was a
 	 * working directory or similar).
 	 */
+	spin_lock(&dentry->d_lock);
 	if (atomic_read(&dentry->d_count) > 1) {
 		if (dentry->d_inode && S_ISDIR(dentry->d_inode->i_mode)) {
+			spin_unlock(&dentry->d_lock);
 			spin_unlock(&dcache_lock);
 			return -EBUSY;
 		}
 	}
 
 	list_del_init(&dentry->d_hash);
+	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
 	return 0;
 }
 
-/* This should be called _only_ with dcache_lock held */
+/*
+ * This should be called _only_ with dcache_lock held. A dentry that
+ * d_lookup() picked up may be on the unused list with references.
+ */
 
 static inline struct dentry * __dget_locked(struct dentry *dentry)
 {
 	atomic_inc(&dentry->d_count);
-	if (atomic_read(&dentry->d_count) == 1) {
+	if (!list_empty(&dentry->d_lru)) {
 		dentry_stat.nr_unused--;
 		list_del_init(&dentry->d_lru);
 	}
@@ -289,7 +337,8 @@ restart:
  * Throw away a dentry - free the inode, dput the parent.
  * This requires that the LRU list has already been
  * removed.
- * Called with dcache_lock, drops it and then regains.
+ * Called with dcache_lock and dentry->d_lock held and d_count
+ * checked to be 0; drops both and then regains dcache_lock.
  */
 static inline void prune_one_dentry(struct dentry * dentry)
 {
@@ -332,18 +381,23 @@ void prune_dcache(int count)
 		list_del_init(tmp);
 		dentry = list_entry(tmp, struct dentry, d_lru);
 
+		/* Picked up by d_lookup() while on the list? */
+		spin_lock(&dentry->d_lock);
+		if (atomic_read(&dentry->d_count)) {
+			spin_unlock(&dentry->d_lock);
+			dentry_stat.nr_unused--;
+			continue;
+		}
+
 		/* If the dentry was recently referenced, don't free it. */
 		if (dentry->d_vfs_flags & DCACHE_REFERENCED) {
 			dentry->d_vfs_flags &= ~DCACHE_REFERENCED;
 			list_add(&dentry->d_lru, &dentry_unused);
+			spin_unlock(&dentry->d_lock);
 			continue;
 		}
 		dentry_stat.nr_unused--;
 
-		/* Unused dentry with a count? */
-		if (atomic_read(&dentry->d_count))
-			BUG();
-
 		prune_one_dentry(dentry);
 		if (!--count)
 			break;
@@ -405,8 +459,11 @@ repeat:
 		dentry = list_entry(tmp, struct dentry, d_lru);
 		if (dentry->d_sb != sb)
 			continue;
-		if (atomic_read(&dentry->d_count))
+		spin_lock(&dentry->d_lock);
+		if (atomic_read(&dentry->d_count)) {
+			spin_unlock(&dentry->d_lock);
 			continue;
+		}
 		dentry_stat.nr_unused--;
 		list_del_init(tmp);
 		prune_one_dentry(dentry);
@@ -554,10 +611,9 @@ void shrink_dcache_memory(int priority, unsigned int gfp_mask)
 	/*
 	 * Nasty deadlock avoidance.
 	 *
-	 * ext2_new_block->getblk->GFP->shrink_dcache_memory->prune_dcache->
+	 * ext2_new_blocks->getblk->GFP->shrink_dcache_memory->prune_dcache->
 	 * prune_one_dentry->dput->dentry_iput->iput->inode->i_sb->s_op->
-	 * put_inode->ext2_discard_prealloc->ext2_free_blocks->lock_super->
-	 * DEADLOCK.
+	 * clear_inode->ext2_discard_reservation->lock_super->DEADLOCK.
 	 *
 	 * We should make sure we don't hold the superblock lock over
 	 * block allocations, but for now:
@@ -617,6 +673,7 @@ struct dentry * d_alloc(struct dentry * parent, const struct qstr *name)
 	dentry->d_op = NULL;
 	dentry->d_fsdata = NULL;
 	dentry->d_mounted = 0;
+	spin_lock_init(&dentry->d_lock);
 	INIT_LIST_HEAD(&dentry->d_hash);
 	INIT_LIST_HEAD(&dentry->d_lru);
 	INIT_LIST_HEAD(&dentry->d_subdirs);
@@ -690,6 +747,50 @@ static inline struct list_head * d_hash(struct dentry * parent, unsigned long ha
 	return dentry_hashtable + (hash & D_HASHMASK);
 }
 
+/* The locked lookup, for when the lockless one in d_lookup() fails */
+static struct dentry * __d_lookup(struct dentry * parent, struct qstr * name)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct list_head *head = d_hash(parent,hash);
+	struct list_head *tmp;
+
+	spin_lock(&dcache_lock);
+	tmp = head->next;
+	for (;;) {
+		struct dentry * dentry = list_entry(tmp, struct dentry, d_hash);
+		if (tmp == head)
+			break;
+		tmp = tmp->next;
+		if (dentry->d_name.hash != hash)
+			continue;
+		if (dentry->d_parent != parent)
+			continue;
+		if (parent->d_op && parent->d_op->d_compare) {
+			if (parent->d_op->d_compare(parent, &dentry->d_name, name))
+				continue;
+		} else {
+			if (dentry->d_name.len != len)
+				continue;
+			if (memcmp(dentry->d_name.name, str, len))
+				continue;
+		}
+		__dget_locked(dentry);
+		dentry->d_vfs_flags |= DCACHE_REFERENCED;
+		spin_unlock(&dcache_lock);
+		return dentry;
+	}
+	spin_unlock(&dcache_lock);
+	return NULL;
+}
+
+static inline int d_hash_head(struct list_head *entry)
+{
+	return entry >= dentry_hashtable &&
+	       entry <= dentry_hashtable + d_hash_mask;
+}
+
 /**
  * d_lookup - search for a dentry
  * @parent: parent dentry
@@ -699,6 +800,20 @@ static inline struct list_head * d_hash(struct dentry * parent, unsigned long ha
  * the dentry is found its reference count is incremented and the dentry
  * is returned. The caller must use d_put to free the entry when it has
  * finished using it. %NULL is returned on failure.
+ *
+ * The hash chain is walked without dcache_lock. Whatever we reach stays
+ * valid memory (d_free() waits for RCU), but the chain may change under
+ * us, and then we do the lookup again under the lock:
+ *  - an entry unhashed meanwhile points to itself; we do not know where
+ *    we were any more;
+ *  - an entry moved by d_move() or rehashed may take us to another
+ *    chain, which we notice when we get to a head that is not ours;
+ *  - d_move() changes names and parents in place, so what we compared
+ *    only counts if dcache_rename_seq stayed the same. Names may be
+ *    torn while that happens, but never freed.
+ * New entries go to the head of the chain, so we can only miss one that
+ * was added after we started. Callers for whom that matters hold the
+ * i_sem of the parent (real_lookup()), which keeps such entries out.
  */
  
 struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
@@ -707,15 +822,27 @@ struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
 	unsigned int hash = name->hash;
 	const unsigned char *str = name->name;
 	struct list_head *head = d_hash(parent,hash);
-	struct list_head *tmp;
+	struct list_head *tmp, *next;
+	unsigned int seq;
 
-	spin_lock(&dcache_lock);
+	seq = dcache_rename_seq;
+	smp_rmb();
+	if (seq & 1)
+		goto locked;
+
+	rcu_read_lock();
 	tmp = head->next;
-	for (;;) {
-		struct dentry * dentry = list_entry(tmp, struct dentry, d_hash);
-		if (tmp == head)
-			break;
-		tmp = tmp->next;
+	while (tmp != head) {
+		struct dentry * dentry;
+
+		rcu_read_barrier();
+		if (d_hash_head(tmp))
+			goto locked_unlock;
+		next = tmp->next;
+		if (next == tmp)
+			goto locked_unlock;
+		dentry = list_entry(tmp, struct dentry, d_hash);
+		tmp = next;
 		if (dentry->d_name.hash != hash)
 			continue;
 		if (dentry->d_parent != parent)
@@ -729,13 +856,29 @@ struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
 			if (memcmp(dentry->d_name.name, str, len))
 				continue;
 		}
-		__dget_locked(dentry);
+
+		spin_lock(&dentry->d_lock);
+		smp_rmb();
+		if (dcache_rename_seq != seq || list_empty(&dentry->d_hash)) {
+			spin_unlock(&dentry->d_lock);
+			goto locked_unlock;
+		}
+		atomic_inc(&dentry->d_count);
 		dentry->d_vfs_flags |= DCACHE_REFERENCED;
-		spin_unlock(&dcache_lock);
+		spin_unlock(&dentry->d_lock);
+		rcu_read_unlock();
 		return dentry;
 	}
-	spin_unlock(&dcache_lock);
-	return NULL;
+	smp_rmb();
+	if (dcache_rename_seq == seq) {
+		rcu_read_unlock();
+		return NULL;
+	}
+
+locked_unlock:
+	rcu_read_unlock();
+locked:
+	return __d_lookup(parent, name);
 }
 
 /**
@@ -811,10 +954,12 @@ void d_delete(struct dentry * dentry)
 	 * Are we the only user?
 	 */
 	spin_lock(&dcache_lock);
+	spin_lock(&dentry->d_lock);
 	if (atomic_read(&dentry->d_count) == 1) {
 		dentry_iput(dentry);
 		return;
 	}
+	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
 
 	/*
@@ -836,7 +981,7 @@ void d_rehash(struct dentry * entry)
 	struct list_head *list = d_hash(entry->d_parent, entry->d_name.hash);
 	if (!list_empty(&entry->d_hash)) BUG();
 	spin_lock(&dcache_lock);
-	list_add(&entry->d_hash, list);
+	list_add_rcu(&entry->d_hash, list);
 	spin_unlock(&dcache_lock);
 }
 
@@ -904,9 +1049,12 @@ void d_move(struct dentry * dentry, struct dentry * target)
 		printk(KERN_WARNING "VFS: moving negative dcache entry\n");
 
 	spin_lock(&dcache_lock);
+	dcache_rename_seq++;
+	smp_wmb();
+
 	/* Move the dentry to the target hash queue */
 	list_del(&dentry->d_hash);
-	list_add(&dentry->d_hash, &target->d_hash);
+	list_add_rcu(&dentry->d_hash, &target->d_hash);
 
 	/* Unhash the target: dput() will then get rid of it */
 	list_del_init(&target->d_hash);
@@ -923,6 +1071,9 @@ void d_move(struct dentry * dentry, struct dentry * target)
 	/* And add them back to the (new) parent lists */
 	list_add(&target->d_child, &target->d_parent->d_subdirs);
 	list_add(&dentry->d_child, &dentry->d_parent->d_subdirs);
+
+	smp_wmb();
+	dcache_rename_seq++;
 	spin_unlock(&dcache_lock);
 }
 
@@ -0,0 +1,785 @@
+/*
+ *  linux/fs/eventpoll.c
+ *
+ *  Scalable event notification for large numbers of file descriptors.
+ *
+ *  select() and poll() rebuild the whole poll table and call every
+ *  file's ->poll method on each invocation, so a process watching
+ *  ten thousand mostly idle sockets pays for all of them on every
+ *  wakeup. An eventpoll object instead keeps the interest set in the
+ *  kernel: when a file is added, a callback entry is hooked into each
+ *  wait queue its ->poll method sleeps on. Any wakeup on those queues
+ *  (sock_def_readable(), the pipe and tty wakeups, ...) puts the file
+ *  on the object's ready list, and sys_epoll_wait() only ever looks
+ *  at that list.
+ *
+ *  Locking:
+ *	epsem		global, serializes the final release of a
+ *			registered file against the release of an
+ *			eventpoll object.
+ *	ep->sem		serializes changes to the interest set and the
+ *			harvesting of the ready list.
+ *	ep->lock	irq-safe, protects the ready list. Taken from
+ *			the wait queue callbacks.
+ *	file->f_ep_lock	protects the list of items a file is part of.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/smp_lock.h>
+#include <linux/string.h>
+#include <linux/list.h>
+#include <linux/eventpoll.h>
+
+#include <asm/uaccess.h>
+#include <asm/semaphore.h>
+
+#define EVENTPOLLFS_MAGIC	0x03111965
+
+/* Interest set hash sizes, picked from the size hint at creation time */
+#define EP_MIN_HASH_BITS	4
+#define EP_MAX_HASH_BITS	12
+
+/* Events that are always reported, whether asked for or not */
+#define EP_ALWAYS_EVENTS	(POLLERR | POLLHUP)
+
+struct eventpoll {
+	spinlock_t lock;
+	struct semaphore sem;
+
+	/* sys_epoll_wait() sleepers */
+	wait_queue_head_t wq;
+
+	/* ->poll() of the eventpoll file itself */
+	wait_queue_head_t poll_wait;
+
+	/* items whose files had a wakeup since they were last looked at */
+	struct list_head rdllist;
+
+	unsigned int hashbits;
+	struct list_head *hash;
+};
+
+/* One per (file, fd) in an interest set */
+struct epitem {
+	struct list_head hlink;		/* ep->hash chain */
+	struct list_head rdllink;	/* ep->rdllist, empty if not ready */
+	struct list_head fllink;	/* file->f_ep_links */
+	struct list_head pwqlist;	/* our wait queue hooks */
+	int nwait;			/* number of hooks, -1 on failure */
+	struct eventpoll *ep;
+	struct file *file;
+	int fd;
+	struct epoll_event event;
+};
+
+/* One per wait queue the file's ->poll method sleeps on */
+struct eppoll_entry {
+	struct list_head llink;
+	struct epitem *base;
+	wait_queue_t wait;
+	wait_queue_head_t *whead;
+};
+
+/* Passed to ->poll() on insertion, to reach the item from the queue proc */
+struct ep_pqueue {
+	poll_table pt;
+	struct epitem *epi;
+};
+
+static DECLARE_MUTEX(epsem);
+
+static kmem_cache_t *epi_cache;
+static kmem_cache_t *pwq_cache;
+
+static struct vfsmount *eventpoll_mnt;
+
+static inline struct list_head *ep_hash_entry(struct eventpoll *ep,
+					      struct file *file, int fd)
+{
+	unsigned long h = (unsigned long) file / L1_CACHE_BYTES + fd;
+
+	h ^= h >> ep->hashbits;
+	return ep->hash + (h & ((1UL << ep->hashbits) - 1));
+}
+
+static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
+{
+	struct list_head *head = ep_hash_entry(ep, file, fd), *tmp;
+
+	list_for_each(tmp, head) {
+		struct epitem *epi = list_entry(tmp, struct epitem, hlink);
+
+		if (epi->file == file && epi->fd == fd)
+			return epi;
+	}
+	return NULL;
+}
+
+/*
+ * Hooked into the wait queues of every registered file. Called with
+ * the queue lock held and interrupts off, so only the ready list is
+ * touched here.
+ */
+static void ep_poll_callback(wait_queue_t *wait, unsigned int mode, int sync)
+{
+	struct eppoll_entry *pwq = list_entry(wait, struct eppoll_entry, wait);
+	struct epitem *epi = pwq->base;
+	struct eventpoll *ep = epi->ep;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (list_empty(&epi->rdllink))
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (waitqueue_active(&ep->wq))
+		wake_up(&ep->wq);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	if (waitqueue_active(&ep->poll_wait))
+		wake_up(&ep->poll_wait);
+}
+
+/*
+ * poll_wait() hook used while inserting an item: hang a callback entry
+ * on the wait queue instead of putting the current task to sleep.
+ */
+static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
+				 poll_table *pt)
+{
+	struct epitem *epi = list_entry(pt, struct ep_pqueue, pt)->epi;
+	struct eppoll_entry *pwq;
+
+	if (epi->nwait < 0)
+		return;
+	pwq = kmem_cache_alloc(pwq_cache, SLAB_KERNEL);
+	if (!pwq) {
+		epi->nwait = -1;
+		return;
+	}
+	init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
+	pwq->whead = whead;
+	pwq->base = epi;
+	add_wait_queue(whead, &pwq->wait);
+	list_add_tail(&pwq->llink, &epi->pwqlist);
+	epi->nwait++;
+}
+
+static void ep_unregister_pollwait(struct epitem *epi)
+{
+	while (!list_empty(&epi->pwqlist)) {
+		struct eppoll_entry *pwq;
+
+		pwq = list_entry(epi->pwqlist.next, struct eppoll_entry, llink);
+		list_del(&pwq->llink);
+		remove_wait_queue(pwq->whead, &pwq->wait);
+		kmem_cache_free(pwq_cache, pwq);
+	}
+}
+
+static inline unsigned int ep_item_poll(struct epitem *epi)
+{
+	return epi->file->f_op->poll(epi->file, NULL) &
+		(epi->event.events | EP_ALWAYS_EVENTS);
+}
+
+/*
+ * Must be called with ep->sem held.
+ */
+static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
+		     struct file *tfile, int fd)
+{
+	struct epitem *epi;
+	struct ep_pqueue epq;
+	unsigned int revents;
+	unsigned long flags;
+
+	epi = kmem_cache_alloc(epi_cache, SLAB_KERNEL);
+	if (!epi)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&epi->rdllink);
+	INIT_LIST_HEAD(&epi->pwqlist);
+	epi->nwait = 0;
+	epi->ep = ep;
+	epi->file = tfile;
+	epi->fd = fd;
+	epi->event = *event;
+
+	/*
+	 * Let the file's ->poll method tell us which wait queues to hook
+	 * into, and get its current state at the same time.
+	 */
+	epq.pt.qproc = ep_ptable_queue_proc;
+	epq.pt.error = 0;
+	epq.pt.table = NULL;
+	epq.epi = epi;
+	revents = tfile->f_op->poll(tfile, &epq.pt) &
+		(event->events | EP_ALWAYS_EVENTS);
+
+	if (epi->nwait < 0) {
+		ep_unregister_pollwait(epi);
+		kmem_cache_free(epi_cache, epi);
+		return -ENOMEM;
+	}
+
+	spin_lock(&tfile->f_ep_lock);
+	list_add_tail(&epi->fllink, &tfile->f_ep_links);
+	spin_unlock(&tfile->f_ep_lock);
+
+	list_add(&epi->hlink, ep_hash_entry(ep, tfile, fd));
+
+	if (revents) {
+		spin_lock_irqsave(&ep->lock, flags);
+		if (list_empty(&epi->rdllink))
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+		if (waitqueue_active(&ep->wq))
+			wake_up(&ep->wq);
+		spin_unlock_irqrestore(&ep->lock, flags);
+		if (waitqueue_active(&ep->poll_wait))
+			wake_up(&ep->poll_wait);
+	}
+	return 0;
+}
+
+/*
+ * Must be called with ep->sem held.
+ */
+static int ep_modify(struct eventpoll *ep, struct epitem *epi,
+		     struct epoll_event *event)
+{
+	unsigned long flags;
+
+	epi->event = *event;
+	if (ep_item_poll(epi)) {
+		spin_lock_irqsave(&ep->lock, flags);
+		if (list_empty(&epi->rdllink))
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+		if (waitqueue_active(&ep->wq))
+			wake_up(&ep->wq);
+		spin_unlock_irqrestore(&ep->lock, flags);
+		if (waitqueue_active(&ep->poll_wait))
+			wake_up(&ep->poll_wait);
+	}
+	return 0;
+}
+
+/*
+ * Must be called with ep->sem held.
+ */
+static void ep_remove(struct eventpoll *ep, struct epitem *epi)
+{
+	struct file *file = epi->file;
+	unsigned long flags;
+
+	/* no callbacks can run for this item once this returns */
+	ep_unregister_pollwait(epi);
+
+	spin_lock(&file->f_ep_lock);
+	list_del(&epi->fllink);
+	spin_unlock(&file->f_ep_lock);
+
+	list_del(&epi->hlink);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (!list_empty(&epi->rdllink))
+		list_del(&epi->rdllink);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	kmem_cache_free(epi_cache, epi);
+}
+
+/*
+ * Move up to 'maxevents' ready events to user space. Level triggered
+ * items that are still ready go back on the ready list, so the next
+ * call looks at them again. Each item is taken off the list before
+ * its file is polled, so a wakeup racing with us re-queues it.
+ */
+static int ep_events_transfer(struct eventpoll *ep,
+			      struct epoll_event *events, int maxevents)
+{
+	struct list_head txlist;
+	struct epitem *epi;
+	struct epoll_event ev;
+	unsigned long flags;
+	int eventcnt = 0;
+
+	down(&ep->sem);
+
+	INIT_LIST_HEAD(&txlist);
+	spin_lock_irqsave(&ep->lock, flags);
+	list_splice(&ep->rdllist, &txlist);
+	INIT_LIST_HEAD(&ep->rdllist);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	while (!list_empty(&txlist) && eventcnt < maxevents) {
+		epi = list_entry(txlist.next, struct epitem, rdllink);
+
+		spin_lock_irqsave(&ep->lock, flags);
+		list_del_init(&epi->rdllink);
+		spin_unlock_irqrestore(&ep->lock, flags);
+
+		ev.events = ep_item_poll(epi);
+		if (!ev.events)
+			continue;
+		ev.data = epi->event.data;
+		if (copy_to_user(events + eventcnt, &ev, sizeof(ev))) {
+			if (!eventcnt)
+				eventcnt = -EFAULT;
+			spin_lock_irqsave(&ep->lock, flags);
+			if (list_empty(&epi->rdllink))
+				list_add(&epi->rdllink, &txlist);
+			spin_unlock_irqrestore(&ep->lock, flags);
+			break;
+		}
+		eventcnt++;
+
+		if (!(epi->event.events & EPOLLET)) {
+			spin_lock_irqsave(&ep->lock, flags);
+			if (list_empty(&epi->rdllink))
+				list_add_tail(&epi->rdllink, &ep->rdllist);
+			spin_unlock_irqrestore(&ep->lock, flags);
+		}
+	}
+
+	/* whatever we did not get to stays ready, in front */
+	spin_lock_irqsave(&ep->lock, flags);
+	list_splice(&txlist, &ep->rdllist);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	up(&ep->sem);
+	return eventcnt;
+}
+
+static int ep_poll(struct eventpoll *ep, struct epoll_event *events,
+		   int maxevents, long timeout)
+{
+	int res;
+	unsigned long flags;
+	DECLARE_WAITQUEUE(wait, current);
+
+	if (timeout < 0)
+		timeout = MAX_SCHEDULE_TIMEOUT;
+	else if (timeout) {
+		/* Careful about overflow in the intermediate values */
+		if ((unsigned long) timeout < MAX_SCHEDULE_TIMEOUT / HZ)
+			timeout = (unsigned long)(timeout*HZ+999)/1000+1;
+		else
+			timeout = MAX_SCHEDULE_TIMEOUT;
+	}
+
+	for (;;) {
+		spin_lock_irqsave(&ep->lock, flags);
+		if (list_empty(&ep->rdllist)) {
+			add_wait_queue(&ep->wq, &wait);
+			for (;;) {
+				set_current_state(TASK_INTERRUPTIBLE);
+				if (!list_empty(&ep->rdllist) || !timeout)
+					break;
+				if (signal_pending(current))
+					break;
+				spin_unlock_irqrestore(&ep->lock, flags);
+				timeout = schedule_timeout(timeout);
+				spin_lock_irqsave(&ep->lock, flags);
+			}
+			remove_wait_queue(&ep->wq, &wait);
+			set_current_state(TASK_RUNNING);
+		}
+		res = list_empty(&ep->rdllist);
+		spin_unlock_irqrestore(&ep->lock, flags);
+
+		if (res) {
+			if (signal_pending(current) && timeout)
+				return -EINTR;
+			return 0;
+		}
+
+		/*
+		 * A wakeup is only a hint: the file might not be ready any
+		 * more, or not for the events asked for. Go back to sleep
+		 * if nothing was really ready.
+		 */
+		res = ep_events_transfer(ep, events, maxevents);
+		if (res || !timeout)
+			return res;
+	}
+}
+
+static void ep_free(struct eventpoll *ep)
+{
+	unsigned int i;
+
+	/*
+	 * Files registered with us may be going away at the same time;
+	 * epsem makes sure each item is removed exactly once.
+	 */
+	down(&epsem);
+	down(&ep->sem);
+	for (i = 0; i < (1U << ep->hashbits); i++) {
+		struct list_head *head = ep->hash + i;
+
+		while (!list_empty(head))
+			ep_remove(ep, list_entry(head->next, struct epitem, hlink));
+	}
+	up(&ep->sem);
+	up(&epsem);
+
+	kfree(ep->hash);
+	kfree(ep);
+}
+
+void eventpoll_release_file(struct file *file)
+{
+	struct epitem *epi;
+	struct eventpoll *ep;
+
+	down(&epsem);
+	while (!list_empty(&file->f_ep_links)) {
+		epi = list_entry(file->f_ep_links.next, struct epitem, fllink);
+		ep = epi->ep;
+		down(&ep->sem);
+		ep_remove(ep, epi);
+		up(&ep->sem);
+	}
+	up(&epsem);
+}
+
+static int ep_eventpoll_release(struct inode *inode, struct file *file)
+{
+	struct eventpoll *ep = file->private_data;
+
+	if (ep)
+		ep_free(ep);
+	return 0;
+}
+
+static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
+{
+	struct eventpoll *ep = file->private_data;
+	unsigned int pollflags = 0;
+	unsigned long flags;
+
+	poll_wait(file, &ep->poll_wait, wait);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (!list_empty(&ep->rdllist))
+		pollflags = POLLIN | POLLRDNORM;
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	return pollflags;
+}
+
+static struct file_operations eventpoll_fops = {
+	release:	ep_eventpoll_release,
+	poll:		ep_eventpoll_poll,
+};
+
+static inline int is_file_epoll(struct file *file)
+{
+	return file->f_op == &eventpoll_fops;
+}
+
+static struct eventpoll *ep_alloc(int size)
+{
+	struct eventpoll *ep;
+	unsigned int i, hashbits = EP_MIN_HASH_BITS;
+
+	while (hashbits < EP_MAX_HASH_BITS && (1 << hashbits) < size)
+		hashbits++;
+
+	ep = kmalloc(sizeof(struct eventpoll), GFP_KERNEL);
+	if (!ep)
+		return NULL;
+	ep->hash = kmalloc(sizeof(struct list_head) << hashbits, GFP_KERNEL);
+	if (!ep->hash) {
+		kfree(ep);
+		return NULL;
+	}
+	for (i = 0; i < (1U << hashbits); i++)
+		INIT_LIST_HEAD(ep->hash + i);
+	ep->hashbits = hashbits;
+	spin_lock_init(&ep->lock);
+	init_MUTEX(&ep->sem);
+	init_waitqueue_head(&ep->wq);
+	init_waitqueue_head(&ep->poll_wait);
+	INIT_LIST_HEAD(&ep->rdllist);
+	return ep;
+}
+
+static int eventpollfs_delete_dentry(struct dentry *dentry)
+{
+	return 1;
+}
+
+static struct dentry_operations eventpollfs_dentry_operations = {
+	d_delete:	eventpollfs_delete_dentry,
+};
+
+static struct inode *ep_eventpoll_inode(void)
+{
+	struct inode *inode = get_empty_inode();
+
+	if (!inode)
+		return NULL;
+
+	inode->i_fop = &eventpoll_fops;
+	inode->i_sb = eventpoll_mnt->mnt_sb;
+
+	/*
+	 * Mark the inode dirty from the very beginning,
+	 * that way it will never be moved to the dirty
+	 * list because "mark_inode_dirty()" will think
+	 * that it already _is_ on the dirty list.
+	 */
+	inode->i_state = I_DIRTY;
+	inode->i_mode = S_IRUSR | S_IWUSR;
+	inode->i_uid = current->fsuid;
+	inode->i_gid = current->fsgid;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_blksize = PAGE_SIZE;
+	return inode;
+}
+
+/*
+ * Create an eventpoll object and return a file descriptor for it.
+ * 'size' is a hint of how many descriptors will be added.
+ */
+asmlinkage long sys_epoll_create(int size)
+{
+	struct eventpoll *ep;
+	struct inode *inode;
+	struct dentry *dentry;
+	struct file *file;
+	struct qstr this;
+	char name[32];
+	int error, fd;
+
+	if (size <= 0)
+		return -EINVAL;
+
+	error = -ENOMEM;
+	ep = ep_alloc(size);
+	if (!ep)
+		goto out;
+
+	error = -ENFILE;
+	file = get_empty_filp();
+	if (!file)
+		goto out_free_ep;
+
+	error = -ENOMEM;
+	inode = ep_eventpoll_inode();
+	if (!inode)
+		goto out_put_filp;
+
+	error = get_unused_fd();
+	if (error < 0)
+		goto out_iput;
+	fd = error;
+
+	error = -ENOMEM;
+	sprintf(name, "[%lu]", inode->i_ino);
+	this.name = name;
+	this.len = strlen(name);
+	this.hash = inode->i_ino;
+	dentry = d_alloc(eventpoll_mnt->mnt_sb->s_root, &this);
+	if (!dentry)
+		goto out_put_fd;
+	dentry->d_op = &eventpollfs_dentry_operations;
+	d_add(dentry, inode);
+
+	file->f_vfsmnt = mntget(eventpoll_mnt);
+	file->f_dentry = dentry;
+	file->f_pos = 0;
+	file->f_flags = O_RDONLY;
+	file->f_op = &eventpoll_fops;
+	file->f_mode = FMODE_READ;
+	file->f_version = 0;
+	file->private_data = ep;
+
+	fd_install(fd, file);
+	return fd;
+
+out_put_fd:
+	put_unused_fd(fd);
+out_iput:
+	iput(inode);
+out_put_filp:
+	put_filp(file);
+out_free_ep:
+	kfree(ep->hash);
+	kfree(ep);
+out:
+	return error;
+}
+
+/*
+ * Add, modify or remove 'fd' in the interest set of 'epfd'.
+ */
+asmlinkage long sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	struct file *file, *tfile;
+	struct eventpoll *ep;
+	struct epitem *epi;
+	struct epoll_event epds;
+	int error;
+
+	error = -EFAULT;
+	if (op != EPOLL_CTL_DEL && copy_from_user(&epds, event, sizeof(epds)))
+		goto out;
+
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto out;
+	tfile = fget(fd);
+	if (!tfile)
+		goto out_fput;
+
+	/*
+	 * The target has to support ->poll, and nesting eventpoll
+	 * objects is not supported: their callbacks could recurse.
+	 */
+	error = -EPERM;
+	if (!tfile->f_op || !tfile->f_op->poll)
+		goto out_tfput;
+	error = -EINVAL;
+	if (!is_file_epoll(file) || is_file_epoll(tfile))
+		goto out_tfput;
+
+	ep = file->private_data;
+
+	down(&ep->sem);
+	epi = ep_find(ep, tfile, fd);
+
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		error = -EEXIST;
+		if (!epi)
+			error = ep_insert(ep, &epds, tfile, fd);
+		break;
+	case EPOLL_CTL_DEL:
+		error = -ENOENT;
+		if (epi) {
+			ep_remove(ep, epi);
+			error = 0;
+		}
+		break;
+	case EPOLL_CTL_MOD:
+		error = -ENOENT;
+		if (epi)
+			error = ep_modify(ep, epi, &epds);
+		break;
+	default:
+		error = -EINVAL;
+	}
+	up(&ep->sem);
+
+out_tfput:
+	fput(tfile);
+out_fput:
+	fput(file);
+out:
+	return error;
+}
+
+/*
+ * Wait for events on an eventpoll object. 'timeout' is in
+ * milliseconds, -1 waits forever.
+ */
+asmlinkage long sys_epoll_wait(int epfd, struct epoll_event *events,
+			       int maxevents, int timeout)
+{
+	struct file *file;
+	int error;
+
+	if (maxevents <= 0)
+		return -EINVAL;
+	if (verify_area(VERIFY_WRITE, events, maxevents * sizeof(struct epoll_event)))
+		return -EFAULT;
+
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto out;
+
+	error = -EINVAL;
+	if (is_file_epoll(file))
+		error = ep_poll(file->private_data, events, maxevents, timeout);
+
+	fput(file);
+out:
+	return error;
+}
+
+/*
+ * eventpollfs should never be mounted by userland, see pipefs.
+ */
+static int eventpollfs_statfs(struct super_block *sb, struct statfs *buf)
+{
+	buf->f_type = EVENTPOLLFS_MAGIC;
+	buf->f_bsize = 1024;
+	buf->f_namelen = 255;
+	return 0;
+}
+
+static struct super_operations eventpollfs_ops = {
+	statfs:		eventpollfs_statfs,
+};
+
+static struct super_block *eventpollfs_read_super(struct super_block *sb, void *data, int silent)
+{
+	struct inode *root = new_inode(sb);
+	if (!root)
+		return NULL;
+	root->i_mode = S_IFDIR | S_IRUSR | S_IWUSR;
+	root->i_uid = root->i_gid = 0;
+	root->i_atime = root->i_mtime = root->i_ctime = CURRENT_TIME;
+	sb->s_blocksize = 1024;
+	sb->s_blocksize_bits = 10;
+	sb->s_magic = EVENTPOLLFS_MAGIC;
+	sb->s_op = &eventpollfs_ops;
+	sb->s_root = d_alloc(NULL, &(const struct qstr) { "eventpoll:", 10, 0 });
+	if (!sb->s_root) {
+		iput(root);
+		return NULL;
+	}
+	sb->s_root->d_sb = sb;
+	sb->s_root->d_parent = sb->s_root;
+	d_instantiate(sb->s_root, root);
+	return sb;
+}
+
+static DECLARE_FSTYPE(eventpoll_fs_type, "eventpollfs", eventpollfs_read_super,
+	FS_NOMOUNT|FS_SINGLE);
+
+static int __init eventpoll_init(void)
+{
+	int error;
+
+	epi_cache = kmem_cache_create("eventpoll_epi", sizeof(struct epitem),
+				      0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	pwq_cache = kmem_cache_create("eventpoll_pwq", sizeof(struct eppoll_entry),
+				      0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!epi_cache || !pwq_cache)
+		panic("eventpoll: cannot create slab caches");
+
+	error = register_filesystem(&eventpoll_fs_type);
+	if (error)
+		return error;
+	eventpoll_mnt = kern_mount(&eventpoll_fs_type);
+	if (IS_ERR(eventpoll_mnt)) {
+		error = PTR_ERR(eventpoll_mnt);
+		unregister_filesystem(&eventpoll_fs_type);
+		return error;
+	}
+	return 0;
+}
+
+__initcall(eventpoll_init);
@@ -33,6 +33,7 @@
 #include <linux/init.h>
 #include <linux/pagemap.h>
 #include <linux/highmem.h>
+#include <linux/swap.h>
 #include <linux/spinlock.h>
 #define __NO_VERSION__
 #include <linux/module.h>
@@ -277,6 +278,8 @@ void put_dirty_page(struct task_struct * tsk, struct page *page, unsigned long a
 	flush_dcache_page(page);
 	flush_page_to_ram(page);
 	set_pte(pte, pte_mkdirty(pte_mkwrite(mk_pte(page, PAGE_COPY))));
+	page_add_rmap(page, pte, tsk->mm, address);
+	lru_cache_add_anon(page);
 	tsk->mm->rss++;
 	spin_unlock(&tsk->mm->page_table_lock);
 
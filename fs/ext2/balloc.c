@@ -346,36 +346,227 @@ error_return:
 }
 
 /*
- * ext2_new_block uses a goal block to assist allocation.  If the goal is
- * free, or there is a free block within 32 blocks of the goal, that block
- * is allocated.  Otherwise a forward search is made for a free block; within 
- * each block group the search first looks for an entire free byte in the block
- * bitmap, and then for any free bit if that fails.
+ * Reservation windows.
+ *
+ * A regular file that allocates gets a window: a run of blocks in one
+ * group, starting at a free block near the goal, that the windows of
+ * other files keep out of. The file takes its blocks from the window
+ * for as long as its goal is in there and free blocks are left, and
+ * then gets a new window. A window that was used up from start to end
+ * is replaced by one twice the size, up to EXT2_MAX_RESERVE_BLOCKS, so
+ * a file that is written sequentially gets ever longer runs of blocks
+ * however many others are written at the same time.
+ *
+ * Nothing is marked in the bitmaps, so there is nothing to give back
+ * when the file is closed or the machine crashes. Allocations without
+ * a window (directories, or everything with "noreservation") do not
+ * look at the windows at all.
+ *
+ * The windows of a filesystem are kept on one list sorted by start,
+ * which is protected by lock_super() like the bitmaps. There are only
+ * as many as there are files being written.
+ */
+
+static inline int rsv_is_empty(struct ext2_reserve_window *rsv)
+{
+	return list_empty(&rsv->rsv_list);
+}
+
+void ext2_init_reservation(struct inode *inode)
+{
+	struct ext2_reserve_window *rsv = &inode->u.ext2_i.i_rsv_window;
+	unsigned goal = inode->i_sb->u.ext2_sb.s_es->s_prealloc_blocks;
+
+	INIT_LIST_HEAD(&rsv->rsv_list);
+	rsv->rsv_start = rsv->rsv_end = 0;
+	rsv->rsv_goal_size = goal ? goal : EXT2_DEFAULT_RESERVE_BLOCKS;
+}
+
+void ext2_discard_reservation(struct inode *inode)
+{
+	struct ext2_reserve_window *rsv = &inode->u.ext2_i.i_rsv_window;
+	struct super_block *sb = inode->i_sb;
+
+	if (rsv_is_empty(rsv))
+		return;
+	lock_super(sb);
+	list_del_init(&rsv->rsv_list);
+	unlock_super(sb);
+}
+
+/*
+ * The first window that ends at or after @block, or NULL.
+ */
+static struct ext2_reserve_window *rsv_next(struct super_block *sb,
+					    unsigned long block)
+{
+	struct ext2_reserve_window *rsv;
+	struct list_head *p;
+
+	list_for_each(p, &sb->u.ext2_sb.s_rsv_windows) {
+		rsv = list_entry(p, struct ext2_reserve_window, rsv_list);
+		if (rsv->rsv_end >= block)
+			return rsv;
+	}
+	return NULL;
+}
+
+/*
+ * Give @rsv a new window of up to rsv_goal_size blocks, from the first
+ * free block at or after @goal that is not in another window. Called
+ * with the superblock locked.
+ */
+static int alloc_new_window(struct super_block *sb,
+			    struct ext2_reserve_window *rsv,
+			    unsigned long goal)
+{
+	struct ext2_super_block *es = sb->u.ext2_sb.s_es;
+	unsigned long first = le32_to_cpu(es->s_first_data_block);
+	unsigned long bpg = EXT2_BLOCKS_PER_GROUP(sb);
+	struct ext2_reserve_window *next;
+	struct ext2_group_desc *gdp;
+	struct buffer_head *bh;
+	unsigned long group, start, block, end;
+	int bitmap_nr, bit, k;
+
+	list_del_init(&rsv->rsv_list);
+	if (goal < first || goal >= le32_to_cpu(es->s_blocks_count))
+		goal = first;
+	group = (goal - first) / bpg;
+	bit = (goal - first) % bpg;
+
+	/* The group of the goal comes round again, for what is before it */
+	for (k = 0; k <= sb->u.ext2_sb.s_groups_count; k++) {
+		gdp = ext2_get_group_desc(sb, group, NULL);
+		if (!gdp)
+			return -EIO;
+		if (!le16_to_cpu(gdp->bg_free_blocks_count))
+			goto next_group;
+		bitmap_nr = load_block_bitmap(sb, group);
+		if (bitmap_nr < 0)
+			return -EIO;
+		bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+		start = group * bpg + first;
+
+		while ((bit = ext2_find_next_zero_bit((unsigned long *) bh->b_data,
+						      bpg, bit)) < bpg) {
+			block = start + bit;
+			next = rsv_next(sb, block);
+			if (next && next->rsv_start <= block) {
+				/* Taken by somebody else, skip it */
+				if (next->rsv_end + 1 - start >= bpg)
+					break;
+				bit = next->rsv_end + 1 - start;
+				continue;
+			}
+			end = block + rsv->rsv_goal_size - 1;
+			if (end > start + bpg - 1)
+				end = start + bpg - 1;
+			if (next && next->rsv_start <= end)
+				end = next->rsv_start - 1;
+			rsv->rsv_start = block;
+			rsv->rsv_end = end;
+			list_add_tail(&rsv->rsv_list, next ? &next->rsv_list :
+				      &sb->u.ext2_sb.s_rsv_windows);
+			return 0;
+		}
+next_group:
+		if (++group >= sb->u.ext2_sb.s_groups_count)
+			group = 0;
+		bit = 0;
+	}
+	return -ENOSPC;
+}
+
+/*
+ * Find a free block in the window of a file, moving the window if the
+ * goal is not in it or it has no free blocks left. Returns the bit in
+ * the bitmap of the group, which goes to *group, with the bitmap in
+ * *bhp and in *limit the bit after the end of the window.
+ */
+static int alloc_from_window(struct super_block *sb,
+			     struct ext2_reserve_window *rsv,
+			     unsigned long goal, int *group,
+			     struct buffer_head **bhp, int *limit)
+{
+	unsigned long first = le32_to_cpu(sb->u.ext2_sb.s_es->s_first_data_block);
+	unsigned long bpg = EXT2_BLOCKS_PER_GROUP(sb);
+	unsigned long start;
+	int bitmap_nr, bit, tries, err;
+
+	for (tries = 0; tries < 3; tries++) {
+		if (rsv_is_empty(rsv) || goal < rsv->rsv_start ||
+		    goal > rsv->rsv_end) {
+			if (!rsv_is_empty(rsv) && goal == rsv->rsv_end + 1 &&
+			    rsv->rsv_goal_size < EXT2_MAX_RESERVE_BLOCKS)
+				rsv->rsv_goal_size <<= 1;
+			err = alloc_new_window(sb, rsv, goal);
+			if (err)
+				return err;
+			goal = rsv->rsv_start;
+		}
+		*group = (rsv->rsv_start - first) / bpg;
+		start = *group * bpg + first;
+		bitmap_nr = load_block_bitmap(sb, *group);
+		if (bitmap_nr < 0)
+			return -EIO;
+		*bhp = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+		*limit = rsv->rsv_end + 1 - start;
+		bit = ext2_find_next_zero_bit((unsigned long *) (*bhp)->b_data,
+					      *limit, goal - start);
+		if (bit < *limit)
+			return bit;
+		/* Somebody without a window took the rest */
+		goal = rsv->rsv_end + 1;
+	}
+	return -ENOSPC;
+}
+
+/*
+ * ext2_new_blocks allocates a run of up to *count blocks, returns the
+ * first one and sets *count to how many it got.
+ *
+ * Regular files take their blocks from their reservation window, see
+ * above. Otherwise the goal block is used to assist allocation.  If the
+ * goal is free, or there is a free block within 32 blocks of the goal,
+ * that block is allocated.  Otherwise a forward search is made for a
+ * free block; within each block group the search first looks for an
+ * entire free byte in the block bitmap, and then for any free bit if
+ * that fails.  The run is made of the free blocks that follow.
  */
-int ext2_new_block (const struct inode * inode, unsigned long goal,
-    u32 * prealloc_count, u32 * prealloc_block, int * err)
+int ext2_new_blocks (struct inode * inode, unsigned long goal,
+		     unsigned long * count, int * err)
 {
 	struct buffer_head * bh;
 	struct buffer_head * bh2;
 	char * p, * r;
-	int i, j, k, tmp;
+	int i, j, k, n, tmp, limit;
 	int bitmap_nr;
 	struct super_block * sb;
 	struct ext2_group_desc * gdp;
 	struct ext2_super_block * es;
+	struct ext2_reserve_window * rsv = NULL;
+	unsigned long free, reserved;
 #ifdef EXT2FS_DEBUG
 	static int goal_hits = 0, goal_attempts = 0;
 #endif
 	*err = -ENOSPC;
 	sb = inode->i_sb;
 	if (!sb) {
-		printk ("ext2_new_block: nonexistent device");
+		printk ("ext2_new_blocks: nonexistent device");
 		return 0;
 	}
 
 	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
-	if (le32_to_cpu(es->s_free_blocks_count) <= le32_to_cpu(es->s_r_blocks_count) &&
+	/* What is promised to the delayed pages of other files is taken */
+	free = le32_to_cpu(es->s_free_blocks_count);
+	reserved = sb->u.ext2_sb.s_delalloc_blocks -
+		   inode->u.ext2_i.i_delalloc_blocks;
+	if (free <= reserved)
+		goto out;
+	free -= reserved;
+	if (free <= le32_to_cpu(es->s_r_blocks_count) &&
 	    ((sb->u.ext2_sb.s_resuid != current->fsuid) &&
 	     (sb->u.ext2_sb.s_resgid == 0 ||
 	      !in_group_p (sb->u.ext2_sb.s_resgid)) && 
@@ -384,7 +575,23 @@ int ext2_new_block (const struct inode * inode, unsigned long goal,
 
 	ext2_debug ("goal=%lu.\n", goal);
 
+	if (S_ISREG(inode->i_mode) && !test_opt(sb, NORESERVATION))
+		rsv = &inode->u.ext2_i.i_rsv_window;
+	if (rsv) {
+		j = alloc_from_window(sb, rsv, goal, &i, &bh, &limit);
+		if (j >= 0) {
+			gdp = ext2_get_group_desc (sb, i, &bh2);
+			if (!gdp)
+				goto io_error;
+			goto got_block;
+		}
+		if (j == -EIO)
+			goto io_error;
+		/* No window to be had, take what there is */
+	}
+
 repeat:
+	limit = EXT2_BLOCKS_PER_GROUP(sb);
 	/*
 	 * First, test whether the goal block is free.
 	 */
@@ -488,7 +695,7 @@ repeat:
 		j = ext2_find_first_zero_bit ((unsigned long *) bh->b_data,
 					 EXT2_BLOCKS_PER_GROUP(sb));
 	if (j >= EXT2_BLOCKS_PER_GROUP(sb)) {
-		ext2_error (sb, "ext2_new_block",
+		ext2_error (sb, "ext2_new_blocks",
 			    "Free blocks count corrupted for block group %d", i);
 		goto out;
 	}
@@ -519,12 +726,12 @@ got_block:
 	    tmp == le32_to_cpu(gdp->bg_inode_bitmap) ||
 	    in_range (tmp, le32_to_cpu(gdp->bg_inode_table),
 		      sb->u.ext2_sb.s_itb_per_group))
-		ext2_error (sb, "ext2_new_block",
+		ext2_error (sb, "ext2_new_blocks",
 			    "Allocating block in system zone - "
 			    "block = %u", tmp);
 
 	if (ext2_set_bit (j, bh->b_data)) {
-		ext2_warning (sb, "ext2_new_block",
+		ext2_warning (sb, "ext2_new_blocks",
 			      "bit already set for block %d", j);
 		DQUOT_FREE_BLOCK(sb, inode, 1);
 		goto repeat;
@@ -532,49 +739,16 @@ got_block:
 
 	ext2_debug ("found bit %d\n", j);
 
-	/*
-	 * Do block preallocation now if required.
-	 */
-#ifdef EXT2_PREALLOCATE
-	/* Writer: ->i_prealloc* */
-	if (prealloc_count && !*prealloc_count) {
-		int	prealloc_goal;
-		unsigned long next_block = tmp + 1;
-
-		prealloc_goal = es->s_prealloc_blocks ?
-			es->s_prealloc_blocks : EXT2_DEFAULT_PREALLOC_BLOCKS;
-
-		*prealloc_block = next_block;
-		/* Writer: end */
-		for (k = 1;
-		     k < prealloc_goal && (j + k) < EXT2_BLOCKS_PER_GROUP(sb);
-		     k++, next_block++) {
-			if (DQUOT_PREALLOC_BLOCK(sb, inode, 1))
-				break;
-			/* Writer: ->i_prealloc* */
-			if (*prealloc_block + *prealloc_count != next_block ||
-			    ext2_set_bit (j + k, bh->b_data)) {
-				/* Writer: end */
-				DQUOT_FREE_BLOCK(sb, inode, 1);
- 				break;
-			}
-			(*prealloc_count)++;
-			/* Writer: end */
-		}	
-		/*
-		 * As soon as we go for per-group spinlocks we'll need these
-		 * done inside the loop above.
-		 */
-		gdp->bg_free_blocks_count =
-			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) -
-			       (k - 1));
-		es->s_free_blocks_count =
-			cpu_to_le32(le32_to_cpu(es->s_free_blocks_count) -
-			       (k - 1));
-		ext2_debug ("Preallocated a further %lu bits.\n",
-			       (k - 1));
+	/* The run goes on for as long as the blocks are free and wanted */
+	for (n = 1; n < *count && j + n < limit; n++) {
+		if (DQUOT_ALLOC_BLOCK(sb, inode, 1))
+			break;
+		if (ext2_set_bit (j + n, bh->b_data)) {
+			DQUOT_FREE_BLOCK(sb, inode, 1);
+			break;
+		}
 	}
-#endif
+	ext2_debug ("got a run of %d blocks\n", n);
 
 	j = tmp;
 
@@ -584,10 +758,10 @@ got_block:
 		wait_on_buffer (bh);
 	}
 
-	if (j >= le32_to_cpu(es->s_blocks_count)) {
-		ext2_error (sb, "ext2_new_block",
+	if (j + n > le32_to_cpu(es->s_blocks_count)) {
+		ext2_error (sb, "ext2_new_blocks",
 			    "block(%d) >= blocks count(%d) - "
-			    "block_group = %d, es == %p ",j,
+			    "block_group = %d, es == %p ",j + n - 1,
 			le32_to_cpu(es->s_blocks_count), i, es);
 		goto out;
 	}
@@ -595,12 +769,13 @@ got_block:
 	ext2_debug ("allocating block %d. "
 		    "Goal hits %d of %d.\n", j, goal_hits, goal_attempts);
 
-	gdp->bg_free_blocks_count = cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - 1);
+	gdp->bg_free_blocks_count = cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - n);
 	mark_buffer_dirty(bh2);
-	es->s_free_blocks_count = cpu_to_le32(le32_to_cpu(es->s_free_blocks_count) - 1);
+	es->s_free_blocks_count = cpu_to_le32(le32_to_cpu(es->s_free_blocks_count) - n);
 	mark_buffer_dirty(sb->u.ext2_sb.s_sbh);
 	sb->s_dirt = 1;
 	unlock_super (sb);
+	*count = n;
 	*err = 0;
 	return j;
 	
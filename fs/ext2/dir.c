@@ -24,6 +24,7 @@
 #include <linux/fs.h>
 #include <linux/ext2_fs.h>
 #include <linux/pagemap.h>
+#include <linux/slab.h>
 
 typedef struct ext2_dir_entry_2 ext2_dirent;
 
@@ -289,6 +290,884 @@ done:
 	return 0;
 }
 
+/*
+ * Find room for a name of @namelen bytes in the @size bytes of
+ * directory at @kaddr: an unused entry or one with enough slack.
+ * Returns NULL if there is none, and sets *err to -EEXIST if the name
+ * is there already.
+ */
+static ext2_dirent *ext2_find_room(char *kaddr, unsigned size,
+				   const char *name, int namelen, int *err)
+{
+	unsigned reclen = EXT2_DIR_REC_LEN(namelen);
+	unsigned short rec_len, name_len;
+	ext2_dirent *de = (ext2_dirent *)kaddr;
+
+	*err = 0;
+	kaddr += size - reclen;
+	while ((char *)de <= kaddr) {
+		if (ext2_match (namelen, name, de)) {
+			*err = -EEXIST;
+			return NULL;
+		}
+		name_len = EXT2_DIR_REC_LEN(de->name_len);
+		rec_len = le16_to_cpu(de->rec_len);
+		if (!de->inode && rec_len >= reclen)
+			return de;
+		if (rec_len >= name_len + reclen)
+			return de;
+		de = (ext2_dirent *) ((char *) de + rec_len);
+	}
+	return NULL;
+}
+
+/*
+ * Put the name in at @de, as found by ext2_find_room(). The page is
+ * mapped and unlocked, and stays so.
+ */
+static int ext2_insert_at(struct inode *dir, struct page *page,
+			  ext2_dirent *de, const char *name, int namelen,
+			  struct inode *inode)
+{
+	unsigned short rec_len = le16_to_cpu(de->rec_len);
+	unsigned short name_len = EXT2_DIR_REC_LEN(de->name_len);
+	unsigned from, to;
+	int err;
+
+	from = (char*)de - (char*)page_address(page);
+	to = from + rec_len;
+	lock_page(page);
+	err = page->mapping->a_ops->prepare_write(NULL, page, from, to);
+	if (err)
+		goto out_unlock;
+	if (de->inode) {
+		ext2_dirent *de1 = (ext2_dirent *) ((char *) de + name_len);
+		de1->rec_len = cpu_to_le16(rec_len - name_len);
+		de->rec_len = cpu_to_le16(name_len);
+		de = de1;
+	}
+	de->name_len = namelen;
+	memcpy (de->name, name, namelen);
+	de->inode = cpu_to_le32(inode->i_ino);
+	ext2_set_de_type (de, inode);
+	err = ext2_commit_chunk(page, from, to);
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+	mark_inode_dirty(dir);
+	/* OFFSET_CACHE */
+out_unlock:
+	UnlockPage(page);
+	return err;
+}
+
+/*
+ * Hash-indexed directories.
+ *
+ * The first block of an indexed directory holds "." and "..", with ".."
+ * covering the rest of the block, and in that space the root of a tree
+ * of (hash, block) pairs sorted by hash. An entry whose name hashes to
+ * at least the hash of a pair, and below that of the next, lives in the
+ * block of that pair. The root may point to index nodes in turn, which
+ * start with an empty dirent spanning the whole block. Everything else
+ * are ordinary directory blocks, so kernels and tools that know nothing
+ * about the index can still read the directory. The layout is that of
+ * the ext3 htree patches.
+ *
+ * When a block fills up it is split at the median hash and the upper
+ * half goes into a new block. If equal hashes end up on both sides, the
+ * low bit of the new pair is set and lookups go on into that block.
+ *
+ * An index that makes no sense is not trusted: lookups fall back to the
+ * linear scan and the next insertion drops EXT2_INDEX_FL.
+ */
+
+#define ERR_BAD_DX_DIR	(-75000)
+#define DX_MAX_LEVELS	2
+
+struct fake_dirent {
+	__u32	inode;
+	__u16	rec_len;
+	__u8	name_len;
+	__u8	file_type;
+};
+
+struct dx_countlimit {
+	__u16	limit;
+	__u16	count;
+};
+
+struct dx_entry {
+	__u32	hash;
+	__u32	block;
+};
+
+/*
+ * dx_root_info is laid out so that if it should somehow get overlaid
+ * by a dirent the two low bits of the hash version will be zero.
+ */
+struct dx_root {
+	struct fake_dirent dot;
+	char dot_name[4];
+	struct fake_dirent dotdot;
+	char dotdot_name[4];
+	struct dx_root_info {
+		__u32	reserved_zero;
+		__u8	hash_version;
+		__u8	info_length;	/* 8 */
+		__u8	indirect_levels;
+		__u8	unused_flags;
+	} info;
+	struct dx_entry	entries[0];
+};
+
+struct dx_node {
+	struct fake_dirent fake;
+	struct dx_entry	entries[0];
+};
+
+/* One level of the path from the root to a leaf */
+struct dx_frame {
+	struct page *page;	/* mapped */
+	char *kaddr;		/* start of the index block */
+	struct dx_entry *entries;
+	struct dx_entry *at;
+};
+
+struct dx_map_entry {
+	__u32	hash;
+	__u16	offs;
+	__u16	size;
+};
+
+/*
+ * The first entry of an index block holds the count and limit instead
+ * of a hash, its block is that of everything below the second hash.
+ */
+static inline unsigned dx_get_block(struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->block) & 0x00ffffff;
+}
+
+static inline void dx_set_block(struct dx_entry *entry, unsigned value)
+{
+	entry->block = cpu_to_le32(value);
+}
+
+static inline unsigned dx_get_hash(struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->hash);
+}
+
+static inline void dx_set_hash(struct dx_entry *entry, unsigned value)
+{
+	entry->hash = cpu_to_le32(value);
+}
+
+static inline unsigned dx_get_count(struct dx_entry *entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *) entries)->count);
+}
+
+static inline unsigned dx_get_limit(struct dx_entry *entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *) entries)->limit);
+}
+
+static inline void dx_set_count(struct dx_entry *entries, unsigned value)
+{
+	((struct dx_countlimit *) entries)->count = cpu_to_le16(value);
+}
+
+static inline void dx_set_limit(struct dx_entry *entries, unsigned value)
+{
+	((struct dx_countlimit *) entries)->limit = cpu_to_le16(value);
+}
+
+static inline unsigned dx_root_limit(struct inode *dir, unsigned infosize)
+{
+	unsigned entry_space = dir->i_sb->s_blocksize - EXT2_DIR_REC_LEN(1) -
+		EXT2_DIR_REC_LEN(2) - infosize;
+	return entry_space / sizeof(struct dx_entry);
+}
+
+static inline unsigned dx_node_limit(struct inode *dir)
+{
+	unsigned entry_space = dir->i_sb->s_blocksize - EXT2_DIR_REC_LEN(0);
+	return entry_space / sizeof(struct dx_entry);
+}
+
+static inline int ext2_dir_indexed(struct inode *dir)
+{
+	return EXT2_HAS_COMPAT_FEATURE(dir->i_sb,
+				       EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+	       (dir->u.ext2_i.i_flags & EXT2_INDEX_FL);
+}
+
+/*
+ * A directory gets an index when it grows past its first block. @pos
+ * is where the new entry would go otherwise.
+ */
+static inline int ext2_dx_wanted(struct inode *dir, loff_t pos)
+{
+	return pos >= dir->i_size && dir->i_size == dir->i_sb->s_blocksize &&
+	       EXT2_HAS_COMPAT_FEATURE(dir->i_sb,
+				       EXT2_FEATURE_COMPAT_DIR_INDEX);
+}
+
+static inline unsigned long dir_blocks(struct inode *inode)
+{
+	return inode->i_size >> inode->i_sb->s_blocksize_bits;
+}
+
+/*
+ * Directory block @block: returns the page it is in, mapped, and its
+ * address in *kaddr. Blocks past the end read as one empty entry.
+ */
+static struct page *ext2_get_dir_block(struct inode *dir,
+				       unsigned long block, char **kaddr)
+{
+	unsigned bits = PAGE_CACHE_SHIFT - dir->i_sb->s_blocksize_bits;
+	struct page *page = ext2_get_page(dir, block >> bits);
+
+	if (!IS_ERR(page))
+		*kaddr = (char *) page_address(page) +
+			((block & ((1 << bits) - 1)) <<
+			 dir->i_sb->s_blocksize_bits);
+	return page;
+}
+
+/*
+ * Rewriting a whole block at @kaddr: lock the page and get the block
+ * ready for writing, allocating it if it is new. ext2_dx_commit()
+ * writes it and unlocks the page again.
+ */
+static int ext2_dx_prepare(struct page *page, char *kaddr, unsigned size)
+{
+	unsigned from = kaddr - (char *) page_address(page);
+	int err;
+
+	lock_page(page);
+	err = page->mapping->a_ops->prepare_write(NULL, page, from,
+						  from + size);
+	if (err)
+		UnlockPage(page);
+	return err;
+}
+
+static int ext2_dx_commit(struct page *page, char *kaddr, unsigned size)
+{
+	unsigned from = kaddr - (char *) page_address(page);
+	int err;
+
+	err = ext2_commit_chunk(page, from, from + size);
+	UnlockPage(page);
+	return err;
+}
+
+static void dx_release(struct dx_frame *frames)
+{
+	int i;
+
+	for (i = 0; i < DX_MAX_LEVELS; i++)
+		if (frames[i].page)
+			ext2_put_page(frames[i].page);
+}
+
+/*
+ * Walk the index from the root down to the leaf for @name, filling in
+ * one frame per level and the hash of @name. Returns the last frame,
+ * or NULL with *err set: ERR_BAD_DX_DIR if the index is no good.
+ */
+static struct dx_frame *dx_probe(struct inode *dir, const char *name,
+				 int len, struct dx_hash_info *hinfo,
+				 struct dx_frame *frames, int *err)
+{
+	struct super_block *sb = dir->i_sb;
+	struct dx_frame *frame = frames;
+	struct dx_entry *entries, *p, *q, *m;
+	struct dx_root *root;
+	struct page *page;
+	unsigned count, indirect;
+	char *kaddr;
+	int i;
+
+	for (i = 0; i < DX_MAX_LEVELS; i++)
+		frames[i].page = NULL;
+
+	page = ext2_get_dir_block(dir, 0, &kaddr);
+	if (IS_ERR(page)) {
+		*err = PTR_ERR(page);
+		return NULL;
+	}
+	frame->page = page;
+	root = (struct dx_root *) kaddr;
+	if (root->info.hash_version != DX_HASH_TEA &&
+	    root->info.hash_version != DX_HASH_HALF_MD4 &&
+	    root->info.hash_version != DX_HASH_LEGACY) {
+		ext2_warning(sb, "dx_probe", "unrecognised hash version %d "
+			     "in directory #%lu", root->info.hash_version,
+			     dir->i_ino);
+		goto bad;
+	}
+	if (root->info.unused_flags & 1) {
+		ext2_warning(sb, "dx_probe", "unimplemented hash flags %#x "
+			     "in directory #%lu", root->info.unused_flags,
+			     dir->i_ino);
+		goto bad;
+	}
+	indirect = root->info.indirect_levels;
+	if (indirect > DX_MAX_LEVELS - 1) {
+		ext2_warning(sb, "dx_probe", "unimplemented hash depth %u "
+			     "in directory #%lu", indirect, dir->i_ino);
+		goto bad;
+	}
+	if (root->info.info_length < sizeof(root->info) ||
+	    root->info.info_length > sb->s_blocksize / 2)
+		goto corrupt;
+
+	hinfo->hash_version = root->info.hash_version;
+	hinfo->seed = sb->u.ext2_sb.s_es->s_hash_seed;
+	ext2_dirhash(name, len, hinfo);
+
+	entries = (struct dx_entry *) ((char *) &root->info +
+				       root->info.info_length);
+	if (dx_get_limit(entries) != dx_root_limit(dir,
+						   root->info.info_length))
+		goto corrupt;
+
+	for (;;) {
+		count = dx_get_count(entries);
+		if (!count || count > dx_get_limit(entries))
+			goto corrupt;
+
+		p = entries + 1;
+		q = entries + count - 1;
+		while (p <= q) {
+			m = p + (q - p) / 2;
+			if (dx_get_hash(m) > hinfo->hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+		frame->kaddr = kaddr;
+		frame->entries = entries;
+		frame->at = p - 1;
+		if (!dx_get_block(frame->at) ||
+		    dx_get_block(frame->at) >= dir_blocks(dir))
+			goto corrupt;
+		if (!indirect--)
+			return frame;
+
+		page = ext2_get_dir_block(dir, dx_get_block(frame->at), &kaddr);
+		if (IS_ERR(page)) {
+			*err = PTR_ERR(page);
+			goto fail;
+		}
+		frame++;
+		frame->page = page;
+		entries = ((struct dx_node *) kaddr)->entries;
+		if (dx_get_limit(entries) != dx_node_limit(dir))
+			goto corrupt;
+	}
+
+corrupt:
+	ext2_warning(sb, "dx_probe", "corrupt index in directory #%lu",
+		     dir->i_ino);
+bad:
+	*err = ERR_BAD_DX_DIR;
+fail:
+	dx_release(frames);
+	return NULL;
+}
+
+/*
+ * Move the path to the next leaf, if it may hold more names that hash
+ * to @hash: returns 1 if it does, 0 if not and a negative error.
+ */
+static int dx_next_block(struct inode *dir, __u32 hash,
+			 struct dx_frame *frame, struct dx_frame *frames)
+{
+	struct dx_frame *p = frame;
+	struct page *page;
+	char *kaddr;
+	int levels = 0;
+
+	/* Find the next entry, going up as long as an index block ends */
+	while (++p->at >= p->entries + dx_get_count(p->entries)) {
+		if (p == frames)
+			return 0;
+		levels++;
+		p--;
+	}
+	/* Not a continuation of our hash, so it's somewhere else */
+	if ((dx_get_hash(p->at) & ~1) != hash)
+		return 0;
+	while (levels--) {
+		page = ext2_get_dir_block(dir, dx_get_block(p->at), &kaddr);
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+		p++;
+		ext2_put_page(p->page);
+		p->page = page;
+		p->kaddr = kaddr;
+		p->entries = p->at = ((struct dx_node *) kaddr)->entries;
+	}
+	return 1;
+}
+
+static ext2_dirent *ext2_dx_find_entry(struct inode *dir,
+			struct dentry *dentry, struct page **res_page, int *err)
+{
+	const char *name = dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	unsigned size = dir->i_sb->s_blocksize;
+	struct dx_frame frames[DX_MAX_LEVELS], *frame;
+	struct dx_hash_info hinfo;
+	struct page *page;
+	ext2_dirent *de;
+	char *kaddr, *limit;
+
+	frame = dx_probe(dir, name, namelen, &hinfo, frames, err);
+	if (!frame)
+		return NULL;
+	do {
+		page = ext2_get_dir_block(dir, dx_get_block(frame->at), &kaddr);
+		if (IS_ERR(page)) {
+			*err = PTR_ERR(page);
+			goto out;
+		}
+		de = (ext2_dirent *) kaddr;
+		limit = kaddr + size - EXT2_DIR_REC_LEN(namelen);
+		for ( ; (char *) de <= limit; de = ext2_next_entry(de))
+			if (ext2_match (namelen, name, de)) {
+				*res_page = page;
+				*err = 0;
+				goto out;
+			}
+		ext2_put_page(page);
+		*err = dx_next_block(dir, hinfo.hash, frame, frames);
+	} while (*err == 1);
+	de = NULL;
+out:
+	dx_release(frames);
+	return de;
+}
+
+/*
+ * Add the pair (@hash, @block) to the index block of @frame, after the
+ * entry the path went through. There is room for it.
+ */
+static int dx_insert_block(struct inode *dir, struct dx_frame *frame,
+			   __u32 hash, unsigned block)
+{
+	unsigned size = dir->i_sb->s_blocksize;
+	struct dx_entry *entries = frame->entries;
+	struct dx_entry *new = frame->at + 1;
+	unsigned count = dx_get_count(entries);
+	int err;
+
+	err = ext2_dx_prepare(frame->page, frame->kaddr, size);
+	if (err)
+		return err;
+	memmove(new + 1, new, (char *) (entries + count) - (char *) new);
+	dx_set_hash(new, hash);
+	dx_set_block(new, block);
+	dx_set_count(entries, count + 1);
+	return ext2_dx_commit(frame->page, frame->kaddr, size);
+}
+
+/*
+ * Start a new index node in the next free block of @dir, holding the
+ * @count entries at @entries. Returns its page and address like
+ * ext2_get_dir_block().
+ */
+static struct page *dx_new_node(struct inode *dir, struct dx_entry *entries,
+				unsigned count, char **kaddr, int *err)
+{
+	unsigned size = dir->i_sb->s_blocksize;
+	struct dx_node *node;
+	struct page *page;
+
+	page = ext2_get_dir_block(dir, dir_blocks(dir), kaddr);
+	if (IS_ERR(page)) {
+		*err = PTR_ERR(page);
+		return NULL;
+	}
+	*err = ext2_dx_prepare(page, *kaddr, size);
+	if (*err) {
+		ext2_put_page(page);
+		return NULL;
+	}
+	node = (struct dx_node *) *kaddr;
+	memset(&node->fake, 0, sizeof(node->fake));
+	node->fake.rec_len = cpu_to_le16(size);
+	memcpy(node->entries, entries, count * sizeof(struct dx_entry));
+	dx_set_limit(node->entries, dx_node_limit(dir));
+	dx_set_count(node->entries, count);
+	*err = ext2_dx_commit(page, *kaddr, size);
+	if (*err) {
+		ext2_put_page(page);
+		return NULL;
+	}
+	return page;
+}
+
+/*
+ * The index block of *@framep is full: split it, or move the root's
+ * entries to a new node below it. *@framep is set to the frame that
+ * now holds the path, which has room for another entry.
+ */
+static int dx_grow_index(struct inode *dir, struct dx_frame *frames,
+			 struct dx_frame **framep)
+{
+	unsigned size = dir->i_sb->s_blocksize;
+	struct dx_frame *frame = *framep;
+	struct dx_entry *entries = frame->entries;
+	unsigned count = dx_get_count(entries);
+	unsigned newblock = dir_blocks(dir);
+	unsigned count1, count2, at;
+	struct dx_root *root;
+	struct page *page;
+	char *kaddr;
+	int err;
+
+	if (frame == frames) {
+		/* The root: everything moves one level down */
+		page = dx_new_node(dir, entries, count, &kaddr, &err);
+		if (!page)
+			return err;
+		err = ext2_dx_prepare(frame->page, frame->kaddr, size);
+		if (err) {
+			ext2_put_page(page);
+			return err;
+		}
+		root = (struct dx_root *) frame->kaddr;
+		dx_set_count(entries, 1);
+		dx_set_block(entries, newblock);
+		root->info.indirect_levels = 1;
+		err = ext2_dx_commit(frame->page, frame->kaddr, size);
+
+		frame[1].page = page;
+		frame[1].kaddr = kaddr;
+		frame[1].entries = ((struct dx_node *) kaddr)->entries;
+		frame[1].at = frame[1].entries + (frame->at - entries);
+		frame->at = entries;
+		*framep = frame + 1;
+		return err;
+	}
+
+	if (dx_get_count(frames->entries) == dx_get_limit(frames->entries)) {
+		ext2_warning(dir->i_sb, "ext2_add_link",
+			     "directory #%lu index full", dir->i_ino);
+		return -ENOSPC;
+	}
+	/* An index node: the upper half goes to a new one */
+	count1 = count / 2;
+	count2 = count - count1;
+	page = dx_new_node(dir, entries + count1, count2, &kaddr, &err);
+	if (!page)
+		return err;
+	err = ext2_dx_prepare(frame->page, frame->kaddr, size);
+	if (err)
+		goto out;
+	dx_set_count(entries, count1);
+	err = ext2_dx_commit(frame->page, frame->kaddr, size);
+	if (err)
+		goto out;
+	err = dx_insert_block(dir, frames, dx_get_hash(entries + count1),
+			      newblock);
+	if (err)
+		goto out;
+
+	at = frame->at - entries;
+	if (at >= count1) {
+		frames->at++;
+		ext2_put_page(frame->page);
+		frame->page = page;
+		frame->kaddr = kaddr;
+		frame->entries = ((struct dx_node *) kaddr)->entries;
+		frame->at = frame->entries + at - count1;
+		return 0;
+	}
+out:
+	ext2_put_page(page);
+	return err;
+}
+
+/* Copy the @count entries of @map from @from to a block at @to */
+static void dx_move_dirents(char *from, char *to, struct dx_map_entry *map,
+			    int count, unsigned size)
+{
+	ext2_dirent *de = NULL;
+	char *p = to;
+
+	while (count--) {
+		de = (ext2_dirent *) p;
+		memcpy(de, from + map->offs, map->size);
+		de->rec_len = cpu_to_le16(map->size);
+		p += map->size;
+		map++;
+	}
+	de->rec_len = cpu_to_le16(to + size - (char *) de);
+}
+
+/*
+ * The leaf of @frame is full: move the upper half of its entries, by
+ * hash, to a new block and add that to the index. Returns the page and
+ * address of the block the name of @hinfo goes into now.
+ */
+static struct page *dx_split_leaf(struct inode *dir,
+				  struct dx_hash_info *hinfo,
+				  struct dx_frame *frame, char **kaddr,
+				  int *err)
+{
+	unsigned size = dir->i_sb->s_blocksize;
+	unsigned block = dx_get_block(frame->at);
+	unsigned newblock = dir_blocks(dir);
+	struct dx_map_entry *map, tmp;
+	struct dx_hash_info h = *hinfo;
+	struct page *page, *page2;
+	char *buf, *kaddr2;
+	ext2_dirent *de;
+	unsigned moved;
+	int count, split, j;
+	__u32 hash2;
+
+	*err = -ENOMEM;
+	buf = kmalloc(size + size / EXT2_DIR_REC_LEN(1) * sizeof(*map),
+		      GFP_KERNEL);
+	if (!buf)
+		return NULL;
+	map = (struct dx_map_entry *) (buf + size);
+
+	page = ext2_get_dir_block(dir, block, kaddr);
+	if (IS_ERR(page)) {
+		*err = PTR_ERR(page);
+		goto out;
+	}
+	memcpy(buf, *kaddr, size);
+	ext2_put_page(page);
+
+	/* Sort the live entries by hash */
+	count = 0;
+	for (de = (ext2_dirent *) buf; (char *) de < buf + size;
+	     de = ext2_next_entry(de)) {
+		if (!de->inode)
+			continue;
+		ext2_dirhash(de->name, de->name_len, &h);
+		tmp.hash = h.hash;
+		tmp.offs = (char *) de - buf;
+		tmp.size = EXT2_DIR_REC_LEN(de->name_len);
+		for (j = count; j > 0 && map[j - 1].hash > tmp.hash; j--)
+			map[j] = map[j - 1];
+		map[j] = tmp;
+		count++;
+	}
+
+	/* Move about half of the bytes, but never everything */
+	moved = 0;
+	for (split = count; split > 1; split--) {
+		if (moved + map[split - 1].size / 2 > size / 2)
+			break;
+		moved += map[split - 1].size;
+	}
+	*err = -ENOSPC;
+	if (split == count)
+		goto out;
+	hash2 = map[split].hash;
+	if (hash2 == map[split - 1].hash)
+		hash2 |= 1;
+
+	/* The new block first, then the old one, then the index */
+	page2 = ext2_get_dir_block(dir, newblock, &kaddr2);
+	if (IS_ERR(page2)) {
+		*err = PTR_ERR(page2);
+		goto out;
+	}
+	*err = ext2_dx_prepare(page2, kaddr2, size);
+	if (*err)
+		goto out_page2;
+	dx_move_dirents(buf, kaddr2, map + split, count - split, size);
+	*err = ext2_dx_commit(page2, kaddr2, size);
+	if (*err)
+		goto out_page2;
+
+	page = ext2_get_dir_block(dir, block, kaddr);
+	if (IS_ERR(page)) {
+		*err = PTR_ERR(page);
+		goto out_page2;
+	}
+	*err = ext2_dx_prepare(page, *kaddr, size);
+	if (*err)
+		goto out_page;
+	dx_move_dirents(buf, *kaddr, map, split, size);
+	*err = ext2_dx_commit(page, *kaddr, size);
+	if (*err)
+		goto out_page;
+
+	*err = dx_insert_block(dir, frame, hash2, newblock);
+	if (*err)
+		goto out_page;
+
+	if (hinfo->hash >= hash2) {
+		ext2_put_page(page);
+		page = page2;
+		*kaddr = kaddr2;
+	} else
+		ext2_put_page(page2);
+	kfree(buf);
+	return page;
+
+out_page:
+	ext2_put_page(page);
+out_page2:
+	ext2_put_page(page2);
+out:
+	kfree(buf);
+	return NULL;
+}
+
+static int ext2_dx_add_entry(struct dentry *dentry, struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	const char *name = dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	struct dx_frame frames[DX_MAX_LEVELS], *frame;
+	struct dx_hash_info hinfo;
+	struct page *page;
+	ext2_dirent *de;
+	char *kaddr;
+	int err;
+
+	frame = dx_probe(dir, name, namelen, &hinfo, frames, &err);
+	if (!frame)
+		return err;
+
+	page = ext2_get_dir_block(dir, dx_get_block(frame->at), &kaddr);
+	if (IS_ERR(page)) {
+		err = PTR_ERR(page);
+		goto out;
+	}
+	de = ext2_find_room(kaddr, dir->i_sb->s_blocksize, name, namelen,
+			    &err);
+	if (de || err)
+		goto got_it;
+	ext2_put_page(page);
+
+	if (dx_get_count(frame->entries) == dx_get_limit(frame->entries)) {
+		err = dx_grow_index(dir, frames, &frame);
+		if (err)
+			goto out;
+	}
+	page = dx_split_leaf(dir, &hinfo, frame, &kaddr, &err);
+	if (!page)
+		goto out;
+	de = ext2_find_room(kaddr, dir->i_sb->s_blocksize, name, namelen,
+			    &err);
+	if (!de && !err)
+		err = -ENOSPC;
+got_it:
+	if (de)
+		err = ext2_insert_at(dir, page, de, name, namelen, inode);
+	ext2_put_page(page);
+out:
+	dx_release(frames);
+	return err;
+}
+
+/*
+ * The one block of @dir is full: move its entries, other than "." and
+ * "..", to a second block and put the root of an index pointing to it
+ * into the first. Then add the entry through the index.
+ */
+static int ext2_dx_make_dir(struct dentry *dentry, struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	struct super_block *sb = dir->i_sb;
+	unsigned size = sb->s_blocksize;
+	struct page *page, *page2;
+	ext2_dirent *de, *last;
+	struct dx_root *root;
+	struct dx_entry *entries;
+	char *kaddr, *kaddr2, *start;
+	unsigned len;
+	int err;
+
+	page = ext2_get_dir_block(dir, 0, &kaddr);
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+	root = (struct dx_root *) kaddr;
+	de = (ext2_dirent *) kaddr;
+	err = ERR_BAD_DX_DIR;
+	if (le16_to_cpu(de->rec_len) != EXT2_DIR_REC_LEN(1) ||
+	    !ext2_match(1, ".", de))
+		goto out;
+	de = ext2_next_entry(de);
+	if (!ext2_match(2, "..", de))
+		goto out;
+	start = (char *) ext2_next_entry(de);
+	len = kaddr + size - start;
+	if (!len)
+		goto out;
+
+	/* Everything after ".." goes to block 1, which we write first */
+	page2 = ext2_get_dir_block(dir, 1, &kaddr2);
+	if (IS_ERR(page2)) {
+		err = PTR_ERR(page2);
+		goto out;
+	}
+	err = ext2_dx_prepare(page2, kaddr2, size);
+	if (err)
+		goto out_page2;
+	memcpy(kaddr2, start, len);
+	last = (ext2_dirent *) kaddr2;
+	while ((char *) ext2_next_entry(last) < kaddr2 + len)
+		last = ext2_next_entry(last);
+	last->rec_len = cpu_to_le16(kaddr2 + size - (char *) last);
+	err = ext2_dx_commit(page2, kaddr2, size);
+	if (err)
+		goto out_page2;
+
+	/*
+	 * Blocks 0 and 1 may share a page, so the root can only be
+	 * prepared now. If that fails, empty block 1 again rather than
+	 * leave every entry in the directory twice.
+	 */
+	err = ext2_dx_prepare(page, kaddr, size);
+	if (err)
+		goto out_undo;
+	root->dotdot.rec_len = cpu_to_le16(size - EXT2_DIR_REC_LEN(1));
+	memset(&root->info, 0, sizeof(root->info));
+	root->info.info_length = sizeof(root->info);
+	root->info.hash_version = sb->u.ext2_sb.s_es->s_def_hash_version;
+	if (root->info.hash_version > DX_HASH_TEA)
+		root->info.hash_version = DX_HASH_HALF_MD4;
+	entries = root->entries;
+	dx_set_limit(entries, dx_root_limit(dir, sizeof(root->info)));
+	dx_set_count(entries, 1);
+	dx_set_block(entries, 1);
+	err = ext2_dx_commit(page, kaddr, size);
+	if (err)
+		goto out_page2;
+
+	dir->u.ext2_i.i_flags |= EXT2_INDEX_FL;
+	mark_inode_dirty(dir);
+	err = ext2_dx_add_entry(dentry, inode);
+	goto out_page2;
+
+out_undo:
+	if (!ext2_dx_prepare(page2, kaddr2, size)) {
+		last = (ext2_dirent *) kaddr2;
+		last->inode = 0;
+		last->rec_len = cpu_to_le16(size);
+		ext2_dx_commit(page2, kaddr2, size);
+	}
+out_page2:
+	ext2_put_page(page2);
+out:
+	ext2_put_page(page);
+	return err;
+}
+
 /*
  *	ext2_find_entry()
  *
@@ -307,10 +1186,18 @@ struct ext2_dir_entry_2 * ext2_find_entry (struct inode * dir,
 	unsigned long npages = dir_pages(dir);
 	struct page *page = NULL;
 	ext2_dirent * de;
+	int err;
 
 	/* OFFSET_CACHE */
 	*res_page = NULL;
 
+	if (ext2_dir_indexed(dir)) {
+		de = ext2_dx_find_entry(dir, dentry, res_page, &err);
+		if (de || err != ERR_BAD_DX_DIR)
+			return de;
+		/* Index is no good, look at every entry */
+	}
+
 	for (n = 0; n < npages; n++) {
 		char *kaddr;
 		page = ext2_get_page(dir, n);
@@ -388,65 +1275,49 @@ int ext2_add_link (struct dentry *dentry, struct inode *inode)
 	struct inode *dir = dentry->d_parent->d_inode;
 	const char *name = dentry->d_name.name;
 	int namelen = dentry->d_name.len;
-	unsigned reclen = EXT2_DIR_REC_LEN(namelen);
-	unsigned short rec_len, name_len;
 	struct page *page = NULL;
 	ext2_dirent * de;
 	unsigned long npages = dir_pages(dir);
 	unsigned long n;
-	char *kaddr;
-	unsigned from, to;
 	int err;
 
+	if (dir->u.ext2_i.i_flags & EXT2_INDEX_FL) {
+		if (ext2_dir_indexed(dir)) {
+			err = ext2_dx_add_entry(dentry, inode);
+			if (err != ERR_BAD_DX_DIR)
+				return err;
+		}
+		/* Adding to it like to any other directory breaks the index */
+		dir->u.ext2_i.i_flags &= ~EXT2_INDEX_FL;
+		mark_inode_dirty(dir);
+	}
+
 	/* We take care of directory expansion in the same loop */
 	for (n = 0; n <= npages; n++) {
 		page = ext2_get_page(dir, n);
 		err = PTR_ERR(page);
 		if (IS_ERR(page))
 			goto out;
-		kaddr = page_address(page);
-		de = (ext2_dirent *)kaddr;
-		kaddr += PAGE_CACHE_SIZE - reclen;
-		while ((char *)de <= kaddr) {
-			err = -EEXIST;
-			if (ext2_match (namelen, name, de))
-				goto out_page;
-			name_len = EXT2_DIR_REC_LEN(de->name_len);
-			rec_len = le16_to_cpu(de->rec_len);
-			if (!de->inode && rec_len >= reclen)
-				goto got_it;
-			if (rec_len >= name_len + reclen)
-				goto got_it;
-			de = (ext2_dirent *) ((char *) de + rec_len);
-		}
+		de = ext2_find_room(page_address(page), PAGE_CACHE_SIZE,
+				    name, namelen, &err);
+		if (err)
+			goto out_page;
+		if (de)
+			goto got_it;
 		ext2_put_page(page);
 	}
 	BUG();
 	return -EINVAL;
 
 got_it:
-	from = (char*)de - (char*)page_address(page);
-	to = from + rec_len;
-	lock_page(page);
-	err = page->mapping->a_ops->prepare_write(NULL, page, from, to);
-	if (err)
-		goto out_unlock;
-	if (de->inode) {
-		ext2_dirent *de1 = (ext2_dirent *) ((char *) de + name_len);
-		de1->rec_len = cpu_to_le16(rec_len - name_len);
-		de->rec_len = cpu_to_le16(name_len);
-		de = de1;
+	/* Growing past the first block? Then it is worth an index. */
+	if (ext2_dx_wanted(dir, ((loff_t) n << PAGE_CACHE_SHIFT) +
+			   ((char *) de - (char *) page_address(page)))) {
+		err = ext2_dx_make_dir(dentry, inode);
+		if (err != ERR_BAD_DX_DIR)
+			goto out_page;
 	}
-	de->name_len = namelen;
-	memcpy (de->name, name, namelen);
-	de->inode = cpu_to_le32(inode->i_ino);
-	ext2_set_de_type (de, inode);
-	err = ext2_commit_chunk(page, from, to);
-	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
-	mark_inode_dirty(dir);
-	/* OFFSET_CACHE */
-out_unlock:
-	UnlockPage(page);
+	err = ext2_insert_at(dir, page, de, name, namelen, inode);
 out_page:
 	ext2_put_page(page);
 out:
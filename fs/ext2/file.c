@@ -75,7 +75,7 @@ static loff_t ext2_file_lseek(
 static int ext2_release_file (struct inode * inode, struct file * filp)
 {
 	if (filp->f_mode & FMODE_WRITE)
-		ext2_discard_prealloc (inode);
+		ext2_discard_reservation (inode);
 	return 0;
 }
 
@@ -28,15 +28,16 @@
 #include <linux/smp_lock.h>
 #include <linux/sched.h>
 #include <linux/highuid.h>
+#include <linux/pagemap.h>
 
 static int ext2_update_inode(struct inode * inode, int do_sync);
 
 /*
- * Called at each iput()
+ * Called when the inode is dropped from memory.
  */
-void ext2_put_inode (struct inode * inode)
+void ext2_clear_inode (struct inode * inode)
 {
-	ext2_discard_prealloc (inode);
+	ext2_discard_reservation (inode);
 }
 
 /*
@@ -56,6 +57,8 @@ void ext2_delete_inode (struct inode * inode)
 	inode->i_size = 0;
 	if (inode->i_blocks)
 		ext2_truncate (inode);
+	/* ext2_free_inode() calls clear_inode() with the superblock locked */
+	ext2_discard_reservation (inode);
 	ext2_free_inode (inode);
 
 	unlock_kernel();
@@ -65,59 +68,6 @@ no_delete:
 	clear_inode(inode);	/* We must guarantee clearing of inode... */
 }
 
-void ext2_discard_prealloc (struct inode * inode)
-{
-#ifdef EXT2_PREALLOCATE
-	lock_kernel();
-	/* Writer: ->i_prealloc* */
-	if (inode->u.ext2_i.i_prealloc_count) {
-		unsigned short total = inode->u.ext2_i.i_prealloc_count;
-		unsigned long block = inode->u.ext2_i.i_prealloc_block;
-		inode->u.ext2_i.i_prealloc_count = 0;
-		inode->u.ext2_i.i_prealloc_block = 0;
-		/* Writer: end */
-		ext2_free_blocks (inode, block, total);
-	}
-	unlock_kernel();
-#endif
-}
-
-static int ext2_alloc_block (struct inode * inode, unsigned long goal, int *err)
-{
-#ifdef EXT2FS_DEBUG
-	static unsigned long alloc_hits = 0, alloc_attempts = 0;
-#endif
-	unsigned long result;
-
-
-#ifdef EXT2_PREALLOCATE
-	/* Writer: ->i_prealloc* */
-	if (inode->u.ext2_i.i_prealloc_count &&
-	    (goal == inode->u.ext2_i.i_prealloc_block ||
-	     goal + 1 == inode->u.ext2_i.i_prealloc_block))
-	{		
-		result = inode->u.ext2_i.i_prealloc_block++;
-		inode->u.ext2_i.i_prealloc_count--;
-		/* Writer: end */
-		ext2_debug ("preallocation hit (%lu/%lu).\n",
-			    ++alloc_hits, ++alloc_attempts);
-	} else {
-		ext2_discard_prealloc (inode);
-		ext2_debug ("preallocation miss (%lu/%lu).\n",
-			    alloc_hits, ++alloc_attempts);
-		if (S_ISREG(inode->i_mode))
-			result = ext2_new_block (inode, goal, 
-				 &inode->u.ext2_i.i_prealloc_count,
-				 &inode->u.ext2_i.i_prealloc_block, err);
-		else
-			result = ext2_new_block (inode, goal, 0, 0, err);
-	}
-#else
-	result = ext2_new_block (inode, goal, 0, 0, err);
-#endif
-	return result;
-}
-
 typedef struct {
 	u32	*p;
 	u32	key;
@@ -349,6 +299,7 @@ static inline int ext2_find_goal(struct inode *inode,
  *	@num: depth of the chain (number of blocks to allocate)
  *	@offsets: offsets (in the blocks) to store the pointers to next.
  *	@branch: place to store the chain in.
+ *	@blks: number of data blocks wanted; how many we got on return
  *
  *	This function allocates @num blocks, zeroes out all but the last one,
  *	links them into chain and (if we are synchronous) writes them to disk.
@@ -362,9 +313,13 @@ static inline int ext2_find_goal(struct inode *inode,
  *	set the last link), but branch->key contains the number that should
  *	be placed into *branch->p to fill that gap.
  *
+ *	The data block comes with up to *@blks - 1 more that follow it on
+ *	disk, for the slots that follow its own. If the leaf is new we put
+ *	them there right away, otherwise ext2_splice_branch() does.
+ *
  *	If allocation fails we free all blocks we've allocated (and forget
  *	their buffer_heads) and return the error value the from failed
- *	ext2_alloc_block() (normally -ENOSPC). Otherwise we set the chain
+ *	ext2_new_blocks() (normally -ENOSPC). Otherwise we set the chain
  *	as described above and return 0.
  */
 
@@ -372,19 +327,23 @@ static int ext2_alloc_branch(struct inode *inode,
 			     int num,
 			     unsigned long goal,
 			     int *offsets,
-			     Indirect *branch)
+			     Indirect *branch,
+			     unsigned long *blks)
 {
 	int blocksize = inode->i_sb->s_blocksize;
+	unsigned long count = num == 1 ? *blks : 1;
 	int n = 0;
 	int err;
 	int i;
-	int parent = ext2_alloc_block(inode, goal, &err);
+	int parent = ext2_new_blocks(inode, goal, &count, &err);
 
 	branch[0].key = cpu_to_le32(parent);
 	if (parent) for (n = 1; n < num; n++) {
 		struct buffer_head *bh;
-		/* Allocate the next block */
-		int nr = ext2_alloc_block(inode, parent, &err);
+		int nr;
+		/* Allocate the next block, the data blocks in one go */
+		count = n == num - 1 ? *blks : 1;
+		nr = ext2_new_blocks(inode, parent, &count, &err);
 		if (!nr)
 			break;
 		branch[n].key = cpu_to_le32(nr);
@@ -398,6 +357,8 @@ static int ext2_alloc_branch(struct inode *inode,
 		branch[n].bh = bh;
 		branch[n].p = (u32*) bh->b_data + offsets[n];
 		*branch[n].p = branch[n].key;
+		for (i = 1; i < count; i++)
+			branch[n].p[i] = cpu_to_le32(nr + i);
 		mark_buffer_uptodate(bh, 1);
 		unlock_buffer(bh);
 		mark_buffer_dirty_inode(bh, inode);
@@ -407,8 +368,10 @@ static int ext2_alloc_branch(struct inode *inode,
 		}
 		parent = nr;
 	}
-	if (n == num)
+	if (n == num) {
+		*blks = count;
 		return 0;
+	}
 
 	/* Allocation failed, free what we already allocated */
 	for (i = 1; i < n; i++)
@@ -426,6 +389,7 @@ static int ext2_alloc_branch(struct inode *inode,
  *		ext2_alloc_branch)
  *	@where: location of missing link
  *	@num:   number of blocks we are adding
+ *	@blks:  number of data blocks among them
  *
  *	This function verifies that chain (up to the missing link) had not
  *	changed, fills the missing link and does all housekeeping needed in
@@ -439,7 +403,8 @@ static inline int ext2_splice_branch(struct inode *inode,
 				     long block,
 				     Indirect chain[4],
 				     Indirect *where,
-				     int num)
+				     int num,
+				     unsigned long blks)
 {
 	int i;
 
@@ -449,13 +414,21 @@ static inline int ext2_splice_branch(struct inode *inode,
 	if (!verify_chain(chain, where-1) || *where->p)
 		/* Writer: end */
 		goto changed;
+	/* So are the slots for the rest of the data blocks, if any */
+	if (num == 1)
+		for (i = 1; i < blks; i++)
+			if (where->p[i])
+				goto changed;
 
 	/* That's it */
 
 	*where->p = where->key;
-	inode->u.ext2_i.i_next_alloc_block = block;
-	inode->u.ext2_i.i_next_alloc_goal = le32_to_cpu(where[num-1].key);
-	inode->i_blocks += num * inode->i_sb->s_blocksize/512;
+	if (num == 1)
+		for (i = 1; i < blks; i++)
+			where->p[i] = cpu_to_le32(le32_to_cpu(where->key) + i);
+	inode->u.ext2_i.i_next_alloc_block = block + blks - 1;
+	inode->u.ext2_i.i_next_alloc_goal = le32_to_cpu(where[num-1].key) + blks - 1;
+	inode->i_blocks += (num + blks - 1) * inode->i_sb->s_blocksize/512;
 
 	/* Writer: end */
 
@@ -482,10 +455,60 @@ changed:
 	for (i = 1; i < num; i++)
 		bforget(where[i].bh);
 	for (i = 0; i < num; i++)
-		ext2_free_blocks(inode, le32_to_cpu(where[i].key), 1);
+		ext2_free_blocks(inode, le32_to_cpu(where[i].key),
+				 i == num - 1 ? blks : 1);
 	return -EAGAIN;
 }
 
+/*
+ * How many data blocks from @block on to allocate at once: as many as
+ * the caller asks for, but not past the end of the file or of the leaf
+ * the first one goes in and, if that leaf is there already, only as
+ * many as there are vacant slots in a row.
+ */
+static unsigned long ext2_blocks_wanted(struct inode *inode,
+					long block,
+					unsigned long max,
+					int depth,
+					int *offsets,
+					Indirect *partial,
+					int left)
+{
+	struct super_block *sb = inode->i_sb;
+	unsigned long room, end, n;
+
+	room = (depth == 1 ? EXT2_NDIR_BLOCKS : EXT2_ADDR_PER_BLOCK(sb)) -
+	       offsets[depth-1];
+	if (max > room)
+		max = room;
+	end = (inode->i_size + sb->s_blocksize - 1) >> sb->s_blocksize_bits;
+	if (block + max > end)
+		max = end > block ? end - block : 1;
+	if (left > 1)
+		return max;
+	for (n = 1; n < max && !partial->p[n]; n++)
+		;
+	return n;
+}
+
+/*
+ * Blocks that were metadata before they were freed may still be in
+ * the buffer cache, dirty. Callers of ext2_get_block() take care of the
+ * one they asked for (BH_New), this is for the rest of an extent.
+ */
+static void ext2_forget_aliases(struct inode *inode, unsigned long block,
+				unsigned long count)
+{
+	struct buffer_head tmp;
+
+	tmp.b_dev = inode->i_dev;
+	tmp.b_size = inode->i_sb->s_blocksize;
+	while (count--) {
+		tmp.b_blocknr = block++;
+		unmap_underlying_metadata(&tmp);
+	}
+}
+
 /*
  * Allocation strategy is simple: if we have to allocate something, we will
  * have to go the whole way to leaf. So let's do it before attaching anything
@@ -499,13 +522,20 @@ changed:
  * reachable from inode.
  */
 
-static int ext2_get_block(struct inode *inode, long iblock, struct buffer_head *bh_result, int create)
+/*
+ * ext2_get_blocks() maps @iblock like ext2_get_block(), and if it has to
+ * allocate may allocate up to *@maxblocks data blocks from there on in
+ * one extent. *@maxblocks is set to how many it mapped.
+ */
+static int ext2_get_blocks(struct inode *inode, long iblock,
+			   unsigned long *maxblocks,
+			   struct buffer_head *bh_result, int create)
 {
 	int err = -EIO;
 	int offsets[4];
 	Indirect chain[4];
 	Indirect *partial;
-	unsigned long goal;
+	unsigned long goal, count = 1;
 	int left;
 	int depth = ext2_block_to_path(inode, iblock, offsets);
 
@@ -518,7 +548,9 @@ reread:
 
 	/* Simplest case - block found, no allocation needed */
 	if (!partial) {
+		count = 1;
 got_it:
+		*maxblocks = count;
 		bh_result->b_dev = inode->i_dev;
 		bh_result->b_blocknr = le32_to_cpu(chain[depth-1].key);
 		bh_result->b_state |= (1UL << BH_Mapped);
@@ -551,14 +583,18 @@ out:
 		goto changed;
 
 	left = (chain + depth) - partial;
+	count = ext2_blocks_wanted(inode, iblock, *maxblocks, depth, offsets,
+				   partial, left);
 	err = ext2_alloc_branch(inode, left, goal,
-					offsets+(partial-chain), partial);
+					offsets+(partial-chain), partial, &count);
 	if (err)
 		goto cleanup;
 
-	if (ext2_splice_branch(inode, iblock, chain, partial, left) < 0)
+	if (ext2_splice_branch(inode, iblock, chain, partial, left, count) < 0)
 		goto changed;
 
+	ext2_forget_aliases(inode, le32_to_cpu(chain[depth-1].key) + 1,
+			    count - 1);
 	bh_result->b_state |= (1UL << BH_New);
 	goto got_it;
 
@@ -570,9 +606,188 @@ changed:
 	goto reread;
 }
 
+static int ext2_get_block(struct inode *inode, long iblock, struct buffer_head *bh_result, int create)
+{
+	unsigned long count = 1;
+
+	return ext2_get_blocks(inode, iblock, &count, bh_result, create);
+}
+
+/*
+ * Delayed allocation, with the "delalloc" mount option.
+ *
+ * A write that covers a whole page of a hole in a regular file does
+ * not allocate. Blocks for the page, and one for an indirect block,
+ * are taken off what ext2_new_blocks() will hand to other files
+ * (s_delalloc_blocks, and i_delalloc_blocks of the file itself), and
+ * the page gets PG_checked and buffers that are uptodate but unmapped.
+ * When it is written out, ext2_writepage() allocates for it and for
+ * the delayed pages that follow it in one go, so a file that was
+ * written a page at a time still gets extents of up to
+ * EXT2_MAX_RESERVE_BLOCKS.
+ *
+ * Nothing is delayed for sync writes or with quotas, which must fail
+ * at write() time, and no more than a sixteenth of memory worth of
+ * pages are delayed at once. Everything else allocates at once.
+ */
+static inline int ext2_page_delayed(struct inode *inode, struct page *page)
+{
+	return S_ISREG(inode->i_mode) && PageChecked(page);
+}
+
+static inline unsigned long ext2_page_reserve(struct super_block *sb)
+{
+	return (PAGE_CACHE_SIZE >> sb->s_blocksize_bits) + 1;
+}
+
+static int ext2_reserve_page(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext2_super_block *es = sb->u.ext2_sb.s_es;
+	unsigned long need = ext2_page_reserve(sb);
+	unsigned long total;
+	int ret = 0;
+
+	lock_super(sb);
+	total = sb->u.ext2_sb.s_delalloc_blocks + need;
+	if (total <= (num_physpages >> 4) * need &&
+	    total + le32_to_cpu(es->s_r_blocks_count) <
+	    le32_to_cpu(es->s_free_blocks_count)) {
+		sb->u.ext2_sb.s_delalloc_blocks = total;
+		inode->u.ext2_i.i_delalloc_blocks += need;
+		ret = 1;
+	}
+	unlock_super(sb);
+	return ret;
+}
+
+static void ext2_release_page(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	unsigned long need = ext2_page_reserve(sb);
+
+	lock_super(sb);
+	sb->u.ext2_sb.s_delalloc_blocks -= need;
+	inode->u.ext2_i.i_delalloc_blocks -= need;
+	unlock_super(sb);
+}
+
+/*
+ * Should the write of @from to @to into @page go without allocation?
+ * Yes if the page is delayed already, or if the write covers it and
+ * starts a hole that has no buffers.
+ */
+static int ext2_want_delay(struct inode *inode, struct page *page,
+			   unsigned from, unsigned to)
+{
+	struct buffer_head dummy;
+
+	if (!test_opt(inode->i_sb, DELALLOC) || !S_ISREG(inode->i_mode))
+		return 0;
+	if (PageChecked(page))
+		return 1;
+	if (from || to != PAGE_CACHE_SIZE || page->buffers ||
+	    IS_SYNC(inode) || inode->u.ext2_i.i_osync || inode->i_sb->dq_op)
+		return 0;
+	dummy.b_state = 0;
+	if (ext2_get_block(inode, page->index <<
+			   (PAGE_CACHE_SHIFT - inode->i_sb->s_blocksize_bits),
+			   &dummy, 0))
+		return 0;
+	return !buffer_mapped(&dummy);
+}
+
+/*
+ * Everything in a delayed page is valid, whether its blocks are there
+ * yet or not.
+ */
+static void ext2_delayed_buffers(struct inode *inode, struct page *page)
+{
+	struct buffer_head *bh;
+
+	if (!page->buffers)
+		create_empty_buffers(page, inode->i_dev,
+				     inode->i_sb->s_blocksize);
+	bh = page->buffers;
+	do {
+		set_bit(BH_Uptodate, &bh->b_state);
+		bh = bh->b_this_page;
+	} while (bh != page->buffers);
+}
+
+/*
+ * Allocate for the delayed @page and the delayed dirty pages after it,
+ * as few extents as the allocator can manage. The pages after @page
+ * that got their blocks are no longer delayed, and give back what
+ * they had reserved; a page we cannot lock keeps its reservation
+ * until its own writepage or flushpage.
+ */
+static void ext2_map_delayed(struct inode *inode, struct page *page)
+{
+	struct super_block *sb = inode->i_sb;
+	int bits = PAGE_CACHE_SHIFT - sb->s_blocksize_bits;
+	unsigned long block = page->index << bits;
+	unsigned long end, count;
+	struct buffer_head dummy;
+	struct page *next;
+	int n, delayed;
+
+	for (n = 1; n < EXT2_MAX_RESERVE_BLOCKS >> bits; n++) {
+		next = find_get_page(page->mapping, page->index + n);
+		if (!next)
+			break;
+		delayed = PageChecked(next) && PageDirty(next);
+		page_cache_release(next);
+		if (!delayed)
+			break;
+	}
+	end = block + (n << bits);
+	count = (inode->i_size + sb->s_blocksize - 1) >> sb->s_blocksize_bits;
+	if (end > count)
+		end = count;
+
+	while (block < end) {
+		count = end - block;
+		dummy.b_state = 0;
+		dummy.b_size = sb->s_blocksize;
+		if (ext2_get_blocks(inode, block, &count, &dummy, 1))
+			break;
+		if (buffer_new(&dummy))
+			unmap_underlying_metadata(&dummy);
+		block += count;
+	}
+
+	for (n = 1; (page->index + n + 1) << bits <= block; n++) {
+		next = find_get_page(page->mapping, page->index + n);
+		if (!next)
+			break;
+		if (!TryLockPage(next)) {
+			if (next->mapping == page->mapping &&
+			    ext2_page_delayed(inode, next)) {
+				ClearPageChecked(next);
+				ext2_release_page(inode);
+			}
+			UnlockPage(next);
+		}
+		page_cache_release(next);
+	}
+}
+
 static int ext2_writepage(struct page *page)
 {
-	return block_write_full_page(page,ext2_get_block);
+	struct inode *inode = page->mapping->host;
+	int delayed = ext2_page_delayed(inode, page);
+	int err;
+
+	if (delayed) {
+		ext2_delayed_buffers(inode, page);
+		ext2_map_delayed(inode, page);
+		ClearPageChecked(page);
+	}
+	err = block_write_full_page(page,ext2_get_block);
+	if (delayed)
+		ext2_release_page(inode);
+	return err;
 }
 static int ext2_readpage(struct file *file, struct page *page)
 {
@@ -580,8 +795,56 @@ static int ext2_readpage(struct file *file, struct page *page)
 }
 static int ext2_prepare_write(struct file *file, struct page *page, unsigned from, unsigned to)
 {
+	struct inode *inode = page->mapping->host;
+
+	if (ext2_want_delay(inode, page, from, to)) {
+		kmap(page);
+		return 0;
+	}
 	return block_prepare_write(page,from,to,ext2_get_block);
 }
+static int ext2_commit_write(struct file *file, struct page *page, unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	loff_t pos = ((loff_t)page->index << PAGE_CACHE_SHIFT) + to;
+	int err;
+
+	/* Only a delayed write leaves the page without buffers */
+	if (page->buffers && !ext2_page_delayed(inode, page))
+		return generic_commit_write(file, page, from, to);
+
+	if (!ext2_page_delayed(inode, page)) {
+		if (!ext2_reserve_page(inode)) {
+			/* Out of promises, allocate after all */
+			err = block_prepare_write(page, 0, PAGE_CACHE_SIZE,
+						  ext2_get_block);
+			kunmap(page);
+			if (err)
+				return err;
+			return generic_commit_write(file, page, from, to);
+		}
+		SetPageChecked(page);
+	}
+	ext2_delayed_buffers(inode, page);
+	SetPageUptodate(page);
+	set_page_dirty(page);
+	kunmap(page);
+	if (pos > inode->i_size) {
+		inode->i_size = pos;
+		mark_inode_dirty(inode);
+	}
+	return 0;
+}
+static int ext2_flushpage(struct page *page, unsigned long offset)
+{
+	struct inode *inode = page->mapping->host;
+
+	if (!offset && ext2_page_delayed(inode, page)) {
+		ClearPageChecked(page);
+		ext2_release_page(inode);
+	}
+	return block_flushpage(page, offset);
+}
 static int ext2_bmap(struct address_space *mapping, long block)
 {
 	return generic_block_bmap(mapping,block,ext2_get_block);
@@ -591,8 +854,9 @@ struct address_space_operations ext2_aops = {
 	writepage: ext2_writepage,
 	sync_page: block_sync_page,
 	prepare_write: ext2_prepare_write,
-	commit_write: generic_commit_write,
-	bmap: ext2_bmap
+	commit_write: ext2_commit_write,
+	bmap: ext2_bmap,
+	flushpage: ext2_flushpage
 };
 
 /*
@@ -803,7 +1067,7 @@ void ext2_truncate (struct inode * inode)
 	if (IS_APPEND(inode) || IS_IMMUTABLE(inode))
 		return;
 
-	ext2_discard_prealloc(inode);
+	ext2_discard_reservation(inode);
 
 	blocksize = inode->i_sb->s_blocksize;
 	iblock = (inode->i_size + blocksize-1)
@@ -965,7 +1229,8 @@ void ext2_read_inode (struct inode * inode)
 	else
 		inode->u.ext2_i.i_dir_acl = le32_to_cpu(raw_inode->i_dir_acl);
 	inode->i_generation = le32_to_cpu(raw_inode->i_generation);
-	inode->u.ext2_i.i_prealloc_count = 0;
+	ext2_init_reservation(inode);
+	inode->u.ext2_i.i_delalloc_blocks = 0;
 	inode->u.ext2_i.i_block_group = block_group;
 
 	/*
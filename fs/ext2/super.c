@@ -132,6 +132,7 @@ void ext2_put_super (struct super_block * sb)
 		if (sb->u.ext2_sb.s_group_desc[i])
 			brelse (sb->u.ext2_sb.s_group_desc[i]);
 	kfree(sb->u.ext2_sb.s_group_desc);
+	kfree(sb->u.ext2_sb.s_debts);
 	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
 		if (sb->u.ext2_sb.s_inode_bitmap[i])
 			brelse (sb->u.ext2_sb.s_inode_bitmap[i]);
@@ -146,7 +147,7 @@ void ext2_put_super (struct super_block * sb)
 static struct super_operations ext2_sops = {
 	read_inode:	ext2_read_inode,
 	write_inode:	ext2_write_inode,
-	put_inode:	ext2_put_inode,
+	clear_inode:	ext2_clear_inode,
 	delete_inode:	ext2_delete_inode,
 	put_super:	ext2_put_super,
 	write_super:	ext2_write_super,
@@ -176,6 +177,18 @@ static int parse_options (char * options, unsigned long * sb_block,
 		else if (!strcmp (this_char, "nouid32")) {
 			set_opt (*mount_options, NO_UID32);
 		}
+		else if (!strcmp (this_char, "noreservation"))
+			set_opt (*mount_options, NORESERVATION);
+		else if (!strcmp (this_char, "reservation"))
+			clear_opt (*mount_options, NORESERVATION);
+		else if (!strcmp (this_char, "delalloc"))
+			set_opt (*mount_options, DELALLOC);
+		else if (!strcmp (this_char, "nodelalloc"))
+			clear_opt (*mount_options, DELALLOC);
+		else if (!strcmp (this_char, "oldalloc"))
+			set_opt (*mount_options, OLDALLOC);
+		else if (!strcmp (this_char, "orlov"))
+			clear_opt (*mount_options, OLDALLOC);
 		else if (!strcmp (this_char, "check")) {
 			if (!value || !*value || !strcmp (value, "none"))
 				clear_opt (*mount_options, CHECK);
@@ -451,6 +464,8 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	 */
 	es = (struct ext2_super_block *) (((char *)bh->b_data) + offset);
 	sb->u.ext2_sb.s_es = es;
+	INIT_LIST_HEAD(&sb->u.ext2_sb.s_rsv_windows);
+	sb->u.ext2_sb.s_delalloc_blocks = 0;
 	sb->s_magic = le16_to_cpu(es->s_magic);
 	if (sb->s_magic != EXT2_SUPER_MAGIC) {
 		if (!silent)
@@ -618,6 +633,12 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 			goto failed_mount;
 		}
 	}
+	sb->u.ext2_sb.s_debts = kmalloc(sb->u.ext2_sb.s_groups_count, GFP_KERNEL);
+	if (!sb->u.ext2_sb.s_debts) {
+		printk ("EXT2-fs: not enough memory\n");
+		goto failed_mount2;
+	}
+	memset(sb->u.ext2_sb.s_debts, 0, sb->u.ext2_sb.s_groups_count);
 	if (!ext2_check_descriptors (sb)) {
 		printk ("EXT2-fs: group descriptors corrupted!\n");
 		db_count = i;
@@ -650,6 +671,7 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	ext2_setup_super (sb, es, sb->s_flags & MS_RDONLY);
 	return sb;
 failed_mount2:
+	kfree(sb->u.ext2_sb.s_debts);
 	for (i = 0; i < db_count; i++)
 		brelse(sb->u.ext2_sb.s_group_desc[i]);
 	kfree(sb->u.ext2_sb.s_group_desc);
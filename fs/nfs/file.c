@@ -182,7 +182,7 @@ static int nfs_commit_write(struct file *file, struct page *page, unsigned offse
 }
 
 /*
- * The following is used by wait_on_page(), generic_file_readahead()
+ * The following is used by wait_on_page() and lock_page()
  * to initiate the completion of any page readahead operations.
  */
 static int nfs_sync_page(struct page *page)
@@ -178,6 +178,48 @@ static int proc_pid_cmdline(struct task_struct *task, char * buffer)
 	return res;
 }
 
+/*
+ * One line for every open file that was read through the page cache:
+ * fd, pages found up to date, found still being read and not found,
+ * pages read ahead, and the window of each read-ahead stream.
+ */
+static int proc_pid_readahead(struct task_struct *task, char * buffer)
+{
+	struct files_struct *files;
+	struct file_ra_state *ra;
+	struct file *file;
+	unsigned int fd;
+	int i, len = 0;
+
+	task_lock(task);
+	files = task->files;
+	if (files)
+		atomic_inc(&files->count);
+	task_unlock(task);
+	if (!files)
+		return 0;
+	read_lock(&files->file_lock);
+	for (fd = 0; fd < files->max_fds; fd++) {
+		file = fcheck_files(files, fd);
+		if (!file)
+			continue;
+		ra = &file->f_ra;
+		if (!ra->hits && !ra->waits && !ra->misses)
+			continue;
+		/* 5 + FILE_RA_STREAMS numbers of at most 20 digits */
+		if (len + 21 * (5 + FILE_RA_STREAMS) > PAGE_SIZE)
+			break;
+		len += sprintf(buffer + len, "%u %lu %lu %lu %lu", fd,
+			       ra->hits, ra->waits, ra->misses, ra->pages);
+		for (i = 0; i < FILE_RA_STREAMS; i++)
+			len += sprintf(buffer + len, " %lu", ra->stream[i].size);
+		buffer[len++] = '\n';
+	}
+	read_unlock(&files->file_lock);
+	put_files_struct(files);
+	return len;
+}
+
 /************************************************************************/
 /*                       Here the fs part begins                        */
 /************************************************************************/
@@ -520,6 +562,7 @@ enum pid_directory_inos {
 	PROC_PID_STATM,
 	PROC_PID_MAPS,
 	PROC_PID_CPU,
+	PROC_PID_READAHEAD,
 	PROC_PID_FD_DIR = 0x8000,	/* 0x8000-0xffff */
 };
 
@@ -535,6 +578,7 @@ static struct pid_entry base_stuff[] = {
   E(PROC_PID_CPU,	"cpu",		S_IFREG|S_IRUGO),
 #endif
   E(PROC_PID_MAPS,	"maps",		S_IFREG|S_IRUGO),
+  E(PROC_PID_READAHEAD,	"readahead",	S_IFREG|S_IRUSR),
   E(PROC_PID_MEM,	"mem",		S_IFREG|S_IRUSR|S_IWUSR),
   E(PROC_PID_CWD,	"cwd",		S_IFLNK|S_IRWXUGO),
   E(PROC_PID_ROOT,	"root",		S_IFLNK|S_IRWXUGO),
@@ -888,6 +932,10 @@ static struct dentry *proc_base_lookup(struct inode *dir, struct dentry *dentry)
 		case PROC_PID_MAPS:
 			inode->i_fop = &proc_maps_operations;
 			break;
+		case PROC_PID_READAHEAD:
+			inode->i_fop = &proc_info_file_operations;
+			inode->u.proc_i.op.proc_read = proc_pid_readahead;
+			break;
 #ifdef CONFIG_SMP
 		case PROC_PID_CPU:
 			inode->i_fop = &proc_info_file_operations;
@@ -92,11 +92,11 @@ static int loadavg_read_proc(char *page, char **start, off_t off,
 	a = avenrun[0] + (FIXED_1/200);
 	b = avenrun[1] + (FIXED_1/200);
 	c = avenrun[2] + (FIXED_1/200);
-	len = sprintf(page,"%d.%02d %d.%02d %d.%02d %d/%d %d\n",
+	len = sprintf(page,"%d.%02d %d.%02d %d.%02d %lu/%d %d\n",
 		LOAD_INT(a), LOAD_FRAC(a),
 		LOAD_INT(b), LOAD_FRAC(b),
 		LOAD_INT(c), LOAD_FRAC(c),
-		nr_running, nr_threads, last_pid);
+		nr_running(), nr_threads, last_pid);
 	return proc_calc_metrics(page, start, off, count, eof, len);
 }
 
@@ -183,8 +183,8 @@ static int meminfo_read_proc(char *page, char **start, off_t off,
 		K(i.bufferram),
 		K(atomic_read(&page_cache_size) - swapper_space.nrpages),
 		K(swapper_space.nrpages),
-		K(nr_active_pages),
-		K(nr_inactive_dirty_pages),
+		K(nr_active_pages()),
+		K(nr_inactive_dirty_pages()),
 		K(nr_inactive_clean_pages()),
 		K(inactive_target),
 		K(i.totalhigh),
@@ -436,6 +436,65 @@ static int swaps_read_proc(char *page, char **start, off_t off,
 	return proc_calc_metrics(page, start, off, count, eof, len);
 }
 
+static int vmscan_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	struct vmscan_stat *v = &vmscan_stat;
+	int len;
+
+	len = sprintf(page,
+		"passes         %lu\n"
+		"scanned        %lu\n"
+		"unmapped       %lu\n"
+		"unmap_failed   %lu\n"
+		"reclaimed      %lu\n"
+		"last_scanned   %lu\n"
+		"last_reclaimed %lu\n"
+		"untracked      %lu\n",
+		v->passes, v->scanned, v->unmapped, v->unmap_failed,
+		v->reclaimed, v->last_scanned, v->last_reclaimed,
+		v->untracked);
+	return proc_calc_metrics(page, start, off, count, eof, len);
+}
+
+/*
+ * The per-CPU free page lists of the buddy allocator, summed over
+ * all zones and CPUs.
+ */
+static int pagesets_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	unsigned long hot = 0, cold = 0;
+	unsigned long allocs = 0, refills = 0, frees = 0, drains = 0;
+	zone_t *zone;
+	int i, len;
+
+	for_each_zone(zone) {
+		for (i = 0; i < smp_num_cpus; i++) {
+			struct per_cpu_pageset *pset;
+
+			pset = zone->pageset + cpu_logical_map(i);
+			hot += pset->pcp[PCP_HOT].count;
+			cold += pset->pcp[PCP_COLD].count;
+			allocs += pset->allocs;
+			refills += pset->refills;
+			frees += pset->frees;
+			drains += pset->drains;
+		}
+	}
+
+	len = sprintf(page,
+		"Hot:      %8lu kB\n"
+		"Cold:     %8lu kB\n"
+		"Allocs:   %8lu\n"
+		"Refills:  %8lu\n"
+		"Frees:    %8lu\n"
+		"Drains:   %8lu\n",
+		hot << (PAGE_SHIFT - 10), cold << (PAGE_SHIFT - 10),
+		allocs, refills, frees, drains);
+	return proc_calc_metrics(page, start, off, count, eof, len);
+}
+
 static int memory_read_proc(char *page, char **start, off_t off,
 				 int count, int *eof, void *data)
 {
@@ -549,6 +608,8 @@ void __init proc_misc_init(void)
 		{"locks",	locks_read_proc},
 		{"mounts",	mounts_read_proc},
 		{"swaps",	swaps_read_proc},
+		{"vmscan",	vmscan_read_proc},
+		{"pagesets",	pagesets_read_proc},
 		{"iomem",	memory_read_proc},
 		{"execdomains",	execdomains_read_proc},
 		{NULL,}
@@ -6,6 +6,7 @@ enum km_type {
 	KM_BOUNCE_WRITE,
 	KM_SKB_DATA,
 	KM_SKB_DATA_SOFTIRQ,
+	KM_IRQ0,
 	KM_TYPE_NR
 };
 
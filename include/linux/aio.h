@@ -0,0 +1,69 @@
+/*
+ *  include/linux/aio.h
+ *
+ *  Asynchronous I/O contexts and requests, see fs/aio.c.
+ */
+
+#ifndef _LINUX_AIO_H
+#define _LINUX_AIO_H
+
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/tqueue.h>
+#include <linux/aio_abi.h>
+#include <asm/atomic.h>
+
+struct kiobuf;
+struct mm_struct;
+
+/*
+ * One submitted iocb. The file's ->aio_read() or ->aio_write() starts
+ * the I/O, returns -EIOCBQUEUED and calls aio_complete() when it is
+ * done, possibly from an interrupt. What it allocated for the request
+ * it hangs off ki_private and frees in ki_dtor, which is called from
+ * process context after the completion.
+ */
+struct kiocb {
+	struct list_head	ki_list;	/* ctx->active_reqs or done_reqs */
+	struct kioctx		*ki_ctx;
+	struct file		*ki_filp;
+	struct iocb		*ki_obj;	/* the iocb in user space */
+	__u64			ki_data;	/* its aio_data */
+
+	/*
+	 * Called under ctx->lock by io_cancel(): stop the request and
+	 * fill in the event, or return nonzero if it is too late.
+	 */
+	int			(*ki_cancel)(struct kiocb *, struct io_event *);
+	void			(*ki_dtor)(struct kiocb *);
+	void			*ki_private;
+};
+
+struct kioctx {
+	atomic_t		users;
+	int			dead;
+	struct kioctx		*next;		/* mm->ioctx_list */
+	unsigned long		user_id;	/* address of the ring */
+
+	wait_queue_head_t	wait;		/* for events or for idle */
+
+	spinlock_t		lock;		/* irq safe, all below */
+	int			reqs_active;	/* submitted, not completed */
+	struct list_head	active_reqs;
+	struct list_head	done_reqs;	/* completed, not yet freed */
+	struct tq_struct	reap;		/* keventd frees done_reqs */
+
+	unsigned		nr;		/* slots in the ring */
+	unsigned		tail;		/* next slot to fill */
+	unsigned long		ring_size;	/* bytes mapped */
+	struct kiobuf		*ring;		/* its pages, pinned */
+};
+
+extern void aio_complete(struct kiocb *iocb, long res, long res2);
+extern void exit_aio(struct mm_struct *mm);
+
+/* sysctl fs.aio-nr and fs.aio-max-nr */
+extern int aio_nr;
+extern int aio_max_nr;
+
+#endif /* _LINUX_AIO_H */
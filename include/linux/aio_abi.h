@@ -0,0 +1,84 @@
+/*
+ *  include/linux/aio_abi.h
+ *
+ *  Asynchronous I/O: what user space sees. io_setup() returns the
+ *  address of a completion ring mapped into the process; io_submit()
+ *  takes iocbs, and every one of them is completed by exactly one
+ *  io_event in the ring, which can be read from user space directly
+ *  or with io_getevents().
+ */
+
+#ifndef _LINUX_AIO_ABI_H
+#define _LINUX_AIO_ABI_H
+
+#include <linux/types.h>
+#include <asm/byteorder.h>
+
+typedef unsigned long	aio_context_t;
+
+/* iocb->aio_lio_opcode */
+#define IOCB_CMD_PREAD		0
+#define IOCB_CMD_PWRITE		1
+#define IOCB_CMD_PREADV		7
+#define IOCB_CMD_PWRITEV	8
+
+struct io_event {
+	__u64	data;		/* the iocb's aio_data */
+	__u64	obj;		/* the iocb it completes */
+	__s64	res;		/* bytes transferred or -errno */
+	__s64	res2;
+};
+
+#if defined(__LITTLE_ENDIAN)
+#define PADDED(x, y)	x, y
+#elif defined(__BIG_ENDIAN)
+#define PADDED(x, y)	y, x
+#else
+#error edit for your odd byteorder.
+#endif
+
+/*
+ * For PREAD and PWRITE aio_buf and aio_nbytes are the buffer, for
+ * PREADV and PWRITEV they are an array of struct iovec and its length.
+ * The layout is the same for 32 and 64 bit processes.
+ */
+struct iocb {
+	__u64	aio_data;	/* returned in the io_event */
+	__u32	PADDED(aio_key, aio_reserved1);
+
+	__u16	aio_lio_opcode;
+	__s16	aio_reqprio;	/* must be 0 */
+	__u32	aio_fildes;
+
+	__u64	aio_buf;
+	__u64	aio_nbytes;
+	__s64	aio_offset;
+
+	__u64	aio_reserved2;
+	__u64	aio_reserved3;
+};
+
+#undef PADDED
+
+/*
+ * The completion ring at the address io_setup() returned. The kernel
+ * adds events at tail, the reader takes them from head and writes
+ * back the new head; both wrap at nr. io_events[] follows the header.
+ */
+#define AIO_RING_MAGIC		0xa10a10a1
+
+struct aio_ring {
+	unsigned	id;		/* serial number of the context */
+	unsigned	nr;		/* slots in io_events[] */
+	unsigned	head;
+	unsigned	tail;
+
+	unsigned	magic;
+	unsigned	compat_features;
+	unsigned	incompat_features;
+	unsigned	header_length;	/* sizeof(struct aio_ring) */
+
+	struct io_event	io_events[0];
+};
+
+#endif /* _LINUX_AIO_ABI_H */
@@ -0,0 +1,66 @@
+#ifndef _LINUX_BIO_H
+#define _LINUX_BIO_H
+
+/*
+ * A bio is one block I/O: a run of sectors on a device and the list of
+ * page segments the data goes to or comes from, up to BIO_MAX_VECS of
+ * them. It is submitted with submit_bio() and completes once, through
+ * bi_end_io, however many pages it spans.
+ *
+ * Queues that can take a bio as a whole say so with
+ * blk_queue_make_bio(). For all others submit_bio() splits the bio
+ * into buffer_heads and completes it when the last of them is done.
+ */
+
+#include <linux/kdev_t.h>
+#include <asm/atomic.h>
+#include <asm/bitops.h>
+
+struct page;
+
+struct bio_vec {
+	struct page	*bv_page;
+	unsigned int	bv_len;
+	unsigned int	bv_offset;
+};
+
+struct bio;
+typedef void (bio_end_io_t) (struct bio *, int);
+
+struct bio {
+	struct bio	*bi_next;	/* for the owner of the bio */
+	kdev_t		bi_dev;
+	unsigned long	bi_sector;
+	unsigned int	bi_size;	/* bytes */
+	unsigned long	bi_flags;
+
+	unsigned short	bi_vcnt;	/* segments in use */
+	unsigned short	bi_max;		/* segments allocated */
+	struct bio_vec	*bi_io_vec;
+
+	atomic_t	bi_pending;	/* buffer_heads in flight */
+
+	bio_end_io_t	*bi_end_io;
+	void		*bi_private;
+};
+
+/*
+ * bi_flags
+ */
+#define BIO_UPTODATE	0	/* completed without error */
+#define BIO_SPLIT_ERR	1	/* a buffer_head of the split failed */
+
+#define BIO_MAX_VECS	256
+
+#define bio_uptodate(bio)	test_bit(BIO_UPTODATE, &(bio)->bi_flags)
+#define bio_sectors(bio)	((bio)->bi_size >> 9)
+
+extern struct bio *bio_alloc(int gfp_mask, int nr_vecs);
+extern void bio_put(struct bio *);
+extern int bio_add_page(struct bio *, struct page *, unsigned int, unsigned int);
+extern void bio_endio(struct bio *, int);
+extern void bio_submit_bh(int rw, struct bio *);
+extern void submit_bio(int rw, struct bio *);
+extern void bio_init(void);
+
+#endif /* _LINUX_BIO_H */
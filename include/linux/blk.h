@@ -87,6 +87,10 @@ void initrd_init(void);
 
 static inline void blkdev_dequeue_request(struct request * req)
 {
+	request_queue_t *q = req->q;
+
+	if (q && q->elevator.elevator_dequeue_fn)
+		q->elevator.elevator_dequeue_fn(q, req);
 	list_del(&req->queue);
 }
 
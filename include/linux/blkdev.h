@@ -11,6 +11,7 @@ struct request_queue;
 typedef struct request_queue request_queue_t;
 struct elevator_s;
 typedef struct elevator_s elevator_t;
+struct bio;
 
 /*
  * Ok, this is an expanded form so that we can use the same
@@ -23,6 +24,9 @@ struct request {
 	int elevator_sequence;
 	struct list_head table;
 
+	struct list_head fifo;		/* deadline elevator expiry list */
+	unsigned long deadline;
+
 	volatile int rq_status;	/* should split this into a few status bits */
 #define RQ_INACTIVE		(-1)
 #define RQ_ACTIVE		1
@@ -60,6 +64,7 @@ typedef int (merge_requests_fn) (request_queue_t *q,
 typedef void (request_fn_proc) (request_queue_t *q);
 typedef request_queue_t * (queue_proc) (kdev_t dev);
 typedef int (make_request_fn) (request_queue_t *q, int rw, struct buffer_head *bh);
+typedef int (make_bio_fn) (request_queue_t *q, int rw, struct bio *bio);
 typedef void (plug_device_fn) (request_queue_t *q, kdev_t device);
 typedef void (unplug_device_fn) (void *q);
 
@@ -89,6 +94,7 @@ struct request_queue
 	merge_request_fn	* front_merge_fn;
 	merge_requests_fn	* merge_requests_fn;
 	make_request_fn		* make_request_fn;
+	make_bio_fn		* make_bio_fn;
 	plug_device_fn		* plug_device_fn;
 	/*
 	 * The queue owner gets to use this for whatever they like.
@@ -162,6 +168,7 @@ extern void blk_init_queue(request_queue_t *, request_fn_proc *);
 extern void blk_cleanup_queue(request_queue_t *);
 extern void blk_queue_headactive(request_queue_t *, int);
 extern void blk_queue_make_request(request_queue_t *, make_request_fn *);
+extern void blk_queue_make_bio(request_queue_t *, make_bio_fn *);
 extern void generic_unplug_device(void *);
 
 extern int * blk_size[MAX_BLKDEV];
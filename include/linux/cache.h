@@ -15,6 +15,14 @@
 #define ____cacheline_aligned __attribute__((__aligned__(SMP_CACHE_BYTES)))
 #endif
 
+#ifndef ____cacheline_aligned_in_smp
+#ifdef CONFIG_SMP
+#define ____cacheline_aligned_in_smp ____cacheline_aligned
+#else
+#define ____cacheline_aligned_in_smp
+#endif
+#endif
+
 #ifndef __cacheline_aligned
 #ifdef MODULE
 #define __cacheline_aligned ____cacheline_aligned
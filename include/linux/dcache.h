@@ -5,6 +5,7 @@
 
 #include <asm/atomic.h>
 #include <linux/mount.h>
+#include <linux/rcupdate.h>
 
 /*
  * linux/include/linux/dcache.h
@@ -80,6 +81,8 @@ struct dentry {
 	struct super_block * d_sb;	/* The root of the dentry tree */
 	unsigned long d_vfs_flags;
 	void * d_fsdata;		/* fs-specific data */
+	spinlock_t d_lock;		/* d_count 0->1 vs. unhashing */
+	struct rcu_head d_rcu;		/* deferred freeing */
 	unsigned char d_iname[DNAME_INLINE_LEN]; /* small names */
 };
 
@@ -108,6 +111,10 @@ d_compare:	no		yes		no
 d_delete:	no		yes		no
 d_release:	no		no		yes
 d_iput:		no		no		yes
+
+d_compare is also called from d_lookup() with no lock held at all, on
+dentries that may be changing under it; the result is thrown away if
+they did.
  */
 
 /* d_flags entries */
@@ -12,6 +12,10 @@ typedef void (elevator_merge_cleanup_fn) (request_queue_t *, struct request *, i
 
 typedef void (elevator_merge_req_fn) (struct request *, struct request *);
 
+typedef void (elevator_add_req_fn) (request_queue_t *, struct request *);
+
+typedef void (elevator_dequeue_fn) (request_queue_t *, struct request *);
+
 struct elevator_s
 {
 	int read_latency;
@@ -20,8 +24,19 @@ struct elevator_s
 	elevator_merge_fn *elevator_merge_fn;
 	elevator_merge_cleanup_fn *elevator_merge_cleanup_fn;
 	elevator_merge_req_fn *elevator_merge_req_fn;
+	elevator_add_req_fn *elevator_add_req_fn;
+	elevator_dequeue_fn *elevator_dequeue_fn;
+
+	int batch;
 
 	unsigned int queue_ID;
+
+	/*
+	 * deadline elevator: queued requests in order of expiry, one
+	 * list per direction, and what is left of the current batch
+	 */
+	struct list_head fifo[2];
+	int batch_left;
 };
 
 int elevator_noop_merge(request_queue_t *, struct request **, struct list_head *, struct buffer_head *, int, int);
@@ -32,6 +47,11 @@ int elevator_linus_merge(request_queue_t *, struct request **, struct list_head
 void elevator_linus_merge_cleanup(request_queue_t *, struct request *, int);
 void elevator_linus_merge_req(struct request *, struct request *);
 
+int elevator_deadline_merge(request_queue_t *, struct request **, struct list_head *, struct buffer_head *, int, int);
+void elevator_deadline_merge_req(struct request *, struct request *);
+void elevator_deadline_add_req(request_queue_t *, struct request *);
+void elevator_deadline_dequeue(request_queue_t *, struct request *);
+
 typedef struct blkelv_ioctl_arg_s {
 	int queue_ID;
 	int read_latency;
@@ -41,11 +61,21 @@ typedef struct blkelv_ioctl_arg_s {
 
 #define BLKELVGET   _IOR(0x12,106,sizeof(blkelv_ioctl_arg_t))
 #define BLKELVSET   _IOW(0x12,107,sizeof(blkelv_ioctl_arg_t))
+#define BLKELVSEL   _IO(0x12,108)
+
+/*
+ * Elevators that can be chosen with BLKELVSEL and elevator=
+ */
+#define ELEVATOR_ID_LINUS	0
+#define ELEVATOR_ID_NOOP	1
+#define ELEVATOR_ID_DEADLINE	2
 
 extern int blkelvget_ioctl(elevator_t *, blkelv_ioctl_arg_t *);
 extern int blkelvset_ioctl(elevator_t *, const blkelv_ioctl_arg_t *);
+extern int blkelvsel_ioctl(request_queue_t *, int);
 
 extern void elevator_init(elevator_t *, elevator_t);
+extern void elevator_init_default(elevator_t *);
 
 /*
  * Return values from elevator merger
@@ -101,4 +131,17 @@ static inline int elevator_request_latency(elevator_t * elevator, int rw)
 	elevator_linus_merge_req,	/* elevator_merge_req_fn */	\
 	})
 
+#define ELEVATOR_DEADLINE						\
+((elevator_t) {								\
+	500,				/* read expiry, ms */		\
+	5000,				/* write expiry, ms */		\
+									\
+	elevator_deadline_merge,	/* elevator_merge_fn */		\
+	elevator_noop_merge_cleanup,	/* elevator_merge_cleanup_fn */	\
+	elevator_deadline_merge_req,	/* elevator_merge_req_fn */	\
+	elevator_deadline_add_req,	/* elevator_add_req_fn */	\
+	elevator_deadline_dequeue,	/* elevator_dequeue_fn */	\
+	16,				/* batch */			\
+	})
+
 #endif
@@ -0,0 +1,54 @@
+/*
+ *  include/linux/eventpoll.h
+ *
+ *  Scalable event notification: a persistent interest set of file
+ *  descriptors whose readiness is reported by wait queue callbacks,
+ *  so waiting costs O(ready) instead of O(registered).
+ */
+
+#ifndef _LINUX_EVENTPOLL_H
+#define _LINUX_EVENTPOLL_H
+
+#include <linux/types.h>
+
+/* Valid opcodes to issue to sys_epoll_ctl() */
+#define EPOLL_CTL_ADD	1
+#define EPOLL_CTL_DEL	2
+#define EPOLL_CTL_MOD	3
+
+/*
+ * Besides the POLL* bits from <asm/poll.h>: report an event only
+ * once per wakeup instead of as long as the file stays ready.
+ */
+#define EPOLLET		(1U << 31)
+
+struct epoll_event {
+	__u32 events;
+	__u64 data;
+};
+
+#ifdef __KERNEL__
+
+#include <linux/fs.h>
+
+static inline void eventpoll_init_file(struct file *file)
+{
+	INIT_LIST_HEAD(&file->f_ep_links);
+	spin_lock_init(&file->f_ep_lock);
+}
+
+extern void eventpoll_release_file(struct file *file);
+
+/*
+ * Called by fput() when the last reference goes away: drop the file
+ * from every interest set it is still registered with.
+ */
+static inline void eventpoll_release(struct file *file)
+{
+	if (!list_empty(&file->f_ep_links))
+		eventpoll_release_file(file);
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_EVENTPOLL_H */
@@ -28,10 +28,12 @@
 #undef EXT2FS_DEBUG
 
 /*
- * Define EXT2_PREALLOCATE to preallocate data blocks for expanding files
+ * Size of the reservation window of a file, in blocks, when it starts
+ * to allocate (unless s_prealloc_blocks says otherwise), and how far it
+ * may grow while the file is written sequentially.
  */
-#define EXT2_PREALLOCATE
-#define EXT2_DEFAULT_PREALLOC_BLOCKS	8
+#define EXT2_DEFAULT_RESERVE_BLOCKS	8
+#define EXT2_MAX_RESERVE_BLOCKS		1024
 
 /*
  * The second extended file system version
@@ -198,10 +200,12 @@ struct ext2_group_desc
 #define EXT2_ECOMPR_FL			0x00000800 /* Compression error */
 /* End compression flags --- maybe not all used */	
 #define EXT2_BTREE_FL			0x00001000 /* btree format dir */
+#define EXT2_INDEX_FL			0x00001000 /* hash-indexed directory */
+#define EXT2_TOPDIR_FL			0x00020000 /* Top of directory hierarchies*/
 #define EXT2_RESERVED_FL		0x80000000 /* reserved for ext2 lib */
 
-#define EXT2_FL_USER_VISIBLE		0x00001FFF /* User visible flags */
-#define EXT2_FL_USER_MODIFIABLE		0x000000FF /* User modifiable flags */
+#define EXT2_FL_USER_VISIBLE		0x00021FFF /* User visible flags */
+#define EXT2_FL_USER_MODIFIABLE		0x000200FF /* User modifiable flags */
 
 /*
  * ioctl commands
@@ -314,6 +318,9 @@ struct ext2_inode {
 #define EXT2_MOUNT_ERRORS_PANIC		0x0040	/* Panic on errors */
 #define EXT2_MOUNT_MINIX_DF		0x0080	/* Mimics the Minix statfs */
 #define EXT2_MOUNT_NO_UID32		0x0200  /* Disable 32-bit UIDs */
+#define EXT2_MOUNT_NORESERVATION	0x0400	/* No reservation windows */
+#define EXT2_MOUNT_DELALLOC		0x0800	/* Allocate at writeback */
+#define EXT2_MOUNT_OLDALLOC		0x1000	/* Old directory placement */
 
 #define clear_opt(o, opt)		o &= ~EXT2_MOUNT_##opt
 #define set_opt(o, opt)			o |= EXT2_MOUNT_##opt
@@ -392,7 +399,21 @@ struct ext2_super_block {
 	__u8	s_prealloc_blocks;	/* Nr of blocks to try to preallocate*/
 	__u8	s_prealloc_dir_blocks;	/* Nr to preallocate for dirs */
 	__u16	s_padding1;
-	__u32	s_reserved[204];	/* Padding to the end of the block */
+	/*
+	 * Journaling support valid if EXT3_FEATURE_COMPAT_HAS_JOURNAL set.
+	 */
+	__u8	s_journal_uuid[16];	/* uuid of journal superblock */
+	__u32	s_journal_inum;		/* inode number of journal file */
+	__u32	s_journal_dev;		/* device number of journal file */
+	__u32	s_last_orphan;		/* start of list of inodes to delete */
+	/*
+	 * Directory indexing, valid if EXT2_FEATURE_COMPAT_DIR_INDEX set.
+	 */
+	__u32	s_hash_seed[4];		/* seed of the directory hash */
+	__u8	s_def_hash_version;	/* hash for new indexed directories */
+	__u8	s_reserved_char_pad;
+	__u16	s_reserved_word_pad;
+	__u32	s_reserved[192];	/* Padding to the end of the block */
 };
 
 #ifdef __KERNEL__
@@ -466,7 +487,7 @@ struct ext2_super_block {
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008
 #define EXT2_FEATURE_INCOMPAT_ANY		0xffffffff
 
-#define EXT2_FEATURE_COMPAT_SUPP	0
+#define EXT2_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_DIR_INDEX
 #define EXT2_FEATURE_INCOMPAT_SUPP	EXT2_FEATURE_INCOMPAT_FILETYPE
 #define EXT2_FEATURE_RO_COMPAT_SUPP	(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT2_FEATURE_RO_COMPAT_LARGE_FILE| \
@@ -532,6 +553,13 @@ enum {
 #define EXT2_DIR_REC_LEN(name_len)	(((name_len) + 8 + EXT2_DIR_ROUND) & \
 					 ~EXT2_DIR_ROUND)
 
+/*
+ * Hash versions of indexed directories, see fs/ext2/hash.c
+ */
+#define DX_HASH_LEGACY		0
+#define DX_HASH_HALF_MD4	1
+#define DX_HASH_TEA		2
+
 #ifdef __KERNEL__
 /*
  * Function prototypes
@@ -551,8 +579,10 @@ extern int ext2_permission (struct inode *, int);
 /* balloc.c */
 extern int ext2_bg_has_super(struct super_block *sb, int group);
 extern unsigned long ext2_bg_num_gdb(struct super_block *sb, int group);
-extern int ext2_new_block (const struct inode *, unsigned long,
-			   __u32 *, __u32 *, int *);
+extern int ext2_new_blocks (struct inode *, unsigned long,
+			    unsigned long *, int *);
+extern void ext2_discard_reservation (struct inode *);
+extern void ext2_init_reservation (struct inode *);
 extern void ext2_free_blocks (const struct inode *, unsigned long,
 			      unsigned long);
 extern unsigned long ext2_count_free_blocks (struct super_block *);
@@ -574,6 +604,19 @@ extern int ext2_write (struct inode *, struct file *, char *, int);
 extern int ext2_sync_file (struct file *, struct dentry *, int);
 extern int ext2_fsync_inode (struct inode *, int);
 
+/* hash.c */
+struct dx_hash_info
+{
+	__u32		hash;
+	__u32		minor_hash;
+	int		hash_version;
+	__u32		*seed;
+};
+
+#define EXT2_HTREE_EOF	0x7fffffff
+
+extern int ext2_dirhash(const char *name, int len, struct dx_hash_info *hinfo);
+
 /* ialloc.c */
 extern struct inode * ext2_new_inode (const struct inode *, int);
 extern void ext2_free_inode (struct inode *);
@@ -587,10 +630,9 @@ extern struct buffer_head * ext2_bread (struct inode *, int, int, int *);
 
 extern void ext2_read_inode (struct inode *);
 extern void ext2_write_inode (struct inode *, int);
-extern void ext2_put_inode (struct inode *);
+extern void ext2_clear_inode (struct inode *);
 extern void ext2_delete_inode (struct inode *);
 extern int ext2_sync_inode (struct inode *);
-extern void ext2_discard_prealloc (struct inode *);
 
 /* ioctl.c */
 extern int ext2_ioctl (struct inode *, struct file *, unsigned int,
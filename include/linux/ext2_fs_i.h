@@ -16,6 +16,20 @@
 #ifndef _LINUX_EXT2_FS_I
 #define _LINUX_EXT2_FS_I
 
+#include <linux/list.h>
+
+/*
+ * Blocks of a group set aside for the next allocations of one file, so
+ * that files written at the same time do not end up interleaved. Only
+ * kept in memory, see fs/ext2/balloc.c.
+ */
+struct ext2_reserve_window {
+	struct list_head rsv_list;	/* on s_rsv_windows, sorted by start */
+	__u32	rsv_start;		/* first block of the window */
+	__u32	rsv_end;		/* last block of the window */
+	__u32	rsv_goal_size;		/* blocks to ask for next time */
+};
+
 /*
  * second extended file system inode data in memory
  */
@@ -32,8 +46,8 @@ struct ext2_inode_info {
 	__u32	i_block_group;
 	__u32	i_next_alloc_block;
 	__u32	i_next_alloc_goal;
-	__u32	i_prealloc_block;
-	__u32	i_prealloc_count;
+	struct ext2_reserve_window i_rsv_window;
+	__u32	i_delalloc_blocks;	/* promised to its delayed pages */
 	int	i_new_inode:1;	/* Is a freshly allocated inode */
 };
 
@@ -56,6 +56,9 @@ struct ext2_sb_info {
 	int s_desc_per_block_bits;
 	int s_inode_size;
 	int s_first_ino;
+	struct list_head s_rsv_windows;	/* reservation windows, by start */
+	unsigned long s_delalloc_blocks;/* promised to delayed pages */
+	__u8 *s_debts;			/* directories minus files, per group */
 };
 
 #endif	/* _LINUX_EXT2_FS_SB */
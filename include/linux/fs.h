@@ -21,11 +21,13 @@
 #include <linux/cache.h>
 #include <linux/stddef.h>
 #include <linux/string.h>
+#include <linux/radix-tree.h>
 
 #include <asm/atomic.h>
 #include <asm/bitops.h>
 
 struct poll_table_struct;
+struct kiocb;
 
 
 /*
@@ -185,6 +187,7 @@ extern int leases_enable, dir_notify_enable, lease_break_time;
 #define BLKPG      _IO(0x12,105)/* See blkpg.h */
 #define BLKELVGET  _IOR(0x12,106,sizeof(blkelv_ioctl_arg_t))/* elevator get */
 #define BLKELVSET  _IOW(0x12,107,sizeof(blkelv_ioctl_arg_t))/* elevator set */
+#define BLKELVSEL  _IO(0x12,108)/* select elevator */
 /* This was here just to show that the number is taken -
    probably all these _IO(0x12,*) ioctls should be moved to blkpg.h. */
 #endif
@@ -261,6 +264,8 @@ struct buffer_head {
 
 	struct inode *	     b_inode;
 	struct list_head     b_inode_buffers;	/* doubly linked list of inode dirty buffers */
+	struct list_head     b_flush_list;	/* dirty list of the device... */
+	struct bdflush_dev * b_flushdev;	/* ...which is this one */
 };
 
 typedef void (bh_end_io_t)(struct buffer_head *bh, int uptodate);
@@ -376,9 +381,13 @@ struct address_space_operations {
 	int (*commit_write)(struct file *, struct page *, unsigned, unsigned);
 	/* Unfortunately this kludge is needed for FIBMAP. Don't use it */
 	int (*bmap)(struct address_space *, long);
+	/* Truncation; block_flushpage() if there is none */
+	int (*flushpage)(struct page *, unsigned long);
 };
 
 struct address_space {
+	struct radix_tree_root	page_tree;	/* index -> page, all pages */
+	spinlock_t		page_lock;	/* protects the tree, lists and nrpages */
 	struct list_head	clean_pages;	/* list of clean pages */
 	struct list_head	dirty_pages;	/* list of dirty pages */
 	struct list_head	locked_pages;	/* list of locked pages */
@@ -488,6 +497,31 @@ struct inode {
 	} u;
 };
 
+/*
+ * Read-ahead state of a struct file, see mm/filemap.c. Each stream is
+ * one reader moving through the file: pages [start, end) have been
+ * submitted for reading, the last window of them was size pages, and
+ * reading the marker page submits the next window.
+ */
+#define FILE_RA_STREAMS	2
+
+struct file_ra_stream {
+	unsigned long start;
+	unsigned long end;
+	unsigned long size;
+	unsigned long marker;
+	unsigned long stamp;		/* ra->clock when last used */
+};
+
+struct file_ra_state {
+	struct file_ra_stream stream[FILE_RA_STREAMS];
+	unsigned long clock;
+	unsigned long hits;		/* pages found up to date */
+	unsigned long waits;		/* pages found still being read */
+	unsigned long misses;		/* pages not in the cache */
+	unsigned long pages;		/* pages submitted by read-ahead */
+};
+
 struct fown_struct {
 	int pid;		/* pid or -pgrp where SIGIO should be sent */
 	uid_t uid, euid;	/* uid/euid of process setting the owner */
@@ -503,7 +537,8 @@ struct file {
 	unsigned int 		f_flags;
 	mode_t			f_mode;
 	loff_t			f_pos;
-	unsigned long 		f_reada, f_ramax, f_raend, f_ralen, f_rawin;
+	unsigned long 		f_reada;
+	struct file_ra_state	f_ra;
 	struct fown_struct	f_owner;
 	unsigned int		f_uid, f_gid;
 	int			f_error;
@@ -512,6 +547,10 @@ struct file {
 
 	/* needed for tty driver, and maybe others */
 	void			*private_data;
+
+	/* event poll interest sets this file is registered with */
+	struct list_head	f_ep_links;
+	spinlock_t		f_ep_lock;
 };
 extern spinlock_t files_lock;
 #define file_list_lock() spin_lock(&files_lock);
@@ -796,6 +835,9 @@ struct file_operations {
 	ssize_t (*writev) (struct file *, const struct iovec *, unsigned long, loff_t *);
 	ssize_t (*sendpage) (struct file *, struct page *, int, size_t, loff_t *, int);
 	unsigned long (*get_unmapped_area)(struct file *, unsigned long, unsigned long, unsigned long, unsigned long);
+	/* start the I/O and return -EIOCBQUEUED, see fs/aio.c */
+	ssize_t (*aio_read) (struct kiocb *, const struct iovec *, unsigned long, loff_t);
+	ssize_t (*aio_write) (struct kiocb *, const struct iovec *, unsigned long, loff_t);
 };
 
 struct inode_operations {
@@ -1324,6 +1366,8 @@ typedef int (get_block_t)(struct inode*,long,struct buffer_head*,int);
 
 /* Generic buffer handling for block filesystems.. */
 extern int block_flushpage(struct page *, unsigned long);
+extern void create_empty_buffers(struct page *, kdev_t, unsigned long);
+extern void unmap_underlying_metadata(struct buffer_head *);
 extern int block_symlink(struct inode *, const char *, int);
 extern int block_write_full_page(struct page*, get_block_t*);
 extern int block_read_full_page(struct page*, get_block_t*);
@@ -0,0 +1,15 @@
+#ifndef _LINUX_FUTEX_H
+#define _LINUX_FUTEX_H
+
+/*
+ * Fast user-space mutexes: sys_futex() operations.
+ *
+ * FUTEX_WAIT	sleep if *uaddr still holds 'val' (optionally with a
+ *		relative timeout), return -EWOULDBLOCK otherwise
+ * FUTEX_WAKE	wake up to 'val' tasks sleeping on uaddr, return
+ *		the number woken
+ */
+#define FUTEX_WAIT	0
+#define FUTEX_WAKE	1
+
+#endif
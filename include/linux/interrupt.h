@@ -76,6 +76,7 @@ extern void open_softirq(int nr, void (*action)(struct softirq_action*), void *d
 extern void softirq_init(void);
 extern void FASTCALL(cpu_raise_softirq(unsigned int cpu, unsigned int nr));
 extern void FASTCALL(raise_softirq(unsigned int nr));
+extern void FASTCALL(remote_raise_softirq(unsigned int cpu, unsigned int nr));
 
 
 
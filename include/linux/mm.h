@@ -16,9 +16,7 @@ extern unsigned long max_mapnr;
 extern unsigned long num_physpages;
 extern void * high_memory;
 extern int page_cluster;
-/* The inactive_clean lists are per zone. */
-extern struct list_head active_list;
-extern struct list_head inactive_dirty_list;
+/* The page lists for pageout are per zone, see mmzone.h. */
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -102,7 +100,7 @@ struct vm_area_struct {
 
 #define VM_DONTCOPY	0x00020000      /* Do not copy this vma on fork */
 #define VM_DONTEXPAND	0x00040000	/* Cannot expand with mremap() */
-#define VM_RESERVED	0x00080000	/* Don't unmap it from swap_out */
+#define VM_RESERVED	0x00080000	/* Don't unmap it for pageout */
 
 #define VM_STACK_FLAGS	0x00000177
 
@@ -133,8 +131,8 @@ struct vm_operations_struct {
 /*
  * Each physical page in the system has a struct page associated with
  * it to keep track of whatever it is we are using the page for at the
- * moment. Note that we have no way to track which tasks are using
- * a page.
+ * moment. The page table entries that map a page into user space are
+ * chained off page->pte_chain, see mm/rmap.c.
  *
  * Try to keep the most commonly accessed fields in single cache lines
  * here (16 bytes or greater).  This ordering should be particularly
@@ -149,20 +147,21 @@ typedef struct page {
 	struct list_head list;		/* ->mapping has some page lists. */
 	struct address_space *mapping;	/* The inode (or ...) we belong to. */
 	unsigned long index;		/* Our offset within mapping. */
-	struct page *next_hash;		/* Next page sharing our hash bucket in
-					   the pagecache hash table. */
+	struct page *next_hash;		/* Arch private, see below. */
 	atomic_t count;			/* Usage count, see below. */
 	unsigned long flags;		/* atomic flags, some possibly
 					   updated asynchronously */
 	struct list_head lru;		/* Pageout list, eg. active_list;
-					   protected by pagemap_lru_lock !! */
+					   protected by zone->lru_lock !! */
 	unsigned long age;		/* Page aging counter. */
 	wait_queue_head_t wait;		/* Page locked?  Stand in line... */
-	struct page **pprev_hash;	/* Complement to *next_hash. */
+	struct page **pprev_hash;	/* Arch private, see below. */
 	struct buffer_head * buffers;	/* Buffer maps us to a disk block. */
 	void *virtual;			/* Kernel virtual address (NULL if
 					   not kmapped, ie. highmem) */
 	struct zone_struct *zone;	/* Memory zone we are in. */
+	struct pte_chain *pte_chain;	/* Reverse mappings, under
+					   PG_chainlock. */
 } mem_map_t;
 
 /*
@@ -226,9 +225,11 @@ typedef struct page {
  * using the page->list list_head. These fields are also used for
  * freelist managemet (when page->count==0).
  *
- * There is also a hash table mapping (inode,offset) to the page
- * in memory if present. The lists for this hash table use the fields
- * page->next_hash and page->pprev_hash.
+ * Each mapping also indexes its pages by offset in a radix tree,
+ * mapping->page_tree, protected by mapping->page_lock together with
+ * the lists above. page->next_hash and page->pprev_hash are no longer
+ * used by the page cache; some architectures use them to chain
+ * page table pages.
  *
  * All process pages can do I/O:
  * - inode pages may need to be read from disk,
@@ -250,9 +251,18 @@ typedef struct page {
  * to manipulate page->age and move the page across the active,
  * inactive_dirty and inactive_clean lists.
  *
- * Note that the referenced bit, the page->lru list_head and the
- * active, inactive_dirty and inactive_clean lists are protected by
- * the pagemap_lru_lock, and *NOT* by the usual PG_locked bit!
+ * Note that the page->lru list_head and the active, inactive_dirty
+ * and inactive_clean lists are protected by the lru_lock of the zone
+ * the page belongs to, and *NOT* by the usual PG_locked bit! Adding
+ * pages to the lists and moving them between the lists is batched
+ * per CPU (see mm/swap.c), so a page that was just added to the page
+ * cache may not be on any list for a short while.
+ *
+ * Every user space mapping of a process page is recorded on the
+ * page->pte_chain list, protected by the PG_chainlock bit, so that
+ * pageout can unmap a page from all of its users. Anonymous pages
+ * are put on the active list when they are first mapped and stay on
+ * the page lists until they are freed.
  *
  * PG_skip is used on sparc/sparc64 architectures to "skip" certain
  * parts of the address space.
@@ -282,6 +292,7 @@ typedef struct page {
 #define PG_inactive_clean	11
 #define PG_highmem		12
 #define PG_checked		13	/* kill me in 2.5.<early>. */
+#define PG_chainlock		14	/* Protects page->pte_chain */
 				/* bits 21-29 unused */
 #define PG_arch_1		30
 #define PG_reserved		31
@@ -298,6 +309,7 @@ typedef struct page {
 #define TryLockPage(page)	test_and_set_bit(PG_locked, &(page)->flags)
 #define PageChecked(page)	test_bit(PG_checked, &(page)->flags)
 #define SetPageChecked(page)	set_bit(PG_checked, &(page)->flags)
+#define ClearPageChecked(page)	clear_bit(PG_checked, &(page)->flags)
 
 extern void __set_page_dirty(struct page *);
 
@@ -417,6 +429,8 @@ extern void FASTCALL(__free_pages(struct page *page, unsigned long order));
 extern void FASTCALL(free_pages(unsigned long addr, unsigned long order));
 
 #define __free_page(page) __free_pages((page), 0)
+extern void FASTCALL(free_cold_page(struct page *page));
+extern void drain_local_pages(void);
 #define free_page(addr) free_pages((addr),0)
 
 extern void show_free_areas(void);
@@ -457,6 +471,7 @@ static inline pmd_t *pmd_alloc(struct mm_struct *mm, pgd_t *pgd, unsigned long a
 }
 
 extern int pgt_cache_water[2];
+extern int percpu_pages_water[2];
 extern int check_pgt_cache(void);
 
 extern void free_area_init(unsigned long * zones_size);
@@ -538,6 +553,7 @@ extern struct page *filemap_nopage(struct vm_area_struct *, unsigned long, int);
 #define __GFP_HIGH	0x20	/* Should access emergency pools? */
 #define __GFP_IO	0x40	/* Can start physical IO? */
 #define __GFP_FS	0x80	/* Can call down to low-level FS? */
+#define __GFP_COLD	0x100	/* Page will not be touched by the CPU soon */
 
 #define GFP_NOIO	(__GFP_HIGH | __GFP_WAIT)
 #define GFP_NOFS	(__GFP_HIGH | __GFP_WAIT | __GFP_IO)
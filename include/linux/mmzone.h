@@ -7,6 +7,8 @@
 #include <linux/config.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/threads.h>
+#include <linux/cache.h>
 
 /*
  * Free memory management - zoned buddy allocator.
@@ -19,6 +21,27 @@ typedef struct free_area_struct {
 	unsigned long		*map;
 } free_area_t;
 
+/*
+ * Every CPU keeps short lists of free order-0 pages per zone, so that
+ * most single page allocations and frees do not need the zone lock.
+ * Pages freed by the CPU itself go on the hot list, pages that are
+ * probably not in its cache (eg. about to be overwritten by DMA) on
+ * the cold list. The lists are only touched by their own CPU, with
+ * interrupts disabled. Pages on them are not counted as free.
+ */
+#define PCP_HOT		0
+#define PCP_COLD	1
+
+struct per_cpu_pages {
+	int			count;
+	struct list_head	list;
+};
+
+struct per_cpu_pageset {
+	struct per_cpu_pages	pcp[2];
+	unsigned long		allocs, refills, frees, drains;
+} ____cacheline_aligned;
+
 struct pglist_data;
 
 /*
@@ -35,16 +58,29 @@ typedef struct zone_struct {
 	 */
 	spinlock_t		lock;
 	unsigned long		free_pages;
-	unsigned long		inactive_clean_pages;
-	unsigned long		inactive_dirty_pages;
 	unsigned long		pages_min, pages_low, pages_high;
 
 	/*
-	 * free areas of different sizes
+	 * page lists for pageout, all protected by lru_lock
 	 */
+	spinlock_t		lru_lock;
+	unsigned long		active_pages;
+	unsigned long		inactive_dirty_pages;
+	unsigned long		inactive_clean_pages;
+	struct list_head	active_list;
+	struct list_head	inactive_dirty_list;
 	struct list_head	inactive_clean_list;
+
+	/*
+	 * free areas of different sizes
+	 */
 	free_area_t		free_area[MAX_ORDER];
 
+	/*
+	 * per-CPU lists of free single pages
+	 */
+	struct per_cpu_pageset	pageset[NR_CPUS];
+
 	/*
 	 * Discontig memory support fields.
 	 */
@@ -89,9 +125,6 @@ typedef struct zonelist_struct {
  *
  * On NUMA machines, each NUMA node would have a pg_data_t to describe
  * it's memory layout.
- *
- * XXX: we need to move the global memory statistics (active_list, ...)
- *      into the pg_data_t to properly support NUMA.
  */
 struct bootmem_data;
 typedef struct pglist_data {
@@ -110,6 +143,23 @@ typedef struct pglist_data {
 extern int numnodes;
 extern pg_data_t *pgdat_list;
 
+/*
+ * Zone iterator: visits every zone of every node, empty ones included.
+ */
+static inline zone_t *next_zone(zone_t *zone)
+{
+	pg_data_t *pgdat = zone->zone_pgdat;
+
+	if (zone < pgdat->node_zones + MAX_NR_ZONES - 1)
+		return zone + 1;
+	if (pgdat->node_next)
+		return pgdat->node_next->node_zones;
+	return NULL;
+}
+
+#define for_each_zone(zone) \
+	for (zone = pgdat_list->node_zones; zone; zone = next_zone(zone))
+
 #define memclass(pgzone, tzone)	(((pgzone)->zone_pgdat == (tzone)->zone_pgdat) \
 			&& ((pgzone) <= (tzone)))
 
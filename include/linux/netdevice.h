@@ -161,6 +161,7 @@ struct netif_rx_stats
 	unsigned fastroute_deferred_out;
 	unsigned fastroute_latency_reduction;
 	unsigned cpu_collision;
+	unsigned steered;
 } __attribute__ ((__aligned__(SMP_CACHE_BYTES)));
 
 extern struct netif_rx_stats netdev_rx_stat[];
@@ -202,7 +203,8 @@ enum netdev_state_t
 	__LINK_STATE_START,
 	__LINK_STATE_PRESENT,
 	__LINK_STATE_SCHED,
-	__LINK_STATE_NOCARRIER
+	__LINK_STATE_NOCARRIER,
+	__LINK_STATE_RX_SCHED
 };
 
 
@@ -285,6 +287,16 @@ struct net_device
 	unsigned long		trans_start;	/* Time (in jiffies) of last Tx	*/
 	unsigned long		last_rx;	/* Time of last Rx	*/
 
+	/*
+	 * Receive polling. A driver that sets poll takes packets off
+	 * the card from net_rx_action() instead of its interrupt
+	 * handler, at most weight of them per round.
+	 */
+	struct list_head	poll_list;	/* on softnet_data.poll_list */
+	int			quota;
+	int			weight;
+	int			(*poll)(struct net_device *dev, int *budget);
+
 	unsigned short		flags;	/* interface flags (a la BSD)	*/
 	unsigned short		gflags;
 	unsigned		mtu;	/* interface MTU value		*/
@@ -459,8 +471,10 @@ static inline int unregister_gifconf(unsigned int family)
 }
 
 /*
- * Incoming packets are placed on per-cpu queues so that
- * no locking is needed.
+ * Incoming packets from netif_rx() are placed on per-cpu queues. The
+ * queue lock is only contended when flows are steered to other CPUs.
+ * Each queue is drained by blog_dev, a pseudo device that sits on the
+ * poll list like any polling driver.
  */
 
 struct softnet_data
@@ -469,8 +483,11 @@ struct softnet_data
 	int			cng_level;
 	int			avg_blog;
 	struct sk_buff_head	input_pkt_queue;
+	struct list_head	poll_list;
 	struct net_device	*output_queue;
 	struct sk_buff		*completion_queue;
+
+	struct net_device	blog_dev;
 } __attribute__((__aligned__(SMP_CACHE_BYTES)));
 
 
@@ -555,6 +572,8 @@ static inline void dev_kfree_skb_any(struct sk_buff *skb)
 extern void		net_call_rx_atomic(void (*fn)(void));
 #define HAVE_NETIF_RX 1
 extern int		netif_rx(struct sk_buff *skb);
+#define HAVE_NETIF_RECEIVE_SKB 1
+extern int		netif_receive_skb(struct sk_buff *skb);
 extern int		dev_ioctl(unsigned int cmd, void *);
 extern int		dev_change_flags(struct net_device *, unsigned);
 extern void		dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev);
@@ -579,6 +598,80 @@ static inline void dev_put(struct net_device *dev)
 #define __dev_put(dev) atomic_dec(&(dev)->refcnt)
 #define dev_hold(dev) atomic_inc(&(dev)->refcnt)
 
+/*
+ * Receive polling.
+ *
+ * A polling driver masks its receive interrupts and calls
+ * netif_rx_schedule() from the interrupt handler. net_rx_action()
+ * later calls dev->poll(dev, &budget), which takes packets off the
+ * ring and hands them to netif_receive_skb(), at most
+ * min(*budget, dev->quota) of them, and subtracts what it did from
+ * both. When the ring is empty it calls netif_rx_complete(), unmasks
+ * the interrupts and returns 0; otherwise it returns 1 and is polled
+ * again in the next round. Under load the card is thus serviced
+ * without any interrupts at all, and the softirq budget bounds how
+ * much time receive processing can take away from everything else.
+ */
+
+/* Returns 1 if the caller has to put the device on the poll list */
+static inline int netif_rx_schedule_prep(struct net_device *dev)
+{
+	return netif_running(dev) &&
+		!test_and_set_bit(__LINK_STATE_RX_SCHED, &dev->state);
+}
+
+static inline void __netif_rx_schedule(struct net_device *dev)
+{
+	unsigned long flags;
+	int cpu = smp_processor_id();
+
+	local_irq_save(flags);
+	dev_hold(dev);
+	list_add_tail(&dev->poll_list, &softnet_data[cpu].poll_list);
+	/* a device that overran its quota last time gets less this time */
+	if (dev->quota < 0)
+		dev->quota += dev->weight;
+	else
+		dev->quota = dev->weight;
+	cpu_raise_softirq(cpu, NET_RX_SOFTIRQ);
+	local_irq_restore(flags);
+}
+
+static inline void netif_rx_schedule(struct net_device *dev)
+{
+	if (netif_rx_schedule_prep(dev))
+		__netif_rx_schedule(dev);
+}
+
+/* Take a device off the poll list, called from its poll method */
+static inline void netif_rx_complete(struct net_device *dev)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	if (!test_bit(__LINK_STATE_RX_SCHED, &dev->state))
+		BUG();
+	list_del(&dev->poll_list);
+	smp_mb__before_clear_bit();
+	clear_bit(__LINK_STATE_RX_SCHED, &dev->state);
+	local_irq_restore(flags);
+}
+
+/* Keep the device from being polled, e.g. while resetting the card */
+static inline void netif_poll_disable(struct net_device *dev)
+{
+	while (test_and_set_bit(__LINK_STATE_RX_SCHED, &dev->state)) {
+		current->state = TASK_INTERRUPTIBLE;
+		schedule_timeout(1);
+	}
+}
+
+static inline void netif_poll_enable(struct net_device *dev)
+{
+	smp_mb__before_clear_bit();
+	clear_bit(__LINK_STATE_RX_SCHED, &dev->state);
+}
+
 /* Carrier loss detection, dial on demand. The functions netif_carrier_on
  * and _off may be called from IRQ context, but it is caller
  * who is responsible for serialization of these calls.
@@ -650,6 +743,8 @@ extern void		dev_mcast_init(void);
 extern int		netdev_register_fc(struct net_device *dev, void (*stimul)(struct net_device *dev));
 extern void		netdev_unregister_fc(int bit);
 extern int		netdev_max_backlog;
+extern int		netdev_weight;
+extern int		netdev_rx_steer_cpus;
 extern unsigned long	netdev_fc_xoff;
 extern atomic_t netdev_dropping;
 extern int		netdev_set_master(struct net_device *dev, struct net_device *master);
@@ -31,6 +31,7 @@ enum ip_conntrack_info
 
 #include <linux/types.h>
 #include <linux/skbuff.h>
+#include <linux/rcupdate.h>
 #include <linux/netfilter_ipv4/ip_conntrack_tcp.h>
 #include <linux/netfilter_ipv4/ip_conntrack_icmp.h>
 
@@ -60,6 +61,10 @@ enum ip_conntrack_status {
 	/* Conntrack should never be early-expired. */
 	IPS_ASSURED_BIT = 2,
 	IPS_ASSURED = (1 << IPS_ASSURED_BIT),
+
+	/* Unlinked from the hash table, lookups must not return it. */
+	IPS_DYING_BIT = 3,
+	IPS_DYING = (1 << IPS_DYING_BIT),
 };
 
 struct ip_conntrack_expect
@@ -98,6 +103,10 @@ struct ip_conntrack
 	/* Timer function; drops refcnt when it goes off. */
 	struct timer_list timeout;
 
+	/* Drops the hash table's refcnt once lockless lookups which
+	   may still see us are done. */
+	struct rcu_head rcu;
+
 	/* If we're expecting another related connection, this will be
            in expected linked list */
 	struct ip_conntrack_expect expected;
@@ -44,7 +44,42 @@ static inline int ip_conntrack_confirm(struct sk_buff *skb)
 	return NF_ACCEPT;
 }
 
-extern struct list_head *ip_conntrack_hash;
+/* The hash table.  Lookups walk the chains without a lock; entries are
+   added and removed under the lock of their chain.  The table is
+   replaced as a whole when it is resized. */
+struct ip_conntrack_bucket
+{
+	struct list_head chain;
+	spinlock_t lock;
+};
+
+struct ip_conntrack_htable
+{
+	unsigned int size;
+	struct ip_conntrack_bucket buckets[0];
+};
+
+extern struct ip_conntrack_htable *ip_conntrack_htable;
+extern int ip_conntrack_resize(unsigned int size);
+
+/* Calls iter for every tuple in the table until it returns true, and
+   returns that tuple.  Only from process context; iter must not sleep. */
+extern struct ip_conntrack_tuple_hash *
+ip_conntrack_walk(int (*iter)(struct ip_conntrack_tuple_hash *, void *),
+		  void *data);
+
+/* Per-CPU statistics, in /proc/net/ip_conntrack_stat. */
+struct ip_conntrack_stat
+{
+	unsigned int searched;		/* hash entries looked at */
+	unsigned int found;		/* lookups which found a conntrack */
+	unsigned int inserted;		/* conntracks confirmed */
+	unsigned int dropped;		/* packets dropped: no room, lost race */
+	unsigned int early_drop;	/* unreplied conntracks freed for room */
+} ____cacheline_aligned_in_smp;
+
+extern struct ip_conntrack_stat ip_conntrack_stat[NR_CPUS];
+
 extern struct list_head expect_list;
 DECLARE_RWLOCK_EXTERN(ip_conntrack_lock);
 #endif /* _IP_CONNTRACK_CORE_H */
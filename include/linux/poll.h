@@ -11,8 +11,17 @@
 #include <asm/uaccess.h>
 
 struct poll_table_page;
+struct poll_table_struct;
+
+/*
+ * Called by poll_wait() for every wait queue a ->poll method wants
+ * to sleep on. select/poll use __pollwait, the event poll interface
+ * hooks its own callbacks in.
+ */
+typedef void (*poll_queue_proc)(struct file *, wait_queue_head_t *, struct poll_table_struct *);
 
 typedef struct poll_table_struct {
+	poll_queue_proc qproc;
 	int error;
 	struct poll_table_page * table;
 } poll_table;
@@ -22,11 +31,12 @@ extern void __pollwait(struct file * filp, wait_queue_head_t * wait_address, pol
 extern inline void poll_wait(struct file * filp, wait_queue_head_t * wait_address, poll_table *p)
 {
 	if (p && wait_address)
-		__pollwait(filp, wait_address, p);
+		p->qproc(filp, wait_address, p);
 }
 
 static inline void poll_initwait(poll_table* pt)
 {
+	pt->qproc = __pollwait;
 	pt->error = 0;
 	pt->table = NULL;
 }
@@ -0,0 +1,42 @@
+#ifndef _LINUX_RADIX_TREE_H
+#define _LINUX_RADIX_TREE_H
+
+/*
+ * A radix tree maps unsigned long indices to pointers. It is dense
+ * where the index space is used and costs nothing where it is not,
+ * which makes it a good fit for the page cache of a single file.
+ *
+ * The tree does no locking of its own; users serialize modifications
+ * and lookups with a lock of their choice.
+ */
+
+struct radix_tree_node;
+
+struct radix_tree_root {
+	unsigned int		height;
+	int			gfp_mask;
+	struct radix_tree_node	*rnode;
+};
+
+#define RADIX_TREE_INIT(mask)	{ 0, (mask), NULL }
+
+#define RADIX_TREE(name, mask) \
+	struct radix_tree_root name = RADIX_TREE_INIT(mask)
+
+#define INIT_RADIX_TREE(root, mask)	\
+do {					\
+	(root)->height = 0;		\
+	(root)->gfp_mask = (mask);	\
+	(root)->rnode = NULL;		\
+} while (0)
+
+extern int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
+extern void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
+extern void *radix_tree_delete(struct radix_tree_root *, unsigned long);
+extern unsigned int radix_tree_gang_lookup(struct radix_tree_root *,
+			void **results, unsigned long first_index,
+			unsigned int max_items);
+extern int radix_tree_preload(int gfp_mask);
+extern void radix_tree_init(void);
+
+#endif /* _LINUX_RADIX_TREE_H */
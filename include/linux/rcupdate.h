@@ -0,0 +1,85 @@
+#ifndef __LINUX_RCUPDATE_H
+#define __LINUX_RCUPDATE_H
+
+/*
+ * Read-copy update.
+ *
+ * Readers of an RCU protected structure take no lock and write nothing
+ * shared; they only must not sleep while they hold pointers into it.
+ * A writer unlinks an object under whatever lock it normally uses and
+ * hands it to call_rcu(), which calls back once every CPU has passed
+ * through a quiescent state (a context switch, user mode or the idle
+ * loop), by which time no reader can still see the object.
+ *
+ * The callbacks are run from a tasklet and must not sleep.
+ */
+
+#include <linux/threads.h>
+#include <linux/list.h>
+#include <linux/cache.h>
+#include <asm/system.h>
+
+struct rcu_head {
+	struct list_head list;
+	void (*func)(void *arg);
+	void *arg;
+};
+
+#define RCU_HEAD_INIT(head)	{ LIST_HEAD_INIT(head.list), NULL, NULL }
+#define INIT_RCU_HEAD(ptr) do { \
+	INIT_LIST_HEAD(&(ptr)->list); (ptr)->func = NULL; (ptr)->arg = NULL; \
+} while (0)
+
+/* Per CPU state, see kernel/rcupdate.c */
+struct rcu_data {
+	long qsctr;			/* quiescent states passed */
+	long last_qsctr;		/* qsctr when the batch was noticed */
+	long batch;			/* batch curlist waits for */
+	struct list_head nxtlist;	/* queued since curlist was started */
+	struct list_head curlist;	/* waiting for the end of batch */
+} ____cacheline_aligned_in_smp;
+
+extern struct rcu_data rcu_data[NR_CPUS];
+
+/*
+ * Called by the scheduler on every pass through schedule(): whoever
+ * calls it can not be in a read side critical section.
+ */
+#define rcu_qsctr_inc(cpu)	(rcu_data[(cpu)].qsctr++)
+
+/*
+ * The read side. Nothing to do without kernel preemption, they are
+ * there to show where a reader may use RCU protected pointers.
+ */
+#define rcu_read_lock()		do { } while (0)
+#define rcu_read_unlock()	do { } while (0)
+
+/*
+ * Between loading a pointer to an object published with a write
+ * barrier and loading its contents. Only the Alpha can reorder those.
+ */
+#ifdef __alpha__
+#define rcu_read_barrier()	smp_rmb()
+#else
+#define rcu_read_barrier()	barrier()
+#endif
+
+/*
+ * list_add() for a list that readers walk without the lock: the new
+ * entry is complete before it can be reached.
+ */
+static inline void list_add_rcu(struct list_head *new, struct list_head *head)
+{
+	new->next = head->next;
+	new->prev = head;
+	smp_wmb();
+	head->next->prev = new;
+	head->next = new;
+}
+
+extern void call_rcu(struct rcu_head *head, void (*func)(void *arg), void *arg);
+extern void synchronize_kernel(void);
+extern void rcu_check_callbacks(int cpu, int user);
+extern void rcu_init(void);
+
+#endif /* __LINUX_RCUPDATE_H */
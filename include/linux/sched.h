@@ -70,7 +70,7 @@ extern unsigned long avenrun[];		/* Load averages */
 #define CT_TO_SECS(x)	((x) / HZ)
 #define CT_TO_USECS(x)	(((x) % HZ) * 1000000/HZ)
 
-extern int nr_running, nr_threads;
+extern int nr_threads;
 extern int last_pid;
 
 #include <linux/fs.h>
@@ -120,11 +120,19 @@ extern int last_pid;
  */
 #define SCHED_YIELD		0x10
 
+/*
+ * Run-queue priority slots: 0..MAX_RT_PRIO-1 for SCHED_FIFO/SCHED_RR,
+ * the 40 nice levels of SCHED_OTHER above that.
+ */
+#define MAX_RT_PRIO		100
+#define MAX_PRIO		(MAX_RT_PRIO + 40)
+
 struct sched_param {
 	int sched_priority;
 };
 
 struct completion;
+struct prio_array;
 
 #ifdef __KERNEL__
 
@@ -137,11 +145,13 @@ struct completion;
  * a separate lock).
  */
 extern rwlock_t tasklist_lock;
-extern spinlock_t runqueue_lock;
 extern spinlock_t mmlist_lock;
 
 extern void sched_init(void);
 extern void init_idle(void);
+extern unsigned long nr_running(void);
+extern void del_from_runqueue(struct task_struct * p);
+extern void rebalance_tick(int idle);
 extern void show_state(void);
 extern void cpu_init (void);
 extern void trap_init(void);
@@ -224,10 +234,13 @@ struct mm_struct {
 	unsigned long rss, total_vm, locked_vm;
 	unsigned long def_flags;
 	unsigned long cpu_vm_mask;
-	unsigned long swap_address;
 
 	unsigned dumpable:1;
 
+	/* Asynchronous I/O contexts, see fs/aio.c */
+	struct kioctx *ioctx_list;
+	rwlock_t ioctx_list_lock;
+
 	/* Architecture-specific MM context */
 	mm_context_t context;
 };
@@ -246,6 +259,7 @@ extern int mmlist_nr;
 	mmap_sem:	__RWSEM_INITIALIZER(name.mmap_sem), \
 	page_table_lock: SPIN_LOCK_UNLOCKED, 		\
 	mmlist:		LIST_HEAD_INIT(name.mmlist),	\
+	ioctx_list_lock: RW_LOCK_UNLOCKED,		\
 }
 
 struct signal_struct {
@@ -315,6 +329,8 @@ struct task_struct {
 	 * that's just fine.)
 	 */
 	struct list_head run_list;
+	int prio;
+	struct prio_array *array;
 	unsigned long sleep_time;
 
 	struct task_struct *next_task, *prev_task;
@@ -452,6 +468,7 @@ struct task_struct {
     counter:		DEF_COUNTER,					\
     nice:		DEF_NICE,					\
     policy:		SCHED_OTHER,					\
+    prio:		MAX_PRIO,					\
     mm:			NULL,						\
     active_mm:		&init_mm,					\
     cpus_allowed:	-1,						\
@@ -838,14 +855,6 @@ do {									\
 #define next_thread(p) \
 	list_entry((p)->thread_group.next, struct task_struct, thread_group)
 
-static inline void del_from_runqueue(struct task_struct * p)
-{
-	nr_running--;
-	p->sleep_time = jiffies;
-	list_del(&p->run_list);
-	p->run_list.next = NULL;
-}
-
 static inline int task_on_runqueue(struct task_struct *p)
 {
 	return (p->run_list.next != NULL);
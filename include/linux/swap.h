@@ -82,18 +82,18 @@ extern int nr_swap_pages;
 extern unsigned int nr_free_pages(void);
 extern unsigned int nr_inactive_clean_pages(void);
 extern unsigned int nr_free_buffer_pages(void);
-extern int nr_active_pages;
-extern int nr_inactive_dirty_pages;
+extern unsigned int nr_active_pages(void);
+extern unsigned int nr_inactive_dirty_pages(void);
 extern atomic_t nr_async_pages;
 extern struct address_space swapper_space;
 extern atomic_t page_cache_size;
 extern atomic_t buffermem_pages;
-extern spinlock_t pagecache_lock;
 extern void __remove_inode_page(struct page *);
 
 /* Incomplete types for prototype declarations: */
 struct task_struct;
 struct vm_area_struct;
+struct mm_struct;
 struct sysinfo;
 
 struct zone_t;
@@ -110,12 +110,43 @@ extern void deactivate_page_nolock(struct page *);
 extern void activate_page(struct page *);
 extern void activate_page_nolock(struct page *);
 extern void lru_cache_add(struct page *);
+extern void lru_cache_add_anon(struct page *);
 extern void __lru_cache_del(struct page *);
 extern void lru_cache_del(struct page *);
+extern void lru_add_drain(void);
 extern void recalculate_vm_stats(void);
 extern void swap_setup(void);
 
+/* linux/mm/rmap.c */
+extern void page_add_rmap(struct page *, pte_t *, struct mm_struct *, unsigned long);
+extern void page_remove_rmap(struct page *, pte_t *);
+extern int page_referenced(struct page *);
+extern int page_mapped_get(struct page *);
+extern int try_to_unmap(struct page *);
+extern void rmap_init(void);
+
+/* try_to_unmap() return values */
+#define SWAP_SUCCESS	0	/* no mappings left */
+#define SWAP_AGAIN	1	/* some mappings were busy, try later */
+#define SWAP_FAIL	2	/* the page can not be unmapped now */
+
+/*
+ * Pageout statistics, shown in /proc/vmscan. A pass is one call of
+ * the page freeing code by kswapd or by an allocating process.
+ */
+struct vmscan_stat {
+	unsigned long passes;
+	unsigned long scanned;		/* pages looked at on the lists */
+	unsigned long unmapped;		/* pages unmapped from all users */
+	unsigned long unmap_failed;	/* locked or recently used mappings */
+	unsigned long reclaimed;	/* pages made freeable */
+	unsigned long last_scanned;	/* the same two for the last pass */
+	unsigned long last_reclaimed;
+	unsigned long untracked;	/* mappings without a pte chain entry */
+};
+
 /* linux/mm/vmscan.c */
+extern struct vmscan_stat vmscan_stat;
 extern struct page * reclaim_page(zone_t *);
 extern wait_queue_head_t kswapd_wait;
 extern wait_queue_head_t kreclaimd_wait;
@@ -133,7 +164,7 @@ extern void rw_swap_page_nolock(int, swp_entry_t, char *);
 
 /* linux/mm/swap_state.c */
 extern void show_swap_cache_info(void);
-extern void add_to_swap_cache(struct page *, swp_entry_t);
+extern int add_to_swap_cache(struct page *, swp_entry_t);
 extern int swap_check_entry(unsigned long);
 extern struct page * lookup_swap_cache(swp_entry_t);
 extern struct page * read_swap_cache_async(swp_entry_t);
@@ -181,8 +212,6 @@ extern unsigned long swap_cache_find_total;
 extern unsigned long swap_cache_find_success;
 #endif
 
-extern spinlock_t pagemap_lru_lock;
-
 /*
  * Page aging defines.
  * Since we do exponential decay of the page age, we
@@ -194,7 +223,8 @@ extern spinlock_t pagemap_lru_lock;
 
 /*
  * List add/del helper macros. These must be called
- * with the pagemap_lru_lock held!
+ * with page->zone->lru_lock held! Pages may be taken
+ * off the lists with a zero count, by __free_pages_ok().
  */
 #define DEBUG_ADD_PAGE \
 	if (PageActive(page) || PageInactiveDirty(page) || \
@@ -207,16 +237,15 @@ extern spinlock_t pagemap_lru_lock;
 	DEBUG_ADD_PAGE \
 	ZERO_PAGE_BUG \
 	SetPageActive(page); \
-	list_add(&(page)->lru, &active_list); \
-	nr_active_pages++; \
+	list_add(&(page)->lru, &page->zone->active_list); \
+	page->zone->active_pages++; \
 }
 
 #define add_page_to_inactive_dirty_list(page) { \
 	DEBUG_ADD_PAGE \
 	ZERO_PAGE_BUG \
 	SetPageInactiveDirty(page); \
-	list_add(&(page)->lru, &inactive_dirty_list); \
-	nr_inactive_dirty_pages++; \
+	list_add(&(page)->lru, &page->zone->inactive_dirty_list); \
 	page->zone->inactive_dirty_pages++; \
 }
 
@@ -231,18 +260,15 @@ extern spinlock_t pagemap_lru_lock;
 #define del_page_from_active_list(page) { \
 	list_del(&(page)->lru); \
 	ClearPageActive(page); \
-	nr_active_pages--; \
+	page->zone->active_pages--; \
 	DEBUG_ADD_PAGE \
-	ZERO_PAGE_BUG \
 }
 
 #define del_page_from_inactive_dirty_list(page) { \
 	list_del(&(page)->lru); \
 	ClearPageInactiveDirty(page); \
-	nr_inactive_dirty_pages--; \
 	page->zone->inactive_dirty_pages--; \
 	DEBUG_ADD_PAGE \
-	ZERO_PAGE_BUG \
 }
 
 #define del_page_from_inactive_clean_list(page) { \
@@ -250,7 +276,6 @@ extern spinlock_t pagemap_lru_lock;
 	ClearPageInactiveClean(page); \
 	page->zone->inactive_clean_pages--; \
 	DEBUG_ADD_PAGE \
-	ZERO_PAGE_BUG \
 }
 
 /*
@@ -23,10 +23,14 @@
  */
 #define WAITQUEUE_DEBUG 0
 
+struct __wait_queue;
+typedef void (*wait_queue_func_t)(struct __wait_queue *wait, unsigned int mode, int sync);
+
 struct __wait_queue {
 	unsigned int flags;
 #define WQ_FLAG_EXCLUSIVE	0x01
 	struct task_struct * task;
+	wait_queue_func_t func;
 	struct list_head task_list;
 #if WAITQUEUE_DEBUG
 	long __magic;
@@ -169,6 +173,23 @@ static inline void init_waitqueue_entry(wait_queue_t *q, struct task_struct *p)
 #endif
 	q->flags = 0;
 	q->task = p;
+	q->func = NULL;
+#if WAITQUEUE_DEBUG
+	q->__magic = (long)&q->__magic;
+#endif
+}
+
+/*
+ * A wait queue entry without a task: wakeups on the queue call
+ * 'func' (with the queue lock held and interrupts off) instead of
+ * waking anybody up. Such entries are never exclusive.
+ */
+static inline void init_waitqueue_func_entry(wait_queue_t *q,
+					     wait_queue_func_t func)
+{
+	q->flags = 0;
+	q->task = NULL;
+	q->func = func;
 #if WAITQUEUE_DEBUG
 	q->__magic = (long)&q->__magic;
 #endif
@@ -227,6 +227,11 @@ extern u32  __fib_res_prefsrc(struct fib_result *res);
 /* Exported by fib_hash.c */
 extern struct fib_table *fib_hash_init(int id);
 
+#ifdef CONFIG_IP_FIB_TRIE
+/* Exported by fib_trie.c */
+extern struct fib_table *fib_trie_init(int id);
+#endif
+
 #ifdef CONFIG_IP_MULTIPLE_TABLES
 /* Exported by fib_rules.c */
 
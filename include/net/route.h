@@ -105,6 +105,11 @@ struct rt_cache_stat
         unsigned int out_hit;
         unsigned int out_slow_tot;
         unsigned int out_slow_mc;
+        unsigned int in_lookup;
+        unsigned int out_lookup;
+        unsigned int gc_total;
+        unsigned int gc_evict;
+        unsigned int chain_evict;
 };
 
 extern struct ip_rt_acct *ip_rt_acct;
@@ -514,6 +514,7 @@ struct sock {
 	struct dst_entry	*dst_cache;	/* Destination cache			*/
 	rwlock_t		dst_lock;
 	atomic_t		rmem_alloc;	/* Receive queue bytes committed	*/
+	atomic_t		drops;		/* Datagrams refused by receive queue	*/
 	struct sk_buff_head	receive_queue;	/* Incoming packets			*/
 	atomic_t		wmem_alloc;	/* Transmit queue bytes committed	*/
 	struct sk_buff_head	write_queue;	/* Packet sending queue			*/
@@ -36,6 +36,15 @@ extern rwlock_t udp_hash_lock;
 
 extern int udp_port_rover;
 
+/* Unicast receive does not walk udp_hash; it looks in a second, larger
+ * table keyed on local port and address, or on all four of port and
+ * address pairs once a socket is connected.  Sockets are linked into it
+ * through ->bind_next while they own a port in udp_hash.
+ */
+extern void __udp_demux_hash(struct sock *sk);
+extern void __udp_demux_unhash(struct sock *sk);
+extern void udp_demux_rehash(struct sock *sk);
+
 static inline int udp_lport_inuse(u16 num)
 {
 	struct sock *sk = udp_hash[num & (UDP_HTABLE_SIZE - 1)];
@@ -68,6 +77,7 @@ extern int	udp_sendmsg(struct sock *sk, struct msghdr *msg, int len);
 extern int	udp_rcv(struct sk_buff *skb);
 extern int	udp_ioctl(struct sock *sk, int cmd, unsigned long arg);
 extern int	udp_disconnect(struct sock *sk, int flags);
+extern void	udp_init(void);
 
 extern struct udp_mib udp_statistics[NR_CPUS*2];
 #define UDP_INC_STATS(field)		SNMP_INC_STATS(udp_statistics, field)
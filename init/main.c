@@ -26,8 +26,10 @@
 #include <linux/blk.h>
 #include <linux/hdreg.h>
 #include <linux/iobuf.h>
+#include <linux/bio.h>
 #include <linux/bootmem.h>
 #include <linux/tty.h>
+#include <linux/swap.h>
 
 #include <asm/io.h>
 #include <asm/bugs.h>
@@ -117,6 +119,7 @@ extern void ipc_init(void);
 
 extern void time_init(void);
 extern void softirq_init(void);
+extern void rcu_init(void);
 
 int rows, cols;
 
@@ -539,6 +542,7 @@ asmlinkage void __init start_kernel(void)
 	init_IRQ();
 	sched_init();
 	softirq_init();
+	rcu_init();
 	time_init();
 
 	/*
@@ -579,7 +583,9 @@ asmlinkage void __init start_kernel(void)
 	proc_caches_init();
 	vfs_caches_init(mempages);
 	buffer_init(mempages);
+	bio_init();
 	page_cache_init(mempages);
+	rmap_init();
 #if defined(CONFIG_ARCH_S390)
 	ccwcache_init();
 #endif
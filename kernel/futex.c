@@ -0,0 +1,253 @@
+/*
+ * linux/kernel/futex.c
+ *
+ * Fast user-space mutexes.
+ *
+ * User space does the uncontended lock and unlock with atomic
+ * instructions on a word of its own memory and only calls in here
+ * when there is contention: FUTEX_WAIT sleeps on the word if it
+ * still holds the value the caller last saw, FUTEX_WAKE wakes
+ * sleepers on it.
+ *
+ * Sleepers are kept in a hashed wait table, keyed by (mm, address)
+ * for private mappings and by (inode, page offset) for shared
+ * mappings, so that processes mapping the same file or shared
+ * memory segment at different addresses find each other.
+ *
+ * No reference is held on the mm or inode of a key. If a mapping
+ * goes away under a sleeper and the object is reused, the worst
+ * that can happen is a spurious wakeup, which callers must expect
+ * anyway.
+ */
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/time.h>
+#include <linux/futex.h>
+
+#include <asm/uaccess.h>
+
+#define FUTEX_HASHBITS	8
+
+/*
+ * 'object' is the mm (private) or the inode (shared), 'word' the page
+ * aligned address or the page index in the file, 'offset' the offset
+ * of the futex within that page.
+ */
+struct futex_key {
+	void *object;
+	unsigned long word;
+	unsigned int offset;
+};
+
+/* One per sleeping task, lives on its stack */
+struct futex_q {
+	struct list_head list;
+	wait_queue_head_t waiters;
+	struct futex_key key;
+};
+
+struct futex_hash_bucket {
+	spinlock_t lock;
+	struct list_head chain;
+} ____cacheline_aligned_in_smp;
+
+static struct futex_hash_bucket futex_queues[1 << FUTEX_HASHBITS];
+
+static inline struct futex_hash_bucket *hash_futex(struct futex_key *key)
+{
+	unsigned long h = (unsigned long) key->object / L1_CACHE_BYTES;
+
+	h += key->word * 31 + key->offset;
+	h ^= h >> FUTEX_HASHBITS;
+	h ^= h >> (2 * FUTEX_HASHBITS);
+	return futex_queues + (h & ((1 << FUTEX_HASHBITS) - 1));
+}
+
+static inline int match_futex_key(struct futex_key *a, struct futex_key *b)
+{
+	return a->object == b->object && a->word == b->word &&
+		a->offset == b->offset;
+}
+
+/*
+ * Work out the key for a user address. The futex word must be
+ * naturally aligned and lie in a readable mapping.
+ */
+static int get_futex_key(unsigned long uaddr, struct futex_key *key)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	int error = -EFAULT;
+
+	if (uaddr & (sizeof(int) - 1))
+		return -EINVAL;
+
+	key->offset = uaddr & ~PAGE_MASK;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, uaddr);
+	if (!vma || vma->vm_start > uaddr || !(vma->vm_flags & VM_READ))
+		goto out;
+
+	if ((vma->vm_flags & VM_SHARED) && vma->vm_file) {
+		key->object = vma->vm_file->f_dentry->d_inode;
+		key->word = vma->vm_pgoff +
+			((uaddr - vma->vm_start) >> PAGE_SHIFT);
+	} else {
+		key->object = mm;
+		key->word = uaddr & PAGE_MASK;
+	}
+	error = 0;
+out:
+	up_read(&mm->mmap_sem);
+	return error;
+}
+
+static void queue_me(struct futex_q *q, struct futex_key *key)
+{
+	struct futex_hash_bucket *bh = hash_futex(key);
+
+	q->key = *key;
+	spin_lock(&bh->lock);
+	list_add_tail(&q->list, &bh->chain);
+	spin_unlock(&bh->lock);
+}
+
+/*
+ * Returns 1 if we were still queued, 0 if a waker got to us first.
+ */
+static int unqueue_me(struct futex_q *q)
+{
+	struct futex_hash_bucket *bh = hash_futex(&q->key);
+	int ret = 0;
+
+	spin_lock(&bh->lock);
+	if (!list_empty(&q->list)) {
+		list_del(&q->list);
+		ret = 1;
+	}
+	spin_unlock(&bh->lock);
+	return ret;
+}
+
+static int futex_wake(unsigned long uaddr, int nr)
+{
+	struct futex_key key;
+	struct futex_hash_bucket *bh;
+	struct list_head *i, *next;
+	int error, woken = 0;
+
+	error = get_futex_key(uaddr, &key);
+	if (error)
+		return error;
+
+	bh = hash_futex(&key);
+	spin_lock(&bh->lock);
+	for (i = bh->chain.next; i != &bh->chain; i = next) {
+		struct futex_q *q = list_entry(i, struct futex_q, list);
+
+		next = i->next;
+		if (!match_futex_key(&q->key, &key))
+			continue;
+		/*
+		 * The sleeper takes the bucket lock before returning,
+		 * so q stays valid until we drop it.
+		 */
+		list_del_init(&q->list);
+		wake_up_all(&q->waiters);
+		if (++woken >= nr)
+			break;
+	}
+	spin_unlock(&bh->lock);
+	return woken;
+}
+
+static int futex_wait(unsigned long uaddr, int val, long timeout)
+{
+	struct futex_key key;
+	struct futex_q q;
+	int error, curval;
+	DECLARE_WAITQUEUE(wait, current);
+
+	error = get_futex_key(uaddr, &key);
+	if (error)
+		return error;
+
+	init_waitqueue_head(&q.waiters);
+	add_wait_queue(&q.waiters, &wait);
+	queue_me(&q, &key);
+
+	/*
+	 * We are on the hash chain before looking at the value, so a
+	 * FUTEX_WAKE issued after user space changed it cannot be lost.
+	 * get_user() may fault and sleep, which is fine here.
+	 */
+	if (get_user(curval, (int *) uaddr)) {
+		error = -EFAULT;
+		goto out_unqueue;
+	}
+	if (curval != val) {
+		error = -EWOULDBLOCK;
+		goto out_unqueue;
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (!list_empty(&q.list))
+		timeout = schedule_timeout(timeout);
+	set_current_state(TASK_RUNNING);
+
+	/* Woken up for real, or timeout/signal? */
+	if (!unqueue_me(&q)) {
+		error = 0;
+		goto out;
+	}
+	error = timeout ? -EINTR : -ETIMEDOUT;
+	goto out;
+
+out_unqueue:
+	/* A wakeup we swallowed here is harmless: we never slept */
+	unqueue_me(&q);
+out:
+	remove_wait_queue(&q.waiters, &wait);
+	return error;
+}
+
+asmlinkage long sys_futex(void *uaddr, int op, int val, struct timespec *utime)
+{
+	long timeout = MAX_SCHEDULE_TIMEOUT;
+
+	switch (op) {
+	case FUTEX_WAIT:
+		if (utime) {
+			struct timespec t;
+
+			if (copy_from_user(&t, utime, sizeof(t)))
+				return -EFAULT;
+			if (t.tv_nsec >= 1000000000L || t.tv_nsec < 0 ||
+			    t.tv_sec < 0)
+				return -EINVAL;
+			timeout = timespec_to_jiffies(&t) + 1;
+		}
+		return futex_wait((unsigned long) uaddr, val, timeout);
+	case FUTEX_WAKE:
+		return futex_wake((unsigned long) uaddr, val);
+	}
+	return -EINVAL;
+}
+
+static int __init futex_init(void)
+{
+	int i;
+
+	for (i = 0; i < (1 << FUTEX_HASHBITS); i++) {
+		spin_lock_init(&futex_queues[i].lock);
+		INIT_LIST_HEAD(&futex_queues[i].chain);
+	}
+	return 0;
+}
+
+__initcall(futex_init);
@@ -0,0 +1,223 @@
+/*
+ * linux/kernel/rcupdate.c
+ *
+ * Read-copy update.
+ *
+ * Callbacks are queued on the CPU that calls call_rcu() and are run
+ * there in batches. A batch is finished when every CPU has gone
+ * through a quiescent state after it was started: each CPU counts its
+ * context switches (from schedule()) and the timer ticks it spends in
+ * user mode or idle (from update_process_times()), and reports to
+ * rcu_ctrlblk once the count has moved since it noticed the batch.
+ * Callbacks wait for the batch after the one that was running when
+ * they were queued, which may have started before them.
+ *
+ * All of the bookkeeping is done by a per-CPU tasklet that the timer
+ * tick schedules while the CPU has callbacks or owes a quiescent
+ * state, so nothing is done on a CPU that does not use RCU.
+ */
+
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/rcupdate.h>
+#include <linux/module.h>
+
+#include <asm/bitops.h>
+
+struct rcu_ctrlblk {
+	spinlock_t mutex;
+	long curbatch;			/* batch in progress */
+	long maxbatch;			/* last batch asked for */
+	unsigned long rcu_cpu_mask;	/* CPUs that still owe curbatch */
+};
+
+static struct rcu_ctrlblk rcu_ctrlblk = { SPIN_LOCK_UNLOCKED, 1, 1, 0 };
+
+struct rcu_data rcu_data[NR_CPUS];
+static struct tasklet_struct rcu_tasklet[NR_CPUS];
+
+#define RCU_QSCTR_INVALID	0
+
+#define rcu_batch_before(a,b)	((long) ((a) - (b)) < 0)
+#define rcu_batch_after(a,b)	((long) ((b) - (a)) < 0)
+
+/**
+ * call_rcu - queue a callback for after the next grace period
+ * @head: structure used for queueing, usually inside the object
+ * @func: function to call
+ * @arg: its argument
+ *
+ * @func is called from a tasklet once all CPUs have passed through
+ * a quiescent state, when no reader can be using anything the caller
+ * unlinked before. May be called from interrupts.
+ */
+void call_rcu(struct rcu_head *head, void (*func)(void *arg), void *arg)
+{
+	int cpu = smp_processor_id();
+	unsigned long flags;
+
+	head->func = func;
+	head->arg = arg;
+	local_irq_save(flags);
+	list_add_tail(&head->list, &rcu_data[cpu].nxtlist);
+	local_irq_restore(flags);
+}
+
+static void rcu_do_batch(struct list_head *list)
+{
+	struct list_head *entry;
+	struct rcu_head *head;
+
+	while (!list_empty(list)) {
+		entry = list->next;
+		list_del(entry);
+		head = list_entry(entry, struct rcu_head, list);
+		head->func(head->arg);
+	}
+}
+
+static unsigned long rcu_online_cpus(void)
+{
+	unsigned long mask = 0;
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++)
+		mask |= 1UL << cpu_logical_map(i);
+	return mask;
+}
+
+/*
+ * Ask for @newbatch and start the next batch if none is in progress.
+ * Called with rcu_ctrlblk.mutex held.
+ */
+static void rcu_start_batch(long newbatch)
+{
+	if (rcu_batch_before(rcu_ctrlblk.maxbatch, newbatch))
+		rcu_ctrlblk.maxbatch = newbatch;
+	if (rcu_batch_before(rcu_ctrlblk.maxbatch, rcu_ctrlblk.curbatch) ||
+	    rcu_ctrlblk.rcu_cpu_mask)
+		return;
+	rcu_ctrlblk.rcu_cpu_mask = rcu_online_cpus();
+}
+
+/*
+ * Report a quiescent state of this CPU for the current batch, if it
+ * owes one and has passed through one since it first looked. The
+ * timer tick may bump qsctr under us, at worst one is missed.
+ */
+static void rcu_check_quiescent_state(int cpu)
+{
+	struct rcu_data *rdp = &rcu_data[cpu];
+
+	if (!test_bit(cpu, &rcu_ctrlblk.rcu_cpu_mask))
+		return;
+	if (rdp->last_qsctr == RCU_QSCTR_INVALID) {
+		rdp->last_qsctr = rdp->qsctr;
+		return;
+	}
+	if (rdp->qsctr == rdp->last_qsctr)
+		return;
+
+	spin_lock(&rcu_ctrlblk.mutex);
+	if (!test_bit(cpu, &rcu_ctrlblk.rcu_cpu_mask))
+		goto out;
+	clear_bit(cpu, &rcu_ctrlblk.rcu_cpu_mask);
+	rdp->last_qsctr = RCU_QSCTR_INVALID;
+	if (rcu_ctrlblk.rcu_cpu_mask)
+		goto out;
+	rcu_ctrlblk.curbatch++;
+	rcu_start_batch(rcu_ctrlblk.maxbatch);
+out:
+	spin_unlock(&rcu_ctrlblk.mutex);
+}
+
+static void rcu_process_callbacks(unsigned long data)
+{
+	int cpu = smp_processor_id();
+	struct rcu_data *rdp = &rcu_data[cpu];
+	LIST_HEAD(list);
+
+	if (!list_empty(&rdp->curlist) &&
+	    rcu_batch_after(rcu_ctrlblk.curbatch, rdp->batch)) {
+		list_splice(&rdp->curlist, &list);
+		INIT_LIST_HEAD(&rdp->curlist);
+	}
+
+	local_irq_disable();
+	if (!list_empty(&rdp->nxtlist) && list_empty(&rdp->curlist)) {
+		list_splice(&rdp->nxtlist, &rdp->curlist);
+		INIT_LIST_HEAD(&rdp->nxtlist);
+		local_irq_enable();
+
+		spin_lock(&rcu_ctrlblk.mutex);
+		rdp->batch = rcu_ctrlblk.curbatch + 1;
+		rcu_start_batch(rdp->batch);
+		spin_unlock(&rcu_ctrlblk.mutex);
+	} else
+		local_irq_enable();
+
+	rcu_check_quiescent_state(cpu);
+	if (!list_empty(&list))
+		rcu_do_batch(&list);
+}
+
+/*
+ * Called from the timer interrupt. @user is set when the tick
+ * interrupted user mode or the idle loop, which is a quiescent state.
+ */
+void rcu_check_callbacks(int cpu, int user)
+{
+	struct rcu_data *rdp = &rcu_data[cpu];
+
+	if (user)
+		rdp->qsctr++;
+	if (!list_empty(&rdp->curlist) || !list_empty(&rdp->nxtlist) ||
+	    test_bit(cpu, &rcu_ctrlblk.rcu_cpu_mask))
+		tasklet_schedule(&rcu_tasklet[cpu]);
+}
+
+struct rcu_synchronize {
+	struct rcu_head head;
+	struct completion completion;
+};
+
+static void wakeme_after_rcu(void *arg)
+{
+	struct rcu_synchronize *rcu = arg;
+
+	complete(&rcu->completion);
+}
+
+/**
+ * synchronize_kernel - wait for a grace period
+ *
+ * Sleeps until all readers that could have seen something the caller
+ * unlinked before are done.
+ */
+void synchronize_kernel(void)
+{
+	struct rcu_synchronize rcu;
+
+	init_completion(&rcu.completion);
+	call_rcu(&rcu.head, wakeme_after_rcu, &rcu);
+	wait_for_completion(&rcu.completion);
+}
+
+void __init rcu_init(void)
+{
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		rcu_data[i].last_qsctr = RCU_QSCTR_INVALID;
+		INIT_LIST_HEAD(&rcu_data[i].nxtlist);
+		INIT_LIST_HEAD(&rcu_data[i].curlist);
+		tasklet_init(&rcu_tasklet[i], rcu_process_callbacks, 0UL);
+	}
+}
+
+EXPORT_SYMBOL(call_rcu);
+EXPORT_SYMBOL(synchronize_kernel);
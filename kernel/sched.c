@@ -26,6 +26,7 @@
 #include <linux/interrupt.h>
 #include <linux/kernel_stat.h>
 #include <linux/completion.h>
+#include <linux/rcupdate.h>
 
 #include <asm/uaccess.h>
 #include <asm/mmu_context.h>
@@ -72,255 +73,274 @@ extern void mem_use(void);
  *	Init task must be ok at boot for the ix86 as we will check its signals
  *	via the SMP irq return path.
  */
- 
+
 struct task_struct * init_tasks[NR_CPUS] = {&init_task, };
 
 /*
  * The tasklist_lock protects the linked list of processes.
  *
- * The runqueue_lock locks the parts that actually access
- * and change the run-queues, and have to be interrupt-safe.
+ * Every CPU has its own run-queue, protected by its own rq->lock,
+ * which has to be interrupt-safe. If two run-queue locks are needed
+ * at once they are taken in ascending address order, see
+ * double_rq_lock().
  *
- * If both locks are to be concurrently held, the runqueue_lock
+ * If both locks are to be concurrently held, the run-queue lock
  * nests inside the tasklist_lock.
  *
  * task->alloc_lock nests inside tasklist_lock.
  */
-spinlock_t runqueue_lock __cacheline_aligned = SPIN_LOCK_UNLOCKED;  /* inner */
 rwlock_t tasklist_lock __cacheline_aligned = RW_LOCK_UNLOCKED;	/* outer */
 
-static LIST_HEAD(runqueue_head);
+#define BITMAP_SIZE	((MAX_PRIO + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/*
+ * A priority array has one list per priority slot plus a bitmap of
+ * the non-empty lists, so finding the best runnable task is a bitmap
+ * search followed by a list_head dereference - no matter how many
+ * tasks are runnable.
+ *
+ * Each run-queue has two arrays: tasks that still have timeslice
+ * left live on the 'active' one, tasks that used it up wait on the
+ * 'expired' one. When the active array drains the two are switched,
+ * which replaces the old for_each_task() counter recalculation.
+ */
+struct runqueue;
+
+struct prio_array {
+	int nr_active;
+	struct runqueue *rq;
+	unsigned long bitmap[BITMAP_SIZE];
+	struct list_head queue[MAX_PRIO];
+};
 
 /*
  * We align per-CPU scheduling data on cacheline boundaries,
  * to prevent cacheline ping-pong.
  */
-static union {
-	struct schedule_data {
-		struct task_struct * curr;
-		cycles_t last_schedule;
-	} schedule_data;
-	char __pad [SMP_CACHE_BYTES];
-} aligned_data [NR_CPUS] __cacheline_aligned = { {{&init_task,0}}};
+struct runqueue {
+	spinlock_t lock;
+	unsigned long nr_running;
+	struct task_struct *curr;
+	struct prio_array *active, *expired, arrays[2];
+	cycles_t last_schedule;
+	unsigned long last_balance;
+} ____cacheline_aligned;
+
+static struct runqueue runqueues[NR_CPUS] __cacheline_aligned;
 
-#define cpu_curr(cpu) aligned_data[(cpu)].schedule_data.curr
-#define last_schedule(cpu) aligned_data[(cpu)].schedule_data.last_schedule
+#define cpu_rq(cpu)		(runqueues + (cpu))
+#define this_rq()		cpu_rq(smp_processor_id())
+#define task_rq(p)		cpu_rq((p)->processor)
+#define cpu_curr(cpu)		(cpu_rq(cpu)->curr)
+#define last_schedule(cpu)	(cpu_rq(cpu)->last_schedule)
+
+#define rt_task(p)		((p)->policy & (SCHED_FIFO | SCHED_RR))
 
 struct kernel_stat kstat;
 
 #ifdef CONFIG_SMP
 
 #define idle_task(cpu) (init_tasks[cpu_number_map(cpu)])
-#define can_schedule(p,cpu) ((!(p)->has_cpu) && \
-				((p)->cpus_allowed & (1 << cpu)))
+#define task_allowed(p,cpu) ((p)->cpus_allowed & (1UL << (cpu)))
 
 #else
 
 #define idle_task(cpu) (&init_task)
-#define can_schedule(p,cpu) (1)
+#define task_allowed(p,cpu) (1)
 
 #endif
 
 void scheduling_functions_start_here(void) { }
 
 /*
- * This is the function that decides how desirable a process is..
- * You can weigh different processes against each other depending
- * on what CPU they've run on lately etc to try to handle cache
- * and TLB miss penalties.
- *
- * Return values:
- *	 -1000: never select this
- *	     0: out of time, recalculate counters (but it might still be
- *		selected)
- *	   +ve: "goodness" value (the larger, the better)
- *	 +1000: realtime process, select this.
+ * Realtime tasks occupy the slots below MAX_RT_PRIO, ordered by
+ * rt_priority; SCHED_OTHER tasks are ordered by their nice value.
+ * A lower slot means a higher priority.
  */
+static inline int effective_prio(struct task_struct * p)
+{
+	if (rt_task(p))
+		return MAX_RT_PRIO - 1 - p->rt_priority;
+	return MAX_RT_PRIO + 20 + p->nice;
+}
 
-static inline int goodness(struct task_struct * p, int this_cpu, struct mm_struct *this_mm)
+static inline int sched_find_first_bit(unsigned long *b)
 {
-	int weight;
+	int i;
 
-	/*
-	 * select the current process after every other
-	 * runnable process, but before the idle thread.
-	 * Also, dont trigger a counter recalculation.
-	 */
-	weight = -1;
-	if (p->policy & SCHED_YIELD)
-		goto out;
+	for (i = 0; i < BITMAP_SIZE; i++)
+		if (b[i])
+			return i * BITS_PER_LONG + ffz(~b[i]);
+	return MAX_PRIO;
+}
 
-	/*
-	 * Non-RT process - normal case first.
-	 */
-	if (p->policy == SCHED_OTHER) {
-		/*
-		 * Give the process a first-approximation goodness value
-		 * according to the number of clock-ticks it has left.
-		 *
-		 * Don't do any other calculations if the time slice is
-		 * over..
-		 */
-		weight = p->counter;
-		if (!weight)
-			goto out;
-			
-#ifdef CONFIG_SMP
-		/* Give a largish advantage to the same processor...   */
-		/* (this is equivalent to penalizing other processors) */
-		if (p->processor == this_cpu)
-			weight += PROC_CHANGE_PENALTY;
-#endif
+static inline void enqueue_task(struct task_struct * p, struct prio_array *array)
+{
+	list_add_tail(&p->run_list, array->queue + p->prio);
+	set_bit(p->prio, array->bitmap);
+	array->nr_active++;
+	p->array = array;
+}
 
-		/* .. and a slight advantage to the current MM */
-		if (p->mm == this_mm || !p->mm)
-			weight += 1;
-		weight += 20 - p->nice;
-		goto out;
+static inline void dequeue_task(struct task_struct * p, struct prio_array *array)
+{
+	array->nr_active--;
+	list_del(&p->run_list);
+	if (list_empty(array->queue + p->prio))
+		clear_bit(p->prio, array->bitmap);
+}
+
+/*
+ * Put a task on a run-queue. A SCHED_OTHER task that comes back
+ * without timeslice goes straight to the expired array with a fresh
+ * one.
+ */
+static inline void activate_task(struct task_struct * p, struct runqueue *rq)
+{
+	struct prio_array *array = rq->active;
+
+	p->prio = effective_prio(p);
+	if (!p->counter && !(p->policy & SCHED_FIFO)) {
+		p->counter = NICE_TO_TICKS(p->nice);
+		if (!rt_task(p))
+			array = rq->expired;
 	}
+	enqueue_task(p, array);
+	rq->nr_running++;
+}
 
-	/*
-	 * Realtime process, select the first one on the
-	 * runqueue (taking priorities within processes
-	 * into account).
-	 */
-	weight = 1000 + p->rt_priority;
-out:
-	return weight;
+static inline void deactivate_task(struct task_struct * p, struct runqueue *rq)
+{
+	rq->nr_running--;
+	p->sleep_time = jiffies;
+	dequeue_task(p, p->array);
+	p->array = NULL;
+	p->run_list.next = NULL;
 }
 
 /*
- * the 'goodness value' of replacing a process on a given CPU.
- * positive value means 'replace', zero or negative means 'dont'.
+ * Move a queued task to the tail of its list in 'array', picking
+ * up any nice or policy change on the way.
  */
-static inline int preemption_goodness(struct task_struct * prev, struct task_struct * p, int cpu)
+static inline void requeue_task(struct task_struct * p, struct prio_array *array)
 {
-	return goodness(p, cpu, prev->active_mm) - goodness(prev, cpu, prev->active_mm);
+	dequeue_task(p, p->array);
+	p->prio = effective_prio(p);
+	enqueue_task(p, array);
 }
 
 /*
- * This is ugly, but reschedule_idle() is very timing-critical.
- * We are called with the runqueue spinlock held and we must
- * not claim the tasklist_lock.
+ * Does the woken task 'p' deserve the CPU more than 'curr'? Tasks
+ * of the same SCHED_OTHER priority compete on the timeslice they have
+ * left, as goodness() used to make them do.
  */
-static FASTCALL(void reschedule_idle(struct task_struct * p));
+static inline int preempts(struct task_struct * p, struct task_struct * curr)
+{
+	if (p->prio != curr->prio)
+		return p->prio < curr->prio;
+	return !rt_task(p) && p->counter > curr->counter + 1;
+}
 
-static void reschedule_idle(struct task_struct * p)
+static inline void resched_task(struct task_struct * p)
 {
 #ifdef CONFIG_SMP
-	int this_cpu = smp_processor_id();
-	struct task_struct *tsk, *target_tsk;
-	int cpu, best_cpu, i, max_prio;
-	cycles_t oldest_idle;
-
-	/*
-	 * shortcut if the woken up task's last CPU is
-	 * idle now.
-	 */
-	best_cpu = p->processor;
-	if (can_schedule(p, best_cpu)) {
-		tsk = idle_task(best_cpu);
-		if (cpu_curr(best_cpu) == tsk) {
-			int need_resched;
-send_now_idle:
-			/*
-			 * If need_resched == -1 then we can skip sending
-			 * the IPI altogether, tsk->need_resched is
-			 * actively watched by the idle thread.
-			 */
-			need_resched = tsk->need_resched;
-			tsk->need_resched = 1;
-			if ((best_cpu != this_cpu) && !need_resched)
-				smp_send_reschedule(best_cpu);
-			return;
-		}
-	}
-
 	/*
-	 * We know that the preferred CPU has a cache-affine current
-	 * process, lets try to find a new idle CPU for the woken-up
-	 * process. Select the least recently active idle CPU. (that
-	 * one will have the least active cache context.) Also find
-	 * the executing process which has the least priority.
+	 * If need_resched == -1 then we can skip sending
+	 * the IPI altogether, tsk->need_resched is
+	 * actively watched by the idle thread.
 	 */
-	oldest_idle = (cycles_t) -1;
-	target_tsk = NULL;
-	max_prio = 1;
+	int need_resched = p->need_resched;
 
-	for (i = 0; i < smp_num_cpus; i++) {
-		cpu = cpu_logical_map(i);
-		if (!can_schedule(p, cpu))
-			continue;
-		tsk = cpu_curr(cpu);
-		/*
-		 * We use the first available idle CPU. This creates
-		 * a priority list between idle CPUs, but this is not
-		 * a problem.
-		 */
-		if (tsk == idle_task(cpu)) {
-			if (last_schedule(cpu) < oldest_idle) {
-				oldest_idle = last_schedule(cpu);
-				target_tsk = tsk;
-			}
-		} else {
-			if (oldest_idle == -1ULL) {
-				int prio = preemption_goodness(tsk, p, cpu);
+	p->need_resched = 1;
+	if (!need_resched && p->processor != smp_processor_id())
+		smp_send_reschedule(p->processor);
+#else
+	p->need_resched = 1;
+#endif
+}
 
-				if (prio > max_prio) {
-					max_prio = prio;
-					target_tsk = tsk;
-				}
-			}
-		}
-	}
-	tsk = target_tsk;
-	if (tsk) {
-		if (oldest_idle != -1ULL) {
-			best_cpu = tsk->processor;
-			goto send_now_idle;
-		}
-		tsk->need_resched = 1;
-		if (tsk->processor != this_cpu)
-			smp_send_reschedule(tsk->processor);
+/*
+ * Lock the run-queue a task is on. The task may be moved to another
+ * run-queue while we spin, in which case we retry.
+ */
+static inline struct runqueue *task_rq_lock(struct task_struct * p, unsigned long *flags)
+{
+	struct runqueue *rq;
+
+repeat_lock_task:
+	rq = task_rq(p);
+	spin_lock_irqsave(&rq->lock, *flags);
+	if (rq != task_rq(p)) {
+		spin_unlock_irqrestore(&rq->lock, *flags);
+		goto repeat_lock_task;
 	}
-	return;
-		
-
-#else /* UP */
-	int this_cpu = smp_processor_id();
-	struct task_struct *tsk;
+	return rq;
+}
 
-	tsk = cpu_curr(this_cpu);
-	if (preemption_goodness(tsk, p, this_cpu) > 1)
-		tsk->need_resched = 1;
-#endif
+static inline void task_rq_unlock(struct runqueue *rq, unsigned long *flags)
+{
+	spin_unlock_irqrestore(&rq->lock, *flags);
 }
 
+#ifdef CONFIG_SMP
+
 /*
- * Careful!
- *
- * This has to add the process to the _beginning_ of the
- * run-queue, not the end. See the comment about "This is
- * subtle" in the scheduler proper..
+ * Interrupts have to be disabled by the caller.
  */
-static inline void add_to_runqueue(struct task_struct * p)
+static inline void double_rq_lock(struct runqueue *rq1, struct runqueue *rq2)
 {
-	list_add(&p->run_list, &runqueue_head);
-	nr_running++;
+	if (rq1 == rq2)
+		spin_lock(&rq1->lock);
+	else if (rq1 < rq2) {
+		spin_lock(&rq1->lock);
+		spin_lock(&rq2->lock);
+	} else {
+		spin_lock(&rq2->lock);
+		spin_lock(&rq1->lock);
+	}
 }
 
-static inline void move_last_runqueue(struct task_struct * p)
+static inline void double_rq_unlock(struct runqueue *rq1, struct runqueue *rq2)
 {
-	list_del(&p->run_list);
-	list_add_tail(&p->run_list, &runqueue_head);
+	spin_unlock(&rq1->lock);
+	if (rq1 != rq2)
+		spin_unlock(&rq2->lock);
 }
 
-static inline void move_first_runqueue(struct task_struct * p)
+/*
+ * Pick the run-queue a woken task should be put on. Synchronous
+ * wakeups stay on the waker's CPU (it is about to sleep), otherwise
+ * the task's previous CPU is preferred unless it is busy and some
+ * other allowed CPU is idle. The unlocked peeks at other CPUs are
+ * only hints.
+ */
+static struct runqueue * wake_target(struct task_struct * p, int synchronous)
 {
-	list_del(&p->run_list);
-	list_add(&p->run_list, &runqueue_head);
+	int this_cpu = smp_processor_id(), cpu = p->processor;
+	int i, allowed = -1;
+
+	if (synchronous && task_allowed(p, this_cpu))
+		return cpu_rq(this_cpu);
+	if (task_allowed(p, cpu) && cpu_curr(cpu) == idle_task(cpu))
+		return cpu_rq(cpu);
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		int c = cpu_logical_map(i);
+
+		if (!task_allowed(p, c))
+			continue;
+		if (cpu_curr(c) == idle_task(c))
+			return cpu_rq(c);
+		if (allowed < 0)
+			allowed = c;
+	}
+	if (task_allowed(p, cpu) || allowed < 0)
+		return cpu_rq(cpu);
+	return cpu_rq(allowed);
 }
 
+#endif /* CONFIG_SMP */
+
 /*
  * Wake up a process. Put it on the run-queue if it's not
  * already there.  The "current" process is always on the
@@ -332,21 +352,44 @@ static inline void move_first_runqueue(struct task_struct * p)
 static inline int try_to_wake_up(struct task_struct * p, int synchronous)
 {
 	unsigned long flags;
+	struct runqueue *rq;
 	int success = 0;
 
 	/*
 	 * We want the common case fall through straight, thus the goto.
 	 */
-	spin_lock_irqsave(&runqueue_lock, flags);
+	rq = task_rq_lock(p, &flags);
 	p->state = TASK_RUNNING;
 	if (task_on_runqueue(p))
 		goto out;
-	add_to_runqueue(p);
-	if (!synchronous || !(p->cpus_allowed & (1 << smp_processor_id())))
-		reschedule_idle(p);
+#ifdef CONFIG_SMP
+	/*
+	 * A task that is still switching out on its old CPU has to be
+	 * queued there; anything else may be moved. Nobody else can queue
+	 * it while both run-queue locks are held, so recheck under them.
+	 */
+	if (!p->has_cpu) {
+		struct runqueue *target = wake_target(p, synchronous);
+
+		if (target != rq) {
+			spin_unlock(&rq->lock);
+			double_rq_lock(rq, target);
+			if (task_on_runqueue(p) || task_rq(p) != rq) {
+				spin_unlock(&target->lock);
+				goto out;
+			}
+			p->processor = target - runqueues;
+			spin_unlock(&rq->lock);
+			rq = target;
+		}
+	}
+#endif
+	activate_task(p, rq);
+	if ((!synchronous || rq != this_rq()) && preempts(p, rq->curr))
+		resched_task(rq->curr);
 	success = 1;
 out:
-	spin_unlock_irqrestore(&runqueue_lock, flags);
+	task_rq_unlock(rq, &flags);
 	return success;
 }
 
@@ -355,6 +398,34 @@ inline int wake_up_process(struct task_struct * p)
 	return try_to_wake_up(p, 0);
 }
 
+/*
+ * Only used by the architecture SMP bootup code to take the freshly
+ * forked idle threads off the run-queue.
+ */
+void del_from_runqueue(struct task_struct * p)
+{
+	struct runqueue *rq = p->array->rq;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rq->lock, flags);
+	deactivate_task(p, rq);
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/*
+ * Number of runnable tasks in the system, for the load average and
+ * /proc. Does not have to be exact.
+ */
+unsigned long nr_running(void)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++)
+		sum += cpu_rq(cpu_logical_map(i))->nr_running;
+	return sum;
+}
+
 static void process_timeout(unsigned long __data)
 {
 	struct task_struct * p = (struct task_struct *) __data;
@@ -379,7 +450,7 @@ static void process_timeout(unsigned long __data)
  * delivered to the current task. In this case the remaining time
  * in jiffies will be returned, or 0 if the timer expired in time
  *
- * The current task state is guaranteed to be TASK_RUNNING when this 
+ * The current task state is guaranteed to be TASK_RUNNING when this
  * routine returns.
  *
  * Specifying a @timeout value of %MAX_SCHEDULE_TIMEOUT will schedule
@@ -440,6 +511,48 @@ signed long schedule_timeout(signed long timeout)
 	return timeout < 0 ? 0 : timeout;
 }
 
+#ifdef CONFIG_SMP
+
+/*
+ * Hand a runnable task that may not run on this CPU (its cpus_allowed
+ * changed) over to one it may run on. Called once its stack is no
+ * longer in use; clears ->has_cpu under the run-queue locks so the
+ * new CPU cannot pick it up early. Returns 1 if it moved the task.
+ */
+static int move_task_away(struct task_struct * p)
+{
+	struct runqueue *rq = task_rq(p), *target;
+	unsigned long flags;
+	int i, cpu, moved = 0;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		cpu = cpu_logical_map(i);
+		if (task_allowed(p, cpu))
+			break;
+	}
+	if (i == smp_num_cpus)
+		return 0;
+	target = cpu_rq(cpu);
+
+	local_irq_save(flags);
+	double_rq_lock(rq, target);
+	if (p->state == TASK_RUNNING) {
+		if (p->array)
+			deactivate_task(p, rq);
+		p->processor = cpu;
+		p->has_cpu = 0;
+		activate_task(p, target);
+		if (preempts(p, target->curr))
+			resched_task(target->curr);
+		moved = 1;
+	}
+	double_rq_unlock(rq, target);
+	local_irq_restore(flags);
+	return moved;
+}
+
+#endif /* CONFIG_SMP */
+
 /*
  * schedule_tail() is getting called from the fork return path. This
  * cleans up all remaining scheduler things, without impacting the
@@ -465,48 +578,21 @@ static inline void __schedule_tail(struct task_struct *prev)
 	wmb();
 
 	/*
-	 * fast path falls through. We have to clear has_cpu before
-	 * checking prev->state to avoid a wakeup race - thus we
-	 * also have to protect against the task exiting early.
+	 * Slow path - schedule() took prev off this CPU's run-queue
+	 * because it may not run here any more, push it to a CPU it
+	 * may run on.
+	 */
+	if (!task_allowed(prev, smp_processor_id()) && move_task_away(prev))
+		return;
+
+	/*
+	 * fast path falls through. We have to protect against the
+	 * task exiting early.
 	 */
 	task_lock(prev);
 	prev->has_cpu = 0;
 	mb();
-	if (prev->state == TASK_RUNNING)
-		goto needs_resched;
-
-out_unlock:
 	task_unlock(prev);	/* Synchronise here with release_task() if prev is TASK_ZOMBIE */
-	return;
-
-	/*
-	 * Slow path - we 'push' the previous process and
-	 * reschedule_idle() will attempt to find a new
-	 * processor for it. (but it might preempt the
-	 * current process as well.) We must take the runqueue
-	 * lock and re-check prev->state to be correct. It might
-	 * still happen that this process has a preemption
-	 * 'in progress' already - but this is not a problem and
-	 * might happen in other circumstances as well.
-	 */
-needs_resched:
-	{
-		unsigned long flags;
-
-		/*
-		 * Avoid taking the runqueue lock in cases where
-		 * no preemption-check is necessery:
-		 */
-		if ((prev == idle_task(smp_processor_id())) ||
-						(policy & SCHED_YIELD))
-			goto out_unlock;
-
-		spin_lock_irqsave(&runqueue_lock, flags);
-		if ((prev->state == TASK_RUNNING) && !prev->has_cpu)
-			reschedule_idle(prev);
-		spin_unlock_irqrestore(&runqueue_lock, flags);
-		goto out_unlock;
-	}
 #else
 	prev->policy &= ~SCHED_YIELD;
 #endif /* CONFIG_SMP */
@@ -517,9 +603,135 @@ void schedule_tail(struct task_struct *prev)
 	__schedule_tail(prev);
 }
 
+#ifdef CONFIG_SMP
+
+/*
+ * Balance at most every millisecond while idle, and five times a
+ * second while busy.
+ */
+#define IDLE_REBALANCE_TICK	(HZ/1000 ?: 1)
+#define BUSY_REBALANCE_TICK	(HZ/5 ?: 1)
+
+/*
+ * Move 'p' from the busiest run-queue to ours, keeping it on the
+ * same kind of array.
+ */
+static inline void pull_task(struct runqueue *src, struct prio_array *src_array,
+	struct task_struct * p, struct runqueue *this_rq, struct prio_array *this_array)
+{
+	dequeue_task(p, src_array);
+	src->nr_running--;
+	p->processor = this_rq - runqueues;
+	enqueue_task(p, this_array);
+	this_rq->nr_running++;
+	if (preempts(p, this_rq->curr))
+		resched_task(this_rq->curr);
+}
+
 /*
- *  'schedule()' is the scheduler function. It's a very simple and nice
- * scheduler: it's not perfect, but certainly works for most things.
+ * Pull tasks over from the busiest run-queue until both have about
+ * the same number of runnable tasks. Tasks on the expired array are
+ * preferred (they are not going to run soon, so their cache state
+ * is the coldest), and within an array the highest priority ones
+ * that have been waiting longest.
+ *
+ * Called with this_rq->lock held and interrupts off. Might drop and
+ * retake the lock to keep the lock ordering.
+ */
+static void load_balance(struct runqueue *this_rq)
+{
+	int this_cpu = this_rq - runqueues;
+	int i, idx, load, max_load, imbalance;
+	struct runqueue *rq, *busiest = NULL;
+	struct prio_array *array, *this_array;
+	struct list_head *head, *curr;
+	struct task_struct *p;
+
+	max_load = this_rq->nr_running + 1;
+	for (i = 0; i < smp_num_cpus; i++) {
+		rq = cpu_rq(cpu_logical_map(i));
+		load = rq->nr_running;
+		if (rq != this_rq && load > max_load) {
+			max_load = load;
+			busiest = rq;
+		}
+	}
+	if (!busiest)
+		return;
+
+	if (!spin_trylock(&busiest->lock)) {
+		if (busiest < this_rq) {
+			spin_unlock(&this_rq->lock);
+			spin_lock(&busiest->lock);
+			spin_lock(&this_rq->lock);
+		} else
+			spin_lock(&busiest->lock);
+	}
+	imbalance = ((int) busiest->nr_running - (int) this_rq->nr_running) / 2;
+	if (imbalance < 1)
+		goto out_unlock;
+
+	if (busiest->expired->nr_active) {
+		array = busiest->expired;
+		this_array = this_rq->expired;
+	} else {
+		array = busiest->active;
+		this_array = this_rq->active;
+	}
+new_array:
+	for (idx = 0; idx < MAX_PRIO; idx++) {
+		if (!test_bit(idx, array->bitmap))
+			continue;
+		head = array->queue + idx;
+		curr = head->next;
+		while (curr != head) {
+			p = list_entry(curr, struct task_struct, run_list);
+			curr = curr->next;
+			/*
+			 * The running task and one still switching out on
+			 * the other CPU stay put.
+			 */
+			if (p == busiest->curr || p->has_cpu ||
+			    !task_allowed(p, this_cpu))
+				continue;
+			pull_task(busiest, array, p, this_rq, this_array);
+			if (!--imbalance)
+				goto out_unlock;
+		}
+	}
+	if (array == busiest->expired) {
+		array = busiest->active;
+		this_array = this_rq->active;
+		goto new_array;
+	}
+out_unlock:
+	spin_unlock(&busiest->lock);
+}
+
+/*
+ * Called from the timer interrupt on every CPU.
+ */
+void rebalance_tick(int idle)
+{
+	struct runqueue *rq = this_rq();
+	unsigned long flags;
+
+	if (jiffies - rq->last_balance <
+	    (idle ? IDLE_REBALANCE_TICK : BUSY_REBALANCE_TICK))
+		return;
+	rq->last_balance = jiffies;
+
+	spin_lock_irqsave(&rq->lock, flags);
+	load_balance(rq);
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+#endif /* CONFIG_SMP */
+
+/*
+ *  'schedule()' is the scheduler function. It picks the highest
+ * priority task off this CPU's run-queue; the cost does not depend
+ * on how many tasks are runnable.
  *
  * The goto is "interesting".
  *
@@ -529,10 +741,10 @@ void schedule_tail(struct task_struct *prev)
  */
 asmlinkage void schedule(void)
 {
-	struct schedule_data * sched_data;
-	struct task_struct *prev, *next, *p;
-	struct list_head *tmp;
-	int this_cpu, c;
+	struct task_struct *prev, *next;
+	struct runqueue *rq;
+	struct prio_array *array;
+	int this_cpu, idx;
 
 	if (!current->active_mm) BUG();
 need_resched_back:
@@ -542,20 +754,15 @@ need_resched_back:
 	if (in_interrupt())
 		goto scheduling_in_interrupt;
 
+	rcu_qsctr_inc(this_cpu);
 	release_kernel_lock(prev, this_cpu);
 
 	/*
-	 * 'sched_data' is protected by the fact that we can run
-	 * only one process per CPU.
+	 * The run-queue of this CPU is only ever scheduled from this
+	 * CPU, other CPUs just queue and steal tasks under rq->lock.
 	 */
-	sched_data = & aligned_data[this_cpu].schedule_data;
-
-	spin_lock_irq(&runqueue_lock);
-
-	/* move an exhausted RR process to be last.. */
-	if (prev->policy == SCHED_RR)
-		goto move_rr_last;
-move_rr_back:
+	rq = cpu_rq(this_cpu);
+	spin_lock_irq(&rq->lock);
 
 	switch (prev->state) {
 		case TASK_INTERRUPTIBLE:
@@ -564,48 +771,69 @@ move_rr_back:
 				break;
 			}
 		default:
-			del_from_runqueue(prev);
+			deactivate_task(prev, rq);
 		case TASK_RUNNING:;
 	}
 	prev->need_resched = 0;
 
 	/*
-	 * this is the scheduler proper:
+	 * prev is still runnable: a yielding task gives the CPU to
+	 * everybody else once, an exhausted RR task goes to the end of
+	 * its list and an exhausted SCHED_OTHER task waits for the next
+	 * epoch on the expired array. A preempted SCHED_OTHER task goes
+	 * behind its equals; preempted FIFO tasks keep their place.
 	 */
+	if (prev->array) {
+		if (prev->policy & SCHED_YIELD)
+			requeue_task(prev, rt_task(prev) ? rq->active : rq->expired);
+		else if (!prev->counter && !(prev->policy & SCHED_FIFO)) {
+			prev->counter = NICE_TO_TICKS(prev->nice);
+			requeue_task(prev, rt_task(prev) ? rq->active : rq->expired);
+		} else if (!rt_task(prev))
+			requeue_task(prev, prev->array);
+#ifdef CONFIG_SMP
+		/* __schedule_tail() pushes it to another CPU */
+		if (!task_allowed(prev, this_cpu))
+			deactivate_task(prev, rq);
+#endif
+	}
 
-repeat_schedule:
-	/*
-	 * Default process to select..
-	 */
-	next = idle_task(this_cpu);
-	c = -1000;
-	if (prev->state == TASK_RUNNING)
-		goto still_running;
-
-still_running_back:
-	list_for_each(tmp, &runqueue_head) {
-		p = list_entry(tmp, struct task_struct, run_list);
-		if (can_schedule(p, this_cpu)) {
-			int weight = goodness(p, this_cpu, prev->active_mm);
-			if (weight > c)
-				c = weight, next = p;
-		}
+	if (!rq->nr_running) {
+#ifdef CONFIG_SMP
+		load_balance(rq);
+		if (rq->nr_running)
+			goto pick_next;
+#endif
+		next = idle_task(this_cpu);
+		goto switch_tasks;
 	}
 
-	/* Do we need to re-calculate counters? */
-	if (!c)
-		goto recalculate;
+#ifdef CONFIG_SMP
+pick_next:
+#endif
+	array = rq->active;
+	if (!array->nr_active) {
+		/*
+		 * Everybody used up their timeslice, start a new epoch.
+		 */
+		rq->active = rq->expired;
+		rq->expired = array;
+		array = rq->active;
+	}
+	idx = sched_find_first_bit(array->bitmap);
+	next = list_entry(array->queue[idx].next, struct task_struct, run_list);
+
+switch_tasks:
 	/*
 	 * from this point on nothing can prevent us from
 	 * switching to the next task, save this fact in
-	 * sched_data.
+	 * the run-queue.
 	 */
-	sched_data->curr = next;
+	rq->curr = next;
 #ifdef CONFIG_SMP
  	next->has_cpu = 1;
-	next->processor = this_cpu;
 #endif
-	spin_unlock_irq(&runqueue_lock);
+	spin_unlock_irq(&rq->lock);
 
 	if (prev == next) {
 		/* We won't go through the normal tail, so do this by hand */
@@ -619,14 +847,14 @@ still_running_back:
  	 * (this has to be recalculated even if we reschedule to
  	 * the same process) Currently this is only used on SMP,
 	 * and it's approximate, so we do not have to maintain
-	 * it while holding the runqueue spinlock.
+	 * it while holding the run-queue spinlock.
  	 */
- 	sched_data->last_schedule = get_cycles();
+ 	rq->last_schedule = get_cycles();
 
 	/*
-	 * We drop the scheduler lock early (it's a global spinlock),
-	 * thus we have to lock the previous process from getting
-	 * rescheduled during switch_to().
+	 * We drop the run-queue lock early, thus prev->has_cpu keeps
+	 * the previous process from being stolen by another CPU
+	 * during switch_to().
 	 */
 
 #endif /* CONFIG_SMP */
@@ -675,32 +903,6 @@ same_process:
 
 	return;
 
-recalculate:
-	{
-		struct task_struct *p;
-		spin_unlock_irq(&runqueue_lock);
-		read_lock(&tasklist_lock);
-		for_each_task(p)
-			p->counter = (p->counter >> 1) + NICE_TO_TICKS(p->nice);
-		read_unlock(&tasklist_lock);
-		spin_lock_irq(&runqueue_lock);
-	}
-	goto repeat_schedule;
-
-still_running:
-	if (!(prev->cpus_allowed & (1UL << this_cpu)))
-		goto still_running_back;
-	c = goodness(prev, this_cpu, prev->active_mm);
-	next = prev;
-	goto still_running_back;
-
-move_rr_last:
-	if (!prev->counter) {
-		prev->counter = NICE_TO_TICKS(prev->nice);
-		move_last_runqueue(prev);
-	}
-	goto move_rr_back;
-
 scheduling_in_interrupt:
 	printk("Scheduling in interrupt\n");
 	BUG();
@@ -732,6 +934,10 @@ static inline void __wake_up_common (wait_queue_head_t *q, unsigned int mode,
 
 		tmp = tmp->next;
 		CHECK_MAGIC(curr->__magic);
+		if (curr->func) {
+			curr->func(curr, mode, sync);
+			continue;
+		}
 		p = curr->task;
 		state = p->state;
 		if (state & mode) {
@@ -908,7 +1114,9 @@ static int setscheduler(pid_t pid, int policy,
 {
 	struct sched_param lp;
 	struct task_struct *p;
-	int retval;
+	struct runqueue *rq;
+	unsigned long flags;
+	int retval, queued;
 
 	retval = -EINVAL;
 	if (!param || pid < 0)
@@ -922,7 +1130,6 @@ static int setscheduler(pid_t pid, int policy,
 	 * We play safe to avoid deadlocks.
 	 */
 	read_lock_irq(&tasklist_lock);
-	spin_lock(&runqueue_lock);
 
 	p = find_process_by_pid(pid);
 
@@ -958,15 +1165,20 @@ static int setscheduler(pid_t pid, int policy,
 		goto out_unlock;
 
 	retval = 0;
+	rq = task_rq_lock(p, &flags);
+	queued = p->array != NULL;
+	if (queued)
+		deactivate_task(p, rq);
 	p->policy = policy;
 	p->rt_priority = lp.sched_priority;
-	if (task_on_runqueue(p))
-		move_first_runqueue(p);
+	if (queued)
+		activate_task(p, rq);
+	resched_task(rq->curr);
+	task_rq_unlock(rq, &flags);
 
 	current->need_resched = 1;
 
 out_unlock:
-	spin_unlock(&runqueue_lock);
 	read_unlock_irq(&tasklist_lock);
 
 out_nounlock:
@@ -1038,35 +1250,17 @@ out_unlock:
 asmlinkage long sys_sched_yield(void)
 {
 	/*
-	 * Trick. sched_yield() first counts the number of truly 
-	 * 'pending' runnable processes, then returns if it's
-	 * only the current processes. (This test does not have
-	 * to be atomic.) In threaded applications this optimization
-	 * gets triggered quite often.
+	 * Trick. sched_yield() first checks whether anything but the
+	 * current process is runnable on this CPU, and returns if not.
+	 * (This test does not have to be atomic.) In threaded applications
+	 * this optimization gets triggered quite often.
 	 */
-
-	int nr_pending = nr_running;
-
-#if CONFIG_SMP
-	int i;
-
-	// Substract non-idle processes running on other CPUs.
-	for (i = 0; i < smp_num_cpus; i++) {
-		int cpu = cpu_logical_map(i);
-		if (aligned_data[cpu].schedule_data.curr != idle_task(cpu))
-			nr_pending--;
-	}
-#else
-	// on UP this process is on the runqueue as well
-	nr_pending--;
-#endif
-	if (nr_pending) {
+	if (this_rq()->nr_running > 1) {
 		/*
 		 * This process can only be rescheduled by us,
 		 * so this is safe without any locking.
 		 */
-		if (current->policy == SCHED_OTHER)
-			current->policy |= SCHED_YIELD;
+		current->policy |= SCHED_YIELD;
 		current->need_resched = 1;
 	}
 	return 0;
@@ -1248,16 +1442,16 @@ void daemonize(void)
 
 void __init init_idle(void)
 {
-	struct schedule_data * sched_data;
-	sched_data = &aligned_data[smp_processor_id()].schedule_data;
+	struct runqueue *rq = this_rq();
 
 	if (current != &init_task && task_on_runqueue(current)) {
 		printk("UGH! (%d:%d) was on the runqueue, removing.\n",
 			smp_processor_id(), current->pid);
 		del_from_runqueue(current);
 	}
-	sched_data->curr = current;
-	sched_data->last_schedule = get_cycles();
+	current->prio = MAX_PRIO;
+	rq->curr = current;
+	rq->last_schedule = get_cycles();
 }
 
 extern void init_timervecs (void);
@@ -1269,13 +1463,29 @@ void __init sched_init(void)
 	 * process right in SMP mode.
 	 */
 	int cpu = smp_processor_id();
-	int nr;
+	int nr, i, j;
 
 	init_task.processor = cpu;
 
 	for(nr = 0; nr < PIDHASH_SZ; nr++)
 		pidhash[nr] = NULL;
 
+	for (nr = 0; nr < NR_CPUS; nr++) {
+		struct runqueue *rq = cpu_rq(nr);
+
+		spin_lock_init(&rq->lock);
+		rq->curr = &init_task;
+		rq->active = rq->arrays;
+		rq->expired = rq->arrays + 1;
+		for (i = 0; i < 2; i++) {
+			struct prio_array *array = rq->arrays + i;
+
+			array->rq = rq;
+			for (j = 0; j < MAX_PRIO; j++)
+				INIT_LIST_HEAD(array->queue + j);
+		}
+	}
+
 	init_timervecs();
 
 	init_bh(TIMER_BH, timer_bh);
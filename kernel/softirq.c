@@ -47,6 +47,22 @@ irq_cpustat_t irq_stat[NR_CPUS];
 
 static struct softirq_action softirq_vec[32] __cacheline_aligned;
 
+/*
+ * Softirqs raised for a CPU by other CPUs. softirq_pending() is only
+ * ever changed by its own CPU, non-atomically, so the others set bits
+ * here and wake that CPU's ksoftirqd; do_softirq() folds them in.
+ */
+static struct {
+	unsigned long pending;
+} ____cacheline_aligned softirq_remote[NR_CPUS];
+
+/* Called with interrupts off. */
+static inline void fold_remote_softirqs(int cpu)
+{
+	if (softirq_remote[cpu].pending)
+		softirq_pending(cpu) |= xchg(&softirq_remote[cpu].pending, 0);
+}
+
 /*
  * we cannot loop indefinitely here to avoid userspace starvation,
  * but we also don't want to introduce a worst case 1/HZ latency
@@ -73,6 +89,7 @@ asmlinkage void do_softirq()
 
 	local_irq_save(flags);
 
+	fold_remote_softirqs(cpu);
 	pending = softirq_pending(cpu);
 
 	if (pending) {
@@ -133,6 +150,13 @@ void raise_softirq(unsigned int nr)
 	cpu_raise_softirq(smp_processor_id(), nr);
 }
 
+/* Raise softirq 'nr' on another CPU; safe from any context. */
+void remote_raise_softirq(unsigned int cpu, unsigned int nr)
+{
+	if (!test_and_set_bit(nr, &softirq_remote[cpu].pending))
+		wakeup_softirqd(cpu);
+}
+
 void open_softirq(int nr, void (*action)(struct softirq_action*), void *data)
 {
 	softirq_vec[nr].data = data;
@@ -393,18 +417,19 @@ static int ksoftirqd(void * __bind_cpu)
 	ksoftirqd_task(cpu) = current;
 
 	for (;;) {
-		if (!softirq_pending(cpu))
+		if (!softirq_pending(cpu) && !softirq_remote[cpu].pending)
 			schedule();
 
 		__set_current_state(TASK_RUNNING);
 
-		while (softirq_pending(cpu)) {
+		do {
 			do_softirq();
 			if (current->need_resched)
 				schedule();
-		}
+		} while (softirq_pending(cpu));
 
-		__set_current_state(TASK_INTERRUPTIBLE);
+		/* Pairs with the test_and_set_bit() in remote_raise_softirq() */
+		set_current_state(TASK_INTERRUPTIBLE);
 	}
 }
 
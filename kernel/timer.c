@@ -22,6 +22,7 @@
 #include <linux/smp_lock.h>
 #include <linux/interrupt.h>
 #include <linux/kernel_stat.h>
+#include <linux/rcupdate.h>
 
 #include <asm/uaccess.h>
 
@@ -594,6 +595,11 @@ void update_process_times(int user_tick)
 		kstat.per_cpu_system[cpu] += system;
 	} else if (local_bh_count(cpu) || local_irq_count(cpu) > 1)
 		kstat.per_cpu_system[cpu] += system;
+	rcu_check_callbacks(cpu, user_tick || (!p->pid &&
+			    !local_bh_count(cpu) && local_irq_count(cpu) <= 1));
+#ifdef CONFIG_SMP
+	rebalance_tick(!p->pid);
+#endif
 }
 
 /*
@@ -0,0 +1,394 @@
+/*
+ * linux/lib/radix-tree.c
+ *
+ * Radix tree mapping unsigned long indices to pointers.
+ *
+ * Every node has RADIX_TREE_MAP_SIZE slots, each holding either a
+ * pointer to a node one level down or, at the bottom, an item. A tree
+ * of height h covers indices 0 .. 2^(h*RADIX_TREE_MAP_SHIFT)-1 and
+ * grows at the top when a larger index is inserted. A tree of height
+ * zero holds at most the item for index 0, directly in the root.
+ *
+ * Interior nodes are freed as soon as they become empty, so the tree
+ * never holds more than one partially used path of nodes per item.
+ */
+
+#include <linux/config.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/radix-tree.h>
+
+#define RADIX_TREE_MAP_SHIFT	6
+#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
+
+struct radix_tree_node {
+	unsigned int	count;		/* number of used slots */
+	void		*slots[RADIX_TREE_MAP_SIZE];
+};
+
+struct radix_tree_path {
+	struct radix_tree_node *node;
+	struct radix_tree_node **slot;
+};
+
+#define RADIX_TREE_INDEX_BITS	(8 * sizeof(unsigned long))
+#define RADIX_TREE_MAX_PATH	(RADIX_TREE_INDEX_BITS/RADIX_TREE_MAP_SHIFT + 2)
+
+static unsigned long height_to_maxindex[RADIX_TREE_MAX_PATH];
+
+static kmem_cache_t *radix_tree_node_cachep;
+
+/*
+ * Nodes set aside by radix_tree_preload(), for insertions done under
+ * a spinlock where the normal allocation may fail. The tree is never
+ * modified from interrupt context, so a per-CPU pool needs no locking.
+ */
+struct radix_tree_preload {
+	int nr;
+	struct radix_tree_node *nodes[RADIX_TREE_MAX_PATH];
+} ____cacheline_aligned;
+
+static struct radix_tree_preload radix_tree_preloads[NR_CPUS];
+
+static struct radix_tree_node *radix_tree_node_alloc(struct radix_tree_root *root)
+{
+	struct radix_tree_node *node;
+
+	node = kmem_cache_alloc(radix_tree_node_cachep, root->gfp_mask);
+	if (!node) {
+		struct radix_tree_preload *rtp;
+
+		rtp = radix_tree_preloads + smp_processor_id();
+		if (rtp->nr) {
+			node = rtp->nodes[--rtp->nr];
+			rtp->nodes[rtp->nr] = NULL;
+		}
+	}
+	return node;
+}
+
+static inline void radix_tree_node_free(struct radix_tree_node *node)
+{
+	kmem_cache_free(radix_tree_node_cachep, node);
+}
+
+/**
+ * radix_tree_preload - make sure an insertion can not run out of nodes
+ * @gfp_mask: allocation flags, may allow sleeping
+ *
+ * Fills this CPU's reserve with enough nodes for one insertion into
+ * a tree of any height. Call it before taking the lock that protects
+ * the tree, and do not sleep between it and radix_tree_insert().
+ */
+int radix_tree_preload(int gfp_mask)
+{
+	struct radix_tree_preload *rtp;
+	struct radix_tree_node *node;
+
+	rtp = radix_tree_preloads + smp_processor_id();
+	while (rtp->nr < RADIX_TREE_MAX_PATH) {
+		node = kmem_cache_alloc(radix_tree_node_cachep, gfp_mask);
+		if (!node)
+			return -ENOMEM;
+		/* we may have slept and changed CPUs */
+		rtp = radix_tree_preloads + smp_processor_id();
+		if (rtp->nr < RADIX_TREE_MAX_PATH)
+			rtp->nodes[rtp->nr++] = node;
+		else
+			radix_tree_node_free(node);
+	}
+	return 0;
+}
+
+static inline unsigned long radix_tree_maxindex(unsigned int height)
+{
+	return height_to_maxindex[height];
+}
+
+/*
+ * Add levels at the top until 'index' fits.
+ */
+static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_node *node;
+	unsigned int height;
+
+	height = root->height + 1;
+	while (index > radix_tree_maxindex(height))
+		height++;
+
+	if (root->rnode == NULL) {
+		root->height = height;
+		return 0;
+	}
+
+	do {
+		node = radix_tree_node_alloc(root);
+		if (!node)
+			return -ENOMEM;
+		/* everything so far lives below slot 0 of the new top */
+		node->slots[0] = root->rnode;
+		node->count = 1;
+		root->rnode = node;
+		root->height++;
+	} while (height > root->height);
+	return 0;
+}
+
+/**
+ * radix_tree_insert - insert an item into the tree
+ * @root: tree root
+ * @index: index key
+ * @item: item to insert, must not be NULL
+ *
+ * Returns 0, -EEXIST if there already is an item at @index, or
+ * -ENOMEM.
+ */
+int radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item)
+{
+	struct radix_tree_node *node = NULL, *tmp, **slot;
+	unsigned int height, shift;
+	int error;
+
+	if (index > radix_tree_maxindex(root->height)) {
+		error = radix_tree_extend(root, index);
+		if (error)
+			return error;
+	}
+
+	slot = &root->rnode;
+	height = root->height;
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+
+	while (height > 0) {
+		if (*slot == NULL) {
+			tmp = radix_tree_node_alloc(root);
+			if (!tmp)
+				return -ENOMEM;
+			*slot = tmp;
+			if (node)
+				node->count++;
+		}
+		node = *slot;
+		slot = (struct radix_tree_node **)
+			(node->slots + ((index >> shift) & RADIX_TREE_MAP_MASK));
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+
+	if (*slot != NULL)
+		return -EEXIST;
+	if (node)
+		node->count++;
+	*slot = item;
+	return 0;
+}
+
+/**
+ * radix_tree_lookup - look up an item
+ * @root: tree root
+ * @index: index key
+ *
+ * Returns the item at @index, or NULL.
+ */
+void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_node **slot;
+	unsigned int height, shift;
+
+	height = root->height;
+	if (index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+	slot = &root->rnode;
+
+	while (height > 0) {
+		if (*slot == NULL)
+			return NULL;
+		slot = (struct radix_tree_node **)
+			((*slot)->slots + ((index >> shift) & RADIX_TREE_MAP_MASK));
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+	return (void *) *slot;
+}
+
+/*
+ * Collect items from the leaf that covers 'index', or from the first
+ * leaf after it. *next_index is set to where the next search has to
+ * start, or to 0 if the end of the index space was reached.
+ */
+static unsigned int __lookup(struct radix_tree_root *root, void **results,
+			     unsigned long index, unsigned int max_items,
+			     unsigned long *next_index)
+{
+	unsigned int nr_found = 0;
+	unsigned int shift, height = root->height;
+	struct radix_tree_node *slot = root->rnode;
+	unsigned long i;
+
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+
+	while (height > 0) {
+		i = (index >> shift) & RADIX_TREE_MAP_MASK;
+		for ( ; i < RADIX_TREE_MAP_SIZE; i++) {
+			if (slot->slots[i] != NULL)
+				break;
+			index &= ~((1UL << shift) - 1);
+			index += 1UL << shift;
+			if (index == 0)
+				goto out;	/* wrapped: end of index space */
+		}
+		if (i == RADIX_TREE_MAP_SIZE)
+			goto out;
+		height--;
+		if (height == 0) {
+			/* bottom level: grab the items */
+			unsigned long j = index & RADIX_TREE_MAP_MASK;
+
+			for ( ; j < RADIX_TREE_MAP_SIZE; j++) {
+				index++;
+				if (slot->slots[j]) {
+					results[nr_found++] = slot->slots[j];
+					if (nr_found == max_items)
+						goto out;
+				}
+			}
+		}
+		shift -= RADIX_TREE_MAP_SHIFT;
+		slot = slot->slots[i];
+	}
+out:
+	*next_index = index;
+	return nr_found;
+}
+
+/**
+ * radix_tree_gang_lookup - look up several items at once
+ * @root: tree root
+ * @results: where the items are placed
+ * @first_index: start the search here
+ * @max_items: place up to this many items at *results
+ *
+ * Fills @results with the items at the lowest indices >= @first_index,
+ * in ascending index order, and returns how many were found. Only
+ * the part of the tree that holds items is visited.
+ */
+unsigned int radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
+				    unsigned long first_index, unsigned int max_items)
+{
+	const unsigned long max_index = radix_tree_maxindex(root->height);
+	unsigned long cur_index = first_index;
+	unsigned int ret = 0;
+
+	if (root->rnode == NULL || !max_items)
+		return 0;
+	if (root->height == 0) {
+		if (first_index == 0)
+			results[ret++] = root->rnode;
+		return ret;
+	}
+
+	while (ret < max_items) {
+		unsigned long next_index;
+
+		if (cur_index > max_index)
+			break;
+		ret += __lookup(root, results + ret, cur_index,
+				max_items - ret, &next_index);
+		if (next_index == 0)
+			break;
+		cur_index = next_index;
+	}
+	return ret;
+}
+
+/**
+ * radix_tree_delete - delete an item from the tree
+ * @root: tree root
+ * @index: index key
+ *
+ * Removes and returns the item at @index, or NULL if there is none.
+ * Nodes that become empty are freed.
+ */
+void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_path path[RADIX_TREE_MAX_PATH], *pathp = path;
+	unsigned int height, shift;
+	void *item;
+
+	height = root->height;
+	if (index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+	pathp->node = NULL;
+	pathp->slot = &root->rnode;
+
+	while (height > 0) {
+		struct radix_tree_node *node = *pathp->slot;
+
+		if (node == NULL)
+			return NULL;
+		pathp[1].node = node;
+		pathp[1].slot = (struct radix_tree_node **)
+			(node->slots + ((index >> shift) & RADIX_TREE_MAP_MASK));
+		pathp++;
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+
+	item = *pathp->slot;
+	if (item == NULL)
+		return NULL;
+
+	*pathp->slot = NULL;
+	while (pathp->node) {
+		if (--pathp->node->count)
+			break;
+		/* the node is empty now, unhook it from its parent */
+		radix_tree_node_free(pathp->node);
+		pathp--;
+		*pathp->slot = NULL;
+	}
+	if (root->rnode == NULL)
+		root->height = 0;
+	return item;
+}
+
+static void radix_tree_node_ctor(void *node, kmem_cache_t *cachep, unsigned long flags)
+{
+	memset(node, 0, sizeof(struct radix_tree_node));
+}
+
+void __init radix_tree_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < RADIX_TREE_MAX_PATH; i++) {
+		unsigned int bits = i * RADIX_TREE_MAP_SHIFT;
+
+		if (bits >= RADIX_TREE_INDEX_BITS)
+			height_to_maxindex[i] = ~0UL;
+		else
+			height_to_maxindex[i] = (1UL << bits) - 1;
+	}
+
+	radix_tree_node_cachep = kmem_cache_create("radix_tree_node",
+			sizeof(struct radix_tree_node), 0,
+			SLAB_HWCACHE_ALIGN, radix_tree_node_ctor, NULL);
+	if (!radix_tree_node_cachep)
+		panic("Failed to create radix_tree_node cache\n");
+}
+
+EXPORT_SYMBOL(radix_tree_insert);
+EXPORT_SYMBOL(radix_tree_lookup);
+EXPORT_SYMBOL(radix_tree_delete);
+EXPORT_SYMBOL(radix_tree_gang_lookup);
+EXPORT_SYMBOL(radix_tree_preload);
@@ -22,6 +22,7 @@
 #include <linux/swapctl.h>
 #include <linux/init.h>
 #include <linux/mm.h>
+#include <linux/radix-tree.h>
 
 #include <asm/pgalloc.h>
 #include <asm/uaccess.h>
@@ -39,86 +40,80 @@
  * page-cache, 21.05.1999, Ingo Molnar <mingo@redhat.com>
  *
  * SMP-threaded pagemap-LRU 1999, Andrea Arcangeli <andrea@suse.de>
+ *
+ * Per-mapping radix tree index and page_lock instead of the global
+ * page hash table and pagecache_lock, 2001.
  */
 
 atomic_t page_cache_size = ATOMIC_INIT(0);
-unsigned int page_hash_bits;
-struct page **page_hash_table;
 
-spinlock_t pagecache_lock = SPIN_LOCK_UNLOCKED;
 /*
- * NOTE: to avoid deadlocking you must never acquire the pagecache_lock with
- *       the pagemap_lru_lock held.
+ * NOTE: to avoid deadlocking you must never acquire a mapping's
+ *       page_lock with a zone's lru_lock held (only trylock it).
  */
-spinlock_t pagemap_lru_lock = SPIN_LOCK_UNLOCKED;
 
 #define CLUSTER_PAGES		(1 << page_cluster)
 #define CLUSTER_OFFSET(x)	(((x) >> page_cluster) << page_cluster)
 
-static void add_page_to_hash_queue(struct page * page, struct page **p)
+/* How many pages the range walkers pick up per radix tree lookup */
+#define PAGE_BATCH		16
+
+/*
+ * Insert a page into the mapping's radix tree and its clean list.
+ * Called with mapping->page_lock held; fails with -EEXIST if another
+ * page is already cached at that index, or -ENOMEM.
+ */
+static inline int add_page_to_inode_queue(struct address_space *mapping,
+	struct page * page, unsigned long index)
 {
-	struct page *next = *p;
+	int error;
 
-	*p = page;
-	page->next_hash = next;
-	page->pprev_hash = p;
-	if (next)
-		next->pprev_hash = &page->next_hash;
+	error = radix_tree_insert(&mapping->page_tree, index, page);
+	if (error)
+		return error;
 	if (page->buffers)
 		PAGE_BUG(page);
-	atomic_inc(&page_cache_size);
-}
-
-static inline void add_page_to_inode_queue(struct address_space *mapping, struct page * page)
-{
-	struct list_head *head = &mapping->clean_pages;
 
+	page->index = index;
 	mapping->nrpages++;
-	list_add(&page->list, head);
+	list_add(&page->list, &mapping->clean_pages);
 	page->mapping = mapping;
+	atomic_inc(&page_cache_size);
+	return 0;
 }
 
 static inline void remove_page_from_inode_queue(struct page * page)
 {
 	struct address_space * mapping = page->mapping;
 
+	radix_tree_delete(&mapping->page_tree, page->index);
 	mapping->nrpages--;
 	list_del(&page->list);
 	page->mapping = NULL;
-}
-
-static inline void remove_page_from_hash_queue(struct page * page)
-{
-	struct page *next = page->next_hash;
-	struct page **pprev = page->pprev_hash;
-
-	if (next)
-		next->pprev_hash = pprev;
-	*pprev = next;
-	page->pprev_hash = NULL;
 	atomic_dec(&page_cache_size);
 }
 
 /*
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
- * is safe.
+ * is safe. The caller must hold page->mapping->page_lock.
  */
 void __remove_inode_page(struct page *page)
 {
 	if (PageDirty(page)) BUG();
 	remove_page_from_inode_queue(page);
-	remove_page_from_hash_queue(page);
 }
 
 void remove_inode_page(struct page *page)
 {
+	struct address_space *mapping = page->mapping;
+
 	if (!PageLocked(page))
 		PAGE_BUG(page);
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	__remove_inode_page(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
 static inline int sync_page(struct page *page)
@@ -137,10 +132,10 @@ void __set_page_dirty(struct page *page)
 {
 	struct address_space *mapping = page->mapping;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	list_del(&page->list);
 	list_add(&page->list, &mapping->dirty_pages);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 
 	if (mapping->host)
 		mark_inode_dirty_pages(mapping->host);
@@ -156,13 +151,16 @@ void __set_page_dirty(struct page *page)
 
 void invalidate_inode_pages(struct inode * inode)
 {
+	struct address_space *mapping = inode->i_mapping;
 	struct list_head *head, *curr;
 	struct page * page;
 
-	head = &inode->i_mapping->clean_pages;
+	head = &mapping->clean_pages;
+
+	/* Pages still queued for the page lists would look in use */
+	lru_add_drain();
 
-	spin_lock(&pagecache_lock);
-	spin_lock(&pagemap_lru_lock);
+	spin_lock(&mapping->page_lock);
 	curr = head->next;
 
 	while (curr != head) {
@@ -181,14 +179,25 @@ void invalidate_inode_pages(struct inode * inode)
 		if (TryLockPage(page))
 			continue;
 
+		spin_lock(&page->zone->lru_lock);
 		__lru_cache_del(page);
+		spin_unlock(&page->zone->lru_lock);
 		__remove_inode_page(page);
 		UnlockPage(page);
 		page_cache_release(page);
 	}
 
-	spin_unlock(&pagemap_lru_lock);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
+}
+
+static inline int do_flushpage(struct page *page, unsigned long offset)
+{
+	int (*flushpage) (struct page *, unsigned long);
+
+	flushpage = page->mapping->a_ops->flushpage;
+	if (flushpage)
+		return (*flushpage)(page, offset);
+	return block_flushpage(page, offset);
 }
 
 static inline void truncate_partial_page(struct page *page, unsigned partial)
@@ -196,14 +205,14 @@ static inline void truncate_partial_page(struct page *page, unsigned partial)
 	memclear_highpage_flush(page, partial, PAGE_CACHE_SIZE-partial);
 				
 	if (page->buffers)
-		block_flushpage(page, partial);
+		do_flushpage(page, partial);
 
 }
 
 static inline void truncate_complete_page(struct page *page)
 {
 	/* Leave it on the LRU if it gets converted into anonymous buffers */
-	if (!page->buffers || block_flushpage(page, 0))
+	if (!page->buffers || do_flushpage(page, 0))
 		lru_cache_del(page);
 
 	/*
@@ -219,51 +228,6 @@ static inline void truncate_complete_page(struct page *page)
 	page_cache_release(page);
 }
 
-static int FASTCALL(truncate_list_pages(struct list_head *, unsigned long, unsigned *));
-static int truncate_list_pages(struct list_head *head, unsigned long start, unsigned *partial)
-{
-	struct list_head *curr;
-	struct page * page;
-
-	curr = head->next;
-	while (curr != head) {
-		unsigned long offset;
-
-		page = list_entry(curr, struct page, list);
-		offset = page->index;
-
-		/* Is one of the pages to truncate? */
-		if ((offset >= start) || (*partial && (offset + 1) == start)) {
-			list_del(head);
-			list_add(head, curr);
-			if (TryLockPage(page)) {
-				page_cache_get(page);
-				spin_unlock(&pagecache_lock);
-				wait_on_page(page);
-				goto out_restart;
-			}
-			page_cache_get(page);
-			spin_unlock(&pagecache_lock);
-
-			if (*partial && (offset + 1) == start) {
-				truncate_partial_page(page, *partial);
-				*partial = 0;
-			} else 
-				truncate_complete_page(page);
-
-			UnlockPage(page);
-			goto out_restart;
-		}
-		curr = curr->next;
-	}
-	return 0;
-out_restart:
-	page_cache_release(page);
-	spin_lock(&pagecache_lock);
-	return 1;
-}
-
-
 /**
  * truncate_inode_pages - truncate *all* the pages from an offset
  * @mapping: mapping to truncate
@@ -272,73 +236,85 @@ out_restart:
  * Truncate the page cache at a set offset, removing the pages
  * that are beyond that offset (and zeroing out partial pages).
  * If any page is locked we wait for it to become unlocked.
+ *
+ * The radix tree is walked in index order from the truncation point,
+ * so only pages that are actually cached beyond it are looked at.
  */
 void truncate_inode_pages(struct address_space * mapping, loff_t lstart) 
 {
 	unsigned long start = (lstart + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 	unsigned partial = lstart & (PAGE_CACHE_SIZE - 1);
+	struct page *pages[PAGE_BATCH];
+	unsigned long next;
+	unsigned int i, nr;
 	int complete;
 
-	spin_lock(&pagecache_lock);
+	if (partial) {
+		struct page *page = find_lock_page(mapping, start - 1);
+
+		if (page) {
+			truncate_partial_page(page, partial);
+			UnlockPage(page);
+			page_cache_release(page);
+		}
+	}
+
+	/*
+	 * Pages can be added behind our back while we sleep on a
+	 * page lock, so repeat until a pass finds nothing to do.
+	 */
 	do {
 		complete = 1;
-		while (truncate_list_pages(&mapping->clean_pages, start, &partial))
-			complete = 0;
-		while (truncate_list_pages(&mapping->dirty_pages, start, &partial))
-			complete = 0;
-		while (truncate_list_pages(&mapping->locked_pages, start, &partial))
+		next = start;
+		for (;;) {
+			spin_lock(&mapping->page_lock);
+			nr = radix_tree_gang_lookup(&mapping->page_tree,
+					(void **) pages, next, PAGE_BATCH);
+			for (i = 0; i < nr; i++)
+				page_cache_get(pages[i]);
+			if (nr)
+				next = pages[nr - 1]->index + 1;
+			spin_unlock(&mapping->page_lock);
+			if (!nr)
+				break;
+
 			complete = 0;
+			for (i = 0; i < nr; i++) {
+				struct page *page = pages[i];
+
+				lock_page(page);
+				/* Did it get truncated while we waited? */
+				if (page->mapping == mapping)
+					truncate_complete_page(page);
+				UnlockPage(page);
+				page_cache_release(page);
+			}
+			if (!next)
+				break;
+		}
 	} while (!complete);
-	/* Traversed all three lists without dropping the lock */
-	spin_unlock(&pagecache_lock);
 }
 
 /*
- * This function is pretty much like __find_page_nolock(), but it only
- * requires 2 arguments and doesn't mark the page as touched, making it
- * ideal for ->writepage() clustering and other places where you don't
- * want to mark the page referenced.
+ * This function is pretty much like __find_page_nolock(), but it
+ * doesn't mark the page as touched, making it ideal for ->writepage()
+ * clustering and other places where you don't want to mark the page
+ * referenced.
  *
- * The caller needs to hold the pagecache_lock.
+ * The caller needs to hold mapping->page_lock.
  */
-static struct page * FASTCALL(__find_page_simple(struct address_space *, unsigned long));
-static struct page * __find_page_simple(struct address_space *mapping, unsigned long index)
+static inline struct page * __find_page_simple(struct address_space *mapping, unsigned long index)
 {
-	struct page **next = page_hash(mapping, index);;
-
-	for (;;) {
-		struct page *page = *next;
-		if (!page)
-			break;
-		next = &page->next_hash;
-		if (page->mapping != mapping)
-			continue;
-		if (page->index != index)
-			continue;
-		return page;
-	}
-
-	return NULL;
+	return radix_tree_lookup(&mapping->page_tree, index);
 }
 
-static inline struct page * __find_page_nolock(struct address_space *mapping, unsigned long offset, struct page *page)
+static inline struct page * __find_page_nolock(struct address_space *mapping, unsigned long offset)
 {
-	goto inside;
+	struct page *page = radix_tree_lookup(&mapping->page_tree, offset);
 
-	for (;;) {
-		page = page->next_hash;
-inside:
-		if (!page)
-			goto not_found;
-		if (page->mapping != mapping)
-			continue;
-		if (page->index == offset)
-			break;
-	}
 	/* Mark the page referenced, kswapd will find it later. */
-	SetPageReferenced(page);
-
-not_found:
+	if (page)
+		SetPageReferenced(page);
 	return page;
 }
 
@@ -377,38 +353,50 @@ int waitfor_one_page(struct page *page)
 	return error;
 }
 
-static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsigned long end, int (*fn)(struct page *))
+/*
+ * Call fn() on every page with buffers in [start, end), looking only
+ * at the pages that are in the cache.
+ */
+static int do_buffer_fdatasync(struct address_space *mapping, unsigned long start, unsigned long end, int (*fn)(struct page *))
 {
-	struct list_head *curr;
-	struct page *page;
+	struct page *pages[PAGE_BATCH];
+	unsigned long next = start;
+	unsigned int i, nr;
 	int retval = 0;
 
-	spin_lock(&pagecache_lock);
-	curr = head->next;
-	while (curr != head) {
-		page = list_entry(curr, struct page, list);
-		curr = curr->next;
-		if (!page->buffers)
-			continue;
-		if (page->index >= end)
-			continue;
-		if (page->index < start)
-			continue;
+	while (next < end) {
+		spin_lock(&mapping->page_lock);
+		nr = radix_tree_gang_lookup(&mapping->page_tree,
+				(void **) pages, next, PAGE_BATCH);
+		for (i = 0; i < nr; i++) {
+			if (pages[i]->index >= end)
+				break;
+			page_cache_get(pages[i]);
+		}
+		nr = i;
+		if (nr)
+			next = pages[nr - 1]->index + 1;
+		spin_unlock(&mapping->page_lock);
+		if (!nr)
+			break;
 
-		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
-		lock_page(page);
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
 
-		/* The buffers could have been free'd while we waited for the page lock */
-		if (page->buffers)
-			retval |= fn(page);
+			if (page->buffers) {
+				lock_page(page);
 
-		UnlockPage(page);
-		spin_lock(&pagecache_lock);
-		curr = page->list.next;
-		page_cache_release(page);
+				/* The buffers could have been free'd while we waited for the page lock */
+				if (page->buffers)
+					retval |= fn(page);
+
+				UnlockPage(page);
+			}
+			page_cache_release(page);
+		}
+		if (!next)
+			break;
 	}
-	spin_unlock(&pagecache_lock);
 
 	return retval;
 }
@@ -421,15 +409,11 @@ int generic_buffer_fdatasync(struct inode *inode, unsigned long start_idx, unsig
 {
 	int retval;
 
-	/* writeout dirty buffers on pages from both clean and dirty lists */
-	retval = do_buffer_fdatasync(&inode->i_mapping->dirty_pages, start_idx, end_idx, writeout_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->clean_pages, start_idx, end_idx, writeout_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->locked_pages, start_idx, end_idx, writeout_one_page);
+	/* writeout dirty buffers on all cached pages in the range */
+	retval = do_buffer_fdatasync(inode->i_mapping, start_idx, end_idx, writeout_one_page);
 
-	/* now wait for locked buffers on pages from both clean and dirty lists */
-	retval |= do_buffer_fdatasync(&inode->i_mapping->dirty_pages, start_idx, end_idx, waitfor_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->clean_pages, start_idx, end_idx, waitfor_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->locked_pages, start_idx, end_idx, waitfor_one_page);
+	/* now wait for locked buffers on the same pages */
+	retval |= do_buffer_fdatasync(inode->i_mapping, start_idx, end_idx, waitfor_one_page);
 
 	return retval;
 }
@@ -445,7 +429,7 @@ void filemap_fdatasync(struct address_space * mapping)
 {
 	int (*writepage)(struct page *) = mapping->a_ops->writepage;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 
         while (!list_empty(&mapping->dirty_pages)) {
 		struct page *page = list_entry(mapping->dirty_pages.next, struct page, list);
@@ -457,7 +441,7 @@ void filemap_fdatasync(struct address_space * mapping)
 			continue;
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		lock_page(page);
 
@@ -468,9 +452,9 @@ void filemap_fdatasync(struct address_space * mapping)
 			UnlockPage(page);
 
 		page_cache_release(page);
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
 /**
@@ -482,7 +466,7 @@ void filemap_fdatasync(struct address_space * mapping)
  */
 void filemap_fdatawait(struct address_space * mapping)
 {
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 
         while (!list_empty(&mapping->locked_pages)) {
 		struct page *page = list_entry(mapping->locked_pages.next, struct page, list);
@@ -494,14 +478,14 @@ void filemap_fdatawait(struct address_space * mapping)
 			continue;
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		___wait_on_page(page);
 
 		page_cache_release(page);
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
 /*
@@ -509,102 +493,120 @@ void filemap_fdatawait(struct address_space * mapping)
  *
  * The caller must have locked the page and 
  * set all the page flags correctly..
+ *
+ * Returns 0, -EEXIST if there already is a page at that index, or
+ * -ENOMEM if the radix tree could not be extended.
  */
-void add_to_page_cache_locked(struct page * page, struct address_space *mapping, unsigned long index)
+int add_to_page_cache_locked(struct page * page, struct address_space *mapping, unsigned long index)
 {
+	int error;
+
 	if (!PageLocked(page))
 		BUG();
 
 	page_cache_get(page);
-	spin_lock(&pagecache_lock);
-	page->index = index;
-	add_page_to_inode_queue(mapping, page);
-	add_page_to_hash_queue(page, page_hash(mapping, index));
-	lru_cache_add(page);
-	spin_unlock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
+	error = add_page_to_inode_queue(mapping, page, index);
+	if (!error)
+		lru_cache_add(page);
+	spin_unlock(&mapping->page_lock);
+	if (error)
+		page_cache_release(page);
+	return error;
 }
 
 /*
  * This adds a page to the page cache, starting out as locked,
  * owned by us, but unreferenced, not uptodate and with no errors.
  */
-static inline void __add_to_page_cache(struct page * page,
-	struct address_space *mapping, unsigned long offset,
-	struct page **hash)
+static inline int __add_to_page_cache(struct page * page,
+	struct address_space *mapping, unsigned long offset)
 {
 	unsigned long flags;
+	int error;
 
 	if (PageLocked(page))
 		BUG();
 
+	/* Nobody can look the page up before we drop the page_lock */
+	error = add_page_to_inode_queue(mapping, page, offset);
+	if (error)
+		return error;
 	flags = page->flags & ~((1 << PG_uptodate) | (1 << PG_error) | (1 << PG_dirty) | (1 << PG_referenced) | (1 << PG_arch_1) | (1 << PG_checked));
 	page->flags = flags | (1 << PG_locked);
 	page_cache_get(page);
-	page->index = offset;
-	add_page_to_inode_queue(mapping, page);
-	add_page_to_hash_queue(page, hash);
 	lru_cache_add(page);
+	return 0;
 }
 
-void add_to_page_cache(struct page * page, struct address_space * mapping, unsigned long offset)
+int add_to_page_cache(struct page * page, struct address_space * mapping, unsigned long offset)
 {
-	spin_lock(&pagecache_lock);
-	__add_to_page_cache(page, mapping, offset, page_hash(mapping, offset));
-	spin_unlock(&pagecache_lock);
+	int error;
+
+	spin_lock(&mapping->page_lock);
+	error = __add_to_page_cache(page, mapping, offset);
+	spin_unlock(&mapping->page_lock);
+	return error;
 }
 
+/*
+ * Like add_to_page_cache(), for callers that can sleep: fill the radix
+ * tree node reserve first so that the insertion does not fail for lack
+ * of atomic memory.
+ */
 static int add_to_page_cache_unique(struct page * page,
-	struct address_space *mapping, unsigned long offset,
-	struct page **hash)
+	struct address_space *mapping, unsigned long offset)
 {
 	int err;
-	struct page *alias;
-
-	spin_lock(&pagecache_lock);
-	alias = __find_page_nolock(mapping, offset, *hash);
 
-	err = 1;
-	if (!alias) {
-		__add_to_page_cache(page,mapping,offset,hash);
-		err = 0;
-	}
-
-	spin_unlock(&pagecache_lock);
-	return err;
+	err = radix_tree_preload(mapping->gfp_mask & SLAB_LEVEL_MASK);
+	if (err)
+		return err;
+	return add_to_page_cache(page, mapping, offset);
 }
 
 /*
  * This adds the requested page to the page cache if it isn't already there,
- * and schedules an I/O to read in its contents from disk.
+ * and schedules an I/O to read in its contents from disk. Returns 1 if it
+ * did that, 0 if the page was there already.
  */
-static inline int page_cache_read(struct file * file, unsigned long offset) 
+static int __page_cache_read(struct file * file, unsigned long offset)
 {
 	struct inode *inode = file->f_dentry->d_inode;
 	struct address_space *mapping = inode->i_mapping;
-	struct page **hash = page_hash(mapping, offset);
 	struct page *page; 
+	int error;
 
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash); 
-	spin_unlock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset); 
+	spin_unlock(&mapping->page_lock);
 	if (page)
 		return 0;
 
-	page = page_cache_alloc(mapping);
+	page = page_cache_alloc_cold(mapping);
 	if (!page)
 		return -ENOMEM;
 
-	if (!add_to_page_cache_unique(page, mapping, offset, hash)) {
-		int error = mapping->a_ops->readpage(file, page);
+	error = add_to_page_cache_unique(page, mapping, offset);
+	if (!error) {
+		error = mapping->a_ops->readpage(file, page);
 		page_cache_release(page);
-		return error;
+		return error ? error : 1;
 	}
 	/*
 	 * We arrive here in the unlikely event that someone 
-	 * raced with us and added our page to the cache first.
+	 * raced with us and added our page to the cache first,
+	 * or if we ran out of memory.
 	 */
 	page_cache_free(page);
-	return 0;
+	return error == -EEXIST ? 0 : error;
+}
+
+static inline int page_cache_read(struct file * file, unsigned long offset)
+{
+	int error = __page_cache_read(file, offset);
+
+	return error < 0 ? error : 0;
 }
 
 /*
@@ -690,31 +692,26 @@ void lock_page(struct page *page)
 
 /*
  * a rather lightweight function, finding and getting a reference to a
- * hashed page atomically.
+ * cached page atomically.
  */
-struct page * __find_get_page(struct address_space *mapping,
-			      unsigned long offset, struct page **hash)
+struct page * find_get_page(struct address_space *mapping, unsigned long offset)
 {
 	struct page *page;
 
-	/*
-	 * We scan the hash list read-only. Addition to and removal from
-	 * the hash-list needs a held write-lock.
-	 */
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset);
 	if (page)
 		page_cache_get(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 	return page;
 }
 
 /*
  * Find a swapcache page (and get a reference) or return NULL.
- * The SwapCache check is protected by the pagecache lock.
+ * The SwapCache check is protected by the page_lock.
  */
-struct page * __find_get_swapcache_page(struct address_space *mapping,
-			      unsigned long offset, struct page **hash)
+struct page * find_get_swapcache_page(struct address_space *mapping,
+				      unsigned long offset)
 {
 	struct page *page;
 
@@ -722,17 +719,19 @@ struct page * __find_get_swapcache_page(struct address_space *mapping,
 	 * We need the LRU lock to protect against page_launder().
 	 */
 
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset);
 	if (page) {
-		spin_lock(&pagemap_lru_lock);
+		zone_t *zone = page->zone;
+
+		spin_lock(&zone->lru_lock);
 		if (PageSwapCache(page)) 
 			page_cache_get(page);
 		else
 			page = NULL;
-		spin_unlock(&pagemap_lru_lock);
+		spin_unlock(&zone->lru_lock);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 
 	return page;
 }
@@ -741,25 +740,20 @@ struct page * __find_get_swapcache_page(struct address_space *mapping,
  * Same as the above, but lock the page too, verifying that
  * it's still valid once we own it.
  */
-struct page * __find_lock_page (struct address_space *mapping,
-				unsigned long offset, struct page **hash)
+struct page * find_lock_page(struct address_space *mapping, unsigned long offset)
 {
 	struct page *page;
 
-	/*
-	 * We scan the hash list read-only. Addition to and removal from
-	 * the hash-list needs a held write-lock.
-	 */
 repeat:
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset);
 	if (page) {
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		lock_page(page);
 
-		/* Is the page still hashed? Ok, good.. */
+		/* Is the page still in the cache? Ok, good.. */
 		if (page->mapping == mapping && page->index == offset)
 			return page;
 
@@ -768,15 +762,10 @@ repeat:
 		page_cache_release(page);
 		goto repeat;
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 	return NULL;
 }
 
-#if 0
-#define PROFILE_READAHEAD
-#define DEBUG_READAHEAD
-#endif
-
 /*
  * We combine this with read-ahead to deactivate pages when we
  * think there's sequential IO going on. Note that this is
@@ -784,13 +773,13 @@ repeat:
  * but just move them to the inactive list.
  *
  * TODO:
- * - make the readahead code smarter
  * - move readahead to the VMA level so we can do the same
  *   trick with mmap()
  *
  * Rik van Riel, 2000
  */
-static void drop_behind(struct file * file, unsigned long index)
+static void drop_behind(struct file * file, unsigned long index,
+	unsigned long window)
 {
 	struct inode *inode = file->f_dentry->d_inode;
 	struct address_space *mapping = inode->i_mapping;
@@ -801,8 +790,8 @@ static void drop_behind(struct file * file, unsigned long index)
 	if (!index)
 		return;
 
-	if (index > file->f_rawin)
-		start = index - file->f_rawin;
+	if (index > window)
+		start = index - window;
 	else
 		start = 0;
 
@@ -812,132 +801,50 @@ static void drop_behind(struct file * file, unsigned long index)
 	 * been increased since the last time we were called, we
 	 * stop when the page isn't there.
 	 */
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	while (--index >= start) {
 		page = __find_page_simple(mapping, index);
 		if (!page)
 			break;
 		deactivate_page(page);
 	}
-	spin_unlock(&pagecache_lock);
-}
-
-/*
- * Read-ahead profiling information
- * --------------------------------
- * Every PROFILE_MAXREADCOUNT, the following information is written 
- * to the syslog:
- *   Percentage of asynchronous read-ahead.
- *   Average of read-ahead fields context value.
- * If DEBUG_READAHEAD is defined, a snapshot of these fields is written 
- * to the syslog.
- */
-
-#ifdef PROFILE_READAHEAD
-
-#define PROFILE_MAXREADCOUNT 1000
-
-static unsigned long total_reada;
-static unsigned long total_async;
-static unsigned long total_ramax;
-static unsigned long total_ralen;
-static unsigned long total_rawin;
-
-static void profile_readahead(int async, struct file *filp)
-{
-	unsigned long flags;
-
-	++total_reada;
-	if (async)
-		++total_async;
-
-	total_ramax	+= filp->f_ramax;
-	total_ralen	+= filp->f_ralen;
-	total_rawin	+= filp->f_rawin;
-
-	if (total_reada > PROFILE_MAXREADCOUNT) {
-		save_flags(flags);
-		cli();
-		if (!(total_reada > PROFILE_MAXREADCOUNT)) {
-			restore_flags(flags);
-			return;
-		}
-
-		printk("Readahead average:  max=%ld, len=%ld, win=%ld, async=%ld%%\n",
-			total_ramax/total_reada,
-			total_ralen/total_reada,
-			total_rawin/total_reada,
-			(total_async*100)/total_reada);
-#ifdef DEBUG_READAHEAD
-		printk("Readahead snapshot: max=%ld, len=%ld, win=%ld, raend=%Ld\n",
-			filp->f_ramax, filp->f_ralen, filp->f_rawin, filp->f_raend);
-#endif
-
-		total_reada	= 0;
-		total_async	= 0;
-		total_ramax	= 0;
-		total_ralen	= 0;
-		total_rawin	= 0;
-
-		restore_flags(flags);
-	}
+	spin_unlock(&mapping->page_lock);
 }
-#endif  /* defined PROFILE_READAHEAD */
 
 /*
- * Read-ahead context:
- * -------------------
- * The read ahead context fields of the "struct file" are the following:
- * - f_raend : position of the first byte after the last page we tried to
- *	       read ahead.
- * - f_ramax : current read-ahead maximum size.
- * - f_ralen : length of the current IO read block we tried to read-ahead.
- * - f_rawin : length of the current read-ahead window.
- *		if last read-ahead was synchronous then
- *			f_rawin = f_ralen
- *		otherwise (was asynchronous)
- *			f_rawin = previous value of f_ralen + f_ralen
+ * Read-ahead
+ * ----------
+ * do_generic_file_read() tells page_cache_readahead() about every page
+ * it reads and whether it found it in the page cache. The state lives
+ * in the struct file, split into a few streams so that a file that is
+ * read at two places in turn (threads sharing the file, nfsd serving
+ * two clients) is read ahead for both. A stream has submitted pages
+ * [start, end) for reading, the last window of them size pages long,
+ * and has a marker page:
  *
- * Read-ahead limits:
- * ------------------
- * MIN_READAHEAD   : minimum read-ahead size when read-ahead.
- * MAX_READAHEAD   : maximum read-ahead size when read-ahead.
+ *  - a page that belongs to no stream starts a new one, in the stream
+ *    used least recently, preferring streams that never got past their
+ *    first window. Only the pages that read() asked for are submitted,
+ *    and the marker is the page after them.
+ *  - reading the marker submits the next window right after the last
+ *    one, two or four times as big, up to the device's max_readahead.
+ *    If the reader is still in the previous window the marker moves to
+ *    the first page of the new one: the I/O is started and nobody waits
+ *    for it until the reader gets there. If the reader has caught up
+ *    it waits for the first page of the new window, and the marker
+ *    goes half way into it.
+ *  - a page that the stream had submitted but that is gone from the
+ *    cache was read too far ahead and reclaimed before use. The stream
+ *    starts again at the reader with half the window.
  *
- * Synchronous read-ahead benefits:
- * --------------------------------
- * Using reasonable IO xfer length from peripheral devices increase system 
- * performances.
- * Reasonable means, in this context, not too large but not too small.
- * The actual maximum value is:
- *	MAX_READAHEAD + PAGE_CACHE_SIZE = 76k is CONFIG_READA_SMALL is undefined
- *      and 32K if defined (4K page size assumed).
+ * A sequential reader thus has one window in flight ahead of it and
+ * only waits for the disk when the disk can't keep up. ra->waits counts
+ * the pages it had to wait for, ra->misses those that read-ahead didn't
+ * see coming; /proc/<pid>/readahead shows them.
  *
- * Asynchronous read-ahead benefits:
- * ---------------------------------
- * Overlapping next read request and user process execution increase system 
- * performance.
- *
- * Read-ahead risks:
- * -----------------
- * We have to guess which further data are needed by the user process.
- * If these data are often not really needed, it's bad for system 
- * performances.
- * However, we know that files are often accessed sequentially by 
- * application programs and it seems that it is possible to have some good 
- * strategy in that guessing.
- * We only try to read-ahead files that seems to be read sequentially.
- *
- * Asynchronous read-ahead risks:
- * ------------------------------
- * In order to maximize overlapping, we must start some asynchronous read 
- * request from the device, as soon as possible.
- * We must be very careful about:
- * - The number of effective pending IO read requests.
- *   ONE seems to be the only reasonable value.
- * - The total memory pool usage for the file access stream.
- *   This maximum memory usage is implicitly 2 IO read chunks:
- *   2*(MAX_READAHEAD + PAGE_CACHE_SIZE) = 156K if CONFIG_READA_SMALL is undefined,
- *   64k if defined (4K page size assumed).
+ * Readers that share a struct file update it without a lock. At worst
+ * a window is submitted twice, which costs lookups but no I/O, or a
+ * count is lost.
  */
 
 static inline int get_max_readahead(struct inode * inode)
@@ -947,114 +854,132 @@ static inline int get_max_readahead(struct inode * inode)
 	return max_readahead[MAJOR(inode->i_dev)][MINOR(inode->i_dev)];
 }
 
-static void generic_file_readahead(int reada_ok,
-	struct file * filp, struct inode * inode,
-	struct page * page)
-{
-	unsigned long end_index = inode->i_size >> PAGE_CACHE_SHIFT;
-	unsigned long index = page->index;
-	unsigned long max_ahead, ahead;
-	unsigned long raend;
-	int max_readahead = get_max_readahead(inode);
-
-	raend = filp->f_raend;
-	max_ahead = 0;
-
-/*
- * The current page is locked.
- * If the current position is inside the previous read IO request, do not
- * try to reread previously read ahead pages.
- * Otherwise decide or not to read ahead some pages synchronously.
- * If we are not going to read ahead, set the read ahead context for this 
- * page only.
- */
-	if (PageLocked(page)) {
-		if (!filp->f_ralen || index >= raend || index + filp->f_rawin < raend) {
-			raend = index;
-			if (raend < end_index)
-				max_ahead = filp->f_ramax;
-			filp->f_rawin = 0;
-			filp->f_ralen = 1;
-			if (!max_ahead) {
-				filp->f_raend  = index + filp->f_ralen;
-				filp->f_rawin += filp->f_ralen;
-			}
-		}
-	}
-/*
- * The current page is not locked.
- * If we were reading ahead and,
- * if the current max read ahead size is not zero and,
- * if the current position is inside the last read-ahead IO request,
- *   it is the moment to try to read ahead asynchronously.
- * We will later force unplug device in order to force asynchronous read IO.
- */
-	else if (reada_ok && filp->f_ramax && raend >= 1 &&
-		 index <= raend && index + filp->f_ralen >= raend) {
-/*
- * Add ONE page to max_ahead in order to try to have about the same IO max size
- * as synchronous read-ahead (MAX_READAHEAD + 1)*PAGE_CACHE_SIZE.
- * Compute the position of the last page we have tried to read in order to 
- * begin to read ahead just at the next page.
- */
-		raend -= 1;
-		if (raend < end_index)
-			max_ahead = filp->f_ramax + 1;
-
-		if (max_ahead) {
-			filp->f_rawin = filp->f_ralen;
-			filp->f_ralen = 0;
-			reada_ok      = 2;
-		}
-	}
 /*
- * Try to read ahead pages.
- * We hope that ll_rw_blk() plug/unplug, coalescence, requests sort and the
- * scheduler, will work enough for us to avoid too bad actuals IO requests.
+ * Start reading the pages of [start, start + nr) that are not in the
+ * page cache, up to the end of the file.
  */
-	ahead = 0;
-	while (ahead < max_ahead) {
-		ahead ++;
-		if ((raend + ahead) >= end_index)
-			break;
-		if (page_cache_read(filp, raend + ahead) < 0)
+static void ra_submit(struct file *filp, unsigned long start, unsigned long nr)
+{
+	struct inode *inode = filp->f_dentry->d_inode;
+	unsigned long end_index;
+	int ret;
+
+	end_index = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	for (; nr && start < end_index; start++, nr--) {
+		ret = __page_cache_read(filp, start);
+		if (ret < 0)
 			break;
+		filp->f_ra.pages += ret;
 	}
-/*
- * If we tried to read ahead some pages,
- * If we tried to read ahead asynchronously,
- *   Try to force unplug of the device in order to start an asynchronous
- *   read IO request.
- * Update the read-ahead context.
- * Store the length of the current read-ahead window.
- * Double the current max read ahead size.
- *   That heuristic avoid to do some large IO for files that are not really
- *   accessed sequentially.
- */
-	if (ahead) {
-		filp->f_ralen += ahead;
-		filp->f_rawin += filp->f_ralen;
-		filp->f_raend = raend + ahead + 1;
+}
 
-		filp->f_ramax += filp->f_ramax;
+static inline unsigned long ra_clip(unsigned long size, unsigned long max)
+{
+	if (size > max)
+		size = max;
+	return size ? size : 1;
+}
 
-		if (filp->f_ramax > max_readahead)
-			filp->f_ramax = max_readahead;
+static struct file_ra_stream *ra_find_stream(struct file_ra_state *ra,
+	unsigned long index)
+{
+	struct file_ra_stream *s;
 
-		/*
-		 * Move the pages that have already been passed
-		 * to the inactive list.
-		 */
-		drop_behind(filp, index);
+	for (s = ra->stream; s < ra->stream + FILE_RA_STREAMS; s++)
+		if (s->end && index >= s->start && index <= s->end)
+			return s;
+	return NULL;
+}
 
-#ifdef PROFILE_READAHEAD
-		profile_readahead((reada_ok == 2), filp);
-#endif
-	}
+/* A stream still in its first window has its marker at the end. */
+#define ra_stream_going(s)	((s)->marker != (s)->end)
 
-	return;
+static struct file_ra_stream *ra_new_stream(struct file_ra_state *ra)
+{
+	struct file_ra_stream *s, *victim = NULL;
+
+	for (s = ra->stream; s < ra->stream + FILE_RA_STREAMS; s++) {
+		if (!s->end)
+			return s;
+		if (victim && ra_stream_going(s) > ra_stream_going(victim))
+			continue;
+		if (victim && ra_stream_going(s) == ra_stream_going(victim) &&
+		    (long) (s->stamp - victim->stamp) > 0)
+			continue;
+		victim = s;
+	}
+	return victim;
 }
 
+/*
+ * page_cache_readahead - account for a page read and read ahead of it
+ * @filp: the file
+ * @index: the page the reader wants
+ * @nr: how many pages it asked for, from @index on
+ * @page: the page it found in the page cache, or NULL
+ *
+ * When @page is NULL it has been submitted for reading on return,
+ * unless there was no memory for it.
+ */
+static void page_cache_readahead(struct file *filp, unsigned long index,
+	unsigned long nr, struct page *page)
+{
+	struct file_ra_state *ra = &filp->f_ra;
+	unsigned long max = get_max_readahead(filp->f_dentry->d_inode);
+	struct file_ra_stream *s;
+	unsigned long size;
+	int async;
+
+	if (!page)
+		ra->misses++;
+	else if (!Page_Uptodate(page))
+		ra->waits++;
+	else
+		ra->hits++;
+
+	s = ra_find_stream(ra, index);
+	if (!s) {
+		s = ra_new_stream(ra);
+		size = ra_clip(nr, max);
+		s->start = index;
+		s->end = index + size;
+		s->size = size;
+		s->marker = s->end;
+		s->stamp = ++ra->clock;
+		ra_submit(filp, index, size);
+		return;
+	}
+	s->stamp = ++ra->clock;
+
+	if (!page && index < s->end) {
+		size = ra_clip(s->size >> 1, max);
+		s->start = index;
+		s->end = index + size;
+		s->size = size;
+		s->marker = index + (size >> 1);
+		ra_submit(filp, index, size);
+		return;
+	}
+	if (index < s->marker)
+		return;
+
+	size = s->size * (s->size < max / 16 ? 4 : 2);
+	size = ra_clip(size, max);
+	async = index < s->end;
+	if (async)
+		s->marker = s->end;
+	else
+		s->marker = s->end + (size >> 1);
+	ra_submit(filp, s->end, size);
+	drop_behind(filp, index, index - s->start);
+	s->start = index;
+	s->end += size;
+	s->size = size;
+
+	/* Don't leave it plugged until the reader gets there. */
+	if (async)
+		run_task_queue(&tq_disk);
+}
 
 /*
  * This is a generic file read routine, and uses the
@@ -1068,57 +993,18 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 {
 	struct inode *inode = filp->f_dentry->d_inode;
 	struct address_space *mapping = inode->i_mapping;
-	unsigned long index, offset;
+	unsigned long index, offset, last_index, ra_index;
 	struct page *cached_page;
-	int reada_ok;
 	int error;
-	int max_readahead = get_max_readahead(inode);
 
 	cached_page = NULL;
 	index = *ppos >> PAGE_CACHE_SHIFT;
 	offset = *ppos & ~PAGE_CACHE_MASK;
-
-/*
- * If the current position is outside the previous read-ahead window, 
- * we reset the current read-ahead context and set read ahead max to zero
- * (will be set to just needed value later),
- * otherwise, we assume that the file accesses are sequential enough to
- * continue read-ahead.
- */
-	if (index > filp->f_raend || index + filp->f_rawin < filp->f_raend) {
-		reada_ok = 0;
-		filp->f_raend = 0;
-		filp->f_ralen = 0;
-		filp->f_ramax = 0;
-		filp->f_rawin = 0;
-	} else {
-		reada_ok = 1;
-	}
-/*
- * Adjust the current value of read-ahead max.
- * If the read operation stay in the first half page, force no readahead.
- * Otherwise try to increase read ahead max just enough to do the read request.
- * Then, at least MIN_READAHEAD if read ahead is ok,
- * and at most MAX_READAHEAD in all cases.
- */
-	if (!index && offset + desc->count <= (PAGE_CACHE_SIZE >> 1)) {
-		filp->f_ramax = 0;
-	} else {
-		unsigned long needed;
-
-		needed = ((offset + desc->count) >> PAGE_CACHE_SHIFT) + 1;
-
-		if (filp->f_ramax < needed)
-			filp->f_ramax = needed;
-
-		if (reada_ok && filp->f_ramax < MIN_READAHEAD)
-				filp->f_ramax = MIN_READAHEAD;
-		if (filp->f_ramax > max_readahead)
-			filp->f_ramax = max_readahead;
-	}
+	last_index = (*ppos + desc->count + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	ra_index = ~0UL;
 
 	for (;;) {
-		struct page *page, **hash;
+		struct page *page;
 		unsigned long end_index, nr, ret;
 
 		end_index = inode->i_size >> PAGE_CACHE_SHIFT;
@@ -1136,19 +1022,28 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 		/*
 		 * Try to find the data in the page cache..
 		 */
-		hash = page_hash(mapping, index);
+		spin_lock(&mapping->page_lock);
+		page = __find_page_nolock(mapping, index);
+		if (page)
+			page_cache_get(page);
+		spin_unlock(&mapping->page_lock);
 
-		spin_lock(&pagecache_lock);
-		page = __find_page_nolock(mapping, index, *hash);
+		/*
+		 * ..and tell read-ahead, once for every page. A page that
+		 * wasn't there has been submitted now, look again.
+		 */
+		if (index != ra_index) {
+			ra_index = index;
+			page_cache_readahead(filp, index,
+				last_index > index ? last_index - index : 1, page);
+			if (!page)
+				continue;
+		}
 		if (!page)
 			goto no_cached_page;
-found_page:
-		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
 
 		if (!Page_Uptodate(page))
 			goto page_not_up_to_date;
-		generic_file_readahead(reada_ok, filp, inode, page);
 page_ok:
 		/* If users can be writing to this page using arbitrary
 		 * virtual addresses, take care about potential aliasing
@@ -1178,11 +1073,10 @@ page_ok:
 		break;
 
 /*
- * Ok, the page was not immediately readable, so let's try to read ahead while we're at it..
+ * Ok, the page was not immediately readable. Most likely read-ahead is
+ * reading it, wait for that..
  */
 page_not_up_to_date:
-		generic_file_readahead(reada_ok, filp, inode, page);
-
 		if (Page_Uptodate(page))
 			goto page_ok;
 
@@ -1209,9 +1103,6 @@ readpage:
 		if (!error) {
 			if (Page_Uptodate(page))
 				goto page_ok;
-
-			/* Again, try some read-ahead while waiting for the page to finish.. */
-			generic_file_readahead(reada_ok, filp, inode, page);
 			wait_on_page(page);
 			if (Page_Uptodate(page))
 				goto page_ok;
@@ -1225,35 +1116,29 @@ readpage:
 
 no_cached_page:
 		/*
-		 * Ok, it wasn't cached, so we need to create a new
-		 * page..
-		 *
-		 * We get here with the page cache lock held.
+		 * Ok, it wasn't cached, and read-ahead couldn't get
+		 * it either, so we need to create a new page..
 		 */
 		if (!cached_page) {
-			spin_unlock(&pagecache_lock);
 			cached_page = page_cache_alloc(mapping);
 			if (!cached_page) {
 				desc->error = -ENOMEM;
 				break;
 			}
-
-			/*
-			 * Somebody may have added the page while we
-			 * dropped the page cache lock. Check for that.
-			 */
-			spin_lock(&pagecache_lock);
-			page = __find_page_nolock(mapping, index, *hash);
-			if (page)
-				goto found_page;
 		}
 
 		/*
-		 * Ok, add the new page to the hash-queues...
+		 * Ok, add the new page to the cache. If somebody
+		 * added the page in the meantime, go and use theirs.
 		 */
+		error = add_to_page_cache_unique(cached_page, mapping, index);
+		if (error == -EEXIST)
+			continue;
+		if (error) {
+			desc->error = error;
+			break;
+		}
 		page = cached_page;
-		__add_to_page_cache(page, mapping, index, hash);
-		spin_unlock(&pagecache_lock);
 		cached_page = NULL;
 
 		goto readpage;
@@ -1497,7 +1382,7 @@ struct page * filemap_nopage(struct vm_area_struct * area,
 	struct file *file = area->vm_file;
 	struct inode *inode = file->f_dentry->d_inode;
 	struct address_space *mapping = inode->i_mapping;
-	struct page *page, **hash, *old_page;
+	struct page *page, *old_page;
 	unsigned long size, pgoff;
 
 	pgoff = ((address - area->vm_start) >> PAGE_CACHE_SHIFT) + area->vm_pgoff;
@@ -1514,9 +1399,8 @@ retry_all:
 	/*
 	 * Do we have something in the page cache already?
 	 */
-	hash = page_hash(mapping, pgoff);
 retry_find:
-	page = __find_get_page(mapping, pgoff, hash);
+	page = find_get_page(mapping, pgoff);
 	if (!page)
 		goto no_cached_page;
 
@@ -2232,13 +2116,13 @@ static unsigned char mincore_page(struct vm_area_struct * vma,
 {
 	unsigned char present = 0;
 	struct address_space * as = &vma->vm_file->f_dentry->d_inode->i_data;
-	struct page * page, ** hash = page_hash(as, pgoff);
+	struct page * page;
 
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(as, pgoff, *hash);
+	spin_lock(&as->page_lock);
+	page = __find_page_nolock(as, pgoff);
 	if ((page) && (Page_Uptodate(page)))
 		present = 1;
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&as->page_lock);
 
 	return present;
 }
@@ -2381,11 +2265,10 @@ struct page *__read_cache_page(struct address_space *mapping,
 				int (*filler)(void *,struct page*),
 				void *data)
 {
-	struct page **hash = page_hash(mapping, index);
 	struct page *page, *cached_page = NULL;
 	int err;
 repeat:
-	page = __find_get_page(mapping, index, hash);
+	page = find_get_page(mapping, index);
 	if (!page) {
 		if (!cached_page) {
 			cached_page = page_cache_alloc(mapping);
@@ -2393,8 +2276,13 @@ repeat:
 				return ERR_PTR(-ENOMEM);
 		}
 		page = cached_page;
-		if (add_to_page_cache_unique(page, mapping, index, hash))
+		err = add_to_page_cache_unique(page, mapping, index);
+		if (err == -EEXIST)
 			goto repeat;
+		if (err) {
+			page_cache_free(cached_page);
+			return ERR_PTR(err);
+		}
 		cached_page = NULL;
 		err = filler(data, page);
 		if (err < 0) {
@@ -2446,9 +2334,10 @@ retry:
 static inline struct page * __grab_cache_page(struct address_space *mapping,
 				unsigned long index, struct page **cached_page)
 {
-	struct page *page, **hash = page_hash(mapping, index);
+	struct page *page;
+	int err;
 repeat:
-	page = __find_lock_page(mapping, index, hash);
+	page = find_lock_page(mapping, index);
 	if (!page) {
 		if (!*cached_page) {
 			*cached_page = page_cache_alloc(mapping);
@@ -2456,8 +2345,11 @@ repeat:
 				return NULL;
 		}
 		page = *cached_page;
-		if (add_to_page_cache_unique(page, mapping, index, hash))
+		err = add_to_page_cache_unique(page, mapping, index);
+		if (err == -EEXIST)
 			goto repeat;
+		if (err)
+			return NULL;
 		*cached_page = NULL;
 	}
 	return page;
@@ -2695,27 +2587,5 @@ fail_write:
 
 void __init page_cache_init(unsigned long mempages)
 {
-	unsigned long htable_size, order;
-
-	htable_size = mempages;
-	htable_size *= sizeof(struct page *);
-	for(order = 0; (PAGE_SIZE << order) < htable_size; order++)
-		;
-
-	do {
-		unsigned long tmp = (PAGE_SIZE << order) / sizeof(struct page *);
-
-		page_hash_bits = 0;
-		while((tmp >>= 1UL) != 0UL)
-			page_hash_bits++;
-
-		page_hash_table = (struct page **)
-			__get_free_pages(GFP_ATOMIC, order);
-	} while(page_hash_table == NULL && --order > 0);
-
-	printk("Page-cache hash table entries: %d (order: %ld, %ld bytes)\n",
-	       (1 << page_hash_bits), order, (PAGE_SIZE << order));
-	if (!page_hash_table)
-		panic("Failed to allocate page hash table\n");
-	memset((void *)page_hash_table, 0, PAGE_HASH_SIZE * sizeof(struct page *));
+	radix_tree_init();
 }
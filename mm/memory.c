@@ -234,6 +234,7 @@ skip_copy_pte_range:		address = (address + PMD_SIZE) & PMD_MASK;
 					pte = pte_mkclean(pte);
 				pte = pte_mkold(pte);
 				get_page(ptepage);
+				page_add_rmap(ptepage, dst_pte, dst, address);
 
 cont_copy_pte_range:		set_pte(dst_pte, pte);
 cont_copy_pte_range_noset:	address += PAGE_SIZE;
@@ -262,12 +263,13 @@ nomem:
 /*
  * Return indicates whether a page was freed so caller can adjust rss
  */
-static inline int free_pte(pte_t pte)
+static inline int free_pte(pte_t *ptep, pte_t pte)
 {
 	if (pte_present(pte)) {
 		struct page *page = pte_page(pte);
 		if ((!VALID_PAGE(page)) || PageReserved(page))
 			return 0;
+		page_remove_rmap(page, ptep);
 		/* 
 		 * free_page() used to be able to clear swap cache
 		 * entries.  We may now have to do it manually.  
@@ -281,11 +283,11 @@ static inline int free_pte(pte_t pte)
 	return 0;
 }
 
-static inline void forget_pte(pte_t page)
+static inline void forget_pte(pte_t *ptep, pte_t page)
 {
 	if (!pte_none(page)) {
 		printk("forget_pte: old mapping existed!\n");
-		free_pte(page);
+		free_pte(ptep, page);
 	}
 }
 
@@ -312,11 +314,10 @@ static inline int zap_pte_range(struct mm_struct *mm, pmd_t * pmd, unsigned long
 		if (!size)
 			break;
 		page = ptep_get_and_clear(pte);
+		if (!pte_none(page))
+			freed += free_pte(pte, page);
 		pte++;
 		size--;
-		if (pte_none(page))
-			continue;
-		freed += free_pte(page);
 	}
 	return freed;
 }
@@ -706,7 +707,7 @@ static inline void zeromap_pte_range(pte_t * pte, unsigned long address,
 		pte_t zero_pte = pte_wrprotect(mk_pte(ZERO_PAGE(address), prot));
 		pte_t oldpage = ptep_get_and_clear(pte);
 		set_pte(pte, zero_pte);
-		forget_pte(oldpage);
+		forget_pte(pte, oldpage);
 		address += PAGE_SIZE;
 		pte++;
 	} while (address && (address < end));
@@ -784,7 +785,7 @@ static inline void remap_pte_range(pte_t * pte, unsigned long address, unsigned
 		page = virt_to_page(__va(phys_addr));
 		if ((!VALID_PAGE(page)) || PageReserved(page))
  			set_pte(pte, mk_pte_phys(phys_addr, prot));
-		forget_pte(oldpage);
+		forget_pte(pte, oldpage);
 		address += PAGE_SIZE;
 		phys_addr += PAGE_SIZE;
 		pte++;
@@ -949,6 +950,9 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 		if (PageReserved(old_page))
 			++mm->rss;
 		break_cow(vma, old_page, new_page, address, page_table);
+		page_remove_rmap(old_page, page_table);
+		page_add_rmap(new_page, page_table, mm, address);
+		lru_cache_add_anon(new_page);
 
 		/* Free the old page.. */
 		new_page = old_page;
@@ -1139,6 +1143,7 @@ static int do_swap_page(struct mm_struct * mm,
 	flush_page_to_ram(page);
 	flush_icache_page(vma, page);
 	set_pte(page_table, pte);
+	page_add_rmap(page, page_table, mm, address);
 
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, address, pte);
@@ -1175,9 +1180,11 @@ static int do_anonymous_page(struct mm_struct * mm, struct vm_area_struct * vma,
 		clear_user_highpage(page, addr);
 		flush_page_to_ram(page);
 		entry = pte_mkwrite(pte_mkdirty(mk_pte(page, vma->vm_page_prot)));
+		lru_cache_add_anon(page);
 	}
 
 	set_pte(page_table, entry);
+	page_add_rmap(pte_page(entry), page_table, mm, addr);
 
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, addr, entry);
@@ -1240,6 +1247,15 @@ static int do_no_page(struct mm_struct * mm, struct vm_area_struct * vma,
 			   !(vma->vm_flags & VM_SHARED))
 			entry = pte_wrprotect(entry);
 		set_pte(page_table, entry);
+		page_add_rmap(new_page, page_table, mm, address);
+
+		/*
+		 * A private copy made by ->nopage() is anonymous memory,
+		 * it goes on the page lists like any other.
+		 */
+		if (!new_page->mapping && !new_page->buffers &&
+		    page_count(new_page) == 1 && !PageReserved(new_page))
+			lru_cache_add_anon(new_page);
 	} else {
 		/* One of our sibling threads was faster, back out. */
 		page_cache_release(new_page);
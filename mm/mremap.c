@@ -57,7 +57,8 @@ static inline pte_t *alloc_one_pte(struct mm_struct *mm, unsigned long addr)
 	return pte;
 }
 
-static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst)
+static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst,
+	unsigned long new_addr)
 {
 	int error = 0;
 	pte_t pte;
@@ -70,6 +71,12 @@ static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst)
 			error++;
 		}
 		set_pte(dst, pte);
+		if (dst != src && pte_present(pte)) {
+			struct page *page = pte_page(pte);
+
+			page_remove_rmap(page, src);
+			page_add_rmap(page, dst, mm, new_addr);
+		}
 	}
 	return error;
 }
@@ -82,7 +89,7 @@ static int move_one_page(struct mm_struct *mm, unsigned long old_addr, unsigned
 	spin_lock(&mm->page_table_lock);
 	src = get_one_pte(mm, old_addr);
 	if (src)
-		error = copy_one_pte(mm, src, alloc_one_pte(mm, new_addr));
+		error = copy_one_pte(mm, src, alloc_one_pte(mm, new_addr), new_addr);
 	spin_unlock(&mm->page_table_lock);
 	return error;
 }
@@ -19,8 +19,6 @@
 #include <linux/slab.h>
 
 int nr_swap_pages;
-int nr_active_pages;
-int nr_inactive_dirty_pages;
 pg_data_t *pgdat_list;
 
 static char *zone_names[MAX_NR_ZONES] = { "DMA", "Normal", "HighMem" };
@@ -28,8 +26,6 @@ static int zone_balance_ratio[MAX_NR_ZONES] = { 32, 128, 128, };
 static int zone_balance_min[MAX_NR_ZONES] = { 10 , 10, 10, };
 static int zone_balance_max[MAX_NR_ZONES] = { 255 , 255, 255, };
 
-struct list_head active_list;
-struct list_head inactive_dirty_list;
 /*
  * Free_page() adds the page to the free lists. This is optimized for
  * fast normal cases (no error jumps taken normally).
@@ -61,14 +57,12 @@ struct list_head inactive_dirty_list;
  * Hint: -mask = 1+~mask
  */
 
-static void FASTCALL(__free_pages_ok (struct page *page, unsigned long order));
-static void __free_pages_ok (struct page *page, unsigned long order)
+/*
+ * Sanity checks and cleanups for a page that is going back to the
+ * free lists.
+ */
+static inline void free_pages_prepare(struct page *page)
 {
-	unsigned long index, page_idx, mask, flags;
-	free_area_t *area;
-	struct page *base;
-	zone_t *zone;
-
 	if (page->buffers)
 		BUG();
 	if (page->mapping)
@@ -81,17 +75,30 @@ static void __free_pages_ok (struct page *page, unsigned long order)
 		BUG();
 	if (PageDecrAfter(page))
 		BUG();
-	if (PageActive(page))
-		BUG();
-	if (PageInactiveDirty(page))
-		BUG();
-	if (PageInactiveClean(page))
+	if (page->pte_chain)
 		BUG();
 
+	/* Anonymous pages leave the page lists only when they are freed */
+	if (PageActive(page) || PageInactiveDirty(page) ||
+			PageInactiveClean(page)) {
+		spin_lock(&page->zone->lru_lock);
+		__lru_cache_del(page);
+		spin_unlock(&page->zone->lru_lock);
+	}
+
 	page->flags &= ~((1<<PG_referenced) | (1<<PG_dirty));
 	page->age = PAGE_AGE_START;
-	
-	zone = page->zone;
+}
+
+/*
+ * Give a block of pages back to the buddy lists of its zone. The
+ * caller holds zone->lock.
+ */
+static void __free_one_page(zone_t *zone, struct page *page, unsigned long order)
+{
+	unsigned long index, page_idx, mask;
+	free_area_t *area;
+	struct page *base;
 
 	mask = (~0UL) << order;
 	base = zone->zone_mem_map;
@@ -102,8 +109,6 @@ static void __free_pages_ok (struct page *page, unsigned long order)
 
 	area = zone->free_area + order;
 
-	spin_lock_irqsave(&zone->lock, flags);
-
 	zone->free_pages -= mask;
 
 	while (mask + (1 << (MAX_ORDER-1))) {
@@ -133,7 +138,19 @@ static void __free_pages_ok (struct page *page, unsigned long order)
 		page_idx &= mask;
 	}
 	memlist_add_head(&(base + page_idx)->list, &area->free_list);
+}
+
+static void FASTCALL(__free_pages_ok (struct page *page, unsigned long order));
+static void __free_pages_ok (struct page *page, unsigned long order)
+{
+	unsigned long flags;
+	zone_t *zone;
+
+	free_pages_prepare(page);
+	zone = page->zone;
 
+	spin_lock_irqsave(&zone->lock, flags);
+	__free_one_page(zone, page, order);
 	spin_unlock_irqrestore(&zone->lock, flags);
 
 	/*
@@ -169,16 +186,17 @@ static inline struct page * expand (zone_t *zone, struct page *page,
 	return page;
 }
 
-static FASTCALL(struct page * rmqueue(zone_t *zone, unsigned long order));
-static struct page * rmqueue(zone_t *zone, unsigned long order)
+/*
+ * Take a block of pages off the buddy lists of a zone. The caller
+ * holds zone->lock.
+ */
+static struct page * __rmqueue(zone_t *zone, unsigned long order)
 {
 	free_area_t * area = zone->free_area + order;
 	unsigned long curr_order = order;
 	struct list_head *head, *curr;
-	unsigned long flags;
 	struct page *page;
 
-	spin_lock_irqsave(&zone->lock, flags);
 	do {
 		head = &area->free_list;
 		curr = memlist_next(head);
@@ -195,23 +213,193 @@ static struct page * rmqueue(zone_t *zone, unsigned long order)
 				MARK_USED(index, curr_order, area);
 			zone->free_pages -= 1 << order;
 
-			page = expand(zone, page, index, order, curr_order, area);
-			spin_unlock_irqrestore(&zone->lock, flags);
-
-			set_page_count(page, 1);
-			if (BAD_RANGE(zone,page))
-				BUG();
-			DEBUG_ADD_PAGE
-			return page;	
+			return expand(zone, page, index, order, curr_order, area);
 		}
 		curr_order++;
 		area++;
 	} while (curr_order < MAX_ORDER);
-	spin_unlock_irqrestore(&zone->lock, flags);
 
 	return NULL;
 }
 
+/*
+ * The per-CPU page lists are refilled up to the low watermark when
+ * they run empty, and drained back to it when they grow beyond the
+ * high watermark. Both are tunable through /proc/sys/vm/percpu_pages.
+ */
+int percpu_pages_water[2] = { 8, 32 };
+
+/*
+ * Move up to count pages from the buddy lists to a per-CPU list.
+ * Called with interrupts disabled.
+ */
+static int rmqueue_bulk(zone_t *zone, int count, struct list_head *list)
+{
+	struct page *page;
+	int i;
+
+	spin_lock(&zone->lock);
+	for (i = 0; i < count; i++) {
+		page = __rmqueue(zone, 0);
+		if (!page)
+			break;
+		list_add_tail(&page->list, list);
+	}
+	spin_unlock(&zone->lock);
+	return i;
+}
+
+/*
+ * Give count pages from the tail of a per-CPU list back to the buddy
+ * lists. Called with interrupts disabled.
+ */
+static int free_pages_bulk(zone_t *zone, int count, struct list_head *list)
+{
+	struct page *page;
+	int i;
+
+	spin_lock(&zone->lock);
+	for (i = 0; i < count && !list_empty(list); i++) {
+		page = list_entry(list->prev, struct page, list);
+		list_del(&page->list);
+		__free_one_page(zone, page, 0);
+	}
+	spin_unlock(&zone->lock);
+	return i;
+}
+
+static struct page * pcp_alloc(zone_t *zone, int cold)
+{
+	struct per_cpu_pageset *pset;
+	struct per_cpu_pages *pcp;
+	struct page *page = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pset = zone->pageset + smp_processor_id();
+	pcp = pset->pcp + cold;
+	if (!pcp->count) {
+		int low = percpu_pages_water[0];
+
+		pcp->count = rmqueue_bulk(zone, low > 0 ? low : 1, &pcp->list);
+		pset->refills++;
+	}
+	if (pcp->count) {
+		page = list_entry(pcp->list.next, struct page, list);
+		list_del(&page->list);
+		pcp->count--;
+		pset->allocs++;
+	}
+	local_irq_restore(flags);
+	return page;
+}
+
+static void FASTCALL(free_hot_cold_page(struct page *page, int cold));
+static void free_hot_cold_page(struct page *page, int cold)
+{
+	struct per_cpu_pageset *pset;
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+	zone_t *zone;
+
+	free_pages_prepare(page);
+	zone = page->zone;
+
+	local_irq_save(flags);
+	pset = zone->pageset + smp_processor_id();
+	pcp = pset->pcp + cold;
+	list_add(&page->list, &pcp->list);
+	pcp->count++;
+	pset->frees++;
+	if (pcp->count > percpu_pages_water[1]) {
+		int low = percpu_pages_water[0], high = percpu_pages_water[1];
+
+		if (low > high)
+			low = high;
+		if (low < 0)
+			low = 0;
+		pcp->count -= free_pages_bulk(zone, pcp->count - low, &pcp->list);
+		pset->drains++;
+	}
+	local_irq_restore(flags);
+
+	if (memory_pressure > NR_CPUS)
+		memory_pressure--;
+}
+
+/**
+ * free_cold_page - free a single page that is not in the CPU cache
+ * @page: the page, its last reference is dropped
+ *
+ * The page will be handed out to allocations that do not care
+ * about cache warmth, like page cache reads, before others.
+ */
+void free_cold_page(struct page *page)
+{
+	if (!PageReserved(page) && put_page_testzero(page))
+		free_hot_cold_page(page, PCP_COLD);
+}
+
+/*
+ * Give all pages on this CPU's lists back to the buddy allocator, so
+ * that they can be merged into larger blocks.
+ */
+void drain_local_pages(void)
+{
+	struct per_cpu_pageset *pset;
+	unsigned long flags;
+	zone_t *zone;
+	int i;
+
+	local_irq_save(flags);
+	for_each_zone(zone) {
+		pset = zone->pageset + smp_processor_id();
+		for (i = 0; i < 2; i++) {
+			struct per_cpu_pages *pcp = pset->pcp + i;
+
+			pcp->count -= free_pages_bulk(zone, pcp->count, &pcp->list);
+		}
+	}
+	local_irq_restore(flags);
+}
+
+static void drain_pages_ipi(void *info)
+{
+	drain_local_pages();
+}
+
+static void drain_all_pages(void)
+{
+	smp_call_function(drain_pages_ipi, NULL, 0, 1);
+	drain_local_pages();
+}
+
+static FASTCALL(struct page * rmqueue(zone_t *zone, unsigned long order, int cold));
+static struct page * rmqueue(zone_t *zone, unsigned long order, int cold)
+{
+	unsigned long flags;
+	struct page *page;
+
+	if (order == 0) {
+		page = pcp_alloc(zone, cold);
+		if (page)
+			goto got_page;
+	}
+
+	spin_lock_irqsave(&zone->lock, flags);
+	page = __rmqueue(zone, order);
+	spin_unlock_irqrestore(&zone->lock, flags);
+	if (!page)
+		return NULL;
+
+got_page:
+	set_page_count(page, 1);
+	if (BAD_RANGE(zone,page))
+		BUG();
+	DEBUG_ADD_PAGE
+	return page;
+}
+
 #define PAGES_MIN	0
 #define PAGES_LOW	1
 #define PAGES_HIGH	2
@@ -222,7 +410,7 @@ static struct page * rmqueue(zone_t *zone, unsigned long order)
  * (suggested by Davem at 1:30 AM, typed by Rik at 6 AM)
  */
 static struct page * __alloc_pages_limit(zonelist_t *zonelist,
-			unsigned long order, int limit, int direct_reclaim)
+			unsigned long order, int limit, int direct_reclaim, int cold)
 {
 	zone_t **zone = zonelist->zones;
 
@@ -258,7 +446,7 @@ static struct page * __alloc_pages_limit(zonelist_t *zonelist,
 				page = reclaim_page(z);
 			/* If that fails, fall back to rmqueue. */
 			if (!page)
-				page = rmqueue(z, order);
+				page = rmqueue(z, order, cold);
 			if (page)
 				return page;
 		}
@@ -283,6 +471,7 @@ struct page * __alloc_pages(unsigned int gfp_mask, unsigned long order, zonelist
 {
 	zone_t **zone;
 	int direct_reclaim = 0;
+	int cold = (gfp_mask & __GFP_COLD) ? PCP_COLD : PCP_HOT;
 	struct page * page;
 
 	/*
@@ -321,7 +510,7 @@ try_again:
 			BUG();
 
 		if (z->free_pages >= z->pages_low) {
-			page = rmqueue(z, order);
+			page = rmqueue(z, order, cold);
 			if (page)
 				return page;
 		} else if (z->free_pages < z->pages_min &&
@@ -338,7 +527,7 @@ try_again:
 	 * will be high and we'll have a good chance of
 	 * finding a page using the HIGH limit.
 	 */
-	page = __alloc_pages_limit(zonelist, order, PAGES_HIGH, direct_reclaim);
+	page = __alloc_pages_limit(zonelist, order, PAGES_HIGH, direct_reclaim, cold);
 	if (page)
 		return page;
 
@@ -350,7 +539,7 @@ try_again:
 	 * is low, we're most likely to have our allocation
 	 * succeed here.
 	 */
-	page = __alloc_pages_limit(zonelist, order, PAGES_LOW, direct_reclaim);
+	page = __alloc_pages_limit(zonelist, order, PAGES_LOW, direct_reclaim, cold);
 	if (page)
 		return page;
 
@@ -385,7 +574,7 @@ try_again:
 	 * Kswapd should, in most situations, bring the situation
 	 * back to normal in no time.
 	 */
-	page = __alloc_pages_limit(zonelist, order, PAGES_MIN, direct_reclaim);
+	page = __alloc_pages_limit(zonelist, order, PAGES_MIN, direct_reclaim, cold);
 	if (page)
 		return page;
 
@@ -408,6 +597,8 @@ try_again:
 		 */
 		if (order > 0 && (gfp_mask & __GFP_WAIT)) {
 			zone = zonelist->zones;
+			/* Single free pages on the CPU lists can't merge */
+			drain_all_pages();
 			/* First, clean some dirty pages. */
 			current->flags |= PF_MEMALLOC;
 			page_launder(gfp_mask, 1);
@@ -424,9 +615,11 @@ try_again:
 					page = reclaim_page(z);
 					if (!page)
 						break;
-					__free_page(page);
+					/* Straight to the buddy lists. */
+					if (put_page_testzero(page))
+						__free_pages_ok(page, 0);
 					/* Try if the allocation succeeds. */
-					page = rmqueue(z, order);
+					page = rmqueue(z, order, cold);
 					if (page)
 						return page;
 				}
@@ -496,7 +689,7 @@ try_again:
 		if (z->free_pages < z->pages_min / 4 &&
 				!(current->flags & PF_MEMALLOC))
 			continue;
-		page = rmqueue(z, order);
+		page = rmqueue(z, order, cold);
 		if (page)
 			return page;
 	}
@@ -534,8 +727,12 @@ unsigned long get_zeroed_page(int gfp_mask)
 
 void __free_pages(struct page *page, unsigned long order)
 {
-	if (!PageReserved(page) && put_page_testzero(page))
-		__free_pages_ok(page, order);
+	if (!PageReserved(page) && put_page_testzero(page)) {
+		if (order == 0)
+			free_hot_cold_page(page, PCP_HOT);
+		else
+			__free_pages_ok(page, order);
+	}
 }
 
 void free_pages(unsigned long addr, unsigned long order)
@@ -580,6 +777,42 @@ unsigned int nr_inactive_clean_pages (void)
 	return sum;
 }
 
+/*
+ * Total amount of active RAM:
+ */
+unsigned int nr_active_pages (void)
+{
+	unsigned int sum;
+	zone_t *zone;
+	pg_data_t *pgdat = pgdat_list;
+
+	sum = 0;
+	while (pgdat) {
+		for (zone = pgdat->node_zones; zone < pgdat->node_zones + MAX_NR_ZONES; zone++)
+			sum += zone->active_pages;
+		pgdat = pgdat->node_next;
+	}
+	return sum;
+}
+
+/*
+ * Total amount of inactive_dirty RAM:
+ */
+unsigned int nr_inactive_dirty_pages (void)
+{
+	unsigned int sum;
+	zone_t *zone;
+	pg_data_t *pgdat = pgdat_list;
+
+	sum = 0;
+	while (pgdat) {
+		for (zone = pgdat->node_zones; zone < pgdat->node_zones + MAX_NR_ZONES; zone++)
+			sum += zone->inactive_dirty_pages;
+		pgdat = pgdat->node_next;
+	}
+	return sum;
+}
+
 /*
  * Amount of free RAM allocatable as buffer memory:
  */
@@ -589,7 +822,7 @@ unsigned int nr_free_buffer_pages (void)
 
 	sum = nr_free_pages();
 	sum += nr_inactive_clean_pages();
-	sum += nr_inactive_dirty_pages;
+	sum += nr_inactive_dirty_pages();
 
 	/*
 	 * Keep our write behind queue filled, even if
@@ -603,7 +836,7 @@ unsigned int nr_free_buffer_pages (void)
 	 * to be possible to have some dirty pages in the
 	 * working set without upsetting the writebehind logic.
 	 */
-	sum += nr_active_pages >> 4;
+	sum += nr_active_pages() >> 4;
 
 	return sum;
 }
@@ -637,8 +870,8 @@ void show_free_areas_core(pg_data_t *pgdat)
 		nr_free_highpages() << (PAGE_SHIFT-10));
 
 	printk("( Active: %d, inactive_dirty: %d, inactive_clean: %d, free: %d (%d %d %d) )\n",
-		nr_active_pages,
-		nr_inactive_dirty_pages,
+		nr_active_pages(),
+		nr_inactive_dirty_pages(),
 		nr_inactive_clean_pages(),
 		nr_free_pages(),
 		freepages.min,
@@ -763,9 +996,6 @@ void __init free_area_init_core(int nid, pg_data_t *pgdat, struct page **gmap,
 			
 	printk("On node %d totalpages: %lu\n", nid, realtotalpages);
 
-	memlist_init(&active_list);
-	memlist_init(&inactive_dirty_list);
-
 	/*
 	 * Some architectures (with lots of mem and discontinous memory
 	 * maps) have to search for a good mem_map area:
@@ -812,9 +1042,20 @@ void __init free_area_init_core(int nid, pg_data_t *pgdat, struct page **gmap,
 		zone->lock = SPIN_LOCK_UNLOCKED;
 		zone->zone_pgdat = pgdat;
 		zone->free_pages = 0;
-		zone->inactive_clean_pages = 0;
+		zone->lru_lock = SPIN_LOCK_UNLOCKED;
+		zone->active_pages = 0;
 		zone->inactive_dirty_pages = 0;
+		zone->inactive_clean_pages = 0;
+		memlist_init(&zone->active_list);
+		memlist_init(&zone->inactive_dirty_list);
 		memlist_init(&zone->inactive_clean_list);
+		for (i = 0; i < NR_CPUS; i++) {
+			struct per_cpu_pageset *pset = zone->pageset + i;
+
+			memset(pset, 0, sizeof(*pset));
+			memlist_init(&pset->pcp[PCP_HOT].list);
+			memlist_init(&pset->pcp[PCP_COLD].list);
+		}
 		if (!size)
 			continue;
 
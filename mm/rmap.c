@@ -0,0 +1,274 @@
+/*
+ *  linux/mm/rmap.c
+ *
+ *  Reverse mappings: every page table entry that maps a page into user
+ *  space is recorded on a chain hanging off the page, so that pageout
+ *  can unmap one particular page from all the processes using it,
+ *  instead of walking the page tables of every process looking for
+ *  pages that might be worth unmapping.
+ *
+ *  A chain entry remembers the pte and the mm and virtual address it
+ *  belongs to. The chain of a page is protected by the PG_chainlock
+ *  bit in page->flags. Chains are modified with the page_table_lock
+ *  of the mm held, so that lock nests outside the chain lock; pageout,
+ *  which comes in from the page side, only ever trylocks it.
+ *
+ *  Entries are allocated atomically, as the callers hold spinlocks.
+ *  If an allocation fails the mapping is simply not recorded: pageout
+ *  can not remove it, and since the mapping still holds a reference,
+ *  the page stays in memory until it is unmapped the normal way.
+ */
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/init.h>
+#include <linux/pagemap.h>
+
+#include <asm/pgalloc.h>
+
+struct pte_chain {
+	struct pte_chain *next;
+	pte_t *ptep;
+	struct mm_struct *mm;
+	unsigned long address;
+};
+
+static kmem_cache_t *pte_chain_cachep;
+
+static inline void pte_chain_lock(struct page *page)
+{
+	while (test_and_set_bit(PG_chainlock, &page->flags)) {
+		while (test_bit(PG_chainlock, &page->flags))
+			barrier();
+	}
+}
+
+static inline void pte_chain_unlock(struct page *page)
+{
+	smp_mb__before_clear_bit();
+	clear_bit(PG_chainlock, &page->flags);
+}
+
+/**
+ * page_add_rmap - record a new mapping of a page
+ * @page: the page that was mapped
+ * @ptep: the page table entry now pointing at it
+ * @mm: address space the entry belongs to
+ * @address: user virtual address mapped by the entry
+ *
+ * Called with mm->page_table_lock held, right after the pte is set.
+ */
+void page_add_rmap(struct page *page, pte_t *ptep, struct mm_struct *mm,
+		   unsigned long address)
+{
+	struct pte_chain *pc;
+
+	if (!VALID_PAGE(page) || PageReserved(page))
+		return;
+
+	pc = kmem_cache_alloc(pte_chain_cachep, SLAB_ATOMIC);
+	if (!pc) {
+		vmscan_stat.untracked++;
+		return;
+	}
+	pc->ptep = ptep;
+	pc->mm = mm;
+	pc->address = address & PAGE_MASK;
+
+	pte_chain_lock(page);
+	pc->next = page->pte_chain;
+	page->pte_chain = pc;
+	pte_chain_unlock(page);
+}
+
+/**
+ * page_remove_rmap - forget a mapping of a page
+ * @page: the page that was mapped
+ * @ptep: the page table entry that pointed at it
+ *
+ * Called with mm->page_table_lock held, after the pte was cleared or
+ * changed and before the reference held by the mapping is dropped.
+ */
+void page_remove_rmap(struct page *page, pte_t *ptep)
+{
+	struct pte_chain *pc, **pcp;
+
+	if (!VALID_PAGE(page) || PageReserved(page))
+		return;
+
+	pte_chain_lock(page);
+	for (pcp = &page->pte_chain; (pc = *pcp) != NULL; pcp = &pc->next) {
+		if (pc->ptep == ptep) {
+			*pcp = pc->next;
+			break;
+		}
+	}
+	pte_chain_unlock(page);
+
+	/* No entry means page_add_rmap() could not allocate one */
+	if (pc)
+		kmem_cache_free(pte_chain_cachep, pc);
+}
+
+/**
+ * page_referenced - test and clear the accessed bits of all mappings
+ * @page: the page to look at
+ *
+ * Returns the number of mappings that were used since the last call.
+ * A mapping whose mm is busy counts as used, we do not wait for it.
+ */
+int page_referenced(struct page *page)
+{
+	struct pte_chain *pc;
+	int referenced = 0;
+
+	pte_chain_lock(page);
+	for (pc = page->pte_chain; pc; pc = pc->next) {
+		struct mm_struct *mm = pc->mm;
+
+		if (!spin_trylock(&mm->page_table_lock)) {
+			referenced++;
+			continue;
+		}
+		if (ptep_test_and_clear_young(pc->ptep))
+			referenced++;
+		spin_unlock(&mm->page_table_lock);
+	}
+	pte_chain_unlock(page);
+	return referenced;
+}
+
+/**
+ * page_mapped_get - take a reference on a page if it is mapped
+ * @page: a page found on the page lists
+ *
+ * The pageout code finds pages on the lists without holding a
+ * reference on them. A page that is still mapped can not be freed
+ * before its pte chain is empty, so the chain lock makes it safe to
+ * take a reference on it. Returns 1 if a reference was taken.
+ */
+int page_mapped_get(struct page *page)
+{
+	int ret = 0;
+
+	pte_chain_lock(page);
+	if (page->pte_chain) {
+		page_cache_get(page);
+		ret = 1;
+	}
+	pte_chain_unlock(page);
+	return ret;
+}
+
+/*
+ * Unmap one pte. The page is locked and in the page cache or the swap
+ * cache, the chain lock is held. Returns one of the SWAP_ codes; on
+ * SWAP_SUCCESS the caller unlinks and frees the chain entry.
+ */
+static int try_to_unmap_one(struct page *page, struct pte_chain *pc, int *dirty)
+{
+	struct mm_struct *mm = pc->mm;
+	unsigned long address = pc->address;
+	struct vm_area_struct *vma;
+	pte_t pte;
+	int ret = SWAP_FAIL;
+
+	if (!spin_trylock(&mm->page_table_lock))
+		return SWAP_AGAIN;
+
+	vma = find_vma(mm, address);
+	if (!vma || (vma->vm_flags & (VM_LOCKED|VM_RESERVED)))
+		goto out_unlock;
+
+	/* Used since the page was deactivated? Leave it alone. */
+	if (ptep_test_and_clear_young(pc->ptep))
+		goto out_unlock;
+
+	flush_cache_page(vma, address);
+	pte = ptep_get_and_clear(pc->ptep);
+	flush_tlb_page(vma, address);
+
+	/*
+	 * A page cache page can just be dropped, it will be faulted in
+	 * again through the mapping. A swap cache page leaves a swap
+	 * entry behind.
+	 */
+	if (PageSwapCache(page)) {
+		swp_entry_t entry;
+
+		entry.val = page->index;
+		swap_duplicate(entry);
+		set_pte(pc->ptep, swp_entry_to_pte(entry));
+	}
+	if (pte_dirty(pte))
+		*dirty = 1;
+
+	mm->rss--;
+	/* The caller holds a reference too, this one is never the last */
+	page_cache_release(page);
+	ret = SWAP_SUCCESS;
+
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
+/**
+ * try_to_unmap - unmap a page from all the processes using it
+ * @page: the page to unmap
+ *
+ * The caller holds the page lock and a reference on the page, which
+ * has to be in the page cache or the swap cache. Stops at the first
+ * mapping that can not be removed.
+ */
+int try_to_unmap(struct page *page)
+{
+	struct pte_chain *pc, **pcp, *freed = NULL;
+	int ret = SWAP_SUCCESS, dirty = 0;
+
+	if (!PageLocked(page))
+		BUG();
+	if (!page->mapping)
+		return SWAP_FAIL;
+
+	pte_chain_lock(page);
+	pcp = &page->pte_chain;
+	while ((pc = *pcp) != NULL) {
+		switch (try_to_unmap_one(page, pc, &dirty)) {
+		case SWAP_SUCCESS:
+			*pcp = pc->next;
+			pc->next = freed;
+			freed = pc;
+			continue;
+		case SWAP_AGAIN:
+			ret = SWAP_AGAIN;
+			break;
+		case SWAP_FAIL:
+			ret = SWAP_FAIL;
+			goto out;
+		}
+		pcp = &pc->next;
+	}
+out:
+	pte_chain_unlock(page);
+
+	/* set_page_dirty() takes the page_lock, which nests outside us */
+	if (dirty)
+		set_page_dirty(page);
+
+	while (freed) {
+		pc = freed;
+		freed = pc->next;
+		kmem_cache_free(pte_chain_cachep, pc);
+	}
+	return ret;
+}
+
+void __init rmap_init(void)
+{
+	pte_chain_cachep = kmem_cache_create("pte_chain",
+			sizeof(struct pte_chain), 0, 0, NULL, NULL);
+	if (!pte_chain_cachep)
+		panic("Failed to create pte_chain cache\n");
+}
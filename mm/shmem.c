@@ -24,6 +24,7 @@
 #include <linux/file.h>
 #include <linux/swap.h>
 #include <linux/pagemap.h>
+#include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/locks.h>
 #include <asm/smplock.h>
@@ -247,6 +248,12 @@ static int shmem_writepage(struct page * page)
 		activate_page(page);
 		goto out;
 	}
+	/* Nothing below may sleep, so make sure the swap cache insert can't fail */
+	if (radix_tree_preload(GFP_NOIO)) {
+		swap_free(swap);
+		activate_page(page);
+		goto out;
+	}
 
 	spin_lock(&info->lock);
 	entry = shmem_swp_entry(info, page->index);
@@ -264,7 +271,8 @@ static int shmem_writepage(struct page * page)
 	remove_inode_page(page);
 
 	/* Add it to the swap cache */
-	add_to_swap_cache(page, swap);
+	if (add_to_swap_cache(page, swap))
+		BUG();
 	page_cache_release(page);
 	info->swapped++;
 
@@ -304,6 +312,10 @@ repeat:
 	if (IS_ERR(entry))
 		return (void *)entry;
 
+	/* For moving a page from the swap cache below, under info->lock */
+	if (radix_tree_preload(mapping->gfp_mask & SLAB_LEVEL_MASK))
+		return ERR_PTR(-ENOMEM);
+
 	spin_lock (&info->lock);
 	
 	/* The shmem_swp_entry() call may have blocked, and
@@ -311,7 +323,7 @@ repeat:
 	 * cache and swap cache.  We need to recheck the page cache
 	 * under the protection of the info->lock spinlock. */
 
-	page = __find_get_page(mapping, idx, page_hash(mapping, idx));
+	page = find_get_page(mapping, idx);
 	if (page) {
 		if (TryLockPage(page))
 			goto wait_retry;
@@ -324,8 +336,7 @@ repeat:
 		unsigned long flags;
 
 		/* Look it up and read it in.. */
-		page = __find_get_page(&swapper_space, entry->val,
-				       page_hash(&swapper_space, entry->val));
+		page = find_get_page(&swapper_space, entry->val);
 		if (!page) {
 			spin_unlock (&info->lock);
 			lock_kernel();
@@ -355,7 +366,8 @@ repeat:
 		delete_from_swap_cache_nolock(page);
 		flags = page->flags & ~((1 << PG_uptodate) | (1 << PG_error) | (1 << PG_referenced) | (1 << PG_arch_1));
 		page->flags = flags | (1 << PG_dirty);
-		add_to_page_cache_locked(page, mapping, idx);
+		if (add_to_page_cache_locked(page, mapping, idx))
+			BUG();	/* preloaded, and we hold info->lock */
 		info->swapped--;
 		spin_unlock (&info->lock);
 	} else {
@@ -377,8 +389,15 @@ repeat:
 		if (!page)
 			return ERR_PTR(-ENOMEM);
 		clear_highpage(page);
+		if (radix_tree_preload(mapping->gfp_mask & SLAB_LEVEL_MASK) ||
+		    add_to_page_cache(page, mapping, idx)) {
+			page_cache_release(page);
+			spin_lock (&inode->i_sb->u.shmem_sb.stat_lock);
+			inode->i_sb->u.shmem_sb.free_blocks++;
+			spin_unlock (&inode->i_sb->u.shmem_sb.stat_lock);
+			return ERR_PTR(-ENOMEM);
+		}
 		inode->i_blocks += BLOCKS_PER_PAGE;
-		add_to_page_cache (page, mapping, idx);
 	}
 
 	/* We have the page */
@@ -1233,7 +1252,8 @@ out:
 	spin_unlock (&info->lock);
 	return 0;
 found:
-	add_to_page_cache(page, inode->i_mapping, offset + idx);
+	if (add_to_page_cache(page, inode->i_mapping, offset + idx))
+		BUG();	/* preloaded by shmem_unuse() */
 	set_page_dirty(page);
 	SetPageUptodate(page);
 	UnlockPage(page);
@@ -1250,6 +1270,10 @@ void shmem_unuse(swp_entry_t entry, struct page *page)
 	struct list_head *p;
 	struct inode * inode;
 
+	/* shmem_unuse_inode() can't fail once it has found the entry */
+	if (radix_tree_preload(GFP_KERNEL))
+		return;
+
 	spin_lock (&shmem_ilock);
 	list_for_each(p, &shmem_inodes) {
 		inode = list_entry(p, struct inode, u.shmem_i.list);
@@ -38,18 +38,31 @@
  * kmem_cache_destroy() CAN CRASH if you try to allocate from the cache
  * during kmem_cache_destroy(). The caller must prevent concurrent allocs.
  *
- * On SMP systems, each cache has a short per-cpu head array, most allocs
- * and frees go into that array, and if that array overflows, then 1/2
- * of the entries in the array are given back into the global cache.
- * This reduces the number of spinlock operations.
+ * On discontiguous memory machines each memory node has its own slab
+ * list, and allocations prefer slabs on the node of the allocating cpu.
  *
- * The c_cpuarray may not be read with enabled local interrupts.
+ * On SMP systems, each cache has a magazine layer in front of the slabs,
+ * as described in
+ *	Magazines and Vmem: Extending the Slab Allocator to Many CPUs
+ *	and Arbitrary Resources, Jeff Bonwick and Jonathan Adams.
+ *	USENIX Annual Technical Conference, 2001.
+ * A magazine is a small stack of objects. Each cpu has a loaded and a
+ * previous magazine, and most allocs and frees only push or pop the
+ * loaded one. When it runs empty or full, the two are exchanged, and
+ * only if that does not help either, a full or empty magazine is
+ * traded with the depot of the cache, which needs a short lock hold.
+ * The slabs themselves are only touched when the depot has nothing to
+ * trade, and then batchcount objects at a time.
+ *
+ * The per-cpu data may not be read with enabled local interrupts.
  *
  * SMP synchronization:
  *  constructors and destructors are called without any locking.
  *  Several members in kmem_cache_t and slab_t never change, they
  *	are accessed without any locking.
- *  The per-cpu arrays are never accessed from the wrong cpu, no locking.
+ *  The per-cpu magazines are never accessed from the wrong cpu, no locking.
+ *  The depot has its own irq spinlock. It nests inside the cache lock,
+ *	the alloc and free paths never hold both.
  *  The non-constant members are protected with a per-cache irq spinlock.
  *
  * Further notes from the original documentation:
@@ -140,8 +153,8 @@ static unsigned long offslab_limit;
  *
  * Manages the objs in a slab. Placed either at the beginning of mem allocated
  * for a slab, or allocated from an general cache.
- * Slabs are chained into one ordered list: fully used, partial, then fully
- * free slabs.
+ * The slabs of each node are chained into one ordered list: fully used,
+ * partial, then fully free slabs.
  */
 typedef struct slab_s {
 	struct list_head	list;
@@ -154,22 +167,90 @@ typedef struct slab_s {
 #define slab_bufctl(slabp) \
 	((kmem_bufctl_t *)(((slab_t*)slabp)+1))
 
+/*
+ * kmem_list_t
+ *
+ * The slabs of a cache that live on one memory node.
+ */
+typedef struct kmem_list_s {
+	/* full, partial first, then free */
+	struct list_head	slabs;
+	struct list_head	*firstnotfull;
+} kmem_list_t;
+
+/*
+ * Nodes beyond SLAB_NODES share lists. The lists only decide which
+ * slab an allocation comes from, so that costs locality, nothing else.
+ */
+#ifdef CONFIG_DISCONTIGMEM
+#define SLAB_NODES		8
+#define page_slab_node(page)	((page)->zone->zone_pgdat->node_id % SLAB_NODES)
+#else
+#define SLAB_NODES		1
+#define page_slab_node(page)	0
+#endif
+
+#ifdef CONFIG_NUMA
+#define slab_local_node()	(numa_node_id() % SLAB_NODES)
+#else
+#define slab_local_node()	0
+#endif
+
+#ifdef CONFIG_SMP
+/*
+ * slab_magazine_t
+ *
+ * A stack of up to 'size' objects. Magazines move between the cpus and
+ * the depot, and keep their size when the cache is retuned.
+ */
+typedef struct slab_magazine_s {
+	struct slab_magazine_s	*next;		/* on a depot list */
+	unsigned short		rounds;		/* objects in the magazine */
+	unsigned short		size;
+} slab_magazine_t;
+
+#define MAX_MAGAZINE_SIZE	0xffff
+
+#define mag_entry(mag) \
+	((void **)(((slab_magazine_t*)mag)+1))
+
 /*
  * cpucache_t
  *
- * Per cpu structures
- * The limit is stored in the per-cpu structure to reduce the data cache
- * footprint.
+ * Per cpu structures. The previous magazine is always either full or
+ * empty. The hit counters count allocs and frees that were satisfied
+ * by the two magazines.
  */
 typedef struct cpucache_s {
-	unsigned int avail;
-	unsigned int limit;
+	slab_magazine_t		*loaded;
+	slab_magazine_t		*previous;
+	unsigned long		allochit;
+	unsigned long		allocmiss;
+	unsigned long		freehit;
+	unsigned long		freemiss;
 } cpucache_t;
 
-#define cc_entry(cpucache) \
-	((void **)(((cpucache_t*)cpucache)+1))
 #define cc_data(cachep) \
 	((cachep)->cpudata[smp_processor_id()])
+
+/*
+ * kmem_depot_t
+ *
+ * Full and empty magazines not loaded on any cpu. min_full is the
+ * lowest number of full magazines seen since the last reap: that many
+ * were not needed, and are given back to the slabs by the next reap.
+ */
+typedef struct kmem_depot_s {
+	spinlock_t		lock;
+	slab_magazine_t		*full;
+	slab_magazine_t		*empty;
+	unsigned int		nr_full;
+	unsigned int		nr_empty;
+	unsigned int		min_full;
+	unsigned long		gets;		/* full magazines handed out */
+	unsigned long		puts;		/* full magazines taken back */
+} kmem_depot_t;
+#endif
 /*
  * kmem_cache_t
  *
@@ -180,15 +261,14 @@ typedef struct cpucache_s {
 
 struct kmem_cache_s {
 /* 1) each alloc & free */
-	/* full, partial first, then free */
-	struct list_head	slabs;
-	struct list_head	*firstnotfull;
+	kmem_list_t		lists[SLAB_NODES];
 	unsigned int		objsize;
 	unsigned int	 	flags;	/* constant flags */
 	unsigned int		num;	/* # of objs per slab */
 	spinlock_t		spinlock;
 #ifdef CONFIG_SMP
 	unsigned int		batchcount;
+	unsigned int		magsize;
 #endif
 
 /* 2) slab additions /removals */
@@ -219,6 +299,7 @@ struct kmem_cache_s {
 #ifdef CONFIG_SMP
 /* 4) per-cpu data */
 	cpucache_t		*cpudata[NR_CPUS];
+	kmem_depot_t		depot;
 #endif
 #if STATS
 	unsigned long		num_active;
@@ -227,12 +308,6 @@ struct kmem_cache_s {
 	unsigned long		grown;
 	unsigned long		reaped;
 	unsigned long 		errors;
-#ifdef CONFIG_SMP
-	atomic_t		allochit;
-	atomic_t		allocmiss;
-	atomic_t		freehit;
-	atomic_t		freemiss;
-#endif
 #endif
 };
 
@@ -267,18 +342,6 @@ struct kmem_cache_s {
 #define	STATS_INC_ERR(x)	do { } while (0)
 #endif
 
-#if STATS && defined(CONFIG_SMP)
-#define STATS_INC_ALLOCHIT(x)	atomic_inc(&(x)->allochit)
-#define STATS_INC_ALLOCMISS(x)	atomic_inc(&(x)->allocmiss)
-#define STATS_INC_FREEHIT(x)	atomic_inc(&(x)->freehit)
-#define STATS_INC_FREEMISS(x)	atomic_inc(&(x)->freemiss)
-#else
-#define STATS_INC_ALLOCHIT(x)	do { } while (0)
-#define STATS_INC_ALLOCMISS(x)	do { } while (0)
-#define STATS_INC_FREEHIT(x)	do { } while (0)
-#define STATS_INC_FREEMISS(x)	do { } while (0)
-#endif
-
 #if DEBUG
 /* Magic nums for obj red zoning.
  * Placed in the first word before and the first word after an obj.
@@ -345,8 +408,6 @@ static cache_sizes_t cache_sizes[] = {
 
 /* internal cache of cache description objs */
 static kmem_cache_t cache_cache = {
-	slabs:		LIST_HEAD_INIT(cache_cache.slabs),
-	firstnotfull:	&cache_cache.slabs,
 	objsize:	sizeof(kmem_cache_t),
 	flags:		SLAB_NO_REAP,
 	spinlock:	SPIN_LOCK_UNLOCKED,
@@ -373,6 +434,25 @@ static void enable_cpucache (kmem_cache_t *cachep);
 static void enable_all_cpucaches (void);
 #endif
 
+static void kmem_cache_init_lists (kmem_cache_t *cachep)
+{
+	int i;
+
+	for (i = 0; i < SLAB_NODES; i++) {
+		INIT_LIST_HEAD(&cachep->lists[i].slabs);
+		cachep->lists[i].firstnotfull = &cachep->lists[i].slabs;
+	}
+#ifdef CONFIG_SMP
+	spin_lock_init(&cachep->depot.lock);
+#endif
+}
+
+/* The slab list of the node the slab's memory is on. */
+static inline kmem_list_t *kmem_slab_list (kmem_cache_t *cachep, slab_t *slabp)
+{
+	return cachep->lists + page_slab_node(virt_to_page(slabp->s_mem));
+}
+
 /* Cal the num objs, wastage, and bytes left over for a given slab size. */
 static void kmem_cache_estimate (unsigned long gfporder, size_t size,
 		 int flags, size_t *left_over, unsigned int *num)
@@ -408,6 +488,7 @@ void __init kmem_cache_init(void)
 
 	init_MUTEX(&cache_chain_sem);
 	INIT_LIST_HEAD(&cache_chain);
+	kmem_cache_init_lists(&cache_cache);
 
 	kmem_cache_estimate(0, cache_cache.objsize, 0,
 			&left_over, &cache_cache.num);
@@ -777,8 +858,7 @@ next:
 		cachep->gfpflags |= GFP_DMA;
 	spin_lock_init(&cachep->spinlock);
 	cachep->objsize = size;
-	INIT_LIST_HEAD(&cachep->slabs);
-	cachep->firstnotfull = &cachep->slabs;
+	kmem_cache_init_lists(cachep);
 
 	if (flags & CFLGS_OFF_SLAB)
 		cachep->slabp_cache = kmem_find_general_cachep(slab_size,0);
@@ -843,6 +923,69 @@ static void do_ccupdate_local(void *info)
 }
 
 static void free_block (kmem_cache_t* cachep, void** objpp, int len);
+static void __free_block (kmem_cache_t* cachep, void** objpp, int len);
+
+static slab_magazine_t *kmem_magazine_alloc (unsigned int size)
+{
+	slab_magazine_t *mag;
+
+	mag = kmalloc(sizeof(slab_magazine_t)+sizeof(void*)*size, GFP_KERNEL);
+	if (mag) {
+		mag->next = NULL;
+		mag->rounds = 0;
+		mag->size = size;
+	}
+	return mag;
+}
+
+static void kmem_cpucache_free (cpucache_t *cc)
+{
+	if (!cc)
+		return;
+	kfree(cc->loaded);
+	kfree(cc->previous);
+	kfree(cc);
+}
+
+/*
+ * Give the objects in the full magazines of the depot back to the slabs:
+ * all of them, or only those the depot did not need since the last
+ * call. Called with the cache lock held and interrupts disabled.
+ */
+static void kmem_depot_drain (kmem_cache_t *cachep, int all)
+{
+	kmem_depot_t *depot = &cachep->depot;
+	slab_magazine_t *mag, *list = NULL;
+	unsigned int nr;
+
+	spin_lock(&depot->lock);
+	nr = all ? depot->nr_full : depot->min_full;
+	while (nr--) {
+		mag = depot->full;
+		depot->full = mag->next;
+		depot->nr_full--;
+		mag->next = list;
+		list = mag;
+	}
+	depot->min_full = depot->nr_full;
+	spin_unlock(&depot->lock);
+
+	if (!list)
+		return;
+	for (mag = list; mag; mag = mag->next) {
+		__free_block(cachep, mag_entry(mag), mag->rounds);
+		mag->rounds = 0;
+	}
+
+	spin_lock(&depot->lock);
+	while ((mag = list) != NULL) {
+		list = mag->next;
+		mag->next = depot->empty;
+		depot->empty = mag;
+		depot->nr_empty++;
+	}
+	spin_unlock(&depot->lock);
+}
 
 static void drain_cpu_caches(kmem_cache_t *cachep)
 {
@@ -856,15 +999,23 @@ static void drain_cpu_caches(kmem_cache_t *cachep)
 	down(&cache_chain_sem);
 	smp_call_function_all_cpus(do_ccupdate_local, (void *)&new);
 
+	local_irq_disable();
+	spin_lock(&cachep->spinlock);
 	for (i = 0; i < smp_num_cpus; i++) {
 		cpucache_t* ccold = new.new[cpu_logical_map(i)];
-		if (!ccold || (ccold->avail == 0))
+		if (!ccold)
 			continue;
-		local_irq_disable();
-		free_block(cachep, cc_entry(ccold), ccold->avail);
-		local_irq_enable();
-		ccold->avail = 0;
+		__free_block(cachep, mag_entry(ccold->loaded),
+					ccold->loaded->rounds);
+		ccold->loaded->rounds = 0;
+		__free_block(cachep, mag_entry(ccold->previous),
+					ccold->previous->rounds);
+		ccold->previous->rounds = 0;
 	}
+	kmem_depot_drain(cachep, 1);
+	spin_unlock(&cachep->spinlock);
+	local_irq_enable();
+
 	smp_call_function_all_cpus(do_ccupdate_local, (void *)&new);
 	up(&cache_chain_sem);
 }
@@ -876,33 +1027,37 @@ static void drain_cpu_caches(kmem_cache_t *cachep)
 static int __kmem_cache_shrink(kmem_cache_t *cachep)
 {
 	slab_t *slabp;
-	int ret;
+	int i, ret = 0;
 
 	drain_cpu_caches(cachep);
 
 	spin_lock_irq(&cachep->spinlock);
 
-	/* If the cache is growing, stop shrinking. */
-	while (!cachep->growing) {
-		struct list_head *p;
+	for (i = 0; i < SLAB_NODES; i++) {
+		kmem_list_t *l = cachep->lists + i;
 
-		p = cachep->slabs.prev;
-		if (p == &cachep->slabs)
-			break;
+		/* If the cache is growing, stop shrinking. */
+		while (!cachep->growing) {
+			struct list_head *p;
 
-		slabp = list_entry(cachep->slabs.prev, slab_t, list);
-		if (slabp->inuse)
-			break;
+			p = l->slabs.prev;
+			if (p == &l->slabs)
+				break;
 
-		list_del(&slabp->list);
-		if (cachep->firstnotfull == &slabp->list)
-			cachep->firstnotfull = &cachep->slabs;
+			slabp = list_entry(l->slabs.prev, slab_t, list);
+			if (slabp->inuse)
+				break;
 
-		spin_unlock_irq(&cachep->spinlock);
-		kmem_slab_destroy(cachep, slabp);
-		spin_lock_irq(&cachep->spinlock);
+			list_del(&slabp->list);
+			if (l->firstnotfull == &slabp->list)
+				l->firstnotfull = &l->slabs;
+
+			spin_unlock_irq(&cachep->spinlock);
+			kmem_slab_destroy(cachep, slabp);
+			spin_lock_irq(&cachep->spinlock);
+		}
+		ret |= !list_empty(&l->slabs);
 	}
-	ret = !list_empty(&cachep->slabs);
 	spin_unlock_irq(&cachep->spinlock);
 	return ret;
 }
@@ -961,9 +1116,16 @@ int kmem_cache_destroy (kmem_cache_t * cachep)
 	}
 #ifdef CONFIG_SMP
 	{
+		slab_magazine_t *mag;
 		int i;
+
 		for (i = 0; i < NR_CPUS; i++)
-			kfree(cachep->cpudata[i]);
+			kmem_cpucache_free(cachep->cpudata[i]);
+		/* the shrink left only empty magazines in the depot */
+		while ((mag = cachep->depot.empty) != NULL) {
+			cachep->depot.empty = mag->next;
+			kfree(mag);
+		}
 	}
 #endif
 	kmem_cache_free(&cache_cache, cachep);
@@ -1128,9 +1290,13 @@ static int kmem_cache_grow (kmem_cache_t * cachep, int flags)
 	cachep->growing--;
 
 	/* Make slab active. */
-	list_add_tail(&slabp->list,&cachep->slabs);
-	if (cachep->firstnotfull == &cachep->slabs)
-		cachep->firstnotfull = &slabp->list;
+	{
+		kmem_list_t *l = kmem_slab_list(cachep, slabp);
+
+		list_add_tail(&slabp->list, &l->slabs);
+		if (l->firstnotfull == &l->slabs)
+			l->firstnotfull = &slabp->list;
+	}
 	STATS_INC_GROWN(cachep);
 	cachep->failures = 0;
 
@@ -1186,6 +1352,31 @@ static inline void kmem_cache_alloc_head(kmem_cache_t *cachep, int flags)
 #endif
 }
 
+/*
+ * The slab the next allocation comes from: the first one with free objects
+ * on the node of this cpu, or else on any node. Called with the cache lock
+ * held.
+ */
+static inline slab_t * kmem_cache_find_slab (kmem_cache_t *cachep)
+{
+	kmem_list_t *l = cachep->lists + slab_local_node();
+#if SLAB_NODES > 1
+	int i;
+
+	if (l->firstnotfull == &l->slabs) {
+		for (i = 0, l = cachep->lists; i < SLAB_NODES; i++, l++)
+			if (l->firstnotfull != &l->slabs)
+				break;
+		if (i == SLAB_NODES)
+			return NULL;
+	}
+#else
+	if (l->firstnotfull == &l->slabs)
+		return NULL;
+#endif
+	return list_entry(l->firstnotfull, slab_t, list);
+}
+
 static inline void * kmem_cache_alloc_one_tail (kmem_cache_t *cachep,
 							 slab_t *slabp)
 {
@@ -1202,7 +1393,7 @@ static inline void * kmem_cache_alloc_one_tail (kmem_cache_t *cachep,
 
 	if (slabp->free == BUFCTL_END)
 		/* slab now full: move to next slab for next alloc */
-		cachep->firstnotfull = slabp->list.next;
+		kmem_slab_list(cachep, slabp)->firstnotfull = slabp->list.next;
 #if DEBUG
 	if (cachep->flags & SLAB_POISON)
 		if (kmem_check_poison_obj(cachep, objp))
@@ -1228,40 +1419,61 @@ static inline void * kmem_cache_alloc_one_tail (kmem_cache_t *cachep,
  */
 #define kmem_cache_alloc_one(cachep)				\
 ({								\
-	slab_t	*slabp;					\
-								\
 	/* Get slab alloc is to come from. */			\
-	{							\
-		struct list_head* p = cachep->firstnotfull;	\
-		if (p == &cachep->slabs)			\
-			goto alloc_new_slab;			\
-		slabp = list_entry(p,slab_t, list);	\
-	}							\
+	slab_t	*slabp = kmem_cache_find_slab(cachep);		\
+								\
+	if (!slabp)						\
+		goto alloc_new_slab;				\
 	kmem_cache_alloc_one_tail(cachep, slabp);		\
 })
 
 #ifdef CONFIG_SMP
-void* kmem_cache_alloc_batch(kmem_cache_t* cachep, int flags)
+/*
+ * Both magazines of this cpu are empty. Trade the previous one for a full
+ * magazine from the depot, or else fill the loaded one from the slabs.
+ */
+static void* kmem_cache_alloc_refill (kmem_cache_t* cachep, cpucache_t* cc)
 {
-	int batchcount = cachep->batchcount;
-	cpucache_t* cc = cc_data(cachep);
+	kmem_depot_t *depot = &cachep->depot;
+	slab_magazine_t *mag;
+	int batchcount;
+
+	spin_lock(&depot->lock);
+	mag = depot->full;
+	if (mag) {
+		depot->full = mag->next;
+		if (--depot->nr_full < depot->min_full)
+			depot->min_full = depot->nr_full;
+		cc->previous->next = depot->empty;
+		depot->empty = cc->previous;
+		depot->nr_empty++;
+		depot->gets++;
+		spin_unlock(&depot->lock);
+
+		cc->previous = cc->loaded;
+		cc->loaded = mag;
+		return mag_entry(mag)[--mag->rounds];
+	}
+	spin_unlock(&depot->lock);
 
+	mag = cc->loaded;
+	batchcount = cachep->batchcount;
+	if (batchcount > mag->size)
+		batchcount = mag->size;
 	spin_lock(&cachep->spinlock);
 	while (batchcount--) {
 		/* Get slab alloc is to come from. */
-		struct list_head *p = cachep->firstnotfull;
-		slab_t *slabp;
+		slab_t *slabp = kmem_cache_find_slab(cachep);
 
-		if (p == &cachep->slabs)
+		if (!slabp)
 			break;
-		slabp = list_entry(p,slab_t, list);
-		cc_entry(cc)[cc->avail++] =
+		mag_entry(mag)[mag->rounds++] =
 				kmem_cache_alloc_one_tail(cachep, slabp);
 	}
 	spin_unlock(&cachep->spinlock);
 
-	if (cc->avail)
-		return cc_entry(cc)[--cc->avail];
+	if (mag->rounds)
+		return mag_entry(mag)[--mag->rounds];
 	return NULL;
 }
 #endif
@@ -1279,12 +1491,19 @@ try_again:
 		cpucache_t *cc = cc_data(cachep);
 
 		if (cc) {
-			if (cc->avail) {
-				STATS_INC_ALLOCHIT(cachep);
-				objp = cc_entry(cc)[--cc->avail];
+			slab_magazine_t *mag = cc->loaded;
+
+			if (!mag->rounds && cc->previous->rounds) {
+				cc->loaded = cc->previous;
+				cc->previous = mag;
+				mag = cc->loaded;
+			}
+			if (mag->rounds) {
+				cc->allochit++;
+				objp = mag_entry(mag)[--mag->rounds];
 			} else {
-				STATS_INC_ALLOCMISS(cachep);
-				objp = kmem_cache_alloc_batch(cachep,flags);
+				cc->allocmiss++;
+				objp = kmem_cache_alloc_refill(cachep, cc);
 				if (!objp)
 					goto alloc_new_slab_nolock;
 			}
@@ -1345,6 +1564,7 @@ alloc_new_slab_nolock:
 static inline void kmem_cache_free_one(kmem_cache_t *cachep, void *objp)
 {
 	slab_t* slabp;
+	kmem_list_t *l;
 
 	CHECK_PAGE(virt_to_page(objp));
 	/* reduces memory footprint
@@ -1387,6 +1607,7 @@ static inline void kmem_cache_free_one(kmem_cache_t *cachep, void *objp)
 	STATS_DEC_ACTIVE(cachep);
 	
 	/* fixup slab chain */
+	l = kmem_slab_list(cachep, slabp);
 	if (slabp->inuse-- == cachep->num)
 		goto moveslab_partial;
 	if (!slabp->inuse)
@@ -1399,9 +1620,9 @@ moveslab_partial:
 	 * slabp: there are no partial slabs in this case
 	 */
 	{
-		struct list_head *t = cachep->firstnotfull;
+		struct list_head *t = l->firstnotfull;
 
-		cachep->firstnotfull = &slabp->list;
+		l->firstnotfull = &slabp->list;
 		if (slabp->list.next == t)
 			return;
 		list_del(&slabp->list);
@@ -1415,18 +1636,18 @@ moveslab_free:
 	 * FIXME: optimize
 	 */
 	{
-		struct list_head *t = cachep->firstnotfull->prev;
+		struct list_head *t = l->firstnotfull->prev;
 
 		list_del(&slabp->list);
-		list_add_tail(&slabp->list, &cachep->slabs);
-		if (cachep->firstnotfull == &slabp->list)
-			cachep->firstnotfull = t->next;
+		list_add_tail(&slabp->list, &l->slabs);
+		if (l->firstnotfull == &slabp->list)
+			l->firstnotfull = t->next;
 		return;
 	}
 }
 
 #ifdef CONFIG_SMP
-static inline void __free_block (kmem_cache_t* cachep,
+static void __free_block (kmem_cache_t* cachep,
 							void** objpp, int len)
 {
 	for ( ; len > 0; len--, objpp++)
@@ -1441,6 +1662,47 @@ static void free_block (kmem_cache_t* cachep, void** objpp, int len)
 }
 #endif
 
+#ifdef CONFIG_SMP
+/*
+ * Both magazines of this cpu are full. Trade the previous one for an
+ * empty magazine from the depot, or else give batchcount objects of the
+ * loaded one back to the slabs.
+ */
+static void kmem_cache_free_refill (kmem_cache_t* cachep, cpucache_t* cc,
+					void* objp)
+{
+	kmem_depot_t *depot = &cachep->depot;
+	slab_magazine_t *mag;
+	int batchcount;
+
+	spin_lock(&depot->lock);
+	mag = depot->empty;
+	if (mag) {
+		depot->empty = mag->next;
+		depot->nr_empty--;
+		cc->previous->next = depot->full;
+		depot->full = cc->previous;
+		depot->nr_full++;
+		depot->puts++;
+		spin_unlock(&depot->lock);
+
+		cc->previous = cc->loaded;
+		cc->loaded = mag;
+		mag_entry(mag)[mag->rounds++] = objp;
+		return;
+	}
+	spin_unlock(&depot->lock);
+
+	mag = cc->loaded;
+	batchcount = cachep->batchcount;
+	if (batchcount > mag->rounds)
+		batchcount = mag->rounds;
+	mag->rounds -= batchcount;
+	free_block(cachep, &mag_entry(mag)[mag->rounds], batchcount);
+	mag_entry(mag)[mag->rounds++] = objp;
+}
+#endif
+
 /*
  * __kmem_cache_free
  * called with disabled ints
@@ -1452,18 +1714,20 @@ static inline void __kmem_cache_free (kmem_cache_t *cachep, void* objp)
 
 	CHECK_PAGE(virt_to_page(objp));
 	if (cc) {
-		int batchcount;
-		if (cc->avail < cc->limit) {
-			STATS_INC_FREEHIT(cachep);
-			cc_entry(cc)[cc->avail++] = objp;
+		slab_magazine_t *mag = cc->loaded;
+
+		if (mag->rounds == mag->size && !cc->previous->rounds) {
+			cc->loaded = cc->previous;
+			cc->previous = mag;
+			mag = cc->loaded;
+		}
+		if (mag->rounds < mag->size) {
+			cc->freehit++;
+			mag_entry(mag)[mag->rounds++] = objp;
 			return;
 		}
-		STATS_INC_FREEMISS(cachep);
-		batchcount = cachep->batchcount;
-		cc->avail -= batchcount;
-		free_block(cachep,
-					&cc_entry(cc)[cc->avail],batchcount);
-		cc_entry(cc)[cc->avail++] = objp;
+		cc->freemiss++;
+		kmem_cache_free_refill(cachep, cc, objp);
 		return;
 	} else {
 		free_block(cachep, &objp, 1);
@@ -1581,10 +1845,16 @@ kmem_cache_t * kmem_find_general_cachep (size_t size, int gfpflags)
 
 #ifdef CONFIG_SMP
 
-/* called with cache_chain_sem acquired.  */
+/*
+ * Replace the magazines of all cpus and of the depot with ones of 'limit'
+ * objects, or remove the magazine layer if 'limit' is 0. The depot starts
+ * out with one empty magazine per cpu.
+ * Called with cache_chain_sem acquired.
+ */
 static int kmem_tune_cpucache (kmem_cache_t* cachep, int limit, int batchcount)
 {
 	ccupdate_struct_t new;
+	slab_magazine_t *mag, *empty = NULL, *full, *old;
 	int i;
 
 	/*
@@ -1598,24 +1868,35 @@ static int kmem_tune_cpucache (kmem_cache_t* cachep, int limit, int batchcount)
 		return -EINVAL;
 	if (limit != 0 && !batchcount)
 		return -EINVAL;
+	if (limit > MAX_MAGAZINE_SIZE)
+		return -EINVAL;
 
 	memset(&new.new,0,sizeof(new.new));
 	if (limit) {
 		for (i = 0; i< smp_num_cpus; i++) {
 			cpucache_t* ccnew;
 
-			ccnew = kmalloc(sizeof(void*)*limit+
-					sizeof(cpucache_t), GFP_KERNEL);
+			ccnew = kmalloc(sizeof(cpucache_t), GFP_KERNEL);
 			if (!ccnew)
 				goto oom;
-			ccnew->limit = limit;
-			ccnew->avail = 0;
+			memset(ccnew, 0, sizeof(cpucache_t));
 			new.new[cpu_logical_map(i)] = ccnew;
+			ccnew->loaded = kmem_magazine_alloc(limit);
+			ccnew->previous = kmem_magazine_alloc(limit);
+			if (!ccnew->loaded || !ccnew->previous)
+				goto oom;
+
+			mag = kmem_magazine_alloc(limit);
+			if (!mag)
+				goto oom;
+			mag->next = empty;
+			empty = mag;
 		}
 	}
 	new.cachep = cachep;
 	spin_lock_irq(&cachep->spinlock);
 	cachep->batchcount = batchcount;
+	cachep->magsize = limit;
 	spin_unlock_irq(&cachep->spinlock);
 
 	smp_call_function_all_cpus(do_ccupdate_local, (void *)&new);
@@ -1625,14 +1906,44 @@ static int kmem_tune_cpucache (kmem_cache_t* cachep, int limit, int batchcount)
 		if (!ccold)
 			continue;
 		local_irq_disable();
-		free_block(cachep, cc_entry(ccold), ccold->avail);
+		free_block(cachep, mag_entry(ccold->loaded),
+					ccold->loaded->rounds);
+		free_block(cachep, mag_entry(ccold->previous),
+					ccold->previous->rounds);
+		local_irq_enable();
+		kmem_cpucache_free(ccold);
+	}
+
+	/* Swap in the new depot magazines and free the old ones. */
+	spin_lock_irq(&cachep->depot.lock);
+	full = cachep->depot.full;
+	old = cachep->depot.empty;
+	cachep->depot.full = NULL;
+	cachep->depot.empty = empty;
+	cachep->depot.nr_full = 0;
+	cachep->depot.nr_empty = limit ? smp_num_cpus : 0;
+	cachep->depot.min_full = 0;
+	spin_unlock_irq(&cachep->depot.lock);
+
+	while ((mag = full) != NULL) {
+		full = mag->next;
+		local_irq_disable();
+		free_block(cachep, mag_entry(mag), mag->rounds);
 		local_irq_enable();
-		kfree(ccold);
+		kfree(mag);
+	}
+	while ((mag = old) != NULL) {
+		old = mag->next;
+		kfree(mag);
 	}
 	return 0;
 oom:
-	for (i--; i >= 0; i--)
-		kfree(new.new[cpu_logical_map(i)]);
+	for (i = 0; i < smp_num_cpus; i++)
+		kmem_cpucache_free(new.new[cpu_logical_map(i)]);
+	while ((mag = empty) != NULL) {
+		empty = mag->next;
+		kfree(mag);
+	}
 	return -ENOMEM;
 }
 
@@ -1644,12 +1955,13 @@ static void enable_cpucache (kmem_cache_t *cachep)
 	/* FIXME: optimize */
 	if (cachep->objsize > PAGE_SIZE)
 		return;
+	/* A magazine, with its header, fills a general cache exactly. */
 	if (cachep->objsize > 1024)
-		limit = 60;
+		limit = 30;
 	else if (cachep->objsize > 256)
-		limit = 124;
+		limit = 62;
 	else
-		limit = 252;
+		limit = 126;
 
 	err = kmem_tune_cpucache(cachep, limit, limit/2);
 	if (err)
@@ -1689,6 +2001,7 @@ void kmem_cache_reap (int gfp_mask)
 	unsigned int best_pages;
 	unsigned int best_len;
 	unsigned int scan;
+	int i;
 
 	if (gfp_mask & __GFP_WAIT)
 		down(&cache_chain_sem);
@@ -1719,21 +2032,30 @@ void kmem_cache_reap (int gfp_mask)
 #ifdef CONFIG_SMP
 		{
 			cpucache_t *cc = cc_data(searchp);
-			if (cc && cc->avail) {
-				__free_block(searchp, cc_entry(cc), cc->avail);
-				cc->avail = 0;
+			if (cc) {
+				__free_block(searchp, mag_entry(cc->loaded),
+						cc->loaded->rounds);
+				cc->loaded->rounds = 0;
+				__free_block(searchp, mag_entry(cc->previous),
+						cc->previous->rounds);
+				cc->previous->rounds = 0;
 			}
+			kmem_depot_drain(searchp, 0);
 		}
 #endif
 
 		full_free = 0;
-		p = searchp->slabs.prev;
-		while (p != &searchp->slabs) {
-			slabp = list_entry(p, slab_t, list);
-			if (slabp->inuse)
-				break;
-			full_free++;
-			p = p->prev;
+		for (i = 0; i < SLAB_NODES; i++) {
+			kmem_list_t *l = searchp->lists + i;
+
+			p = l->slabs.prev;
+			while (p != &l->slabs) {
+				slabp = list_entry(p, slab_t, list);
+				if (slabp->inuse)
+					break;
+				full_free++;
+				p = p->prev;
+			}
 		}
 
 		/*
@@ -1772,29 +2094,36 @@ next:
 perfect:
 	/* free only 80% of the free slabs */
 	best_len = (best_len*4 + 1)/5;
-	for (scan = 0; scan < best_len; scan++) {
-		struct list_head *p;
-
-		if (best_cachep->growing)
-			break;
-		p = best_cachep->slabs.prev;
-		if (p == &best_cachep->slabs)
-			break;
-		slabp = list_entry(p,slab_t,list);
-		if (slabp->inuse)
-			break;
-		list_del(&slabp->list);
-		if (best_cachep->firstnotfull == &slabp->list)
-			best_cachep->firstnotfull = &best_cachep->slabs;
-		STATS_INC_REAPED(best_cachep);
-
-		/* Safe to drop the lock. The slab is no longer linked to the
-		 * cache.
-		 */
-		spin_unlock_irq(&best_cachep->spinlock);
-		kmem_slab_destroy(best_cachep, slabp);
-		spin_lock_irq(&best_cachep->spinlock);
+	scan = 0;
+	for (i = 0; i < SLAB_NODES; i++) {
+		kmem_list_t *l = best_cachep->lists + i;
+
+		for ( ; scan < best_len; scan++) {
+			struct list_head *p;
+
+			/* Stop on every node, not just this one */
+			if (best_cachep->growing)
+				goto out_unlock;
+			p = l->slabs.prev;
+			if (p == &l->slabs)
+				break;
+			slabp = list_entry(p,slab_t,list);
+			if (slabp->inuse)
+				break;
+			list_del(&slabp->list);
+			if (l->firstnotfull == &slabp->list)
+				l->firstnotfull = &l->slabs;
+			STATS_INC_REAPED(best_cachep);
+
+			/* Safe to drop the lock. The slab is no longer linked
+			 * to the cache.
+			 */
+			spin_unlock_irq(&best_cachep->spinlock);
+			kmem_slab_destroy(best_cachep, slabp);
+			spin_lock_irq(&best_cachep->spinlock);
+		}
 	}
+out_unlock:
 	spin_unlock_irq(&best_cachep->spinlock);
 out:
 	up(&cache_chain_sem);
@@ -1826,7 +2155,7 @@ static int proc_getdata (char*page, char**start, off_t off, int count)
 	/* Output format version, so at least we can change it without _too_
 	 * many complaints.
 	 */
-	len += sprintf(page+len, "slabinfo - version: 1.1"
+	len += sprintf(page+len, "slabinfo - version: 1.2"
 #if STATS
 				" (statistics)"
 #endif
@@ -1846,19 +2175,27 @@ static int proc_getdata (char*page, char**start, off_t off, int count)
 		unsigned long	num_objs;
 		unsigned long	active_slabs = 0;
 		unsigned long	num_slabs;
+		unsigned long	node_active[SLAB_NODES];
+		unsigned long	node_slabs[SLAB_NODES];
+		int		i;
 		cachep = list_entry(p, kmem_cache_t, next);
 
 		spin_lock_irq(&cachep->spinlock);
 		active_objs = 0;
 		num_slabs = 0;
-		list_for_each(q,&cachep->slabs) {
-			slabp = list_entry(q, slab_t, list);
-			active_objs += slabp->inuse;
-			num_objs += cachep->num;
-			if (slabp->inuse)
-				active_slabs++;
-			else
-				num_slabs++;
+		for (i = 0; i < SLAB_NODES; i++) {
+			node_active[i] = 0;
+			node_slabs[i] = 0;
+			list_for_each(q,&cachep->lists[i].slabs) {
+				slabp = list_entry(q, slab_t, list);
+				node_active[i] += slabp->inuse;
+				node_slabs[i]++;
+				if (slabp->inuse)
+					active_slabs++;
+				else
+					num_slabs++;
+			}
+			active_objs += node_active[i];
 		}
 		num_slabs+=active_slabs;
 		num_objs = num_slabs*cachep->num;
@@ -1882,25 +2219,39 @@ static int proc_getdata (char*page, char**start, off_t off, int count)
 #ifdef CONFIG_SMP
 		{
 			unsigned int batchcount = cachep->batchcount;
-			unsigned int limit;
+			unsigned int limit = cachep->magsize;
 
-			if (cc_data(cachep))
-				limit = cc_data(cachep)->limit;
-			 else
-				limit = 0;
 			len += sprintf(page+len, " : %4u %4u",
 					limit, batchcount);
 		}
-#endif
-#if STATS && defined(CONFIG_SMP)
 		{
-			unsigned long allochit = atomic_read(&cachep->allochit);
-			unsigned long allocmiss = atomic_read(&cachep->allocmiss);
-			unsigned long freehit = atomic_read(&cachep->freehit);
-			unsigned long freemiss = atomic_read(&cachep->freemiss);
+			/* cpudata can not change, we hold cache_chain_sem */
+			unsigned long allochit = 0, allocmiss = 0;
+			unsigned long freehit = 0, freemiss = 0;
+
+			for (i = 0; i < smp_num_cpus; i++) {
+				cpucache_t *cc = cachep->cpudata[cpu_logical_map(i)];
+
+				if (!cc)
+					continue;
+				allochit += cc->allochit;
+				allocmiss += cc->allocmiss;
+				freehit += cc->freehit;
+				freemiss += cc->freemiss;
+			}
 			len += sprintf(page+len, " : %6lu %6lu %6lu %6lu",
 					allochit, allocmiss, freehit, freemiss);
+			len += sprintf(page+len, " : %4u %4u %6lu %6lu",
+					cachep->depot.nr_full,
+					cachep->depot.nr_empty,
+					cachep->depot.gets, cachep->depot.puts);
 		}
+#endif
+#ifdef CONFIG_DISCONTIGMEM
+		len += sprintf(page+len, " :");
+		for (i = 0; i < SLAB_NODES && i < numnodes; i++)
+			len += sprintf(page+len, " %lu/%lu", node_active[i],
+					node_slabs[i]*cachep->num);
 #endif
 		len += sprintf(page+len,"\n");
 		spin_unlock_irq(&cachep->spinlock);
@@ -1933,6 +2284,13 @@ got_data:
  * total-slabs
  * num-pages-per-slab
  * + further values on SMP and with statistics enabled
+ *
+ * On SMP these are the magazine size and batchcount, the allocs and
+ * frees that were and were not satisfied by the cpu magazines, and
+ * the full and empty magazines in the depot and the number of full
+ * magazines handed out and taken back by it. On discontiguous memory
+ * machines, they are followed by the active and total objects on each
+ * node.
  */
 int slabinfo_read_proc (char *page, char **start, off_t off,
 				 int count, int *eof, void *data)
@@ -77,10 +77,10 @@ pager_daemon_t pager_daemon = {
 /**
  * age_page_{up,down} -	page aging helper functions
  * @page - the page we want to age
- * @nolock - are we already holding the pagelist_lru_lock?
+ * @nolock - are we already holding the lru_lock of the page's zone?
  *
  * If the page is on one of the lists (active, inactive_dirty or
- * inactive_clean), we will grab the pagelist_lru_lock as needed.
+ * inactive_clean), we will grab the zone's lru_lock as needed.
  * If you're already holding the lock, call this function with the
  * nolock argument non-zero.
  */
@@ -150,10 +150,33 @@ void age_page_down(struct page * page)
 }
 
 
+/*
+ * Adding pages to the page lists and moving them between the lists
+ * is batched per CPU, so that a busy page cache does not take the
+ * lru_lock of a zone for every single page. A queued page holds a
+ * reference, which is dropped once the batch has been applied. The
+ * batches are only used from process context and nobody sleeps with
+ * a page half queued, so they need no locking of their own.
+ */
+#define LRU_BATCH		16
+
+#define LRU_ADD			0
+#define LRU_ACTIVATE		1
+#define LRU_DEACTIVATE		2
+#define NR_LRU_BATCHES		3
+
+struct lru_batch {
+	int nr;
+	struct page *pages[LRU_BATCH];
+} ____cacheline_aligned;
+
+static struct lru_batch lru_batches[NR_CPUS][NR_LRU_BATCHES];
+
 /**
  * (de)activate_page - move pages from/to active and inactive lists
  * @page: the page we want to move
- * @nolock - are we already holding the pagemap_lru_lock?
+ * @nolock - are we already holding the lru_lock of the page's zone?
+ * @extra - the number of references the caller holds on the page
  *
  * Deactivate_page will move an active page to the right
  * inactive list, while activate_page will move a page back
@@ -161,17 +184,17 @@ void age_page_down(struct page * page)
  * called on a page which is not on any of the lists, the
  * page is left alone.
  */
-void deactivate_page_nolock(struct page * page)
+static void __deactivate_page_nolock(struct page * page, int extra)
 {
 	/*
-	 * One for the cache, one for the extra reference the
-	 * caller has and (maybe) one for the buffers.
+	 * One for the cache, the extra references the caller
+	 * has and (maybe) one for the buffers.
 	 *
 	 * This isn't perfect, but works for just about everything.
 	 * Besides, as long as we don't move unfreeable pages to the
 	 * inactive_clean list it doesn't need to be perfect...
 	 */
-	int maxcount = (page->buffers ? 3 : 2);
+	int maxcount = (page->buffers ? 2 : 1) + extra;
 	page->age = 0;
 	ClearPageReferenced(page);
 
@@ -183,13 +206,11 @@ void deactivate_page_nolock(struct page * page)
 		del_page_from_active_list(page);
 		add_page_to_inactive_dirty_list(page);
 	}
-}	
+}
 
-void deactivate_page(struct page * page)
+void deactivate_page_nolock(struct page * page)
 {
-	spin_lock(&pagemap_lru_lock);
-	deactivate_page_nolock(page);
-	spin_unlock(&pagemap_lru_lock);
+	__deactivate_page_nolock(page, 1);
 }
 
 /*
@@ -215,11 +236,105 @@ void activate_page_nolock(struct page * page)
 		page->age = PAGE_AGE_START;
 }
 
+/*
+ * Called for a page from the add batch. The batch reference
+ * is the one extra reference we hold.
+ */
+static void lru_cache_add_nolock(struct page * page)
+{
+	/* Removed from the page cache while it was queued? */
+	if (!page->mapping)
+		return;
+	/* Anonymous pages are already on the lists when swapped out */
+	if (PageActive(page) || PageInactiveDirty(page) ||
+			PageInactiveClean(page))
+		return;
+	add_page_to_active_list(page);
+	/* This should be relatively rare */
+	if (!page->age)
+		__deactivate_page_nolock(page, 2);
+}
+
+static void lru_deactivate_nolock(struct page * page)
+{
+	__deactivate_page_nolock(page, 2);
+}
+
+static void (*lru_batch_fn[NR_LRU_BATCHES])(struct page *) = {
+	lru_cache_add_nolock,
+	activate_page_nolock,
+	lru_deactivate_nolock,
+};
+
+/*
+ * Apply a batch. Runs of pages from the same zone, which is
+ * the common case, are done under a single lock hold.
+ */
+static void lru_batch_drain(struct lru_batch *batch, int type)
+{
+	void (*fn)(struct page *) = lru_batch_fn[type];
+	zone_t *zone = NULL;
+	int i, nr = batch->nr;
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = batch->pages[i];
+
+		if (page->zone != zone) {
+			if (zone)
+				spin_unlock(&zone->lru_lock);
+			zone = page->zone;
+			spin_lock(&zone->lru_lock);
+		}
+		fn(page);
+	}
+	if (zone)
+		spin_unlock(&zone->lru_lock);
+
+	/* Freeing a page takes the lru_lock, so do this last */
+	batch->nr = 0;
+	for (i = 0; i < nr; i++)
+		page_cache_release(batch->pages[i]);
+}
+
+static inline void lru_batch_add(struct page * page, int type)
+{
+	struct lru_batch *batch = &lru_batches[smp_processor_id()][type];
+
+	page_cache_get(page);
+	batch->pages[batch->nr++] = page;
+	if (batch->nr == LRU_BATCH)
+		lru_batch_drain(batch, type);
+}
+
+/**
+ * lru_add_drain: apply the page list updates queued on this CPU
+ */
+void lru_add_drain(void)
+{
+	struct lru_batch *batches = lru_batches[smp_processor_id()];
+	int type;
+
+	for (type = 0; type < NR_LRU_BATCHES; type++)
+		if (batches[type].nr)
+			lru_batch_drain(batches + type, type);
+}
+
+void deactivate_page(struct page * page)
+{
+	/* Make it old right away, the list move can wait */
+	page->age = 0;
+	ClearPageReferenced(page);
+	if (PageActive(page))
+		lru_batch_add(page, LRU_DEACTIVATE);
+}
+
 void activate_page(struct page * page)
 {
-	spin_lock(&pagemap_lru_lock);
-	activate_page_nolock(page);
-	spin_unlock(&pagemap_lru_lock);
+	/* Pages that are not on an inactive list only need aging */
+	if (page->age < PAGE_AGE_START)
+		page->age = PAGE_AGE_START;
+	if (PageInactiveDirty(page) || PageInactiveClean(page))
+		lru_batch_add(page, LRU_ACTIVATE);
 }
 
 /**
@@ -228,15 +343,28 @@ void activate_page(struct page * page)
  */
 void lru_cache_add(struct page * page)
 {
-	spin_lock(&pagemap_lru_lock);
 	if (!PageLocked(page))
 		BUG();
+	lru_batch_add(page, LRU_ADD);
+}
+
+/**
+ * lru_cache_add_anon: add a newly mapped anonymous page to the page lists
+ * @page: the page to add
+ *
+ * The page stays on the lists until it is freed, so that pageout
+ * can find it and unmap it through its pte chain. This is not
+ * batched: the fault paths look at the page count of anonymous
+ * pages, which a queued page would have raised.
+ */
+void lru_cache_add_anon(struct page * page)
+{
+	zone_t *zone = page->zone;
+
+	spin_lock(&zone->lru_lock);
 	DEBUG_ADD_PAGE
 	add_page_to_active_list(page);
-	/* This should be relatively rare */
-	if (!page->age)
-		deactivate_page_nolock(page);
-	spin_unlock(&pagemap_lru_lock);
+	spin_unlock(&zone->lru_lock);
 }
 
 /**
@@ -244,7 +372,9 @@ void lru_cache_add(struct page * page)
  * @page: the page to add
  *
  * This function is for when the caller already holds
- * the pagemap_lru_lock.
+ * the lru_lock of the page's zone. A page that is still
+ * waiting in an add batch is not on any list yet; it will
+ * not be added once it has left the page cache.
  */
 void __lru_cache_del(struct page * page)
 {
@@ -254,8 +384,6 @@ void __lru_cache_del(struct page * page)
 		del_page_from_inactive_dirty_list(page);
 	} else if (PageInactiveClean(page)) {
 		del_page_from_inactive_clean_list(page);
-	} else {
-		printk("VM: __lru_cache_del, found unknown page ?!\n");
 	}
 	DEBUG_ADD_PAGE
 }
@@ -266,11 +394,13 @@ void __lru_cache_del(struct page * page)
  */
 void lru_cache_del(struct page * page)
 {
+	zone_t *zone = page->zone;
+
 	if (!PageLocked(page))
 		BUG();
-	spin_lock(&pagemap_lru_lock);
+	spin_lock(&zone->lru_lock);
 	__lru_cache_del(page);
-	spin_unlock(&pagemap_lru_lock);
+	spin_unlock(&zone->lru_lock);
 }
 
 /**
@@ -44,6 +44,8 @@ static struct address_space_operations swap_aops = {
 };
 
 struct address_space swapper_space = {
+	RADIX_TREE_INIT(GFP_ATOMIC),
+	SPIN_LOCK_UNLOCKED,
 	LIST_HEAD_INIT(swapper_space.clean_pages),
 	LIST_HEAD_INIT(swapper_space.dirty_pages),
 	LIST_HEAD_INIT(swapper_space.locked_pages),
@@ -66,9 +68,13 @@ void show_swap_cache_info(void)
 }
 #endif
 
-void add_to_swap_cache(struct page *page, swp_entry_t entry)
+/*
+ * Returns -ENOMEM if the swap cache index could not be extended; use
+ * radix_tree_preload() first where sleeping is allowed.
+ */
+int add_to_swap_cache(struct page *page, swp_entry_t entry)
 {
-	unsigned long flags;
+	int error;
 
 #ifdef SWAP_CACHE_INFO
 	swap_cache_add_total++;
@@ -79,10 +85,15 @@ void add_to_swap_cache(struct page *page, swp_entry_t entry)
 		BUG();
 	if (page->mapping)
 		BUG();
-	flags = page->flags & ~((1 << PG_error) | (1 << PG_arch_1));
-	page->flags = flags | (1 << PG_uptodate);
+	/* Mapped pages have other bits changed under us: stay atomic */
+	ClearPageError(page);
+	clear_bit(PG_arch_1, &page->flags);
+	SetPageUptodate(page);
 	page->age = PAGE_AGE_START;
-	add_to_page_cache_locked(page, &swapper_space, entry.val);
+	error = add_to_page_cache_locked(page, &swapper_space, entry.val);
+	if (error)
+		PageClearSwapCache(page);
+	return error;
 }
 
 static inline void remove_from_swap_cache(struct page *page)
@@ -125,13 +136,28 @@ void delete_from_swap_cache_nolock(struct page *page)
 	if (!PageLocked(page))
 		BUG();
 
-	if (block_flushpage(page, 0))
-		lru_cache_del(page);
+	/*
+	 * A page that is still mapped (swapoff) becomes plain anonymous
+	 * memory again and stays on the lists, but not on inactive_clean,
+	 * which is only for cache pages. Move it now, not through the
+	 * per-CPU batches: it must be off inactive_clean before it loses
+	 * its mapping, and a queued reference would make it look shared.
+	 */
+	if (block_flushpage(page, 0)) {
+		if (page->pte_chain) {
+			zone_t *zone = page->zone;
 
-	spin_lock(&pagecache_lock);
+			spin_lock(&zone->lru_lock);
+			activate_page_nolock(page);
+			spin_unlock(&zone->lru_lock);
+		} else
+			lru_cache_del(page);
+	}
+
+	spin_lock(&swapper_space.page_lock);
 	ClearPageDirty(page);
 	__delete_from_swap_cache(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&swapper_space.page_lock);
 	page_cache_release(page);
 }
 
@@ -214,6 +240,7 @@ struct page * lookup_swap_cache(swp_entry_t entry)
 struct page * read_swap_cache_async(swp_entry_t entry)
 {
 	struct page *found_page = 0, *new_page;
+	int error;
 	
 	/*
 	 * Make sure the swap entry is still in use.
@@ -230,6 +257,8 @@ struct page * read_swap_cache_async(swp_entry_t entry)
 	new_page = alloc_page(GFP_HIGHUSER);
 	if (!new_page)
 		goto out_free_swap;	/* Out of memory */
+	if (radix_tree_preload(GFP_KERNEL))
+		goto out_free_page;
 
 	/*
 	 * Check the swap cache again, in case we stalled above.
@@ -242,7 +271,13 @@ struct page * read_swap_cache_async(swp_entry_t entry)
 	 */
 	if (TryLockPage(new_page))
 		BUG();
-	add_to_swap_cache(new_page, entry);
+	error = add_to_swap_cache(new_page, entry);
+	if (error) {
+		UnlockPage(new_page);
+		if (error == -EEXIST)
+			found_page = lookup_swap_cache(entry);
+		goto out_free_page;
+	}
 	rw_swap_page(READ, new_page);
 	return new_page;
 
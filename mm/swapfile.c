@@ -230,6 +230,7 @@ static inline void unuse_pte(struct vm_area_struct * vma, unsigned long address,
 	if (pte_to_swp_entry(pte).val != entry.val)
 		return;
 	set_pte(dir, pte_mkdirty(mk_pte(page, vma->vm_page_prot)));
+	page_add_rmap(page, dir, vma->vm_mm, vma->vm_start + address);
 	swap_free(entry);
 	get_page(page);
 	++vma->vm_mm->rss;
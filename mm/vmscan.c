@@ -26,300 +26,50 @@
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 
+struct vmscan_stat vmscan_stat;
+
 /*
- * The swap-out function returns 1 if it successfully
- * scanned all the pages it was asked to (`count').
- * It returns zero if it couldn't do anything,
- *
- * rss may decrease because pages are shared, but this
- * doesn't count as having freed a page.
+ * Unmap a page found on the inactive_dirty list from all the processes
+ * using it. Anonymous pages are added to the swap cache first, so the
+ * ptes can be turned into swap entries. The caller holds a reference
+ * on the page, but no locks.
  */
-
-/* mm->page_table_lock is held. mmap_sem is not held */
-static void try_to_swap_out(struct mm_struct * mm, struct vm_area_struct* vma, unsigned long address, pte_t * page_table, struct page *page)
+static void unmap_page(struct page *page)
 {
-	pte_t pte;
-	swp_entry_t entry;
-
-	/* Don't look at this pte if it's been accessed recently. */
-	if (ptep_test_and_clear_young(page_table)) {
-		page->age += PAGE_AGE_ADV;
-		if (page->age > PAGE_AGE_MAX)
-			page->age = PAGE_AGE_MAX;
-		return;
-	}
-
 	if (TryLockPage(page))
 		return;
 
-	/* From this point on, the odds are that we're going to
-	 * nuke this pte, so read and clear the pte.  This hook
-	 * is needed on CPUs which update the accessed and dirty
-	 * bits in hardware.
-	 */
-	pte = ptep_get_and_clear(page_table);
-	flush_tlb_page(vma, address);
-
-	/*
-	 * Is the page already in the swap cache? If so, then
-	 * we can just drop our reference to it without doing
-	 * any IO - it's already up-to-date on disk.
-	 */
-	if (PageSwapCache(page)) {
-		entry.val = page->index;
-		if (pte_dirty(pte))
-			set_page_dirty(page);
-set_swap_pte:
-		swap_duplicate(entry);
-		set_pte(page_table, swp_entry_to_pte(entry));
-drop_pte:
-		mm->rss--;
-		if (!page->age)
-			deactivate_page(page);
-		UnlockPage(page);
-		page_cache_release(page);
-		return;
-	}
-
-	/*
-	 * Is it a clean page? Then it must be recoverable
-	 * by just paging it in again, and we can just drop
-	 * it..
-	 *
-	 * However, this won't actually free any real
-	 * memory, as the page will just be in the page cache
-	 * somewhere, and as such we should just continue
-	 * our scan.
-	 *
-	 * Basically, this just makes it possible for us to do
-	 * some real work in the future in "refill_inactive()".
-	 */
-	flush_cache_page(vma, address);
-	if (!pte_dirty(pte))
-		goto drop_pte;
-
-	/*
-	 * Ok, it's really dirty. That means that
-	 * we should either create a new swap cache
-	 * entry for it, or we should write it back
-	 * to its own backing store.
-	 */
-	if (page->mapping) {
-		set_page_dirty(page);
-		goto drop_pte;
-	}
-
-	/*
-	 * This is a dirty, swappable page.  First of all,
-	 * get a suitable swap entry for it, and make sure
-	 * we have the swap cache set up to associate the
-	 * page with that swap entry.
-	 */
-	entry = get_swap_page();
-	if (!entry.val)
-		goto out_unlock_restore; /* No swap space left */
-
-	/* Add it to the swap cache and mark it dirty */
-	add_to_swap_cache(page, entry);
-	set_page_dirty(page);
-	goto set_swap_pte;
-
-out_unlock_restore:
-	set_pte(page_table, pte);
-	UnlockPage(page);
-	return;
-}
+	if (!page->mapping) {
+		swp_entry_t entry = get_swap_page();
 
-/* mm->page_table_lock is held. mmap_sem is not held */
-static int swap_out_pmd(struct mm_struct * mm, struct vm_area_struct * vma, pmd_t *dir, unsigned long address, unsigned long end, int count)
-{
-	pte_t * pte;
-	unsigned long pmd_end;
-
-	if (pmd_none(*dir))
-		return count;
-	if (pmd_bad(*dir)) {
-		pmd_ERROR(*dir);
-		pmd_clear(dir);
-		return count;
-	}
-	
-	pte = pte_offset(dir, address);
-	
-	pmd_end = (address + PMD_SIZE) & PMD_MASK;
-	if (end > pmd_end)
-		end = pmd_end;
-
-	do {
-		if (pte_present(*pte)) {
-			struct page *page = pte_page(*pte);
-
-			if (VALID_PAGE(page) && !PageReserved(page)) {
-				try_to_swap_out(mm, vma, address, pte, page);
-				if (!--count)
-					break;
-			}
+		/* No swap space left, don't come back for a while */
+		if (!entry.val) {
+			activate_page(page);
+			goto out_unlock;
 		}
-		address += PAGE_SIZE;
-		pte++;
-	} while (address && (address < end));
-	mm->swap_address = address + PAGE_SIZE;
-	return count;
-}
-
-/* mm->page_table_lock is held. mmap_sem is not held */
-static inline int swap_out_pgd(struct mm_struct * mm, struct vm_area_struct * vma, pgd_t *dir, unsigned long address, unsigned long end, int count)
-{
-	pmd_t * pmd;
-	unsigned long pgd_end;
-
-	if (pgd_none(*dir))
-		return count;
-	if (pgd_bad(*dir)) {
-		pgd_ERROR(*dir);
-		pgd_clear(dir);
-		return count;
-	}
-
-	pmd = pmd_offset(dir, address);
-
-	pgd_end = (address + PGDIR_SIZE) & PGDIR_MASK;	
-	if (pgd_end && (end > pgd_end))
-		end = pgd_end;
-	
-	do {
-		count = swap_out_pmd(mm, vma, pmd, address, end, count);
-		if (!count)
-			break;
-		address = (address + PMD_SIZE) & PMD_MASK;
-		pmd++;
-	} while (address && (address < end));
-	return count;
-}
-
-/* mm->page_table_lock is held. mmap_sem is not held */
-static int swap_out_vma(struct mm_struct * mm, struct vm_area_struct * vma, unsigned long address, int count)
-{
-	pgd_t *pgdir;
-	unsigned long end;
-
-	/* Don't swap out areas which are locked down */
-	if (vma->vm_flags & (VM_LOCKED|VM_RESERVED))
-		return count;
-
-	pgdir = pgd_offset(mm, address);
-
-	end = vma->vm_end;
-	if (address >= end)
-		BUG();
-	do {
-		count = swap_out_pgd(mm, vma, pgdir, address, end, count);
-		if (!count)
-			break;
-		address = (address + PGDIR_SIZE) & PGDIR_MASK;
-		pgdir++;
-	} while (address && (address < end));
-	return count;
-}
-
-/*
- * Returns non-zero if we scanned all `count' pages
- */
-static int swap_out_mm(struct mm_struct * mm, int count)
-{
-	unsigned long address;
-	struct vm_area_struct* vma;
-
-	if (!count)
-		return 1;
-	/*
-	 * Go through process' page directory.
-	 */
-
-	/*
-	 * Find the proper vm-area after freezing the vma chain 
-	 * and ptes.
-	 */
-	spin_lock(&mm->page_table_lock);
-	address = mm->swap_address;
-	vma = find_vma(mm, address);
-	if (vma) {
-		if (address < vma->vm_start)
-			address = vma->vm_start;
-
-		for (;;) {
-			count = swap_out_vma(mm, vma, address, count);
-			if (!count)
-				goto out_unlock;
-			vma = vma->vm_next;
-			if (!vma)
-				break;
-			address = vma->vm_start;
+		/* We can't sleep here, try again later if this fails */
+		if (add_to_swap_cache(page, entry)) {
+			swap_free(entry);
+			goto out_unlock;
 		}
+		/* add_to_swap_cache() makes the page young, but it is not */
+		page->age = 0;
+		set_page_dirty(page);
 	}
-	/* Reset to 0 when we reach the end of address space */
-	mm->swap_address = 0;
-
-out_unlock:
-	spin_unlock(&mm->page_table_lock);
-	return !count;
-}
 
-#define SWAP_MM_SHIFT	4
-#define SWAP_SHIFT	5
-#define SWAP_MIN	8
-
-static inline int swap_amount(struct mm_struct *mm)
-{
-	int nr = mm->rss >> SWAP_SHIFT;
-	if (nr < SWAP_MIN) {
-		nr = SWAP_MIN;
-		if (nr > mm->rss)
-			nr = mm->rss;
+	switch (try_to_unmap(page)) {
+	case SWAP_SUCCESS:
+		vmscan_stat.unmapped++;
+		break;
+	case SWAP_FAIL:
+		vmscan_stat.unmap_failed++;
+		activate_page(page);
+		break;
 	}
-	return nr;
-}
-
-static void swap_out(unsigned int priority, int gfp_mask)
-{
-	int counter;
-	int retval = 0;
-	struct mm_struct *mm = current->mm;
-
-	/* Always start by trying to penalize the process that is allocating memory */
-	if (mm)
-		retval = swap_out_mm(mm, swap_amount(mm));
-
-	/* Then, look at the other mm's */
-	counter = (mmlist_nr << SWAP_MM_SHIFT) >> priority;
-	do {
-		struct list_head *p;
-
-		spin_lock(&mmlist_lock);
-		p = init_mm.mmlist.next;
-		if (p == &init_mm.mmlist)
-			goto empty;
-
-		/* Move it to the back of the queue.. */
-		list_del(p);
-		list_add_tail(p, &init_mm.mmlist);
-		mm = list_entry(p, struct mm_struct, mmlist);
-
-		/* Make sure the mm doesn't disappear when we drop the lock.. */
-		atomic_inc(&mm->mm_users);
-		spin_unlock(&mmlist_lock);
-
-		/* Walk about 6% of the address space each time */
-		retval |= swap_out_mm(mm, swap_amount(mm));
-		mmput(mm);
-	} while (--counter >= 0);
-	return;
-
-empty:
-	spin_unlock(&mmlist_lock);
+out_unlock:
+	UnlockPage(page);
 }
 
-
 /**
  * reclaim_page -	reclaims one page from the inactive_clean list
  * @zone: reclaim a page from this zone
@@ -332,15 +82,15 @@ struct page * reclaim_page(zone_t * zone)
 {
 	struct page * page = NULL;
 	struct list_head * page_lru;
+	struct address_space * mapping;
 	int maxscan;
 
 	/*
-	 * We only need the pagemap_lru_lock if we don't reclaim the page,
-	 * but we have to grab the pagecache_lock before the pagemap_lru_lock
-	 * to avoid deadlocks and most of the time we'll succeed anyway.
+	 * The page_lock of a mapping nests outside the zone's lru_lock,
+	 * so we can only trylock it once we know which mapping the page
+	 * belongs to. Pages whose mapping is busy are skipped for now.
 	 */
-	spin_lock(&pagecache_lock);
-	spin_lock(&pagemap_lru_lock);
+	spin_lock(&zone->lru_lock);
 	maxscan = zone->inactive_clean_pages;
 	while ((page_lru = zone->inactive_clean_list.prev) !=
 			&zone->inactive_clean_list && maxscan--) {
@@ -370,13 +120,30 @@ struct page * reclaim_page(zone_t * zone)
 		}
 
 		/* OK, remove the page from the caches. */
-                if (PageSwapCache(page)) {
-			__delete_from_swap_cache(page);
-			goto found_page;
-		}
-
-		if (page->mapping) {
-			__remove_inode_page(page);
+		mapping = page->mapping;
+		if (mapping) {
+			if (!spin_trylock(&mapping->page_lock)) {
+				UnlockPage(page);
+				list_del(page_lru);
+				list_add(page_lru, &zone->inactive_clean_list);
+				continue;
+			}
+			/*
+			 * find_get_page() takes its reference under the
+			 * page_lock, so only now is the count stable.
+			 */
+			if (page_count(page) != 1) {
+				spin_unlock(&mapping->page_lock);
+				UnlockPage(page);
+				del_page_from_inactive_clean_list(page);
+				add_page_to_active_list(page);
+				continue;
+			}
+			if (PageSwapCache(page))
+				__delete_from_swap_cache(page);
+			else
+				__remove_inode_page(page);
+			spin_unlock(&mapping->page_lock);
 			goto found_page;
 		}
 
@@ -399,8 +166,7 @@ found_page:
 		printk("VM: reclaim_page, found page with count %d!\n",
 				page_count(page));
 out:
-	spin_unlock(&pagemap_lru_lock);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&zone->lru_lock);
 	return page;
 }
 
@@ -431,177 +197,213 @@ int page_launder(int gfp_mask, int sync)
 	int launder_loop, maxscan, cleaned_pages, maxlaunder;
 	struct list_head * page_lru;
 	struct page * page;
+	zone_t * zone;
 
 	launder_loop = 0;
 	maxlaunder = 0;
 	cleaned_pages = 0;
 
 dirty_page_rescan:
-	spin_lock(&pagemap_lru_lock);
-	maxscan = nr_inactive_dirty_pages;
-	while ((page_lru = inactive_dirty_list.prev) != &inactive_dirty_list &&
-				maxscan-- > 0) {
-		page = list_entry(page_lru, struct page, lru);
-
-		/* Wrong page on list?! (list corruption, should not happen) */
-		if (!PageInactiveDirty(page)) {
-			printk("VM: page_launder, wrong page on list.\n");
-			list_del(page_lru);
-			nr_inactive_dirty_pages--;
-			page->zone->inactive_dirty_pages--;
-			continue;
-		}
-
-		/* Page is or was in use?  Move it to the active list. */
-		if (PageReferenced(page) || page->age > 0 ||
-				(!page->buffers && page_count(page) > 1) ||
-				page_ramdisk(page)) {
-			del_page_from_inactive_dirty_list(page);
-			add_page_to_active_list(page);
-			continue;
-		}
-
-		/*
-		 * The page is locked. IO in progress?
-		 * Move it to the back of the list.
-		 */
-		if (TryLockPage(page)) {
-			list_del(page_lru);
-			list_add(page_lru, &inactive_dirty_list);
-			continue;
-		}
-
-		/*
-		 * Dirty swap-cache page? Write it out if
-		 * last copy..
-		 */
-		if (PageDirty(page)) {
-			int (*writepage)(struct page *) = page->mapping->a_ops->writepage;
-
-			if (!writepage)
-				goto page_active;
-
-			/* First time through? Move it to the back of the list */
-			if (!launder_loop || !CAN_DO_FS) {
+	for_each_zone(zone) {
+		spin_lock(&zone->lru_lock);
+		maxscan = zone->inactive_dirty_pages;
+		while ((page_lru = zone->inactive_dirty_list.prev) !=
+				&zone->inactive_dirty_list && maxscan-- > 0) {
+			page = list_entry(page_lru, struct page, lru);
+
+			/* Wrong page on list?! (list corruption, should not happen) */
+			if (!PageInactiveDirty(page)) {
+				printk("VM: page_launder, wrong page on list.\n");
 				list_del(page_lru);
-				list_add(page_lru, &inactive_dirty_list);
-				UnlockPage(page);
+				zone->inactive_dirty_pages--;
+				continue;
+			}
+			vmscan_stat.scanned++;
+
+			/* Page is or was in use?  Move it to the active list. */
+			if (PageReferenced(page) || page->age > 0 ||
+					(!page->buffers && page_count(page) > 1 &&
+					 !page->pte_chain) ||
+					page_ramdisk(page)) {
+				del_page_from_inactive_dirty_list(page);
+				add_page_to_active_list(page);
 				continue;
 			}
 
-			/* OK, do a physical asynchronous write to swap.  */
-			ClearPageDirty(page);
-			page_cache_get(page);
-			spin_unlock(&pagemap_lru_lock);
+			/*
+			 * Still mapped? Unmap it from all its users first. The
+			 * page goes to the back of the list meanwhile and will
+			 * be cleaned when we find it again.
+			 */
+			if (page->pte_chain) {
+				list_del(page_lru);
+				list_add(page_lru, &zone->inactive_dirty_list);
+				if (!page_mapped_get(page))
+					continue;
+				spin_unlock(&zone->lru_lock);
 
-			writepage(page);
-			page_cache_release(page);
+				unmap_page(page);
+				page_cache_release(page);
 
-			/* And re-start the thing.. */
-			spin_lock(&pagemap_lru_lock);
-			continue;
-		}
+				spin_lock(&zone->lru_lock);
+				continue;
+			}
 
-		/*
-		 * If the page has buffers, try to free the buffer mappings
-		 * associated with this page. If we succeed we either free
-		 * the page (in case it was a buffercache only page) or we
-		 * move the page to the inactive_clean list.
-		 *
-		 * On the first round, we should free all previously cleaned
-		 * buffer pages
-		 */
-		if (page->buffers) {
-			unsigned int buffer_mask;
-			int clearedbuf;
-			int freed_page = 0;
 			/*
-			 * Since we might be doing disk IO, we have to
-			 * drop the spinlock and take an extra reference
-			 * on the page so it doesn't go away from under us.
+			 * An anonymous page that is not mapped is being freed, or
+			 * is pinned by someone else. It may have no references
+			 * left, so don't try to lock it.
 			 */
-			del_page_from_inactive_dirty_list(page);
-			page_cache_get(page);
-			spin_unlock(&pagemap_lru_lock);
-
-			/* Will we do (asynchronous) IO? */
-			if (launder_loop && maxlaunder == 0 && sync)
-				buffer_mask = gfp_mask;				/* Do as much as we can */
-			else if (launder_loop && maxlaunder-- > 0)
-				buffer_mask = gfp_mask & ~__GFP_WAIT;			/* Don't wait, async write-out */
-			else
-				buffer_mask = gfp_mask & ~(__GFP_WAIT | __GFP_IO);	/* Don't even start IO */
+			if (!page->mapping && !page->buffers) {
+				del_page_from_inactive_dirty_list(page);
+				add_page_to_active_list(page);
+				continue;
+			}
 
-			/* Try to free the page buffers. */
-			clearedbuf = try_to_free_buffers(page, buffer_mask);
+			/*
+			 * The page is locked. IO in progress?
+			 * Move it to the back of the list.
+			 */
+			if (TryLockPage(page)) {
+				list_del(page_lru);
+				list_add(page_lru, &zone->inactive_dirty_list);
+				continue;
+			}
 
 			/*
-			 * Re-take the spinlock. Note that we cannot
-			 * unlock the page yet since we're still
-			 * accessing the page_struct here...
+			 * Dirty swap-cache page? Write it out if
+			 * last copy..
 			 */
-			spin_lock(&pagemap_lru_lock);
+			if (PageDirty(page)) {
+				int (*writepage)(struct page *) = page->mapping->a_ops->writepage;
 
-			/* The buffers were not freed. */
-			if (!clearedbuf) {
-				add_page_to_inactive_dirty_list(page);
+				if (!writepage)
+					goto page_active;
 
-			/* The page was only in the buffer cache. */
-			} else if (!page->mapping) {
-				atomic_dec(&buffermem_pages);
-				freed_page = 1;
-				cleaned_pages++;
+				/* First time through? Move it to the back of the list */
+				if (!launder_loop || !CAN_DO_FS) {
+					list_del(page_lru);
+					list_add(page_lru, &zone->inactive_dirty_list);
+					UnlockPage(page);
+					continue;
+				}
 
-			/* The page has more users besides the cache and us. */
-			} else if (page_count(page) > 2) {
-				add_page_to_active_list(page);
+				/* OK, do a physical asynchronous write to swap.  */
+				ClearPageDirty(page);
+				page_cache_get(page);
+				spin_unlock(&zone->lru_lock);
 
-			/* OK, we "created" a freeable page. */
-			} else /* page->mapping && page_count(page) == 2 */ {
-				add_page_to_inactive_clean_list(page);
-				cleaned_pages++;
+				writepage(page);
+				page_cache_release(page);
+
+				/* And re-start the thing.. */
+				spin_lock(&zone->lru_lock);
+				continue;
 			}
 
 			/*
-			 * Unlock the page and drop the extra reference.
-			 * We can only do it here because we are accessing
-			 * the page struct above.
+			 * If the page has buffers, try to free the buffer mappings
+			 * associated with this page. If we succeed we either free
+			 * the page (in case it was a buffercache only page) or we
+			 * move the page to the inactive_clean list.
+			 *
+			 * On the first round, we should free all previously cleaned
+			 * buffer pages
 			 */
-			UnlockPage(page);
-			page_cache_release(page);
+			if (page->buffers) {
+				unsigned int buffer_mask;
+				int clearedbuf;
+				int freed_page = 0;
+				/*
+				 * Since we might be doing disk IO, we have to
+				 * drop the spinlock and take an extra reference
+				 * on the page so it doesn't go away from under us.
+				 */
+				del_page_from_inactive_dirty_list(page);
+				page_cache_get(page);
+				spin_unlock(&zone->lru_lock);
+
+				/* Will we do (asynchronous) IO? */
+				if (launder_loop && maxlaunder == 0 && sync)
+					buffer_mask = gfp_mask;				/* Do as much as we can */
+				else if (launder_loop && maxlaunder-- > 0)
+					buffer_mask = gfp_mask & ~__GFP_WAIT;			/* Don't wait, async write-out */
+				else
+					buffer_mask = gfp_mask & ~(__GFP_WAIT | __GFP_IO);	/* Don't even start IO */
+
+				/* Try to free the page buffers. */
+				clearedbuf = try_to_free_buffers(page, buffer_mask);
+
+				/*
+				 * Re-take the spinlock. Note that we cannot
+				 * unlock the page yet since we're still
+				 * accessing the page_struct here...
+				 */
+				spin_lock(&zone->lru_lock);
+
+				/* The buffers were not freed. */
+				if (!clearedbuf) {
+					add_page_to_inactive_dirty_list(page);
+
+				/* The page was only in the buffer cache. */
+				} else if (!page->mapping) {
+					atomic_dec(&buffermem_pages);
+					freed_page = 1;
+					cleaned_pages++;
+
+				/* The page has more users besides the cache and us. */
+				} else if (page_count(page) > 2) {
+					add_page_to_active_list(page);
+
+				/* OK, we "created" a freeable page. */
+				} else /* page->mapping && page_count(page) == 2 */ {
+					add_page_to_inactive_clean_list(page);
+					cleaned_pages++;
+				}
 
-			/* 
-			 * If we're freeing buffer cache pages, stop when
-			 * we've got enough free memory.
-			 */
-			if (freed_page && !free_shortage())
-				break;
-			continue;
-		} else if (page->mapping && !PageDirty(page)) {
-			/*
-			 * If a page had an extra reference in
-			 * deactivate_page(), we will find it here.
-			 * Now the page is really freeable, so we
-			 * move it to the inactive_clean list.
-			 */
-			del_page_from_inactive_dirty_list(page);
-			add_page_to_inactive_clean_list(page);
-			UnlockPage(page);
-			cleaned_pages++;
-		} else {
+				/*
+				 * Unlock the page and drop the extra reference.
+				 * We can only do it here because we are accessing
+				 * the page struct above.
+				 */
+				UnlockPage(page);
+				page_cache_release(page);
+
+				/* 
+				 * If we're freeing buffer cache pages, stop when
+				 * we've got enough free memory.
+				 */
+				if (freed_page && !free_shortage()) {
+					spin_unlock(&zone->lru_lock);
+					goto out;
+				}
+				continue;
+			} else if (page->mapping && !PageDirty(page)) {
+				/*
+				 * If a page had an extra reference in
+				 * deactivate_page(), we will find it here.
+				 * Now the page is really freeable, so we
+				 * move it to the inactive_clean list.
+				 */
+				del_page_from_inactive_dirty_list(page);
+				add_page_to_inactive_clean_list(page);
+				UnlockPage(page);
+				cleaned_pages++;
+			} else {
 page_active:
-			/*
-			 * OK, we don't know what to do with the page.
-			 * It's no use keeping it here, so we move it to
-			 * the active list.
-			 */
-			del_page_from_inactive_dirty_list(page);
-			add_page_to_active_list(page);
-			UnlockPage(page);
+				/*
+				 * OK, we don't know what to do with the page.
+				 * It's no use keeping it here, so we move it to
+				 * the active list.
+				 */
+				del_page_from_inactive_dirty_list(page);
+				add_page_to_active_list(page);
+				UnlockPage(page);
+			}
 		}
+		spin_unlock(&zone->lru_lock);
 	}
-	spin_unlock(&pagemap_lru_lock);
-
+out:
 	/*
 	 * If we don't have enough free pages, we loop back once
 	 * to queue the dirty pages for writeout. When we were called
@@ -625,48 +427,45 @@ page_active:
 		goto dirty_page_rescan;
 	}
 
+	vmscan_stat.reclaimed += cleaned_pages;
+
 	/* Return the number of pages moved to the inactive_clean list. */
 	return cleaned_pages;
 }
 
-/**
- * refill_inactive_scan - scan the active list and find pages to deactivate
- * @priority: the priority at which to scan
- * @target: number of pages to deactivate, zero for background aging
- *
- * This function will scan a portion of the active list to find
- * unused pages, those pages will then be moved to the inactive list.
+/*
+ * Scan up to maxscan pages of the active list of one zone, see
+ * refill_inactive_scan() below.
  */
-int refill_inactive_scan(unsigned int priority, int target)
+static int refill_inactive_zone(zone_t *zone, int maxscan, int target)
 {
 	struct list_head * page_lru;
 	struct page * page;
-	int maxscan = nr_active_pages >> priority;
 	int page_active = 0;
 	int nr_deactivated = 0;
-
-	/*
-	 * When we are background aging, we try to increase the page aging
-	 * information in the system.
-	 */
-	if (!target)
-		maxscan = nr_active_pages >> 4;
+	int referenced;
 
 	/* Take the lock while messing with the list... */
-	spin_lock(&pagemap_lru_lock);
-	while (maxscan-- > 0 && (page_lru = active_list.prev) != &active_list) {
+	spin_lock(&zone->lru_lock);
+	while (maxscan-- > 0 && (page_lru = zone->active_list.prev) !=
+			&zone->active_list) {
 		page = list_entry(page_lru, struct page, lru);
 
 		/* Wrong page on list?! (list corruption, should not happen) */
 		if (!PageActive(page)) {
 			printk("VM: refill_inactive, wrong page on list.\n");
 			list_del(page_lru);
-			nr_active_pages--;
+			zone->active_pages--;
 			continue;
 		}
 
-		/* Do aging on the pages. */
-		if (PageTestandClearReferenced(page)) {
+		vmscan_stat.scanned++;
+
+		/* Do aging on the pages, looking at all their mappings. */
+		referenced = PageTestandClearReferenced(page);
+		if (page->pte_chain && page_referenced(page))
+			referenced = 1;
+		if (referenced) {
 			age_page_up_nolock(page);
 			page_active = 1;
 		} else {
@@ -680,8 +479,15 @@ int refill_inactive_scan(unsigned int priority, int target)
 			 * inactive_dirty list and back again...
 			 *
 			 * SUBTLE: we can have buffer pages with count 1.
+			 *
+			 * Mapped pages go to the inactive_dirty list
+			 * whatever their count, page_launder() unmaps them.
 			 */
-			if (page->age == 0 && page_count(page) <=
+			if (page->age == 0 && page->pte_chain) {
+				del_page_from_active_list(page);
+				add_page_to_inactive_dirty_list(page);
+				page_active = 0;
+			} else if (page->age == 0 && page_count(page) <=
 						(page->buffers ? 2 : 1)) {
 				deactivate_page_nolock(page);
 				page_active = 0;
@@ -696,18 +502,55 @@ int refill_inactive_scan(unsigned int priority, int target)
 		 */
 		if (page_active || PageActive(page)) {
 			list_del(page_lru);
-			list_add(page_lru, &active_list);
+			list_add(page_lru, &zone->active_list);
 		} else {
 			nr_deactivated++;
 			if (target && nr_deactivated >= target)
 				break;
 		}
 	}
-	spin_unlock(&pagemap_lru_lock);
+	spin_unlock(&zone->lru_lock);
 
 	return nr_deactivated;
 }
 
+/**
+ * refill_inactive_scan - scan the active lists and find pages to deactivate
+ * @priority: the priority at which to scan
+ * @target: number of pages to deactivate, zero for background aging
+ *
+ * This function will scan a portion of the active lists to find
+ * unused pages, those pages will then be moved to the inactive lists.
+ * Every zone gets a share of the work in proportion to its number
+ * of active pages.
+ */
+int refill_inactive_scan(unsigned int priority, int target)
+{
+	unsigned long total = nr_active_pages() >> 6;
+	int nr_deactivated = 0;
+	zone_t *zone;
+
+	for_each_zone(zone) {
+		int maxscan = zone->active_pages >> priority;
+		int zone_target = 0;
+
+		if (!zone->active_pages)
+			continue;
+		/*
+		 * When we are background aging, we try to increase the page
+		 * aging information in the system.
+		 */
+		if (!target)
+			maxscan = zone->active_pages >> 4;
+		else
+			zone_target = (unsigned long) target *
+				(zone->active_pages >> 6) / (total + 1) + 1;
+		nr_deactivated += refill_inactive_zone(zone, maxscan,
+						       zone_target);
+	}
+	return nr_deactivated;
+}
+
 /*
  * Check if there are zones with a severe shortage of free pages,
  * or if all zones have a minor shortage.
@@ -755,7 +598,7 @@ int inactive_shortage(void)
 	shortage += inactive_target;
 	shortage -= nr_free_pages();
 	shortage -= nr_inactive_clean_pages();
-	shortage -= nr_inactive_dirty_pages;
+	shortage -= nr_inactive_dirty_pages();
 
 	if (shortage > 0)
 		return shortage;
@@ -787,8 +630,8 @@ int inactive_shortage(void)
 
 /*
  * Refill_inactive is the function used to scan and age the pages on
- * the active list and in the working set of processes, moving the
- * little-used pages to the inactive list.
+ * the active list, moving the little-used pages to the inactive list.
+ * Pages mapped by processes are aged through their pte chains.
  *
  * When called by kswapd, we try to deactivate as many pages as needed
  * to recover from the inactive page shortage. This makes it possible
@@ -823,9 +666,6 @@ static int refill_inactive(unsigned int gfp_mask, int user)
 				return 1;
 		}
 
-		/* Walk the VM space for a bit.. */
-		swap_out(DEF_PRIORITY, gfp_mask);
-
 		count -= refill_inactive_scan(DEF_PRIORITY, count);
 		if (count <= 0)
 			goto done;
@@ -841,8 +681,13 @@ done:
 
 static int do_try_to_free_pages(unsigned int gfp_mask, int user)
 {
+	unsigned long scanned = vmscan_stat.scanned;
+	unsigned long reclaimed = vmscan_stat.reclaimed;
 	int ret = 0;
 
+	/* Let the pages queued on this CPU be seen by the scans */
+	lru_add_drain();
+
 	/*
 	 * If we're low on free pages, move pages from the
 	 * inactive_dirty list to the inactive_clean list.
@@ -869,6 +714,10 @@ static int do_try_to_free_pages(unsigned int gfp_mask, int user)
 	 */
 	kmem_cache_reap(gfp_mask);
 
+	vmscan_stat.passes++;
+	vmscan_stat.last_scanned = vmscan_stat.scanned - scanned;
+	vmscan_stat.last_reclaimed = vmscan_stat.reclaimed - reclaimed;
+
 	return ret;
 }
 
@@ -1026,7 +875,7 @@ int kreclaimd(void *unused)
 					page = reclaim_page(zone);
 					if (!page)
 						break;
-					__free_page(page);
+					free_cold_page(page);
 				}
 			}
 			pgdat = pgdat->node_next;
@@ -81,6 +81,7 @@
 #include <linux/errno.h>
 #include <linux/interrupt.h>
 #include <linux/if_ether.h>
+#include <linux/ip.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/notifier.h>
@@ -778,6 +779,17 @@ int dev_close(struct net_device *dev)
 
 	clear_bit(__LINK_STATE_START, &dev->state);
 
+	/*
+	 *	A polling device may still be on the poll list of some CPU.
+	 *	netif_running() is false now, so it will not be put back
+	 *	once it is taken off; wait for that.
+	 */
+	smp_mb__after_clear_bit();
+	while (test_bit(__LINK_STATE_RX_SCHED, &dev->state)) {
+		current->state = TASK_INTERRUPTIBLE;
+		schedule_timeout(1);
+	}
+
 	/*
 	 *	Call the device specific close. This cannot fail.
 	 *	Only if device is UP
@@ -1052,6 +1064,10 @@ int dev_queue_xmit(struct sk_buff *skb)
   =======================================================================*/
 
 int netdev_max_backlog = 300;
+/* Packets the backlog of one CPU may process per poll round */
+int netdev_weight = 64;
+/* CPUs that flows are spread over, 0 processes them where they arrive */
+int netdev_rx_steer_cpus = 0;
 /* These numbers are selected based on intuition and some
  * experimentatiom, if you have more scientific way of doing this
  * please go ahead and fix things.
@@ -1173,68 +1189,88 @@ static void sample_queue(unsigned long dummy)
 #endif
 
 
-/**
- *	netif_rx	-	post buffer to the network code
- *	@skb: buffer to post
- *
- *	This function receives a packet from a device driver and queues it for
- *	the upper (protocol) levels to process.  It always succeeds. The buffer
- *	may be dropped during processing for congestion control or by the 
- *	protocol layers.
- *      
- *	return values:
- *	NET_RX_SUCCESS	(no congestion)           
- *	NET_RX_CN_LOW     (low congestion) 
- *	NET_RX_CN_MOD     (moderate congestion)
- *	NET_RX_CN_HIGH    (high congestion) 
- *	NET_RX_DROP    (packet was dropped)
- *      
- *      
+#ifdef CONFIG_SMP
+/*
+ * Pick the CPU whose backlog a packet is queued to. All packets of
+ * one IPv4 flow hash to the same CPU, so a flow is never reordered.
+ * Everything else is processed on the CPU it arrived on.
  */
+static int netif_rx_cpu(struct sk_buff *skb, int this_cpu)
+{
+	unsigned long mask = netdev_rx_steer_cpus & cpu_online_map;
+	struct iphdr *iph;
+	unsigned int ihl;
+	u32 hash;
+	int n, cpu;
+
+	if (!mask || skb->protocol != htons(ETH_P_IP) ||
+	    skb_headlen(skb) < sizeof(struct iphdr))
+		return this_cpu;
+
+	iph = (struct iphdr *) skb->data;
+	hash = iph->saddr ^ iph->daddr ^ iph->protocol;
+	ihl = iph->ihl * 4;
+	if (!(iph->frag_off & htons(IP_MF|IP_OFFSET)) &&
+	    (iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP) &&
+	    skb_headlen(skb) >= ihl + 4)
+		hash ^= *(u32 *) (skb->data + ihl);	/* both ports */
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	n = hash % hweight32(mask);
+	for (cpu = 0; ; cpu++)
+		if ((mask & (1UL << cpu)) && n-- == 0)
+			break;
+	return cpu;
+}
+#else
+#define netif_rx_cpu(skb, this_cpu)	(this_cpu)
+#endif
 
-int netif_rx(struct sk_buff *skb)
+/*
+ * Queue a packet to the backlog of 'cpu' and make sure that CPU gets
+ * around to processing it. Another CPU is kicked with its receive
+ * softirq through remote_raise_softirq(); net_rx_action() there finds
+ * the packets and schedules the backlog.
+ */
+static int enqueue_to_backlog(struct sk_buff *skb, int cpu)
 {
 	int this_cpu = smp_processor_id();
-	struct softnet_data *queue;
+	struct softnet_data *queue = &softnet_data[cpu];
 	unsigned long flags;
-
-	if (skb->stamp.tv_sec == 0)
-		get_fast_time(&skb->stamp);
-
-	/* The code is rearranged so that the path is the most
-	   short when CPU is congested, but is still operating.
-	 */
-	queue = &softnet_data[this_cpu];
+	int qlen;
 
 	local_irq_save(flags);
+	spin_lock(&queue->input_pkt_queue.lock);
 
-	netdev_rx_stat[this_cpu].total++;
-	if (queue->input_pkt_queue.qlen <= netdev_max_backlog) {
-		if (queue->input_pkt_queue.qlen) {
+	qlen = queue->input_pkt_queue.qlen;
+	if (qlen <= netdev_max_backlog) {
+		if (qlen) {
 			if (queue->throttle)
 				goto drop;
-
-enqueue:
-			dev_hold(skb->dev);
-			__skb_queue_tail(&queue->input_pkt_queue,skb);
-
-			/* Runs from irqs or BH's, no need to wake BH */
-			__cpu_raise_softirq(this_cpu, NET_RX_SOFTIRQ);
-			local_irq_restore(flags);
-#ifndef OFFLINE_SAMPLE
-			get_sample_stats(this_cpu);
-#endif
-			return softnet_data[this_cpu].cng_level;
-		}
-
-		if (queue->throttle) {
+		} else if (queue->throttle) {
 			queue->throttle = 0;
 #ifdef CONFIG_NET_HW_FLOWCONTROL
 			if (atomic_dec_and_test(&netdev_dropping))
 				netdev_wakeup();
 #endif
 		}
-		goto enqueue;
+
+		dev_hold(skb->dev);
+		__skb_queue_tail(&queue->input_pkt_queue, skb);
+		spin_unlock(&queue->input_pkt_queue.lock);
+
+		if (cpu == this_cpu)
+			netif_rx_schedule(&queue->blog_dev);
+		else {
+			netdev_rx_stat[this_cpu].steered++;
+			remote_raise_softirq(cpu, NET_RX_SOFTIRQ);
+		}
+		local_irq_restore(flags);
+#ifndef OFFLINE_SAMPLE
+		get_sample_stats(cpu);
+#endif
+		return queue->cng_level;
 	}
 
 	if (queue->throttle == 0) {
@@ -1246,6 +1282,7 @@ enqueue:
 	}
 
 drop:
+	spin_unlock(&queue->input_pkt_queue.lock);
 	netdev_rx_stat[this_cpu].dropped++;
 	local_irq_restore(flags);
 
@@ -1253,6 +1290,37 @@ drop:
 	return NET_RX_DROP;
 }
 
+/**
+ *	netif_rx	-	post buffer to the network code
+ *	@skb: buffer to post
+ *
+ *	This function receives a packet from a device driver and queues it for
+ *	the upper (protocol) levels to process.  It always succeeds. The buffer
+ *	may be dropped during processing for congestion control or by the 
+ *	protocol layers. The packet goes to the backlog of this CPU, or of
+ *	the CPU its flow is steered to (see netdev_rx_steer_cpus).
+ *      
+ *	return values:
+ *	NET_RX_SUCCESS	(no congestion)           
+ *	NET_RX_CN_LOW     (low congestion) 
+ *	NET_RX_CN_MOD     (moderate congestion)
+ *	NET_RX_CN_HIGH    (high congestion) 
+ *	NET_RX_DROP    (packet was dropped)
+ *      
+ *      
+ */
+
+int netif_rx(struct sk_buff *skb)
+{
+	int this_cpu = smp_processor_id();
+
+	if (skb->stamp.tv_sec == 0)
+		get_fast_time(&skb->stamp);
+
+	netdev_rx_stat[this_cpu].total++;
+	return enqueue_to_backlog(skb, netif_rx_cpu(skb, this_cpu));
+}
+
 /* Deliver skb to an old protocol, which is not threaded well
    or which do not understand shared skbs.
  */
@@ -1291,17 +1359,16 @@ static int deliver_to_old_ones(struct packet_type *pt, struct sk_buff *skb, int
 
 /* Reparent skb to master device. This function is called
  * only from net_rx_action under BR_NETPROTO_LOCK. It is misuse
- * of BR_NETPROTO_LOCK, but it is OK for now.
+ * of BR_NETPROTO_LOCK, but it is OK for now. No reference is
+ * taken on the master: a slave can not be released while the
+ * lock is held.
  */
 static __inline__ void skb_bond(struct sk_buff *skb)
 {
 	struct net_device *dev = skb->dev;
 	
-	if (dev->master) {
-		dev_hold(dev->master);
+	if (dev->master)
 		skb->dev = dev->master;
-		dev_put(dev);
-	}
 }
 
 static void net_tx_action(struct softirq_action *h)
@@ -1398,120 +1465,153 @@ static inline void handle_diverter(struct sk_buff *skb)
 #endif   /* CONFIG_NET_DIVERT */
 
 
-static void net_rx_action(struct softirq_action *h)
+/*
+ * Hand a packet to the protocols. Called from net_rx_action() under
+ * BR_NETPROTO_LOCK, either by a polling driver or by the backlog.
+ */
+static int __netif_receive_skb(struct sk_buff *skb)
 {
-	int this_cpu = smp_processor_id();
-	struct softnet_data *queue = &softnet_data[this_cpu];
-	unsigned long start_time = jiffies;
-	int bugdet = netdev_max_backlog;
-
-	br_read_lock(BR_NETPROTO_LOCK);
-
-	for (;;) {
-		struct sk_buff *skb;
-		struct net_device *rx_dev;
-
-		local_irq_disable();
-		skb = __skb_dequeue(&queue->input_pkt_queue);
-		local_irq_enable();
-
-		if (skb == NULL)
-			break;
-
-		skb_bond(skb);
+	struct packet_type *ptype, *pt_prev;
+	unsigned short type = skb->protocol;
+	int ret = NET_RX_DROP;
 
-		rx_dev = skb->dev;
+	skb_bond(skb);
 
 #ifdef CONFIG_NET_FASTROUTE
-		if (skb->pkt_type == PACKET_FASTROUTE) {
-			netdev_rx_stat[this_cpu].fastroute_deferred_out++;
-			dev_queue_xmit(skb);
-			dev_put(rx_dev);
-			continue;
-		}
+	if (skb->pkt_type == PACKET_FASTROUTE) {
+		netdev_rx_stat[smp_processor_id()].fastroute_deferred_out++;
+		return dev_queue_xmit(skb);
+	}
 #endif
-		skb->h.raw = skb->nh.raw = skb->data;
-		{
-			struct packet_type *ptype, *pt_prev;
-			unsigned short type = skb->protocol;
-
-			pt_prev = NULL;
-			for (ptype = ptype_all; ptype; ptype = ptype->next) {
-				if (!ptype->dev || ptype->dev == skb->dev) {
-					if (pt_prev) {
-						if (!pt_prev->data) {
-							deliver_to_old_ones(pt_prev, skb, 0);
-						} else {
-							atomic_inc(&skb->users);
-							pt_prev->func(skb,
-								      skb->dev,
-								      pt_prev);
-						}
-					}
-					pt_prev = ptype;
+
+	skb->h.raw = skb->nh.raw = skb->data;
+
+	pt_prev = NULL;
+	for (ptype = ptype_all; ptype; ptype = ptype->next) {
+		if (!ptype->dev || ptype->dev == skb->dev) {
+			if (pt_prev) {
+				if (!pt_prev->data) {
+					ret = deliver_to_old_ones(pt_prev, skb, 0);
+				} else {
+					atomic_inc(&skb->users);
+					ret = pt_prev->func(skb, skb->dev, pt_prev);
 				}
 			}
+			pt_prev = ptype;
+		}
+	}
 
 #ifdef CONFIG_NET_DIVERT
-			if (skb->dev->divert && skb->dev->divert->divert)
-				handle_diverter(skb);
+	if (skb->dev->divert && skb->dev->divert->divert)
+		handle_diverter(skb);
 #endif /* CONFIG_NET_DIVERT */
 
-			
 #if defined(CONFIG_BRIDGE) || defined(CONFIG_BRIDGE_MODULE)
-			if (skb->dev->br_port != NULL &&
-			    br_handle_frame_hook != NULL) {
-				handle_bridge(skb, pt_prev);
-				dev_put(rx_dev);
-				continue;
-			}
+	if (skb->dev->br_port != NULL &&
+	    br_handle_frame_hook != NULL)
+		return handle_bridge(skb, pt_prev);
 #endif
 
-			for (ptype=ptype_base[ntohs(type)&15];ptype;ptype=ptype->next) {
-				if (ptype->type == type &&
-				    (!ptype->dev || ptype->dev == skb->dev)) {
-					if (pt_prev) {
-						if (!pt_prev->data)
-							deliver_to_old_ones(pt_prev, skb, 0);
-						else {
-							atomic_inc(&skb->users);
-							pt_prev->func(skb,
-								      skb->dev,
-								      pt_prev);
-						}
-					}
-					pt_prev = ptype;
+	for (ptype=ptype_base[ntohs(type)&15];ptype;ptype=ptype->next) {
+		if (ptype->type == type &&
+		    (!ptype->dev || ptype->dev == skb->dev)) {
+			if (pt_prev) {
+				if (!pt_prev->data) {
+					ret = deliver_to_old_ones(pt_prev, skb, 0);
+				} else {
+					atomic_inc(&skb->users);
+					ret = pt_prev->func(skb, skb->dev, pt_prev);
 				}
 			}
-
-			if (pt_prev) {
-				if (!pt_prev->data)
-					deliver_to_old_ones(pt_prev, skb, 1);
-				else
-					pt_prev->func(skb, skb->dev, pt_prev);
-			} else
-				kfree_skb(skb);
+			pt_prev = ptype;
 		}
+	}
+
+	if (pt_prev) {
+		if (!pt_prev->data)
+			ret = deliver_to_old_ones(pt_prev, skb, 1);
+		else
+			ret = pt_prev->func(skb, skb->dev, pt_prev);
+	} else {
+		kfree_skb(skb);
+		ret = NET_RX_DROP;
+	}
+	return ret;
+}
+
+/**
+ *	netif_receive_skb	-	process a received packet
+ *	@skb: buffer to process
+ *
+ *	The receive path of polling drivers: call this from the poll method
+ *	instead of netif_rx(). The packet is processed right away, unless its
+ *	flow is steered to another CPU. Returns one of the NET_RX_ codes.
+ */
 
-		dev_put(rx_dev);
+int netif_receive_skb(struct sk_buff *skb)
+{
+	int this_cpu = smp_processor_id();
+	int cpu;
 
-		if (bugdet-- < 0 || jiffies - start_time > 1)
-			goto softnet_break;
+	if (skb->stamp.tv_sec == 0)
+		get_fast_time(&skb->stamp);
+
+	netdev_rx_stat[this_cpu].total++;
+	cpu = netif_rx_cpu(skb, this_cpu);
+	if (cpu != this_cpu)
+		return enqueue_to_backlog(skb, cpu);
+	return __netif_receive_skb(skb);
+}
+
+/*
+ * The poll method of the backlog pseudo device: process the packets
+ * netif_rx() queued to this CPU.
+ */
+static int process_backlog(struct net_device *blog_dev, int *budget)
+{
+	int this_cpu = smp_processor_id();
+	struct softnet_data *queue = &softnet_data[this_cpu];
+	unsigned long start_time = jiffies;
+	int quota = blog_dev->quota;
+	int work = 0;
+
+	if (quota > *budget)
+		quota = *budget;
+	blog_dev->weight = netdev_weight;
+
+	for (;;) {
+		struct sk_buff *skb;
+		struct net_device *dev;
 
+		spin_lock_irq(&queue->input_pkt_queue.lock);
+		skb = __skb_dequeue(&queue->input_pkt_queue);
+		if (skb == NULL)
+			goto job_done;
 #ifdef CONFIG_NET_HW_FLOWCONTROL
-	if (queue->throttle && queue->input_pkt_queue.qlen < no_cong_thresh ) {
-		if (atomic_dec_and_test(&netdev_dropping)) {
+		if (queue->throttle &&
+		    queue->input_pkt_queue.qlen < no_cong_thresh) {
 			queue->throttle = 0;
-			netdev_wakeup();
-			goto softnet_break;
+			if (atomic_dec_and_test(&netdev_dropping))
+				netdev_wakeup();
 		}
-	}
 #endif
+		spin_unlock_irq(&queue->input_pkt_queue.lock);
 
+		dev = skb->dev;
+		__netif_receive_skb(skb);
+		dev_put(dev);
+
+		if (++work >= quota || jiffies - start_time > 1)
+			break;
 	}
-	br_read_unlock(BR_NETPROTO_LOCK);
 
-	local_irq_disable();
+	blog_dev->quota -= work;
+	*budget -= work;
+	return 1;
+
+job_done:
+	/* Checked under the lock, a new packet reschedules us */
+	netif_rx_complete(blog_dev);
 	if (queue->throttle) {
 		queue->throttle = 0;
 #ifdef CONFIG_NET_HW_FLOWCONTROL
@@ -1519,20 +1619,78 @@ static void net_rx_action(struct softirq_action *h)
 			netdev_wakeup();
 #endif
 	}
+	spin_unlock_irq(&queue->input_pkt_queue.lock);
+
+	blog_dev->quota -= work;
+	*budget -= work;
+	return 0;
+}
+
+/*
+ * Poll the devices on this CPU's poll list round robin, each for at
+ * most its quota, until all are done or the budget of
+ * netdev_max_backlog packets or a tick is used up. Whatever is left
+ * waits for the next softirq run, with the device interrupts still
+ * masked, so a receive flood can not keep the CPU in the driver's
+ * interrupt handler.
+ */
+static void net_rx_action(struct softirq_action *h)
+{
+	int this_cpu = smp_processor_id();
+	struct softnet_data *queue = &softnet_data[this_cpu];
+	struct net_device *blog_dev = &queue->blog_dev;
+	unsigned long start_time = jiffies;
+	int budget = netdev_max_backlog;
+
+	br_read_lock(BR_NETPROTO_LOCK);
+	local_irq_disable();
+
+	/* Packets other CPUs steered to us */
+	if (queue->input_pkt_queue.qlen &&
+	    !test_and_set_bit(__LINK_STATE_RX_SCHED, &blog_dev->state)) {
+		dev_hold(blog_dev);
+		list_add_tail(&blog_dev->poll_list, &queue->poll_list);
+		blog_dev->quota = blog_dev->weight;
+	}
+
+	while (!list_empty(&queue->poll_list)) {
+		struct net_device *dev;
+
+		if (budget <= 0 || jiffies - start_time > 1)
+			goto softnet_break;
+
+		local_irq_enable();
+
+		dev = list_entry(queue->poll_list.next, struct net_device, poll_list);
+
+		if (dev->quota <= 0 || dev->poll(dev, &budget)) {
+			/* more work to do: go to the back of the list */
+			local_irq_disable();
+			list_del(&dev->poll_list);
+			list_add_tail(&dev->poll_list, &queue->poll_list);
+			if (dev->quota < 0)
+				dev->quota += dev->weight;
+			else
+				dev->quota = dev->weight;
+		} else {
+			dev_put(dev);
+			local_irq_disable();
+		}
+	}
+
 	local_irq_enable();
+	br_read_unlock(BR_NETPROTO_LOCK);
 
 	NET_PROFILE_LEAVE(softnet_process);
 	return;
 
 softnet_break:
-	br_read_unlock(BR_NETPROTO_LOCK);
-
-	local_irq_disable();
 	netdev_rx_stat[this_cpu].time_squeeze++;
 
 	/* This already runs in BH context, no need to wake up BH's */
 	__cpu_raise_softirq(this_cpu, NET_RX_SOFTIRQ);
 	local_irq_enable();
+	br_read_unlock(BR_NETPROTO_LOCK);
 
 	NET_PROFILE_LEAVE(softnet_process);
 	return;
@@ -1746,7 +1904,7 @@ static int dev_proc_stats(char *buffer, char **start, off_t offset,
 
 	for (lcpu=0; lcpu<smp_num_cpus; lcpu++) {
 		i = cpu_logical_map(lcpu);
-		len += sprintf(buffer+len, "%08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+		len += sprintf(buffer+len, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
 			       netdev_rx_stat[i].total,
 			       netdev_rx_stat[i].dropped,
 			       netdev_rx_stat[i].time_squeeze,
@@ -1756,10 +1914,11 @@ static int dev_proc_stats(char *buffer, char **start, off_t offset,
 			       netdev_rx_stat[i].fastroute_defer,
 			       netdev_rx_stat[i].fastroute_deferred_out,
 #if 0
-			       netdev_rx_stat[i].fastroute_latency_reduction
+			       netdev_rx_stat[i].fastroute_latency_reduction,
 #else
-			       netdev_rx_stat[i].cpu_collision
+			       netdev_rx_stat[i].cpu_collision,
 #endif
+			       netdev_rx_stat[i].steered
 			       );
 	}
 
@@ -2671,6 +2830,11 @@ int __init net_dev_init(void)
 		queue->cng_level = 0;
 		queue->avg_blog = 10; /* arbitrary non-zero */
 		queue->completion_queue = NULL;
+		INIT_LIST_HEAD(&queue->poll_list);
+		set_bit(__LINK_STATE_START, &queue->blog_dev.state);
+		queue->blog_dev.weight = netdev_weight;
+		queue->blog_dev.poll = process_backlog;
+		atomic_set(&queue->blog_dev.refcnt, 1);
 	}
 	
 #ifdef CONFIG_NET_PROFILE
@@ -16,6 +16,8 @@ extern int no_cong_thresh;
 extern int no_cong;
 extern int lo_cong;
 extern int mod_cong;
+extern int netdev_weight;
+extern int netdev_rx_steer_cpus;
 extern int netdev_fastroute;
 extern int net_msg_cost;
 extern int net_msg_burst;
@@ -62,6 +64,12 @@ ctl_table core_table[] = {
 	{NET_CORE_MOD_CONG, "mod_cong",
 	 &mod_cong, sizeof(int), 0644, NULL,
 	 &proc_dointvec},
+	{NET_CORE_DEV_WEIGHT, "dev_weight",
+	 &netdev_weight, sizeof(int), 0644, NULL,
+	 &proc_dointvec},
+	{NET_CORE_RX_STEER_CPUS, "rx_steer_cpus",
+	 &netdev_rx_steer_cpus, sizeof(int), 0644, NULL,
+	 &proc_dointvec},
 #ifdef CONFIG_NET_FASTROUTE
 	{NET_CORE_FASTROUTE, "netdev_fastroute",
 	 &netdev_fastroute, sizeof(int), 0644, NULL,
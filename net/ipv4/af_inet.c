@@ -1147,6 +1147,8 @@ static int __init inet_init(void)
 	/* Setup TCP slab cache for open requests. */
 	tcp_init();
 
+	udp_init();
+
 
 	/*
 	 *	Set the ICMP layer up
@@ -47,6 +47,35 @@
 
 #define FFprint(a...) printk(KERN_DEBUG a)
 
+#ifdef CONFIG_IP_FIB_TRIE
+/* "fib=hash" at boot puts the tables in fib_hash.c instead */
+static int fib_use_trie = 1;
+
+static int __init fib_engine_setup(char *str)
+{
+	if (!strcmp(str, "hash"))
+		fib_use_trie = 0;
+	else if (!strcmp(str, "trie"))
+		fib_use_trie = 1;
+	return 1;
+}
+
+__setup("fib=", fib_engine_setup);
+#endif
+
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+static struct fib_table * fib_table_init(int id)
+#else
+static struct fib_table * __init fib_table_init(int id)
+#endif
+{
+#ifdef CONFIG_IP_FIB_TRIE
+	if (fib_use_trie)
+		return fib_trie_init(id);
+#endif
+	return fib_hash_init(id);
+}
+
 #ifndef CONFIG_IP_MULTIPLE_TABLES
 
 #define RT_TABLE_MIN RT_TABLE_MAIN
@@ -64,7 +93,7 @@ struct fib_table *__fib_new_table(int id)
 {
 	struct fib_table *tb;
 
-	tb = fib_hash_init(id);
+	tb = fib_table_init(id);
 	if (!tb)
 		return NULL;
 	fib_tables[id] = tb;
@@ -646,9 +675,13 @@ void __init ip_fib_init(void)
 	proc_net_create("route",0,fib_get_procinfo);
 #endif		/* CONFIG_PROC_FS */
 
+#ifdef CONFIG_IP_FIB_TRIE
+	printk(KERN_INFO "IP: FIB lookups use the %s\n",
+	       fib_use_trie ? "LC-trie" : "hash tables");
+#endif
 #ifndef CONFIG_IP_MULTIPLE_TABLES
-	local_table = fib_hash_init(RT_TABLE_LOCAL);
-	main_table = fib_hash_init(RT_TABLE_MAIN);
+	local_table = fib_table_init(RT_TABLE_LOCAL);
+	main_table = fib_table_init(RT_TABLE_MAIN);
 #else
 	fib_rules_init();
 #endif
@@ -0,0 +1,1239 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		IPv4 FIB: lookup engine based on a level compressed trie.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * fib_hash.c keeps one hash table per prefix length and a lookup probes
+ * every non-empty one, longest first, so a table with many different
+ * prefix lengths costs up to 33 probes per lookup. Here the prefixes are
+ * leaves of a path compressed binary trie whose internal nodes are
+ * widened to index several bits at once where the trie is dense
+ * (S. Nilsson and G. Karlsson, "IP-address lookup using LC-tries"), so a
+ * lookup is a handful of array indexations, plus a few more to back up
+ * when the longest matching prefix is shorter than the one the address
+ * leads to.
+ *
+ * Keys are host order addresses. A leaf holds the routes of one network
+ * address, grouped by prefix length; an internal node indexes the bits
+ * pos .. pos+bits-1 of the key, and all keys below it have the bits of
+ * its own key above those. Only the RTNL holder changes the trie: new
+ * nodes are built aside and linked in under fib_trie_lock, which lookups
+ * hold for reading, as in fib_hash.c.
+ */
+
+#include <linux/config.h>
+#include <asm/uaccess.h>
+#include <asm/system.h>
+#include <asm/bitops.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/socket.h>
+#include <linux/sockios.h>
+#include <linux/errno.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/netdevice.h>
+#include <linux/if_arp.h>
+#include <linux/proc_fs.h>
+#include <linux/skbuff.h>
+#include <linux/netlink.h>
+#include <linux/init.h>
+#include <linux/vmalloc.h>
+
+#include <net/ip.h>
+#include <net/protocol.h>
+#include <net/route.h>
+#include <net/tcp.h>
+#include <net/sock.h>
+#include <net/ip_fib.h>
+
+#define T_TNODE		0
+#define T_LEAF		1
+
+struct tnode;
+
+struct node
+{
+	struct tnode		*parent;	/* writers only */
+	u32			key;
+	int			type;
+};
+
+struct fib_alias
+{
+	struct fib_alias	*fa_next;
+	struct fib_info		*fa_info;
+	u8			fa_tos;
+	u8			fa_type;
+	u8			fa_scope;
+	u8			fa_state;
+};
+
+#define FA_S_ACCESSED	1
+
+/* The routes to one prefix, sorted by tos and priority like fib_hash's. */
+struct leaf_info
+{
+	struct leaf_info	*li_next;
+	int			li_plen;
+	struct fib_alias	*li_alias;
+};
+
+struct leaf
+{
+	struct node		l_node;
+	struct leaf_info	*l_info;	/* longest prefix first */
+};
+
+struct tnode
+{
+	struct node		tn_node;
+	unsigned char		tn_pos;
+	unsigned char		tn_bits;
+	unsigned int		tn_full;	/* children tnode_full() */
+	unsigned int		tn_empty;	/* NULL children */
+	struct node		*tn_child[0];
+};
+
+struct trie
+{
+	struct node		*root;
+};
+
+#define IS_LEAF(n)	((n)->type == T_LEAF)
+
+/*
+ * Widen a node when (non-empty + full children) / (2 * slots) would
+ * exceed the inflate threshold, narrow it when non-empty / slots falls
+ * below the halve threshold. The root may be sparser: every lookup
+ * starts there.
+ */
+#define TRIE_INFLATE		50
+#define TRIE_HALVE		25
+#define TRIE_ROOT_INFLATE	30
+#define TRIE_ROOT_HALVE		15
+#define TRIE_MAX_BITS		16
+
+static kmem_cache_t *fn_alias_kmem;
+
+static rwlock_t fib_trie_lock = RW_LOCK_UNLOCKED;
+
+static __inline__ int tnode_prefix_match(struct tnode *tn, u32 key)
+{
+	int shift = tn->tn_pos + tn->tn_bits;
+
+	return shift >= 32 || ((key ^ tn->tn_node.key) >> shift) == 0;
+}
+
+static __inline__ unsigned int tnode_index(struct tnode *tn, u32 key)
+{
+	return (key >> tn->tn_pos) & ((1U << tn->tn_bits) - 1);
+}
+
+/* A child with no bits skipped between it and tn: inflate() splits it. */
+static __inline__ int tnode_full(struct tnode *tn, struct node *n)
+{
+	return n && !IS_LEAF(n) &&
+	       ((struct tnode *)n)->tn_pos + ((struct tnode *)n)->tn_bits == tn->tn_pos;
+}
+
+/* The number of the highest bit in which a and b differ; they must differ. */
+static __inline__ int trie_diff_bit(u32 a, u32 b)
+{
+	u32 x = a ^ b;
+	int bit = 0;
+
+	if (x >> 16) {
+		x >>= 16;
+		bit += 16;
+	}
+	if (x >> 8) {
+		x >>= 8;
+		bit += 8;
+	}
+	if (x >> 4) {
+		x >>= 4;
+		bit += 4;
+	}
+	if (x >> 2) {
+		x >>= 2;
+		bit += 2;
+	}
+	if (x >> 1)
+		bit++;
+	return bit;
+}
+
+static __inline__ u32 trie_mask(int plen)
+{
+	return plen ? ~0U << (32 - plen) : 0;
+}
+
+static struct tnode *tnode_alloc(u32 key, int pos, int bits)
+{
+	int size = sizeof(struct tnode) + (sizeof(struct node *) << bits);
+	struct tnode *tn;
+
+	if (size <= PAGE_SIZE)
+		tn = kmalloc(size, GFP_KERNEL);
+	else
+		tn = vmalloc(size);
+	if (tn == NULL)
+		return NULL;
+	memset(tn, 0, size);
+	tn->tn_node.key = key;
+	tn->tn_node.type = T_TNODE;
+	tn->tn_pos = pos;
+	tn->tn_bits = bits;
+	tn->tn_empty = 1 << bits;
+	return tn;
+}
+
+static void tnode_free(struct tnode *tn)
+{
+	if (sizeof(struct tnode) + (sizeof(struct node *) << tn->tn_bits) <= PAGE_SIZE)
+		kfree(tn);
+	else
+		vfree(tn);
+}
+
+/*
+ * Nodes that resize() replaced stay reachable for lookups until their
+ * replacement is linked in, and are freed only after that. The list is
+ * threaded through the parent pointers, which nobody needs any more.
+ */
+static struct tnode *tnode_dead;
+
+static void tnode_defer_free(struct tnode *tn)
+{
+	tn->tn_node.parent = tnode_dead;
+	tnode_dead = tn;
+}
+
+static void tnode_free_dead(void)
+{
+	struct tnode *tn;
+
+	while ((tn = tnode_dead) != NULL) {
+		tnode_dead = tn->tn_node.parent;
+		tnode_free(tn);
+	}
+}
+
+/* Callers hold fib_trie_lock for writing if tn is in the trie. */
+static void put_child(struct tnode *tn, unsigned int i, struct node *n)
+{
+	struct node *old = tn->tn_child[i];
+
+	if (old == NULL)
+		tn->tn_empty--;
+	else if (tnode_full(tn, old))
+		tn->tn_full--;
+	if (n == NULL)
+		tn->tn_empty++;
+	else {
+		if (tnode_full(tn, n))
+			tn->tn_full++;
+		n->parent = tn;
+	}
+	tn->tn_child[i] = n;
+}
+
+/* The child of a node that has only one, or NULL. */
+static struct node *tnode_only_child(struct tnode *tn)
+{
+	unsigned int i;
+
+	for (i = 0; i < (1U << tn->tn_bits); i++)
+		if (tn->tn_child[i])
+			return tn->tn_child[i];
+	return NULL;
+}
+
+static __inline__ unsigned int tnode_used(struct tnode *tn)
+{
+	return (1U << tn->tn_bits) - tn->tn_empty;
+}
+
+/* What should replace a new node, one that is not in the trie yet. */
+static struct node *tnode_collapse(struct tnode *tn)
+{
+	struct node *n;
+
+	if (tnode_used(tn) > 1)
+		return &tn->tn_node;
+	n = tnode_only_child(tn);
+	tnode_free(tn);
+	return n;
+}
+
+/*
+ * Double the children of tn by taking in the next bit below it. Full
+ * children index that bit themselves and are split in two.
+ */
+static struct tnode *inflate(struct tnode *tn)
+{
+	unsigned int olen = 1U << tn->tn_bits;
+	struct tnode *new, *c, *left, *right;
+	unsigned int i, j, size;
+
+	new = tnode_alloc(tn->tn_node.key, tn->tn_pos - 1, tn->tn_bits + 1);
+	if (new == NULL)
+		return NULL;
+
+	/* Allocate the halves first, parked in their future slots. */
+	for (i = 0; i < olen; i++) {
+		if (!tnode_full(tn, tn->tn_child[i]))
+			continue;
+		c = (struct tnode *)tn->tn_child[i];
+		if (c->tn_bits == 1)
+			continue;
+		left = tnode_alloc(c->tn_node.key, c->tn_pos, c->tn_bits - 1);
+		right = tnode_alloc(c->tn_node.key | (1U << new->tn_pos),
+				    c->tn_pos, c->tn_bits - 1);
+		new->tn_child[2*i] = (struct node *)left;
+		new->tn_child[2*i+1] = (struct node *)right;
+		if (left == NULL || right == NULL)
+			goto nomem;
+	}
+
+	for (i = 0; i < olen; i++) {
+		if (tn->tn_child[i] == NULL)
+			continue;
+		if (!tnode_full(tn, tn->tn_child[i])) {
+			put_child(new, 2*i + ((tn->tn_child[i]->key >> new->tn_pos) & 1),
+				  tn->tn_child[i]);
+			continue;
+		}
+		c = (struct tnode *)tn->tn_child[i];
+		if (c->tn_bits == 1) {
+			put_child(new, 2*i, c->tn_child[0]);
+			put_child(new, 2*i+1, c->tn_child[1]);
+			tnode_defer_free(c);
+			continue;
+		}
+		left = (struct tnode *)new->tn_child[2*i];
+		right = (struct tnode *)new->tn_child[2*i+1];
+		new->tn_child[2*i] = new->tn_child[2*i+1] = NULL;
+		size = 1U << left->tn_bits;
+		for (j = 0; j < size; j++) {
+			put_child(left, j, c->tn_child[j]);
+			put_child(right, j, c->tn_child[j + size]);
+		}
+		put_child(new, 2*i, tnode_collapse(left));
+		put_child(new, 2*i+1, tnode_collapse(right));
+		tnode_defer_free(c);
+	}
+	return new;
+
+nomem:
+	for (i = 0; i < 2*olen; i++)
+		if (new->tn_child[i])
+			tnode_free((struct tnode *)new->tn_child[i]);
+	tnode_free(new);
+	return NULL;
+}
+
+/* Halve the children of tn; pairs that are both used get a binary node. */
+static struct tnode *halve(struct tnode *tn)
+{
+	unsigned int olen = 1U << tn->tn_bits;
+	struct tnode *new, *b;
+	struct node *l, *r;
+	unsigned int i;
+
+	new = tnode_alloc(tn->tn_node.key, tn->tn_pos + 1, tn->tn_bits - 1);
+	if (new == NULL)
+		return NULL;
+
+	for (i = 0; i < olen; i += 2) {
+		if (tn->tn_child[i] == NULL || tn->tn_child[i+1] == NULL)
+			continue;
+		b = tnode_alloc(tn->tn_node.key | (i << tn->tn_pos), tn->tn_pos, 1);
+		new->tn_child[i/2] = (struct node *)b;
+		if (b == NULL)
+			goto nomem;
+	}
+
+	for (i = 0; i < olen; i += 2) {
+		l = tn->tn_child[i];
+		r = tn->tn_child[i+1];
+		if (l && r) {
+			b = (struct tnode *)new->tn_child[i/2];
+			new->tn_child[i/2] = NULL;
+			put_child(b, 0, l);
+			put_child(b, 1, r);
+			put_child(new, i/2, &b->tn_node);
+		} else
+			put_child(new, i/2, l ? l : r);
+	}
+	return new;
+
+nomem:
+	for (i = 0; i < olen/2; i++)
+		if (new->tn_child[i])
+			tnode_free((struct tnode *)new->tn_child[i]);
+	tnode_free(new);
+	return NULL;
+}
+
+static __inline__ int should_inflate(struct tnode *tn, int root)
+{
+	unsigned int size = 1U << tn->tn_bits;
+
+	if (tn->tn_pos == 0 || tn->tn_bits >= TRIE_MAX_BITS)
+		return 0;
+	return 50 * (tnode_used(tn) + tn->tn_full) >
+	       (root ? TRIE_ROOT_INFLATE : TRIE_INFLATE) * size;
+}
+
+static __inline__ int should_halve(struct tnode *tn, int root)
+{
+	unsigned int size = 1U << tn->tn_bits;
+
+	return tn->tn_bits > 1 &&
+	       100 * tnode_used(tn) < (root ? TRIE_ROOT_HALVE : TRIE_HALVE) * size;
+}
+
+/*
+ * What should be in the place of tn, which is in the trie: tn itself,
+ * a wider or narrower copy of it, its only child or nothing. A replaced
+ * tn goes on tnode_dead.
+ */
+static struct node *resize(struct tnode *tn)
+{
+	int root = tn->tn_node.parent == NULL;
+	struct tnode *new;
+	struct node *n;
+
+	if (tnode_used(tn) > 1) {
+		while (should_inflate(tn, root) && (new = inflate(tn)) != NULL) {
+			tnode_defer_free(tn);
+			tn = new;
+		}
+		while (should_halve(tn, root) && (new = halve(tn)) != NULL) {
+			tnode_defer_free(tn);
+			tn = new;
+		}
+		if (tnode_used(tn) > 1)
+			return &tn->tn_node;
+	}
+	n = tnode_only_child(tn);
+	tnode_defer_free(tn);
+	return n;
+}
+
+/*
+ * Resize the nodes from tn up to the root, for as long as a node is
+ * replaced and so changes the counts of its parent.
+ */
+static void trie_rebalance(struct trie *t, struct tnode *tn)
+{
+	struct tnode *tp;
+	struct node *n;
+
+	for (; tn; tn = tp) {
+		tp = tn->tn_node.parent;
+		n = resize(tn);
+		if (n == &tn->tn_node)
+			break;
+
+		write_lock_bh(&fib_trie_lock);
+		if (tp)
+			put_child(tp, tnode_index(tp, tn->tn_node.key), n);
+		else {
+			t->root = n;
+			if (n)
+				n->parent = NULL;
+		}
+		write_unlock_bh(&fib_trie_lock);
+		tnode_free_dead();
+	}
+}
+
+static struct leaf *trie_find_leaf(struct trie *t, u32 key)
+{
+	struct node *n = t->root;
+	struct tnode *tn;
+
+	while (n && !IS_LEAF(n)) {
+		tn = (struct tnode *)n;
+		if (!tnode_prefix_match(tn, key))
+			return NULL;
+		n = tn->tn_child[tnode_index(tn, key)];
+	}
+	if (n && n->key == key)
+		return (struct leaf *)n;
+	return NULL;
+}
+
+/* Add an empty leaf for key, which must not be in the trie yet. */
+static struct leaf *trie_insert_leaf(struct trie *t, u32 key)
+{
+	struct tnode *tp = NULL, *tn;
+	struct node *n = t->root;
+	struct leaf *l;
+	unsigned int i = 0;
+	int bit;
+
+	while (n && !IS_LEAF(n) && tnode_prefix_match((struct tnode *)n, key)) {
+		tp = (struct tnode *)n;
+		i = tnode_index(tp, key);
+		n = tp->tn_child[i];
+	}
+
+	l = kmalloc(sizeof(struct leaf), GFP_KERNEL);
+	if (l == NULL)
+		return NULL;
+	memset(l, 0, sizeof(struct leaf));
+	l->l_node.key = key;
+	l->l_node.type = T_LEAF;
+
+	if (n) {
+		/* n and the new leaf go below a node for the first bit they differ in. */
+		bit = trie_diff_bit(key, n->key);
+		tn = tnode_alloc(key & ~((2U << bit) - 1), bit, 1);
+		if (tn == NULL) {
+			kfree(l);
+			return NULL;
+		}
+		put_child(tn, (key >> bit) & 1, &l->l_node);
+		put_child(tn, (n->key >> bit) & 1, n);
+		n = &tn->tn_node;
+	} else
+		n = &l->l_node;
+
+	write_lock_bh(&fib_trie_lock);
+	if (tp)
+		put_child(tp, i, n);
+	else {
+		t->root = n;
+		n->parent = NULL;
+	}
+	write_unlock_bh(&fib_trie_lock);
+
+	trie_rebalance(t, tp);
+	return l;
+}
+
+static void trie_remove_leaf(struct trie *t, struct leaf *l)
+{
+	struct tnode *tp = l->l_node.parent;
+
+	write_lock_bh(&fib_trie_lock);
+	if (tp)
+		put_child(tp, tnode_index(tp, l->l_node.key), NULL);
+	else
+		t->root = NULL;
+	write_unlock_bh(&fib_trie_lock);
+	kfree(l);
+
+	trie_rebalance(t, tp);
+}
+
+/*
+ * The leaf with the smallest key not below key. Walks under the read
+ * lock use this rather than the parent pointers, which only writers may
+ * follow. It recurses once per level, at most 32 times.
+ */
+static struct leaf *trie_leaf_from(struct node *n, u32 key)
+{
+	struct tnode *tn;
+	struct leaf *l;
+	unsigned int i;
+	int shift;
+
+	if (n == NULL)
+		return NULL;
+	if (IS_LEAF(n))
+		return n->key >= key ? (struct leaf *)n : NULL;
+
+	tn = (struct tnode *)n;
+	shift = tn->tn_pos + tn->tn_bits;
+	if (shift < 32 && (n->key >> shift) != (key >> shift)) {
+		if ((n->key >> shift) < (key >> shift))
+			return NULL;
+		key = 0;
+	}
+	i = tnode_index(tn, key);
+	if ((l = trie_leaf_from(tn->tn_child[i], key)) != NULL)
+		return l;
+	while (++i < (1U << tn->tn_bits))
+		if (tn->tn_child[i])
+			return trie_leaf_from(tn->tn_child[i], 0);
+	return NULL;
+}
+
+static __inline__ struct leaf *trie_next_leaf(struct trie *t, struct leaf *l)
+{
+	if (l->l_node.key == ~0U)
+		return NULL;
+	return trie_leaf_from(t->root, l->l_node.key + 1);
+}
+
+static struct leaf_info *leaf_info_find(struct leaf *l, int plen)
+{
+	struct leaf_info *li;
+
+	for (li = l->l_info; li; li = li->li_next)
+		if (li->li_plen == plen)
+			return li;
+	return NULL;
+}
+
+static void fn_free_alias(struct fib_alias *fa)
+{
+	fib_release_info(fa->fa_info);
+	kmem_cache_free(fn_alias_kmem, fa);
+}
+
+static int check_leaf(struct leaf *l, u32 dst, const struct rt_key *key,
+		      struct fib_result *res)
+{
+	struct leaf_info *li;
+	struct fib_alias *fa;
+	int err;
+
+	for (li = l->l_info; li; li = li->li_next) {
+		if ((dst ^ l->l_node.key) & trie_mask(li->li_plen))
+			continue;
+		for (fa = li->li_alias; fa; fa = fa->fa_next) {
+#ifdef CONFIG_IP_ROUTE_TOS
+			if (fa->fa_tos && fa->fa_tos != key->tos)
+				continue;
+#endif
+			fa->fa_state |= FA_S_ACCESSED;
+
+			if (fa->fa_scope < key->scope)
+				continue;
+
+			err = fib_semantic_match(fa->fa_type, fa->fa_info, key, res);
+			if (err == 0) {
+				res->type = fa->fa_type;
+				res->scope = fa->fa_scope;
+				res->prefixlen = li->li_plen;
+				return 0;
+			}
+			if (err < 0)
+				return err;
+		}
+	}
+	return 1;
+}
+
+/*
+ * The prefixes that match dst are dst with its low bits cleared, and
+ * the trie keeps them in the order of those bits: k starts as dst and
+ * each time the leaf it leads to has no usable route, the lowest set bit
+ * of k in the index of the deepest node above is cleared along with all
+ * the bits below it. The routes are found longest prefix first, like
+ * fn_hash_lookup() finds them.
+ */
+static int
+fn_trie_lookup(struct fib_table *tb, const struct rt_key *key, struct fib_result *res)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct tnode *stack[32], *tn;
+	u32 dst = ntohl(key->dst);
+	u32 k = dst, bit;
+	unsigned int index;
+	struct node *n;
+	int depth = 0;
+	int err;
+
+	read_lock(&fib_trie_lock);
+	n = t->root;
+	for (;;) {
+		while (n && !IS_LEAF(n)) {
+			tn = (struct tnode *)n;
+			if (!tnode_prefix_match(tn, k)) {
+				/*
+				 * Everything below tn has a 0 where k has
+				 * a 1, or there is nothing for k here.
+				 */
+				bit = 1U << trie_diff_bit(k, n->key);
+				if (!(k & bit)) {
+					n = NULL;
+					break;
+				}
+				k &= ~((bit << 1) - 1);
+				if (!tnode_prefix_match(tn, k)) {
+					n = NULL;
+					break;
+				}
+			}
+			stack[depth++] = tn;
+			n = tn->tn_child[tnode_index(tn, k)];
+		}
+
+		if (n) {
+			err = check_leaf((struct leaf *)n, dst, key, res);
+			if (err <= 0)
+				goto out;
+		}
+
+		do {
+			if (depth == 0) {
+				err = 1;
+				goto out;
+			}
+			tn = stack[--depth];
+			index = tnode_index(tn, k);
+		} while (index == 0);
+		index &= -index;
+		k &= ~(((index << tn->tn_pos) << 1) - 1);
+		n = &tn->tn_node;
+	}
+out:
+	read_unlock(&fib_trie_lock);
+	return err;
+}
+
+static int fn_trie_last_dflt=-1;
+
+static int fib_detect_death(struct fib_info *fi, int order,
+			    struct fib_info **last_resort, int *last_idx)
+{
+	struct neighbour *n;
+	int state = NUD_NONE;
+
+	n = neigh_lookup(&arp_tbl, &fi->fib_nh[0].nh_gw, fi->fib_dev);
+	if (n) {
+		state = n->nud_state;
+		neigh_release(n);
+	}
+	if (state==NUD_REACHABLE)
+		return 0;
+	if ((state&NUD_VALID) && order != fn_trie_last_dflt)
+		return 0;
+	if ((state&NUD_VALID) ||
+	    (*last_idx<0 && order > fn_trie_last_dflt)) {
+		*last_resort = fi;
+		*last_idx = order;
+	}
+	return 1;
+}
+
+static void
+fn_trie_select_default(struct fib_table *tb, const struct rt_key *key, struct fib_result *res)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	int order, last_idx;
+	struct leaf *l;
+	struct leaf_info *li;
+	struct fib_alias *fa;
+	struct fib_info *fi = NULL;
+	struct fib_info *last_resort;
+
+	last_idx = -1;
+	last_resort = NULL;
+	order = -1;
+
+	read_lock(&fib_trie_lock);
+	l = trie_find_leaf(t, 0);
+	if (l == NULL || (li = leaf_info_find(l, 0)) == NULL)
+		goto out;
+
+	for (fa = li->li_alias; fa; fa = fa->fa_next) {
+		struct fib_info *next_fi = fa->fa_info;
+
+		if (fa->fa_scope != res->scope ||
+		    fa->fa_type != RTN_UNICAST)
+			continue;
+
+		if (next_fi->fib_priority > res->fi->fib_priority)
+			break;
+		if (!next_fi->fib_nh[0].nh_gw || next_fi->fib_nh[0].nh_scope != RT_SCOPE_LINK)
+			continue;
+		fa->fa_state |= FA_S_ACCESSED;
+
+		if (fi == NULL) {
+			if (next_fi != res->fi)
+				break;
+		} else if (!fib_detect_death(fi, order, &last_resort, &last_idx)) {
+			if (res->fi)
+				fib_info_put(res->fi);
+			res->fi = fi;
+			atomic_inc(&fi->fib_clntref);
+			fn_trie_last_dflt = order;
+			goto out;
+		}
+		fi = next_fi;
+		order++;
+	}
+
+	if (order<=0 || fi==NULL) {
+		fn_trie_last_dflt = -1;
+		goto out;
+	}
+
+	if (!fib_detect_death(fi, order, &last_resort, &last_idx)) {
+		if (res->fi)
+			fib_info_put(res->fi);
+		res->fi = fi;
+		atomic_inc(&fi->fib_clntref);
+		fn_trie_last_dflt = order;
+		goto out;
+	}
+
+	if (last_idx >= 0) {
+		if (res->fi)
+			fib_info_put(res->fi);
+		res->fi = last_resort;
+		if (last_resort)
+			atomic_inc(&last_resort->fib_clntref);
+	}
+	fn_trie_last_dflt = last_idx;
+out:
+	read_unlock(&fib_trie_lock);
+}
+
+#define FA_SCAN(fa, fap) \
+for ( ; ((fa) = *(fap)) != NULL; (fap) = &(fa)->fa_next)
+
+#ifndef CONFIG_IP_ROUTE_TOS
+#define FA_SCAN_TOS(fa, fap, tos) FA_SCAN(fa, fap)
+#else
+#define FA_SCAN_TOS(fa, fap, tos) \
+for ( ; ((fa) = *(fap)) != NULL && (fa)->fa_tos == (tos); (fap) = &(fa)->fa_next)
+#endif
+
+
+#ifdef CONFIG_RTNETLINK
+static void rtmsg_fib(int, u32, struct fib_alias *, int, int,
+		      struct nlmsghdr *n,
+		      struct netlink_skb_parms *);
+#else
+#define rtmsg_fib(a, b, c, d, e, f, g)
+#endif
+
+
+static int
+fn_trie_insert(struct fib_table *tb, struct rtmsg *r, struct kern_rta *rta,
+	       struct nlmsghdr *n, struct netlink_skb_parms *req)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct fib_alias *new_fa, *fa, **fap, **del_fap, *none = NULL;
+	struct leaf_info *li, *new_li, **lip;
+	struct leaf *l;
+	struct fib_info *fi;
+
+	int plen = r->rtm_dst_len;
+	int type = r->rtm_type;
+#ifdef CONFIG_IP_ROUTE_TOS
+	u8 tos = r->rtm_tos;
+#endif
+	u32 key = 0;
+	int err;
+
+	if (plen > 32)
+		return -EINVAL;
+	if (rta->rta_dst) {
+		u32 dst;
+		memcpy(&dst, rta->rta_dst, 4);
+		key = ntohl(dst);
+	}
+	if (key & ~trie_mask(plen))
+		return -EINVAL;
+
+	if  ((fi = fib_create_info(r, rta, n, &err)) == NULL)
+		return err;
+
+	l = trie_find_leaf(t, key);
+	li = l ? leaf_info_find(l, plen) : NULL;
+	fap = li ? &li->li_alias : &none;
+
+#ifdef CONFIG_IP_ROUTE_TOS
+	/*
+	 * Find the routes with the same tos.
+	 */
+	FA_SCAN(fa, fap) {
+		if (fa->fa_tos <= tos)
+			break;
+	}
+#endif
+
+	del_fap = NULL;
+
+	FA_SCAN_TOS(fa, fap, tos) {
+		if (fi->fib_priority <= fa->fa_info->fib_priority)
+			break;
+	}
+
+	/* As in fn_hash_insert(), fa==*fap is the first route with the
+	   same tos and priority, or the one to insert the new route before.
+	 */
+
+	if (fa &&
+#ifdef CONFIG_IP_ROUTE_TOS
+	    fa->fa_tos == tos &&
+#endif
+	    fi->fib_priority == fa->fa_info->fib_priority) {
+		struct fib_alias **ins_fap;
+
+		err = -EEXIST;
+		if (n->nlmsg_flags&NLM_F_EXCL)
+			goto out;
+
+		if (n->nlmsg_flags&NLM_F_REPLACE) {
+			del_fap = fap;
+			fap = &fa->fa_next;
+			fa = *fap;
+			goto replace;
+		}
+
+		ins_fap = fap;
+
+		FA_SCAN_TOS(fa, fap, tos) {
+			if (fi->fib_priority != fa->fa_info->fib_priority)
+				break;
+			if (fa->fa_type == type && fa->fa_scope == r->rtm_scope
+			    && fa->fa_info == fi)
+				goto out;
+		}
+
+		if (!(n->nlmsg_flags&NLM_F_APPEND)) {
+			fap = ins_fap;
+			fa = *fap;
+		}
+	}
+
+	err = -ENOENT;
+	if (!(n->nlmsg_flags&NLM_F_CREATE))
+		goto out;
+
+replace:
+	err = -ENOBUFS;
+	new_fa = kmem_cache_alloc(fn_alias_kmem, SLAB_KERNEL);
+	if (new_fa == NULL)
+		goto out;
+
+	memset(new_fa, 0, sizeof(struct fib_alias));
+	new_fa->fa_info = fi;
+#ifdef CONFIG_IP_ROUTE_TOS
+	new_fa->fa_tos = tos;
+#endif
+	new_fa->fa_type = type;
+	new_fa->fa_scope = r->rtm_scope;
+	new_fa->fa_next = fa;
+
+	if (li == NULL) {
+		/* The first route to this prefix, maybe to this address. */
+		new_li = kmalloc(sizeof(struct leaf_info), GFP_KERNEL);
+		if (new_li == NULL)
+			goto out_free;
+		if (l == NULL && (l = trie_insert_leaf(t, key)) == NULL) {
+			kfree(new_li);
+			goto out_free;
+		}
+		new_li->li_plen = plen;
+		new_li->li_alias = new_fa;
+		for (lip = &l->l_info; *lip && (*lip)->li_plen > plen;
+		     lip = &(*lip)->li_next)
+			/* NONE */;
+		new_li->li_next = *lip;
+		write_lock_bh(&fib_trie_lock);
+		*lip = new_li;
+		write_unlock_bh(&fib_trie_lock);
+	} else {
+		write_lock_bh(&fib_trie_lock);
+		*fap = new_fa;
+		write_unlock_bh(&fib_trie_lock);
+	}
+
+	if (del_fap) {
+		fa = *del_fap;
+		/* Unlink replaced route */
+		write_lock_bh(&fib_trie_lock);
+		*del_fap = fa->fa_next;
+		write_unlock_bh(&fib_trie_lock);
+
+		rtmsg_fib(RTM_DELROUTE, key, fa, plen, tb->tb_id, n, req);
+		if (fa->fa_state&FA_S_ACCESSED)
+			rt_cache_flush(-1);
+		fn_free_alias(fa);
+	} else {
+		rt_cache_flush(-1);
+	}
+	rtmsg_fib(RTM_NEWROUTE, key, new_fa, plen, tb->tb_id, n, req);
+	return 0;
+
+out_free:
+	kmem_cache_free(fn_alias_kmem, new_fa);
+out:
+	fib_release_info(fi);
+	return err;
+}
+
+
+static int
+fn_trie_delete(struct fib_table *tb, struct rtmsg *r, struct kern_rta *rta,
+	       struct nlmsghdr *n, struct netlink_skb_parms *req)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct fib_alias *fa, **fap, **del_fap;
+	struct leaf_info *li, **lip;
+	struct leaf *l;
+	int plen = r->rtm_dst_len;
+#ifdef CONFIG_IP_ROUTE_TOS
+	u8 tos = r->rtm_tos;
+#endif
+	u32 key = 0;
+
+	if (plen > 32)
+		return -EINVAL;
+	if (rta->rta_dst) {
+		u32 dst;
+		memcpy(&dst, rta->rta_dst, 4);
+		key = ntohl(dst);
+	}
+	if (key & ~trie_mask(plen))
+		return -EINVAL;
+
+	if ((l = trie_find_leaf(t, key)) == NULL)
+		return -ESRCH;
+	for (lip = &l->l_info; (li = *lip) != NULL; lip = &li->li_next)
+		if (li->li_plen == plen)
+			break;
+	if (li == NULL)
+		return -ESRCH;
+
+	fap = &li->li_alias;
+#ifdef CONFIG_IP_ROUTE_TOS
+	FA_SCAN(fa, fap) {
+		if (fa->fa_tos == tos)
+			break;
+	}
+#endif
+
+	del_fap = NULL;
+	FA_SCAN_TOS(fa, fap, tos) {
+		struct fib_info * fi = fa->fa_info;
+
+		if ((!r->rtm_type || fa->fa_type == r->rtm_type) &&
+		    (r->rtm_scope == RT_SCOPE_NOWHERE || fa->fa_scope == r->rtm_scope) &&
+		    (!r->rtm_protocol || fi->fib_protocol == r->rtm_protocol) &&
+		    fib_nh_match(r, n, rta, fi) == 0) {
+			del_fap = fap;
+			break;
+		}
+	}
+	if (del_fap == NULL)
+		return -ESRCH;
+
+	fa = *del_fap;
+	rtmsg_fib(RTM_DELROUTE, key, fa, plen, tb->tb_id, n, req);
+
+	write_lock_bh(&fib_trie_lock);
+	*del_fap = fa->fa_next;
+	if (li->li_alias == NULL)
+		*lip = li->li_next;
+	write_unlock_bh(&fib_trie_lock);
+
+	if (li->li_alias == NULL) {
+		kfree(li);
+		if (l->l_info == NULL)
+			trie_remove_leaf(t, l);
+	}
+	if (fa->fa_state&FA_S_ACCESSED)
+		rt_cache_flush(-1);
+	fn_free_alias(fa);
+	return 0;
+}
+
+static int fn_trie_flush(struct fib_table *tb)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct fib_alias *fa, **fap;
+	struct leaf_info *li, **lip;
+	struct leaf *l, *next;
+	int found = 0;
+
+	for (l = trie_leaf_from(t->root, 0); l; l = next) {
+		lip = &l->l_info;
+		while ((li = *lip) != NULL) {
+			fap = &li->li_alias;
+			while ((fa = *fap) != NULL) {
+				if (fa->fa_info->fib_flags&RTNH_F_DEAD) {
+					write_lock_bh(&fib_trie_lock);
+					*fap = fa->fa_next;
+					write_unlock_bh(&fib_trie_lock);
+
+					fn_free_alias(fa);
+					found++;
+					continue;
+				}
+				fap = &fa->fa_next;
+			}
+			if (li->li_alias == NULL) {
+				write_lock_bh(&fib_trie_lock);
+				*lip = li->li_next;
+				write_unlock_bh(&fib_trie_lock);
+				kfree(li);
+				continue;
+			}
+			lip = &li->li_next;
+		}
+		next = trie_next_leaf(t, l);
+		if (l->l_info == NULL)
+			trie_remove_leaf(t, l);
+	}
+	return found;
+}
+
+
+#ifdef CONFIG_PROC_FS
+
+static int fn_trie_get_info(struct fib_table *tb, char *buffer, int first, int count)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct leaf *l;
+	struct leaf_info *li;
+	struct fib_alias *fa;
+	int pos = 0;
+	int n = 0;
+
+	read_lock(&fib_trie_lock);
+	for (l = trie_leaf_from(t->root, 0); l; l = trie_next_leaf(t, l)) {
+		for (li = l->l_info; li; li = li->li_next) {
+			for (fa = li->li_alias; fa; fa = fa->fa_next) {
+				if (++pos <= first)
+					continue;
+				fib_node_get_info(fa->fa_type, 0, fa->fa_info,
+						  htonl(l->l_node.key),
+						  inet_make_mask(li->li_plen),
+						  buffer);
+				buffer += 128;
+				if (++n >= count)
+					goto out;
+			}
+		}
+	}
+out:
+	read_unlock(&fib_trie_lock);
+	return n;
+}
+#endif
+
+
+#ifdef CONFIG_RTNETLINK
+
+static int
+fn_trie_dump_leaf(struct sk_buff *skb, struct netlink_callback *cb,
+		  struct fib_table *tb, struct leaf *l)
+{
+	struct leaf_info *li;
+	struct fib_alias *fa;
+	u32 prefix = htonl(l->l_node.key);
+	int i, s_i;
+
+	s_i = cb->args[2];
+	i = 0;
+	for (li = l->l_info; li; li = li->li_next) {
+		for (fa = li->li_alias; fa; fa = fa->fa_next, i++) {
+			if (i < s_i)
+				continue;
+			if (fib_dump_info(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+					  RTM_NEWROUTE, tb->tb_id, fa->fa_type,
+					  fa->fa_scope, &prefix, li->li_plen,
+					  fa->fa_tos, fa->fa_info) < 0) {
+				cb->args[2] = i;
+				return -1;
+			}
+		}
+	}
+	return skb->len;
+}
+
+/* cb->args[1] is the key of the leaf to go on with, args[2] its route. */
+static int fn_trie_dump(struct fib_table *tb, struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	u32 s_key = cb->args[1];
+	struct leaf *l;
+
+	read_lock(&fib_trie_lock);
+	for (l = trie_leaf_from(t->root, s_key); l; l = trie_next_leaf(t, l)) {
+		if (l->l_node.key != s_key)
+			cb->args[2] = 0;
+		if (fn_trie_dump_leaf(skb, cb, tb, l) < 0) {
+			cb->args[1] = l->l_node.key;
+			read_unlock(&fib_trie_lock);
+			return -1;
+		}
+	}
+	read_unlock(&fib_trie_lock);
+	return skb->len;
+}
+
+static void rtmsg_fib(int event, u32 key, struct fib_alias *fa, int plen,
+		      int tb_id, struct nlmsghdr *n, struct netlink_skb_parms *req)
+{
+	struct sk_buff *skb;
+	u32 pid = req ? req->pid : 0;
+	u32 prefix = htonl(key);
+	int size = NLMSG_SPACE(sizeof(struct rtmsg)+256);
+
+	skb = alloc_skb(size, GFP_KERNEL);
+	if (!skb)
+		return;
+
+	if (fib_dump_info(skb, pid, n->nlmsg_seq, event, tb_id,
+			  fa->fa_type, fa->fa_scope, &prefix, plen, fa->fa_tos,
+			  fa->fa_info) < 0) {
+		kfree_skb(skb);
+		return;
+	}
+	NETLINK_CB(skb).dst_groups = RTMGRP_IPV4_ROUTE;
+	if (n->nlmsg_flags&NLM_F_ECHO)
+		atomic_inc(&skb->users);
+	netlink_broadcast(rtnl, skb, pid, RTMGRP_IPV4_ROUTE, GFP_KERNEL);
+	if (n->nlmsg_flags&NLM_F_ECHO)
+		netlink_unicast(rtnl, skb, pid, MSG_DONTWAIT);
+}
+
+#endif /* CONFIG_RTNETLINK */
+
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+struct fib_table * fib_trie_init(int id)
+#else
+struct fib_table * __init fib_trie_init(int id)
+#endif
+{
+	struct fib_table *tb;
+
+	if (fn_alias_kmem == NULL)
+		fn_alias_kmem = kmem_cache_create("ip_fib_alias",
+						  sizeof(struct fib_alias),
+						  0, SLAB_HWCACHE_ALIGN,
+						  NULL, NULL);
+
+	tb = kmalloc(sizeof(struct fib_table) + sizeof(struct trie), GFP_KERNEL);
+	if (tb == NULL)
+		return NULL;
+
+	tb->tb_id = id;
+	tb->tb_lookup = fn_trie_lookup;
+	tb->tb_insert = fn_trie_insert;
+	tb->tb_delete = fn_trie_delete;
+	tb->tb_flush = fn_trie_flush;
+	tb->tb_select_default = fn_trie_select_default;
+#ifdef CONFIG_RTNETLINK
+	tb->tb_dump = fn_trie_dump;
+#endif
+#ifdef CONFIG_PROC_FS
+	tb->tb_get_info = fn_trie_get_info;
+#endif
+	memset(tb->tb_data, 0, sizeof(struct trie));
+	return tb;
+}
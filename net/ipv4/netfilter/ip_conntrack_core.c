@@ -23,11 +23,13 @@
 #include <linux/stddef.h>
 #include <linux/sysctl.h>
 #include <linux/slab.h>
+#include <linux/rcupdate.h>
+#include <asm/semaphore.h>
 /* For ERR_PTR().  Yeah, I know... --RR */
 #include <linux/fs.h>
 
-/* This rwlock protects the main hash table, protocol/helper/expected
-   registrations, conntrack timers*/
+/* This rwlock protects protocol/helper/expected registrations.  The
+   hash table has a lock per chain, see ip_conntrack_core.h. */
 #define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(&ip_conntrack_lock)
 #define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(&ip_conntrack_lock)
 
@@ -52,9 +54,17 @@ static LIST_HEAD(helpers);
 unsigned int ip_conntrack_htable_size = 0;
 static int ip_conntrack_max = 0;
 static atomic_t ip_conntrack_count = ATOMIC_INIT(0);
-struct list_head *ip_conntrack_hash;
+struct ip_conntrack_htable *ip_conntrack_htable;
 static kmem_cache_t *ip_conntrack_cachep;
 
+/* Odd while ip_conntrack_resize() is replacing the table: lookups take
+   the chain lock then. */
+static volatile unsigned int ip_conntrack_resize_seq = 0;
+static DECLARE_MUTEX(ip_conntrack_resize_sem);
+
+struct ip_conntrack_stat ip_conntrack_stat[NR_CPUS];
+#define IP_CT_STAT_INC(count) (ip_conntrack_stat[smp_processor_id()].count++)
+
 extern struct ip_conntrack_protocol ip_conntrack_generic_protocol;
 
 static inline int proto_cmpfn(const struct ip_conntrack_protocol *curr,
@@ -76,14 +86,18 @@ struct ip_conntrack_protocol *__find_proto(u_int8_t protocol)
 	return p;
 }
 
+/* Protocols are never unregistered, and are added with list_add_rcu(),
+   so this can walk the list without the lock. */
 struct ip_conntrack_protocol *find_proto(u_int8_t protocol)
 {
-	struct ip_conntrack_protocol *p;
+	struct list_head *i;
 
-	READ_LOCK(&ip_conntrack_lock);
-	p = __find_proto(protocol);
-	READ_UNLOCK(&ip_conntrack_lock);
-	return p;
+	for (i = protocol_list.next; i != &protocol_list; i = i->next) {
+		rcu_read_barrier();
+		if (((struct ip_conntrack_protocol *)i)->proto == protocol)
+			return (struct ip_conntrack_protocol *)i;
+	}
+	return &ip_conntrack_generic_protocol;
 }
 
 static inline void ip_conntrack_put(struct ip_conntrack *ct)
@@ -96,7 +110,8 @@ static inline void ip_conntrack_put(struct ip_conntrack *ct)
 }
 
 static inline u_int32_t
-hash_conntrack(const struct ip_conntrack_tuple *tuple)
+hash_conntrack(const struct ip_conntrack_htable *t,
+	       const struct ip_conntrack_tuple *tuple)
 {
 #if 0
 	dump_tuple(tuple);
@@ -108,7 +123,63 @@ hash_conntrack(const struct ip_conntrack_tuple *tuple)
 		     + tuple->src.u.all + tuple->dst.u.all
 		     + tuple->dst.protonum)
 		+ ntohs(tuple->src.u.all))
-		% ip_conntrack_htable_size;
+		% t->size;
+}
+
+/* Lock the chain of a tuple in the current table.  A resize may
+   replace the table before we get the lock: then try the new one. */
+static struct ip_conntrack_bucket *
+lock_chain(const struct ip_conntrack_tuple *tuple)
+{
+	struct ip_conntrack_htable *t;
+	struct ip_conntrack_bucket *b;
+
+	for (;;) {
+		t = ip_conntrack_htable;
+		b = &t->buckets[hash_conntrack(t, tuple)];
+		spin_lock_bh(&b->lock);
+		if (t == ip_conntrack_htable)
+			return b;
+		spin_unlock_bh(&b->lock);
+	}
+}
+
+/* Lock the chains of both directions, lower one first. */
+static struct ip_conntrack_htable *
+lock_chains(struct ip_conntrack *ct, unsigned int *hash,
+	    unsigned int *repl_hash)
+{
+	struct ip_conntrack_htable *t;
+
+	for (;;) {
+		t = ip_conntrack_htable;
+		*hash = hash_conntrack(t,
+				&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		*repl_hash = hash_conntrack(t,
+				&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+		if (*hash <= *repl_hash) {
+			spin_lock_bh(&t->buckets[*hash].lock);
+			if (*repl_hash != *hash)
+				spin_lock(&t->buckets[*repl_hash].lock);
+		} else {
+			spin_lock_bh(&t->buckets[*repl_hash].lock);
+			spin_lock(&t->buckets[*hash].lock);
+		}
+		if (t == ip_conntrack_htable)
+			return t;
+		if (*repl_hash != *hash)
+			spin_unlock(&t->buckets[*repl_hash].lock);
+		spin_unlock_bh(&t->buckets[*hash].lock);
+	}
+}
+
+static inline void
+unlock_chains(struct ip_conntrack_htable *t, unsigned int hash,
+	      unsigned int repl_hash)
+{
+	if (repl_hash != hash)
+		spin_unlock(&t->buckets[repl_hash].lock);
+	spin_unlock_bh(&t->buckets[hash].lock);
 }
 
 inline int
@@ -153,21 +224,29 @@ invert_tuple(struct ip_conntrack_tuple *inverse,
 static void
 clean_from_lists(struct ip_conntrack *ct)
 {
-	MUST_BE_WRITE_LOCKED(&ip_conntrack_lock);
+	struct ip_conntrack_htable *t;
+	unsigned int hash, repl_hash;
+
+	t = lock_chains(ct, &hash, &repl_hash);
 	/* Remove from both hash lists: must not NULL out next ptrs,
-           otherwise we'll look unconfirmed.  Fortunately, LIST_DELETE
-           doesn't do this. --RR */
-	LIST_DELETE(&ip_conntrack_hash
-		    [hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple)],
-		    &ct->tuplehash[IP_CT_DIR_ORIGINAL]);
-	LIST_DELETE(&ip_conntrack_hash
-		    [hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple)],
-		    &ct->tuplehash[IP_CT_DIR_REPLY]);
-	/* If our expected is in the list, take it out. */
-	if (ct->expected.expectant) {
-		IP_NF_ASSERT(list_inlist(&expect_list, &ct->expected));
-		IP_NF_ASSERT(ct->expected.expectant == ct);
-		LIST_DELETE(&expect_list, &ct->expected);
+           otherwise we'll look unconfirmed.  Lockless lookups may
+           also still be following them. */
+	set_bit(IPS_DYING_BIT, &ct->status);
+	list_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list);
+	list_del(&ct->tuplehash[IP_CT_DIR_REPLY].list);
+	unlock_chains(t, hash, repl_hash);
+
+	/* If our expected is in the list, take it out.  Only a conntrack
+	   with a helper gets one. */
+	if (ct->helper || ct->expected.expectant) {
+		WRITE_LOCK(&ip_conntrack_lock);
+		if (ct->expected.expectant) {
+			IP_NF_ASSERT(list_inlist(&expect_list,
+						 &ct->expected));
+			IP_NF_ASSERT(ct->expected.expectant == ct);
+			LIST_DELETE(&expect_list, &ct->expected);
+		}
+		WRITE_UNLOCK(&ip_conntrack_lock);
 	}
 }
 
@@ -188,14 +267,20 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	atomic_dec(&ip_conntrack_count);
 }
 
+static void put_after_lookups(void *ul_conntrack)
+{
+	ip_conntrack_put(ul_conntrack);
+}
+
 static void death_by_timeout(unsigned long ul_conntrack)
 {
 	struct ip_conntrack *ct = (void *)ul_conntrack;
 
-	WRITE_LOCK(&ip_conntrack_lock);
 	clean_from_lists(ct);
-	WRITE_UNLOCK(&ip_conntrack_lock);
-	ip_conntrack_put(ct);
+	/* A lockless lookup which found us before we were unlinked
+	   takes a reference: it must not be the one to bring the
+	   count up from zero. */
+	call_rcu(&ct->rcu, put_after_lookups, ct);
 }
 
 static inline int
@@ -203,22 +288,84 @@ conntrack_tuple_cmp(const struct ip_conntrack_tuple_hash *i,
 		    const struct ip_conntrack_tuple *tuple,
 		    const struct ip_conntrack *ignored_conntrack)
 {
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
 	return i->ctrack != ignored_conntrack
 		&& ip_ct_tuple_equal(tuple, &i->tuple);
 }
 
+/* Called with the chain lock held. */
+static struct ip_conntrack_tuple_hash *
+chain_find(struct list_head *chain,
+	   const struct ip_conntrack_tuple *tuple,
+	   const struct ip_conntrack *ignored_conntrack)
+{
+	struct list_head *pos;
+	struct ip_conntrack_tuple_hash *h;
+
+	list_for_each(pos, chain) {
+		h = list_entry(pos, struct ip_conntrack_tuple_hash, list);
+		IP_CT_STAT_INC(searched);
+		if (conntrack_tuple_cmp(h, tuple, ignored_conntrack))
+			return h;
+	}
+	return NULL;
+}
+
+/* The chain is walked without a lock.  Entries are only unlinked
+   under the chain lock, and the hash table's reference is dropped a
+   grace period later (see death_by_timeout), so a reference can be
+   taken on anything found here; it is given back again if the
+   conntrack turns out to be dying.  While a resize moves entries
+   between chains the lookup is done under the chain lock instead. */
 static struct ip_conntrack_tuple_hash *
 __ip_conntrack_find(const struct ip_conntrack_tuple *tuple,
-		    const struct ip_conntrack *ignored_conntrack)
+		    const struct ip_conntrack *ignored_conntrack,
+		    int get)
 {
+	struct ip_conntrack_htable *t;
+	struct ip_conntrack_bucket *b;
 	struct ip_conntrack_tuple_hash *h;
+	struct list_head *chain, *pos;
+	unsigned int seq;
+
+	seq = ip_conntrack_resize_seq;
+	smp_rmb();
+	if (seq & 1)
+		goto locked;
+
+	rcu_read_lock();
+	t = ip_conntrack_htable;
+	rcu_read_barrier();
+	chain = &t->buckets[hash_conntrack(t, tuple)].chain;
+	for (pos = chain->next; pos != chain; pos = pos->next) {
+		rcu_read_barrier();
+		h = list_entry(pos, struct ip_conntrack_tuple_hash, list);
+		IP_CT_STAT_INC(searched);
+		if (!conntrack_tuple_cmp(h, tuple, ignored_conntrack)
+		    || test_bit(IPS_DYING_BIT, &h->ctrack->status))
+			continue;
+		if (get) {
+			atomic_inc(&h->ctrack->ct_general.use);
+			if (test_bit(IPS_DYING_BIT, &h->ctrack->status)) {
+				ip_conntrack_put(h->ctrack);
+				continue;
+			}
+		}
+		rcu_read_unlock();
+		IP_CT_STAT_INC(found);
+		return h;
+	}
+	rcu_read_unlock();
+	return NULL;
 
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
-	h = LIST_FIND(&ip_conntrack_hash[hash_conntrack(tuple)],
-		      conntrack_tuple_cmp,
-		      struct ip_conntrack_tuple_hash *,
-		      tuple, ignored_conntrack);
+ locked:
+	b = lock_chain(tuple);
+	h = chain_find(&b->chain, tuple, ignored_conntrack);
+	if (h) {
+		if (get)
+			atomic_inc(&h->ctrack->ct_general.use);
+		IP_CT_STAT_INC(found);
+	}
+	spin_unlock_bh(&b->lock);
 	return h;
 }
 
@@ -227,15 +374,7 @@ struct ip_conntrack_tuple_hash *
 ip_conntrack_find_get(const struct ip_conntrack_tuple *tuple,
 		      const struct ip_conntrack *ignored_conntrack)
 {
-	struct ip_conntrack_tuple_hash *h;
-
-	READ_LOCK(&ip_conntrack_lock);
-	h = __ip_conntrack_find(tuple, ignored_conntrack);
-	if (h)
-		atomic_inc(&h->ctrack->ct_general.use);
-	READ_UNLOCK(&ip_conntrack_lock);
-
-	return h;
+	return __ip_conntrack_find(tuple, ignored_conntrack, 1);
 }
 
 static inline struct ip_conntrack *
@@ -264,6 +403,7 @@ int
 __ip_conntrack_confirm(struct nf_ct_info *nfct)
 {
 	unsigned int hash, repl_hash;
+	struct ip_conntrack_htable *t;
 	struct ip_conntrack *ct;
 	enum ip_conntrack_info ctinfo;
 
@@ -276,9 +416,6 @@ __ip_conntrack_confirm(struct nf_ct_info *nfct)
 	if (CTINFO2DIR(ctinfo) != IP_CT_DIR_ORIGINAL)
 		return NF_ACCEPT;
 
-	hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
 	   REJECT will give spurious warnings here. */
@@ -289,33 +426,33 @@ __ip_conntrack_confirm(struct nf_ct_info *nfct)
 	IP_NF_ASSERT(!is_confirmed(ct));
 	DEBUGP("Confirming conntrack %p\n", ct);
 
-	WRITE_LOCK(&ip_conntrack_lock);
+	t = lock_chains(ct, &hash, &repl_hash);
 	/* See if there's one in the list already, including reverse:
            NAT could have grabbed it without realizing, since we're
            not in the hash.  If there is, we lost race. */
-	if (!LIST_FIND(&ip_conntrack_hash[hash],
-		       conntrack_tuple_cmp,
-		       struct ip_conntrack_tuple_hash *,
-		       &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, NULL)
-	    && !LIST_FIND(&ip_conntrack_hash[repl_hash],
-			  conntrack_tuple_cmp,
-			  struct ip_conntrack_tuple_hash *,
-			  &ct->tuplehash[IP_CT_DIR_REPLY].tuple, NULL)) {
-		list_prepend(&ip_conntrack_hash[hash],
-			     &ct->tuplehash[IP_CT_DIR_ORIGINAL]);
-		list_prepend(&ip_conntrack_hash[repl_hash],
-			     &ct->tuplehash[IP_CT_DIR_REPLY]);
+	if (!chain_find(&t->buckets[hash].chain,
+			&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, NULL)
+	    && !chain_find(&t->buckets[repl_hash].chain,
+			   &ct->tuplehash[IP_CT_DIR_REPLY].tuple, NULL)) {
+		/* The hash table's reference. */
+		atomic_inc(&ct->ct_general.use);
+		list_add_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list,
+			     &t->buckets[hash].chain);
+		list_add_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].list,
+			     &t->buckets[repl_hash].chain);
 		/* Timer relative to confirmation time, not original
 		   setting time, otherwise we'd get timer wrap in
-		   wierd delay cases. */
+		   wierd delay cases.  Started under the chain locks, so
+		   that it can't unlink us before we are linked. */
 		ct->timeout.expires += jiffies;
 		add_timer(&ct->timeout);
-		atomic_inc(&ct->ct_general.use);
-		WRITE_UNLOCK(&ip_conntrack_lock);
+		unlock_chains(t, hash, repl_hash);
+		IP_CT_STAT_INC(inserted);
 		return NF_ACCEPT;
 	}
 
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	unlock_chains(t, hash, repl_hash);
+	IP_CT_STAT_INC(dropped);
 	return NF_DROP;
 }
 
@@ -325,13 +462,7 @@ int
 ip_conntrack_tuple_taken(const struct ip_conntrack_tuple *tuple,
 			 const struct ip_conntrack *ignored_conntrack)
 {
-	struct ip_conntrack_tuple_hash *h;
-
-	READ_LOCK(&ip_conntrack_lock);
-	h = __ip_conntrack_find(tuple, ignored_conntrack);
-	READ_UNLOCK(&ip_conntrack_lock);
-
-	return h != NULL;
+	return __ip_conntrack_find(tuple, ignored_conntrack, 0) != NULL;
 }
 
 /* Returns conntrack if it dealt with ICMP, and filled in skb fields */
@@ -432,17 +563,33 @@ static inline int unreplied(const struct ip_conntrack_tuple_hash *i)
 	return !(i->ctrack->status & IPS_ASSURED);
 }
 
-static int early_drop(struct list_head *chain)
+/* Chain number n of the current table, whatever its size. */
+static int early_drop(unsigned int n)
 {
 	/* Traverse backwards: gives us oldest, which is roughly LRU */
-	struct ip_conntrack_tuple_hash *h;
+	struct ip_conntrack_htable *t;
+	struct ip_conntrack_bucket *b;
+	struct ip_conntrack_tuple_hash *h = NULL;
+	struct list_head *pos;
 	int dropped = 0;
 
-	READ_LOCK(&ip_conntrack_lock);
-	h = LIST_FIND(chain, unreplied, struct ip_conntrack_tuple_hash *);
+	for (;;) {
+		t = ip_conntrack_htable;
+		b = &t->buckets[n % t->size];
+		spin_lock_bh(&b->lock);
+		if (t == ip_conntrack_htable)
+			break;
+		spin_unlock_bh(&b->lock);
+	}
+	list_for_each(pos, &b->chain) {
+		h = list_entry(pos, struct ip_conntrack_tuple_hash, list);
+		if (unreplied(h))
+			break;
+		h = NULL;
+	}
 	if (h)
 		atomic_inc(&h->ctrack->ct_general.use);
-	READ_UNLOCK(&ip_conntrack_lock);
+	spin_unlock_bh(&b->lock);
 
 	if (!h)
 		return dropped;
@@ -450,6 +597,7 @@ static int early_drop(struct list_head *chain)
 	if (del_timer(&h->ctrack->timeout)) {
 		death_by_timeout((unsigned long)h->ctrack);
 		dropped = 1;
+		IP_CT_STAT_INC(early_drop);
 	}
 	ip_conntrack_put(h->ctrack);
 	return dropped;
@@ -477,13 +625,10 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 {
 	struct ip_conntrack *conntrack;
 	struct ip_conntrack_tuple repl_tuple;
-	size_t hash, repl_hash;
 	struct ip_conntrack_expect *expected;
 	int i;
 	static unsigned int drop_next = 0;
 
-	hash = hash_conntrack(tuple);
-
 	if (ip_conntrack_max &&
 	    atomic_read(&ip_conntrack_count) >= ip_conntrack_max) {
 		/* Try dropping from random chain, or else from the
@@ -491,12 +636,14 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
                    bomb one hash chain). */
 		if (drop_next >= ip_conntrack_htable_size)
 			drop_next = 0;
-		if (!early_drop(&ip_conntrack_hash[drop_next++])
-		    && !early_drop(&ip_conntrack_hash[hash])) {
+		if (!early_drop(drop_next++)
+		    && !early_drop(hash_conntrack(ip_conntrack_htable,
+						  tuple))) {
 			if (net_ratelimit())
 				printk(KERN_WARNING
 				       "ip_conntrack: table full, dropping"
 				       " packet.\n");
+			IP_CT_STAT_INC(dropped);
 			return ERR_PTR(-ENOMEM);
 		}
 	}
@@ -505,11 +652,11 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 		DEBUGP("Can't invert tuple.\n");
 		return NULL;
 	}
-	repl_hash = hash_conntrack(&repl_tuple);
 
 	conntrack = kmem_cache_alloc(ip_conntrack_cachep, GFP_ATOMIC);
 	if (!conntrack) {
 		DEBUGP("Can't allocate conntrack.\n");
+		IP_CT_STAT_INC(dropped);
 		return ERR_PTR(-ENOMEM);
 	}
 
@@ -770,17 +917,15 @@ void ip_conntrack_unexpect_related(struct ip_conntrack *related_to)
 int ip_conntrack_alter_reply(struct ip_conntrack *conntrack,
 			     const struct ip_conntrack_tuple *newreply)
 {
-	WRITE_LOCK(&ip_conntrack_lock);
-	if (__ip_conntrack_find(newreply, conntrack)) {
-		WRITE_UNLOCK(&ip_conntrack_lock);
+	if (__ip_conntrack_find(newreply, conntrack, 0))
 		return 0;
-	}
 	/* Should be unconfirmed, so not in hash table yet */
 	IP_NF_ASSERT(!is_confirmed(conntrack));
 
 	DEBUGP("Altering reply tuple of %p to ", conntrack);
 	DUMP_TUPLE(newreply);
 
+	WRITE_LOCK(&ip_conntrack_lock);
 	conntrack->tuplehash[IP_CT_DIR_REPLY].tuple = *newreply;
 	conntrack->helper = LIST_FIND(&helpers, helper_cmp,
 				      struct ip_conntrack_helper *,
@@ -800,36 +945,36 @@ int ip_conntrack_helper_register(struct ip_conntrack_helper *me)
 	return 0;
 }
 
-static inline int unhelp(struct ip_conntrack_tuple_hash *i,
-			 const struct ip_conntrack_helper *me)
+static int unhelp(struct ip_conntrack_tuple_hash *i, void *me)
 {
 	if (i->ctrack->helper == me) {
-		i->ctrack->helper = NULL;
-		/* Get rid of any expected. */
+		WRITE_LOCK(&ip_conntrack_lock);
+		/* Get rid of any expected, before clean_from_lists()
+		   can see no helper and skip it. */
 		if (i->ctrack->expected.expectant) {
 			IP_NF_ASSERT(i->ctrack->expected.expectant
 				     == i->ctrack);
 			LIST_DELETE(&expect_list, &i->ctrack->expected);
 			i->ctrack->expected.expectant = NULL;
 		}
+		smp_wmb();
+		i->ctrack->helper = NULL;
+		WRITE_UNLOCK(&ip_conntrack_lock);
 	}
 	return 0;
 }
 
 void ip_conntrack_helper_unregister(struct ip_conntrack_helper *me)
 {
-	unsigned int i;
-
 	/* Need write lock here, to delete helper. */
 	WRITE_LOCK(&ip_conntrack_lock);
 	LIST_DELETE(&helpers, me);
-
-	/* Get rid of expecteds, set helpers to NULL. */
-	for (i = 0; i < ip_conntrack_htable_size; i++)
-		LIST_FIND_W(&ip_conntrack_hash[i], unhelp,
-			    struct ip_conntrack_tuple_hash *, me);
 	WRITE_UNLOCK(&ip_conntrack_lock);
 
+	/* Get rid of expecteds, set helpers to NULL.  New conntracks
+	   can't pick it up any more. */
+	ip_conntrack_walk(unhelp, me);
+
 	/* Someone could be still looking at the helper in a bh. */
 	br_write_lock_bh(BR_NETPROTO_LOCK);
 	br_write_unlock_bh(BR_NETPROTO_LOCK);
@@ -842,7 +987,8 @@ void ip_ct_refresh(struct ip_conntrack *ct, unsigned long extra_jiffies)
 {
 	IP_NF_ASSERT(ct->timeout.data == (unsigned long)ct);
 
-	WRITE_LOCK(&ip_conntrack_lock);
+	/* No lock: only the packet which creates it sees an unconfirmed
+	   conntrack, and of racing del_timer()s only one can win. */
 	/* If not in hash table, timer will not be active yet */
 	if (!is_confirmed(ct))
 		ct->timeout.expires = extra_jiffies;
@@ -853,7 +999,6 @@ void ip_ct_refresh(struct ip_conntrack *ct, unsigned long extra_jiffies)
 			add_timer(&ct->timeout);
 		}
 	}
-	WRITE_UNLOCK(&ip_conntrack_lock);
 }
 
 /* Returns new sk_buff, or NULL */
@@ -916,12 +1061,51 @@ static void ip_conntrack_attach(struct sk_buff *nskb, struct nf_ct_info *nfct)
 	atomic_inc(&ct->ct_general.use);
 }
 
-static inline int
-do_kill(const struct ip_conntrack_tuple_hash *i,
-	int (*kill)(const struct ip_conntrack *i, void *data),
-	void *data)
+struct ip_conntrack_tuple_hash *
+ip_conntrack_walk(int (*iter)(struct ip_conntrack_tuple_hash *, void *),
+		  void *data)
+{
+	struct ip_conntrack_htable *t;
+	struct ip_conntrack_tuple_hash *h;
+	struct list_head *pos;
+	unsigned int i;
+
+	/* Keeps the table, and every entry where it is; each chain
+	   is walked under its lock. */
+	down(&ip_conntrack_resize_sem);
+	t = ip_conntrack_htable;
+	for (i = 0; i < t->size; i++) {
+		spin_lock_bh(&t->buckets[i].lock);
+		list_for_each(pos, &t->buckets[i].chain) {
+			h = list_entry(pos, struct ip_conntrack_tuple_hash,
+				       list);
+			if (iter(h, data)) {
+				spin_unlock_bh(&t->buckets[i].lock);
+				up(&ip_conntrack_resize_sem);
+				return h;
+			}
+		}
+		spin_unlock_bh(&t->buckets[i].lock);
+	}
+	up(&ip_conntrack_resize_sem);
+	return NULL;
+}
+
+struct kill_args
 {
-	return kill(i->ctrack, data);
+	int (*kill)(const struct ip_conntrack *i, void *data);
+	void *data;
+};
+
+/* Called with the chain lock held, so the reference is safe to take. */
+static int do_kill(struct ip_conntrack_tuple_hash *i, void *data)
+{
+	struct kill_args *args = data;
+
+	if (!args->kill(i->ctrack, args->data))
+		return 0;
+	atomic_inc(&i->ctrack->ct_general.use);
+	return 1;
 }
 
 /* Bring out ya dead! */
@@ -929,19 +1113,9 @@ static struct ip_conntrack_tuple_hash *
 get_next_corpse(int (*kill)(const struct ip_conntrack *i, void *data),
 		void *data)
 {
-	struct ip_conntrack_tuple_hash *h = NULL;
-	unsigned int i;
-
-	READ_LOCK(&ip_conntrack_lock);
-	for (i = 0; !h && i < ip_conntrack_htable_size; i++) {
-		h = LIST_FIND(&ip_conntrack_hash[i], do_kill,
-			      struct ip_conntrack_tuple_hash *, kill, data);
-	}
-	if (h)
-		atomic_inc(&h->ctrack->ct_general.use);
-	READ_UNLOCK(&ip_conntrack_lock);
+	struct kill_args args = { kill, data };
 
-	return h;
+	return ip_conntrack_walk(do_kill, &args);
 }
 
 void
@@ -1015,15 +1189,109 @@ static struct nf_sockopt_ops so_getorigdst
     SO_ORIGINAL_DST, SO_ORIGINAL_DST+1, &getorigdst,
     0, NULL };
 
+static struct ip_conntrack_htable *alloc_htable(unsigned int size)
+{
+	struct ip_conntrack_htable *t;
+	unsigned int i;
+
+	t = vmalloc(sizeof(struct ip_conntrack_htable)
+		    + sizeof(struct ip_conntrack_bucket) * size);
+	if (!t)
+		return NULL;
+	t->size = size;
+	for (i = 0; i < size; i++) {
+		INIT_LIST_HEAD(&t->buckets[i].chain);
+		spin_lock_init(&t->buckets[i].lock);
+	}
+	return t;
+}
+
+/* Move every conntrack into a new table of size chains.  Lookups are
+   first sent to the chain locks and allowed to finish, then all the
+   chains are locked while the entries move, so packets wait for that
+   long. */
+int ip_conntrack_resize(unsigned int size)
+{
+	struct ip_conntrack_htable *new, *old;
+	struct ip_conntrack_tuple_hash *h;
+	struct list_head *chain;
+	unsigned int i;
+
+	if (size < 16 || size > (1 << 24))
+		return -EINVAL;
+	new = alloc_htable(size);
+	if (!new)
+		return -ENOMEM;
+
+	down(&ip_conntrack_resize_sem);
+	old = ip_conntrack_htable;
+	ip_conntrack_resize_seq++;
+	smp_wmb();
+	synchronize_kernel();
+
+	local_bh_disable();
+	for (i = 0; i < old->size; i++)
+		spin_lock(&old->buckets[i].lock);
+	for (i = 0; i < old->size; i++) {
+		chain = &old->buckets[i].chain;
+		while (!list_empty(chain)) {
+			h = list_entry(chain->next,
+				       struct ip_conntrack_tuple_hash, list);
+			list_del(&h->list);
+			list_add(&h->list, &new->buckets
+				 [hash_conntrack(new, &h->tuple)].chain);
+		}
+	}
+	smp_wmb();
+	ip_conntrack_htable = new;
+	ip_conntrack_htable_size = size;
+	for (i = 0; i < old->size; i++)
+		spin_unlock(&old->buckets[i].lock);
+	local_bh_enable();
+
+	smp_wmb();
+	ip_conntrack_resize_seq++;
+	up(&ip_conntrack_resize_sem);
+
+	/* Someone may still be waiting for a lock in the old table. */
+	synchronize_kernel();
+	vfree(old);
+
+	printk("ip_conntrack: %u buckets\n", size);
+	return 0;
+}
+
 #define NET_IP_CONNTRACK_MAX 2089
 #define NET_IP_CONNTRACK_MAX_NAME "ip_conntrack_max"
+#define NET_IP_CONNTRACK_BUCKETS 2090
+#define NET_IP_CONNTRACK_BUCKETS_NAME "ip_conntrack_buckets"
 
 #ifdef CONFIG_SYSCTL
 static struct ctl_table_header *ip_conntrack_sysctl_header;
 
+/* Writing ip_conntrack_buckets resizes the table. */
+static int
+ip_conntrack_buckets_sysctl(ctl_table *ctl, int write, struct file *filp,
+			    void *buffer, size_t *lenp)
+{
+	ctl_table tmp = *ctl;
+	int size = ip_conntrack_htable_size;
+	int ret;
+
+	tmp.data = &size;
+	ret = proc_dointvec(&tmp, write, filp, buffer, lenp);
+	if (ret || !write || size == ip_conntrack_htable_size)
+		return ret;
+	if (size < 0)
+		return -EINVAL;
+	return ip_conntrack_resize(size);
+}
+
 static ctl_table ip_conntrack_table[] = {
 	{ NET_IP_CONNTRACK_MAX, NET_IP_CONNTRACK_MAX_NAME, &ip_conntrack_max,
 	  sizeof(ip_conntrack_max), 0644,  NULL, proc_dointvec },
+	{ NET_IP_CONNTRACK_BUCKETS, NET_IP_CONNTRACK_BUCKETS_NAME, NULL,
+	  sizeof(int), 0644, NULL, ip_conntrack_buckets_sysctl },
  	{ 0 }
 };
 
@@ -1065,7 +1333,7 @@ void ip_conntrack_cleanup(void)
 	}
 
 	kmem_cache_destroy(ip_conntrack_cachep);
-	vfree(ip_conntrack_hash);
+	vfree(ip_conntrack_htable);
 	nf_unregister_sockopt(&so_getorigdst);
 }
 
@@ -1074,7 +1342,6 @@ MODULE_PARM(hashsize, "i");
 
 int __init ip_conntrack_init(void)
 {
-	unsigned int i;
 	int ret;
 
 	/* Idea from tcp.c: use 1/16384 of memory.  On i386: 32MB
@@ -1099,9 +1366,8 @@ int __init ip_conntrack_init(void)
 	if (ret != 0)
 		return ret;
 
-	ip_conntrack_hash = vmalloc(sizeof(struct list_head)
-				    * ip_conntrack_htable_size);
-	if (!ip_conntrack_hash) {
+	ip_conntrack_htable = alloc_htable(ip_conntrack_htable_size);
+	if (!ip_conntrack_htable) {
 		nf_unregister_sockopt(&so_getorigdst);
 		return -ENOMEM;
 	}
@@ -1111,7 +1377,7 @@ int __init ip_conntrack_init(void)
 	                                        SLAB_HWCACHE_ALIGN, NULL, NULL);
 	if (!ip_conntrack_cachep) {
 		printk(KERN_ERR "Unable to create ip_conntrack slab cache\n");
-		vfree(ip_conntrack_hash);
+		vfree(ip_conntrack_htable);
 		nf_unregister_sockopt(&so_getorigdst);
 		return -ENOMEM;
 	}
@@ -1124,9 +1390,6 @@ int __init ip_conntrack_init(void)
 	list_append(&protocol_list, &ip_conntrack_protocol_icmp);
 	WRITE_UNLOCK(&ip_conntrack_lock);
 
-	for (i = 0; i < ip_conntrack_htable_size; i++)
-		INIT_LIST_HEAD(&ip_conntrack_hash[i]);
-
 /* This is fucking braindead.  There is NO WAY of doing this without
    the CONFIG_SYSCTL unless you don't want to detect errors.
    Grrr... --RR */
@@ -1135,7 +1398,7 @@ int __init ip_conntrack_init(void)
 		= register_sysctl_table(ip_conntrack_root_table, 0);
 	if (ip_conntrack_sysctl_header == NULL) {
 		kmem_cache_destroy(ip_conntrack_cachep);
-		vfree(ip_conntrack_hash);
+		vfree(ip_conntrack_htable);
 		nf_unregister_sockopt(&so_getorigdst);
 		return -ENOMEM;
 	}
@@ -67,8 +67,8 @@ print_conntrack(char *buffer, const struct ip_conntrack *conntrack)
 {
 	unsigned int len;
 	struct ip_conntrack_protocol *proto
-		= __find_proto(conntrack->tuplehash[IP_CT_DIR_ORIGINAL]
-			       .tuple.dst.protonum);
+		= find_proto(conntrack->tuplehash[IP_CT_DIR_ORIGINAL]
+			     .tuple.dst.protonum);
 
 	len = sprintf(buffer, "%-8s %u %lu ",
 		      proto->name,
@@ -95,28 +95,32 @@ print_conntrack(char *buffer, const struct ip_conntrack *conntrack)
 	return len;
 }
 
+struct list_state
+{
+	char *buffer;
+	off_t offset, upto;
+	unsigned int len, maxlen;
+};
+
 /* Returns true when finished. */
-static inline int
-conntrack_iterate(const struct ip_conntrack_tuple_hash *hash,
-		  char *buffer, off_t offset, off_t *upto,
-		  unsigned int *len, unsigned int maxlen)
+static int
+conntrack_iterate(struct ip_conntrack_tuple_hash *hash, void *data)
 {
+	struct list_state *s = data;
 	unsigned int newlen;
 	IP_NF_ASSERT(hash->ctrack);
 
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
-
 	/* Only count originals */
 	if (DIRECTION(hash))
 		return 0;
 
-	if ((*upto)++ < offset)
+	if (s->upto++ < s->offset)
 		return 0;
 
-	newlen = print_conntrack(buffer + *len, hash->ctrack);
-	if (*len + newlen > maxlen)
+	newlen = print_conntrack(s->buffer + s->len, hash->ctrack);
+	if (s->len + newlen > s->maxlen)
 		return 1;
-	else *len += newlen;
+	else s->len += newlen;
 
 	return 0;
 }
@@ -124,40 +128,62 @@ conntrack_iterate(const struct ip_conntrack_tuple_hash *hash,
 static int
 list_conntracks(char *buffer, char **start, off_t offset, int length)
 {
-	unsigned int i;
-	unsigned int len = 0;
-	off_t upto = 0;
+	struct list_state s = { buffer, offset, 0, 0, length };
 	struct list_head *e;
 
-	READ_LOCK(&ip_conntrack_lock);
 	/* Traverse hash; print originals then reply. */
-	for (i = 0; i < ip_conntrack_htable_size; i++) {
-		if (LIST_FIND(&ip_conntrack_hash[i], conntrack_iterate,
-			      struct ip_conntrack_tuple_hash *,
-			      buffer, offset, &upto, &len, length))
-			goto finished;
-	}
+	if (ip_conntrack_walk(conntrack_iterate, &s))
+		goto out;
 
+	READ_LOCK(&ip_conntrack_lock);
 	/* Now iterate through expecteds. */
 	for (e = expect_list.next; e != &expect_list; e = e->next) {
 		unsigned int last_len;
 		struct ip_conntrack_expect *expect
 			= (struct ip_conntrack_expect *)e;
-		if (upto++ < offset) continue;
+		if (s.upto++ < offset) continue;
 
-		last_len = len;
-		len += print_expect(buffer + len, expect);
-		if (len > length) {
-			len = last_len;
+		last_len = s.len;
+		s.len += print_expect(buffer + s.len, expect);
+		if (s.len > length) {
+			s.len = last_len;
 			goto finished;
 		}
 	}
 
  finished:
 	READ_UNLOCK(&ip_conntrack_lock);
-
+ out:
 	/* `start' hack - see fs/proc/generic.c line ~165 */
-	*start = (char *)((unsigned int)upto - offset);
+	*start = (char *)((unsigned int)s.upto - offset);
+	return s.len;
+}
+
+static int
+conntrack_stat(char *buffer, char **start, off_t offset, int length)
+{
+	unsigned int i;
+	int len;
+
+	len = sprintf(buffer, "cpu   searched      found   inserted"
+		      "    dropped early_drop\n");
+	for (i = 0; i < smp_num_cpus; i++) {
+		struct ip_conntrack_stat *st
+			= &ip_conntrack_stat[cpu_logical_map(i)];
+
+		len += sprintf(buffer + len, "%3u %10u %10u %10u %10u %10u\n",
+			       cpu_logical_map(i), st->searched, st->found,
+			       st->inserted, st->dropped, st->early_drop);
+	}
+
+	if (offset >= len) {
+		*start = buffer;
+		return 0;
+	}
+	*start = buffer + offset;
+	len -= offset;
+	if (len > length)
+		len = length;
 	return len;
 }
 
@@ -235,6 +261,7 @@ static int init_or_cleanup(int init)
 		goto cleanup_nothing;
 
 	proc_net_create("ip_conntrack",0,list_conntracks);
+	proc_net_create("ip_conntrack_stat",0,conntrack_stat);
 	ret = nf_register_hook(&ip_conntrack_in_ops);
 	if (ret < 0) {
 		printk("ip_conntrack: can't register in hook.\n");
@@ -267,6 +294,7 @@ static int init_or_cleanup(int init)
  cleanup_inops:
 	nf_unregister_hook(&ip_conntrack_in_ops);
  cleanup_init:
+	proc_net_remove("ip_conntrack_stat");
 	proc_net_remove("ip_conntrack");
 	ip_conntrack_cleanup();
  cleanup_nothing:
@@ -289,7 +317,8 @@ int ip_conntrack_protocol_register(struct ip_conntrack_protocol *proto)
 		}
 	}
 
-	list_prepend(&protocol_list, proto);
+	/* find_proto() walks the list without the lock. */
+	list_add_rcu((struct list_head *)proto, &protocol_list);
 	MOD_INC_USE_COUNT;
 
  out:
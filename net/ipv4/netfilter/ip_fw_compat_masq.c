@@ -241,12 +241,18 @@ print_masq(char *buffer, const struct ip_conntrack *conntrack)
 	return sprintf(buffer, "%-127s\n", temp);
 }
 
+struct masq_state
+{
+	char *buffer;
+	off_t offset, upto;
+	unsigned int len, maxlen;
+};
+
 /* Returns true when finished. */
 static int
-masq_iterate(const struct ip_conntrack_tuple_hash *hash,
-	     char *buffer, off_t offset, off_t *upto,
-	     unsigned int *len, unsigned int maxlen)
+masq_iterate(struct ip_conntrack_tuple_hash *hash, void *data)
 {
+	struct masq_state *s = data;
 	unsigned int newlen;
 
 	IP_NF_ASSERT(hash->ctrack);
@@ -255,13 +261,13 @@ masq_iterate(const struct ip_conntrack_tuple_hash *hash,
 	if (DIRECTION(hash))
 		return 0;
 
-	if ((*upto)++ < offset)
+	if (s->upto++ < s->offset)
 		return 0;
 
-	newlen = print_masq(buffer + *len, hash->ctrack);
-	if (*len + newlen > maxlen)
+	newlen = print_masq(s->buffer + s->len, hash->ctrack);
+	if (s->len + newlen > s->maxlen)
 		return 1;
-	else *len += newlen;
+	else s->len += newlen;
 
 	return 0;
 }
@@ -270,9 +276,7 @@ masq_iterate(const struct ip_conntrack_tuple_hash *hash,
 static int
 masq_procinfo(char *buffer, char **start, off_t offset, int length)
 {
-	unsigned int i;
-	int len = 0;
-	off_t upto = 1;
+	struct masq_state s = { buffer, 0, 1, 0, length };
 
 	/* Header: first record */
 	if (offset == 0) {
@@ -280,23 +284,17 @@ masq_procinfo(char *buffer, char **start, off_t offset, int length)
 
 		sprintf(temp,
 			"Prc FromIP   FPrt ToIP     TPrt Masq Init-seq  Delta PDelta Expires (free=0,0,0)");
-		len = sprintf(buffer, "%-127s\n", temp);
+		s.len = sprintf(buffer, "%-127s\n", temp);
 		offset = 1;
 	}
+	s.offset = offset;
 
-	READ_LOCK(&ip_conntrack_lock);
 	/* Traverse hash; print originals then reply. */
-	for (i = 0; i < ip_conntrack_htable_size; i++) {
-		if (LIST_FIND(&ip_conntrack_hash[i], masq_iterate,
-			      struct ip_conntrack_tuple_hash *,
-			      buffer, offset, &upto, &len, length))
-			break;
-	}
-	READ_UNLOCK(&ip_conntrack_lock);
+	ip_conntrack_walk(masq_iterate, &s);
 
 	/* `start' hack - see fs/proc/generic.c line ~165 */
-	*start = (char *)((unsigned int)upto - offset);
-	return len;
+	*start = (char *)((unsigned int)s.upto - offset);
+	return s.len;
 }
 
 int __init masq_init(void)
@@ -77,6 +77,60 @@ static DECLARE_MUTEX(ipt_mutex);
 
    Hence the start of any table is given by get_table() below.  */
 
+/* Rule set compiler: see ipt_compile() below. */
+#define IPT_CDIM_SRC	0
+#define IPT_CDIM_DST	1
+#define IPT_CDIM_PROTO	2
+#define IPT_CDIM_DPORT	3
+#define IPT_CDIMS	4
+
+#define IPT_CBITS	(8 * sizeof(unsigned long))
+
+struct ipt_ckey
+{
+	/* Value (host order), masked to plen bits for addresses */
+	u_int32_t key;
+	unsigned int plen;
+	/* Next key in the hash bucket, -1 ends */
+	int next;
+	/* First rule with this key; the others are chained by link[] */
+	int rule;
+};
+
+struct ipt_cdim
+{
+	/* Rules that may match whatever the packet has here */
+	unsigned long *any;
+
+	struct ipt_ckey *keys;
+	unsigned int nkeys;
+	int *hash;
+	unsigned int hash_bits;
+	int *link;
+
+	/* Bit n-1 set: there are keys of prefix length n */
+	u_int32_t plens;
+};
+
+struct ipt_compiled
+{
+	/* Rules, and the offset of each in the table */
+	unsigned int number;
+	unsigned int *offset;
+
+	/* unsigned longs in a rule bitmap */
+	unsigned int words;
+
+	/* Of all the rules: skipping a rule depends on the same fields */
+	unsigned int nfcache;
+
+	struct ipt_cdim dim[IPT_CDIMS];
+
+	/* Two bitmaps per CPU for ipt_classify() */
+	unsigned long *scratch;
+	unsigned int scratch_words;
+};
+
 /* The table itself */
 struct ipt_table_info
 {
@@ -89,6 +143,9 @@ struct ipt_table_info
 	unsigned int hook_entry[NF_IP_NUMHOOKS];
 	unsigned int underflow[NF_IP_NUMHOOKS];
 
+	/* Decision structures, NULL to walk every rule */
+	struct ipt_compiled *compiled;
+
 	/* ipt_entry tables: one per CPU */
 	char entries[0] __attribute__((aligned(SMP_CACHE_BYTES)));
 };
@@ -243,6 +300,332 @@ get_entry(void *base, unsigned int offset)
 	return (struct ipt_entry *)(base + offset);
 }
 
+/* Rule set compilation.
+
+   Walking 5000 rules for every packet is slow, and almost none of
+   them can match: they are for other addresses and ports.  So when a
+   table is loaded, we index every rule on what ip_packet_match() and
+   the tcp/udp matches look at: source and destination prefix,
+   protocol and destination port.  Per dimension there is a hash of
+   the values rules ask for, each giving the rules that ask for it,
+   and a bitmap of the rules that don't care (or invert, or use a
+   mask that isn't a prefix).  Prefixes are looked up with one hash
+   probe per prefix length in use.
+
+   For a packet, ipt_classify() ORs together the rules of the keys it
+   hits and the don't-care bitmap, for every dimension, and ANDs the
+   dimensions: what is left is a superset of the rules that can
+   match.  ipt_do_table() then walks the chains exactly as before, but
+   goes from each rule straight to the next one in the bitmap.  The
+   rules it skips are exactly ones that would have failed
+   ip_packet_match() or, with the packet's whole header there, the
+   port test of a tcp or udp match coming first in the rule: they have
+   no side effects, and skipping them changes nothing.  Every other
+   match is evaluated as before.  The last rule of a chain is
+   unconditional, so the walk never skips out of a chain.
+
+   With few rules this costs about as much as it saves, but never
+   much. */
+
+static struct ipt_match tcp_matchstruct, udp_matchstruct;
+
+static inline void
+ipt_cset(unsigned long *bitmap, unsigned int i)
+{
+	bitmap[i / IPT_CBITS] |= 1UL << (i % IPT_CBITS);
+}
+
+static inline unsigned int
+ipt_chash(u_int32_t key, unsigned int plen, unsigned int bits)
+{
+	return ((key ^ plen) * 2654435761U) >> (32 - bits);
+}
+
+static inline u_int32_t
+ipt_cmask(unsigned int plen)
+{
+	return plen ? ~0U << (32 - plen) : 0;
+}
+
+/* Length of a prefix mask (network order); -1 if it isn't one. */
+static int
+ipt_cplen(u_int32_t mask)
+{
+	u_int32_t m = ntohl(mask);
+	int plen = 0;
+
+	while (m & 0x80000000) {
+		m <<= 1;
+		plen++;
+	}
+	return m ? -1 : plen;
+}
+
+static void
+ipt_cadd(struct ipt_cdim *d, u_int32_t key, unsigned int plen, int rule)
+{
+	unsigned int h = ipt_chash(key, plen, d->hash_bits);
+	int k;
+
+	for (k = d->hash[h]; k >= 0; k = d->keys[k].next)
+		if (d->keys[k].key == key && d->keys[k].plen == plen)
+			break;
+	if (k < 0) {
+		k = d->nkeys++;
+		d->keys[k].key = key;
+		d->keys[k].plen = plen;
+		d->keys[k].next = d->hash[h];
+		d->keys[k].rule = -1;
+		d->hash[h] = k;
+		d->plens |= 1 << (plen - 1);
+	}
+	d->link[rule] = d->keys[k].rule;
+	d->keys[k].rule = rule;
+}
+
+/* The port a rule needs, if its first match asks for a single
+   destination port; -1 otherwise.  A match in front of it could have
+   side effects (limit), so the rule could not be skipped. */
+static int
+ipt_cdport(const struct ipt_entry *e)
+{
+	const struct ipt_entry_match *m = (void *)e->elems;
+
+	if (e->target_offset == sizeof(struct ipt_entry))
+		return -1;
+
+	if (m->u.kernel.match == &tcp_matchstruct) {
+		const struct ipt_tcp *tcpinfo = (void *)m->data;
+
+		if (!(tcpinfo->invflags & IPT_TCP_INV_DSTPT)
+		    && tcpinfo->dpts[0] == tcpinfo->dpts[1])
+			return tcpinfo->dpts[0];
+	} else if (m->u.kernel.match == &udp_matchstruct) {
+		const struct ipt_udp *udpinfo = (void *)m->data;
+
+		if (!(udpinfo->invflags & IPT_UDP_INV_DSTPT)
+		    && udpinfo->dpts[0] == udpinfo->dpts[1])
+			return udpinfo->dpts[0];
+	}
+	return -1;
+}
+
+static void
+ipt_caddr(struct ipt_cdim *d, struct in_addr addr, struct in_addr msk,
+	  int invert, int rule)
+{
+	int plen = ipt_cplen(msk.s_addr);
+
+	if (invert || plen <= 0)
+		ipt_cset(d->any, rule);
+	else
+		ipt_cadd(d, ntohl(addr.s_addr & msk.s_addr), plen, rule);
+}
+
+static inline int
+ipt_coffset(struct ipt_entry *e, void *base, unsigned int *offset,
+	    unsigned int *i)
+{
+	offset[(*i)++] = (void *)e - base;
+	return 0;
+}
+
+/* Carve n bytes off *p, keeping longs aligned */
+static inline void *
+ipt_ccarve(char **p, unsigned long n)
+{
+	void *ret = *p;
+
+	*p += (n + sizeof(long) - 1) & ~(sizeof(long) - 1);
+	return ret;
+}
+
+static void
+ipt_uncompile(struct ipt_table_info *info)
+{
+	if (info->compiled)
+		vfree(info->compiled);
+	info->compiled = NULL;
+}
+
+/* Build the decision structures for a checked table.  Without
+   memory for them the table is just walked. */
+static void
+ipt_compile(struct ipt_table_info *info)
+{
+	struct ipt_compiled *c;
+	struct ipt_entry *e;
+	unsigned int n = info->number, words, bits, i, d;
+	unsigned long scratch, size;
+	char *p;
+	int port;
+
+	words = (n + IPT_CBITS - 1) / IPT_CBITS;
+	for (bits = 4; (1U << bits) < n; bits++);
+	scratch = SMP_ALIGN(2 * words * sizeof(long));
+
+	size = SMP_ALIGN(sizeof(*c)) + scratch * smp_num_cpus
+		+ n * sizeof(unsigned int) + sizeof(long)
+		+ IPT_CDIMS * (words * sizeof(long)
+			       + n * sizeof(struct ipt_ckey)
+			       + (1 << bits) * sizeof(int)
+			       + n * sizeof(int) + 3 * sizeof(long));
+	c = vmalloc(size);
+	if (!c) {
+		duprintf("ipt_compile: no memory for %u rules\n", n);
+		info->compiled = NULL;
+		return;
+	}
+	memset(c, 0, sizeof(*c));
+	c->number = n;
+	c->words = words;
+
+	p = (char *)c + SMP_ALIGN(sizeof(*c));
+	c->scratch = (unsigned long *)p;
+	c->scratch_words = scratch / sizeof(long);
+	p += scratch * smp_num_cpus;
+	for (d = 0; d < IPT_CDIMS; d++) {
+		struct ipt_cdim *dim = &c->dim[d];
+
+		dim->any = ipt_ccarve(&p, words * sizeof(long));
+		memset(dim->any, 0, words * sizeof(long));
+		dim->keys = ipt_ccarve(&p, n * sizeof(struct ipt_ckey));
+		dim->hash_bits = bits;
+		dim->hash = ipt_ccarve(&p, (1 << bits) * sizeof(int));
+		memset(dim->hash, 0xff, (1 << bits) * sizeof(int));
+		dim->link = ipt_ccarve(&p, n * sizeof(int));
+	}
+	c->offset = ipt_ccarve(&p, n * sizeof(unsigned int));
+
+	i = 0;
+	IPT_ENTRY_ITERATE(info->entries, info->size,
+			  ipt_coffset, info->entries, c->offset, &i);
+
+	for (i = 0; i < n; i++) {
+		e = get_entry(info->entries, c->offset[i]);
+		c->nfcache |= e->nfcache;
+
+		ipt_caddr(&c->dim[IPT_CDIM_SRC], e->ip.src, e->ip.smsk,
+			  e->ip.invflags & IPT_INV_SRCIP, i);
+		ipt_caddr(&c->dim[IPT_CDIM_DST], e->ip.dst, e->ip.dmsk,
+			  e->ip.invflags & IPT_INV_DSTIP, i);
+
+		if (e->ip.proto && !(e->ip.invflags & IPT_INV_PROTO))
+			ipt_cadd(&c->dim[IPT_CDIM_PROTO], e->ip.proto, 32, i);
+		else
+			ipt_cset(c->dim[IPT_CDIM_PROTO].any, i);
+
+		port = ipt_cdport(e);
+		if (port >= 0)
+			ipt_cadd(&c->dim[IPT_CDIM_DPORT], port, 32, i);
+		else
+			ipt_cset(c->dim[IPT_CDIM_DPORT].any, i);
+	}
+	info->compiled = c;
+}
+
+/* Rules that may match value in this dimension */
+static void
+ipt_clookup(const struct ipt_cdim *d, u_int32_t value,
+	    unsigned long *out, unsigned int words)
+{
+	u_int32_t plens = d->plens, key;
+	unsigned int plen;
+	int k, r;
+
+	memcpy(out, d->any, words * sizeof(long));
+	while (plens) {
+		plen = ffs(plens);
+		plens &= plens - 1;
+		key = value & ipt_cmask(plen);
+		for (k = d->hash[ipt_chash(key, plen, d->hash_bits)];
+		     k >= 0;
+		     k = d->keys[k].next) {
+			if (d->keys[k].key != key || d->keys[k].plen != plen)
+				continue;
+			for (r = d->keys[k].rule; r >= 0; r = d->link[r])
+				ipt_cset(out, r);
+			break;
+		}
+	}
+}
+
+static inline void
+ipt_cand(const struct ipt_cdim *d, u_int32_t value,
+	 unsigned long *cand, unsigned long *tmp, unsigned int words)
+{
+	unsigned int i;
+
+	/* Nobody asks: every rule may match */
+	if (!d->nkeys)
+		return;
+	ipt_clookup(d, value, tmp, words);
+	for (i = 0; i < words; i++)
+		cand[i] &= tmp[i];
+}
+
+/* The rules that may match this packet. */
+static unsigned long *
+ipt_classify(const struct ipt_compiled *c, const struct iphdr *ip,
+	     u_int16_t offset, const void *protohdr, u_int16_t datalen)
+{
+	unsigned long *cand, *tmp;
+	int dport = -1;
+
+	cand = c->scratch
+		+ c->scratch_words * cpu_number_map(smp_processor_id());
+	tmp = cand + c->words;
+
+	ipt_clookup(&c->dim[IPT_CDIM_SRC], ntohl(ip->saddr), cand, c->words);
+	ipt_cand(&c->dim[IPT_CDIM_DST], ntohl(ip->daddr), cand, tmp, c->words);
+	ipt_cand(&c->dim[IPT_CDIM_PROTO], ip->protocol, cand, tmp, c->words);
+
+	/* Without the whole header the tcp and udp matches drop the
+	   packet (hotdrop), so they must all be tried. */
+	if (!offset) {
+		if (ip->protocol == IPPROTO_TCP
+		    && datalen >= sizeof(struct tcphdr))
+			dport = ntohs(((struct tcphdr *)protohdr)->dest);
+		else if (ip->protocol == IPPROTO_UDP
+			 && datalen >= sizeof(struct udphdr))
+			dport = ntohs(((struct udphdr *)protohdr)->dest);
+	}
+	if (dport >= 0)
+		ipt_cand(&c->dim[IPT_CDIM_DPORT], dport, cand, tmp, c->words);
+
+	return cand;
+}
+
+/* The first rule from e on that may match. */
+static inline struct ipt_entry *
+ipt_skip(const struct ipt_compiled *c, const unsigned long *cand,
+	 void *table_base, struct ipt_entry *e)
+{
+	unsigned int pos = (void *)e - table_base;
+	unsigned int lo = 0, hi = c->number, mid, i;
+	unsigned long w;
+
+	while (lo + 1 < hi) {
+		mid = (lo + hi) / 2;
+		if (c->offset[mid] <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	if (c->offset[lo] != pos)
+		return e;
+
+	i = lo - lo % IPT_CBITS;
+	w = cand[i / IPT_CBITS] & (~0UL << (lo % IPT_CBITS));
+	while (!w) {
+		i += IPT_CBITS;
+		if (i >= c->number)
+			return e;
+		w = cand[i / IPT_CBITS];
+	}
+	return get_entry(table_base, c->offset[i + ffz(~w)]);
+}
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff **pskb,
@@ -263,6 +646,8 @@ ipt_do_table(struct sk_buff **pskb,
 	const char *indev, *outdev;
 	void *table_base;
 	struct ipt_entry *e, *back;
+	struct ipt_compiled *c;
+	unsigned long *cand = NULL;
 
 	/* Initialization */
 	ip = (*pskb)->nh.iph;
@@ -301,9 +686,17 @@ ipt_do_table(struct sk_buff **pskb,
 	/* For return from builtin chain */
 	back = get_entry(table_base, table->private->underflow[hook]);
 
+	c = table->private->compiled;
+	if (c) {
+		cand = ipt_classify(c, ip, offset, protohdr, datalen);
+		(*pskb)->nfcache |= c->nfcache;
+	}
+
 	do {
 		IP_NF_ASSERT(e);
 		IP_NF_ASSERT(back);
+		if (cand)
+			e = ipt_skip(c, cand, table_base, e);
 		(*pskb)->nfcache |= e->nfcache;
 		if (ip_packet_match(ip, indev, outdev, &e->ip, offset)) {
 			struct ipt_entry_target *t;
@@ -374,6 +767,9 @@ ipt_do_table(struct sk_buff **pskb,
 				ip = (*pskb)->nh.iph;
 				protohdr = (u_int32_t *)ip + ip->ihl;
 				datalen = (*pskb)->len - ip->ihl * 4;
+				if (cand && verdict == IPT_CONTINUE)
+					cand = ipt_classify(c, ip, offset,
+							    protohdr, datalen);
 
 				if (verdict == IPT_CONTINUE)
 					e = (void *)e + e->next_offset;
@@ -801,6 +1197,7 @@ translate_table(const char *name,
 
 	newinfo->size = size;
 	newinfo->number = number;
+	newinfo->compiled = NULL;
 
 	/* Init all hooks to impossible value. */
 	for (i = 0; i < NF_IP_NUMHOOKS; i++) {
@@ -864,6 +1261,8 @@ translate_table(const char *name,
 		       SMP_ALIGN(newinfo->size));
 	}
 
+	/* All copies have the same offsets: one index does */
+	ipt_compile(newinfo);
 	return ret;
 }
 
@@ -1105,6 +1504,7 @@ do_replace(void *user, unsigned int len)
 	get_counters(oldinfo, counters);
 	/* Decrease module usage counts and free resource */
 	IPT_ENTRY_ITERATE(oldinfo->entries, oldinfo->size, cleanup_entry,NULL);
+	ipt_uncompile(oldinfo);
 	vfree(oldinfo);
 	/* Silent error: too late now. */
 	copy_to_user(tmp.counters, counters,
@@ -1117,6 +1517,7 @@ do_replace(void *user, unsigned int len)
 	up(&ipt_mutex);
  free_newinfo_counters_untrans:
 	IPT_ENTRY_ITERATE(newinfo->entries, newinfo->size, cleanup_entry,NULL);
+	ipt_uncompile(newinfo);
  free_newinfo_counters:
 	vfree(counters);
  free_newinfo:
@@ -1359,7 +1760,7 @@ int ipt_register_table(struct ipt_table *table)
 	int ret;
 	struct ipt_table_info *newinfo;
 	static struct ipt_table_info bootstrap
-		= { 0, 0, { 0 }, { 0 }, { } };
+		= { 0, 0, { 0 }, { 0 }, NULL, { } };
 
 	MOD_INC_USE_COUNT;
 	newinfo = vmalloc(sizeof(struct ipt_table_info)
@@ -1384,6 +1785,7 @@ int ipt_register_table(struct ipt_table *table)
 
 	ret = down_interruptible(&ipt_mutex);
 	if (ret != 0) {
+		ipt_uncompile(newinfo);
 		vfree(newinfo);
 		MOD_DEC_USE_COUNT;
 		return ret;
@@ -1411,6 +1813,7 @@ int ipt_register_table(struct ipt_table *table)
 	return ret;
 
  free_unlock:
+	ipt_uncompile(newinfo);
 	vfree(newinfo);
 	MOD_DEC_USE_COUNT;
 	goto unlock;
@@ -1425,6 +1828,7 @@ void ipt_unregister_table(struct ipt_table *table)
 	/* Decrease module usage counts and free resources */
 	IPT_ENTRY_ITERATE(table->private->entries, table->private->size,
 			  cleanup_entry, NULL);
+	ipt_uncompile(table->private);
 	vfree(table->private);
 	MOD_DEC_USE_COUNT;
 }
@@ -1709,6 +2113,293 @@ static int ipt_get_tables(char *buffer, char **start, off_t offset, int length)
 }
 #endif /*CONFIG_PROC_FS*/
 
+#ifdef CONFIG_IP_NF_IPTABLES_SELFTEST
+/* Load synthetic tables of growing size, replay the same synthetic
+   packets through each with and without the compiled index, check
+   that the same rules matched, and report the cost per packet.  The
+   tables are never hooked in. */
+
+#define IPT_ST_PACKETS	4096
+#define IPT_ST_ROUNDS	4
+
+static unsigned int ipt_st_seed;
+
+static unsigned int __init
+ipt_st_random(void)
+{
+	ipt_st_seed = ipt_st_seed * 1103515245 + 12345;
+	return ipt_st_seed >> 8;
+}
+
+/* Append a rule at off; returns the offset after it */
+static unsigned int __init
+ipt_st_rule(char *base, unsigned int off, u_int32_t src, int splen,
+	    u_int32_t dst, int dplen, u_int8_t proto,
+	    u_int16_t dport_min, u_int16_t dport_max, int verdict)
+{
+	struct ipt_entry *e = (void *)(base + off);
+	struct ipt_entry_match *m;
+	struct ipt_standard_target *t;
+	unsigned int size = sizeof(struct ipt_entry);
+
+	memset(e, 0, sizeof(*e));
+	e->ip.src.s_addr = htonl(src);
+	e->ip.smsk.s_addr = htonl(ipt_cmask(splen));
+	e->ip.dst.s_addr = htonl(dst);
+	e->ip.dmsk.s_addr = htonl(ipt_cmask(dplen));
+	e->ip.proto = proto;
+
+	if (proto == IPPROTO_TCP) {
+		struct ipt_tcp *tcpinfo;
+
+		m = (void *)(base + off + size);
+		memset(m, 0, IPT_ALIGN(sizeof(*m)) + IPT_ALIGN(sizeof(*tcpinfo)));
+		m->u.user.match_size = IPT_ALIGN(sizeof(*m))
+			+ IPT_ALIGN(sizeof(*tcpinfo));
+		strcpy(m->u.user.name, "tcp");
+		tcpinfo = (void *)m->data;
+		tcpinfo->spts[1] = 0xFFFF;
+		tcpinfo->dpts[0] = dport_min;
+		tcpinfo->dpts[1] = dport_max;
+		size += m->u.user.match_size;
+	} else if (proto == IPPROTO_UDP) {
+		struct ipt_udp *udpinfo;
+
+		m = (void *)(base + off + size);
+		memset(m, 0, IPT_ALIGN(sizeof(*m)) + IPT_ALIGN(sizeof(*udpinfo)));
+		m->u.user.match_size = IPT_ALIGN(sizeof(*m))
+			+ IPT_ALIGN(sizeof(*udpinfo));
+		strcpy(m->u.user.name, "udp");
+		udpinfo = (void *)m->data;
+		udpinfo->spts[1] = 0xFFFF;
+		udpinfo->dpts[0] = dport_min;
+		udpinfo->dpts[1] = dport_max;
+		size += m->u.user.match_size;
+	}
+
+	e->target_offset = size;
+	t = (void *)(base + off + size);
+	memset(t, 0, IPT_ALIGN(sizeof(*t)));
+	t->target.u.user.target_size = IPT_ALIGN(sizeof(*t));
+	t->verdict = -verdict - 1;
+	size += IPT_ALIGN(sizeof(*t));
+	e->next_offset = size;
+
+	return off + size;
+}
+
+/* An edge filter: host blocks, services on subnets, port ranges.
+   Returns the size; *policy is the offset of the last rule. */
+static unsigned int __init
+ipt_st_table(char *base, unsigned int n, unsigned int *policy)
+{
+	unsigned int off = 0, i;
+	struct ipt_entry *e;
+	struct ipt_entry_target *t;
+
+	for (i = 0; i < n; i++) {
+		switch (i % 4) {
+		case 0:
+			off = ipt_st_rule(base, off,
+					  0xC0A80000 | (i & 0x1FFF), 32,
+					  0, 0, 0, 0, 0, NF_DROP);
+			break;
+		case 1:
+			off = ipt_st_rule(base, off, 0, 0,
+					  0x0A000000 | (i & 0x1FFF) << 8, 24,
+					  IPPROTO_TCP, 1024 + i % 4096,
+					  1024 + i % 4096, NF_ACCEPT);
+			break;
+		case 2:
+			off = ipt_st_rule(base, off, 0, 0, 0x0A000000, 8,
+					  IPPROTO_UDP, 1024 + i % 4096,
+					  1024 + i % 4096, NF_DROP);
+			break;
+		case 3:
+			off = ipt_st_rule(base, off,
+					  0xAC100000 | (i & 0xFF) << 8, 24,
+					  0, 0, IPPROTO_TCP, 6000, 6063,
+					  NF_DROP);
+			break;
+		}
+	}
+	/* Policy, then the error entry that ends every table */
+	*policy = off;
+	off = ipt_st_rule(base, off, 0, 0, 0, 0, 0, 0, 0, NF_ACCEPT);
+
+	e = (void *)(base + off);
+	memset(e, 0, sizeof(*e));
+	e->target_offset = sizeof(*e);
+	e->next_offset = sizeof(*e) + IPT_ALIGN(sizeof(*t) + IPT_FUNCTION_MAXNAMELEN);
+	t = (void *)e->elems;
+	memset(t, 0, e->next_offset - e->target_offset);
+	t->u.user.target_size = e->next_offset - e->target_offset;
+	strcpy(t->u.user.name, IPT_ERROR_TARGET);
+	strcpy((char *)t->data, "ERROR");
+
+	return off + e->next_offset;
+}
+
+static void __init
+ipt_st_packet(struct sk_buff *skb, unsigned int i)
+{
+	struct iphdr *ip = skb->nh.iph;
+	struct tcphdr *tcp = (void *)(ip + 1);
+
+	ipt_st_seed = i + 1;
+	memset(ip, 0, sizeof(*ip) + sizeof(*tcp));
+	ip->version = 4;
+	ip->ihl = sizeof(*ip) / 4;
+	ip->tot_len = htons(sizeof(*ip) + sizeof(*tcp));
+	ip->saddr = htonl(ipt_st_random() & 1
+			  ? 0xC0A80000 | (ipt_st_random() & 0x1FFF)
+			  : 0xAC100000 | (ipt_st_random() & 0xFFFF));
+	ip->daddr = htonl(0x0A000000 | (ipt_st_random() & 0x1FFFFF));
+	ip->protocol = ipt_st_random() & 1 ? IPPROTO_TCP : IPPROTO_UDP;
+	tcp->source = htons(ipt_st_random());
+	tcp->dest = htons(1024 + ipt_st_random() % 6000);
+	skb->nfcache = 0;
+}
+
+/* Replays the packets; returns ns per packet */
+static unsigned long __init
+ipt_st_run(struct ipt_table *table, struct sk_buff *skb,
+	   unsigned char *verdicts, unsigned int rounds)
+{
+	struct timeval start, end;
+	unsigned long usecs;
+	unsigned int r, i;
+
+	do_gettimeofday(&start);
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < IPT_ST_PACKETS; i++) {
+			ipt_st_packet(skb, i);
+			verdicts[i] = ipt_do_table(&skb, NF_IP_LOCAL_IN,
+						   NULL, NULL, table, NULL);
+		}
+	do_gettimeofday(&end);
+
+	usecs = (end.tv_sec - start.tv_sec) * 1000000
+		+ end.tv_usec - start.tv_usec;
+	return usecs * 1000 / (rounds * IPT_ST_PACKETS);
+}
+
+static int __init
+ipt_st_counters_equal(struct ipt_counters *a, struct ipt_counters *b,
+		      struct ipt_counters *c, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (b[i].pcnt - a[i].pcnt != c[i].pcnt - b[i].pcnt)
+			return 0;
+	return 1;
+}
+
+static void __init
+ipt_selftest(void)
+{
+	static const unsigned int sizes[] = { 10, 100, 1000, 5000 };
+	struct ipt_table table;
+	struct ipt_table_info *info;
+	struct ipt_compiled *c;
+	struct ipt_counters *cnt;
+	struct sk_buff *skb;
+	unsigned char *verdicts;
+	unsigned int k, n, size, hook_entry[NF_IP_NUMHOOKS];
+	unsigned int underflow[NF_IP_NUMHOOKS];
+	unsigned long walked, compiled;
+	int ret, bad;
+
+	skb = alloc_skb(sizeof(struct iphdr) + sizeof(struct tcphdr),
+			GFP_KERNEL);
+	verdicts = vmalloc(2 * IPT_ST_PACKETS);
+	if (!skb || !verdicts)
+		goto out;
+	skb->nh.iph = (void *)skb_put(skb, sizeof(struct iphdr)
+				      + sizeof(struct tcphdr));
+
+	for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+		n = sizes[k];
+		/* Rules are at most this big */
+		size = (n + 2) * (sizeof(struct ipt_entry)
+				  + IPT_ALIGN(sizeof(struct ipt_entry_match))
+				  + IPT_ALIGN(sizeof(struct ipt_tcp))
+				  + IPT_ALIGN(sizeof(struct ipt_entry_target)
+					      + IPT_FUNCTION_MAXNAMELEN));
+		info = vmalloc(sizeof(*info) + SMP_ALIGN(size) * smp_num_cpus);
+		cnt = vmalloc(3 * (n + 2) * sizeof(*cnt));
+		if (!info || !cnt) {
+			printk("ip_tables: selftest: no memory for %u rules\n", n);
+			goto next;
+		}
+		memset(hook_entry, 0, sizeof(hook_entry));
+		memset(underflow, 0, sizeof(underflow));
+		size = ipt_st_table(info->entries, n,
+				    &underflow[NF_IP_LOCAL_IN]);
+		ret = translate_table("selftest", 1 << NF_IP_LOCAL_IN, info,
+				      size, n + 2, hook_entry, underflow);
+		if (ret != 0) {
+			printk("ip_tables: selftest: bad table (%d)\n", ret);
+			goto next;
+		}
+		c = info->compiled;
+
+		memset(&table, 0, sizeof(table));
+		strcpy(table.name, "selftest");
+		table.valid_hooks = 1 << NF_IP_LOCAL_IN;
+		table.lock = RW_LOCK_UNLOCKED;
+		table.private = info;
+#ifdef CONFIG_NETFILTER_DEBUG
+		{
+			unsigned int cpu;
+
+			for (cpu = 0; cpu < smp_num_cpus; cpu++)
+				((struct ipt_entry *)(info->entries
+				 + TABLE_OFFSET(info, cpu)))->comefrom
+					= 0xdead57ac;
+		}
+#endif
+
+		/* Same rules must match, in the same order */
+		memset(cnt, 0, 3 * (n + 2) * sizeof(*cnt));
+		get_counters(info, cnt);
+		info->compiled = NULL;
+		ipt_st_run(&table, skb, verdicts, 1);
+		get_counters(info, cnt + (n + 2));
+		info->compiled = c;
+		ipt_st_run(&table, skb, verdicts + IPT_ST_PACKETS, 1);
+		get_counters(info, cnt + 2 * (n + 2));
+		bad = memcmp(verdicts, verdicts + IPT_ST_PACKETS, IPT_ST_PACKETS)
+			|| !ipt_st_counters_equal(cnt, cnt + (n + 2),
+						  cnt + 2 * (n + 2), n + 2);
+
+		info->compiled = NULL;
+		walked = ipt_st_run(&table, skb, verdicts, IPT_ST_ROUNDS);
+		info->compiled = c;
+		compiled = c ? ipt_st_run(&table, skb, verdicts,
+					  IPT_ST_ROUNDS) : 0;
+
+		printk("ip_tables: selftest: %4u rules: %6lu ns/packet walked, "
+		       "%6lu compiled%s\n", n, walked, compiled,
+		       !c ? " (not compiled)" : bad ? " MISMATCH" : "");
+
+		IPT_ENTRY_ITERATE(info->entries, info->size, cleanup_entry, NULL);
+		ipt_uncompile(info);
+	next:
+		if (cnt)
+			vfree(cnt);
+		if (info)
+			vfree(info);
+	}
+out:
+	if (verdicts)
+		vfree(verdicts);
+	if (skb)
+		kfree_skb(skb);
+}
+#endif /* CONFIG_IP_NF_IPTABLES_SELFTEST */
+
 static int __init init(void)
 {
 	int ret;
@@ -1737,6 +2428,9 @@ static int __init init(void)
 #endif
 
 	printk("ip_tables: (c)2000 Netfilter core team\n");
+#ifdef CONFIG_IP_NF_IPTABLES_SELFTEST
+	ipt_selftest();
+#endif
 	return 0;
 }
 
@@ -85,6 +85,7 @@
 #include <linux/mroute.h>
 #include <linux/netfilter_ipv4.h>
 #include <linux/random.h>
+#include <linux/jhash.h>
 #include <net/protocol.h>
 #include <net/ip.h>
 #include <net/route.h>
@@ -117,6 +118,8 @@ int ip_rt_gc_elasticity		= 8;
 int ip_rt_mtu_expires		= 10 * 60 * HZ;
 int ip_rt_min_pmtu		= 512 + 20 + 20;
 int ip_rt_min_advmss		= 256;
+int ip_rt_secret_interval	= 10 * 60 * HZ;
+int ip_rt_max_chain		= 32;
 
 static unsigned long rt_deadline;
 
@@ -124,6 +127,7 @@ static unsigned long rt_deadline;
 
 static struct timer_list rt_flush_timer;
 static struct timer_list rt_periodic_timer;
+static struct timer_list rt_secret_timer;
 
 /*
  *	Interface to generic destination cache.
@@ -198,19 +202,22 @@ struct rt_hash_bucket {
 static struct rt_hash_bucket 	*rt_hash_table;
 static unsigned			rt_hash_mask;
 static int			rt_hash_log;
+static u32			rt_hash_rnd;
 
 struct rt_cache_stat rt_cache_stat[NR_CPUS];
 
 static int rt_intern_hash(unsigned hash, struct rtable *rth,
 				struct rtable **res);
 
+/*
+ * Both addresses come straight off the wire, so the hash is keyed:
+ * without rt_hash_rnd nobody can tell which sources share a chain.
+ * The key changes on every flush of the cache, see rt_run_flush().
+ */
 static __inline__ unsigned rt_hash_code(u32 daddr, u32 saddr, u8 tos)
 {
-	unsigned hash = ((daddr & 0xF0F0F0F0) >> 4) |
-			((daddr & 0x0F0F0F0F) << 4);
-	hash ^= saddr ^ tos;
-	hash ^= (hash >> 16);
-	return (hash ^ (hash >> 8)) & rt_hash_mask;
+	return jhash_3words(daddr, saddr, (u32) tos, rt_hash_rnd)
+		& rt_hash_mask;
 }
 
 static int rt_cache_get_info(char *buffer, char **start, off_t offset,
@@ -290,7 +297,7 @@ static int rt_cache_stat_get_info(char *buffer, char **start, off_t offset, int
         for (lcpu = 0; lcpu < smp_num_cpus; lcpu++) {
                 i = cpu_logical_map(lcpu);
 
-		len += sprintf(buffer+len, "%08x  %08x %08x %08x %08x %08x %08x %08x  %08x %08x %08x\n",
+		len += sprintf(buffer+len, "%08x  %08x %08x %08x %08x %08x %08x %08x  %08x %08x %08x  %08x %08x  %08x %08x %08x\n",
 			       dst_entries,		       
 			       rt_cache_stat[i].in_hit,
 			       rt_cache_stat[i].in_slow_tot,
@@ -302,7 +309,14 @@ static int rt_cache_stat_get_info(char *buffer, char **start, off_t offset, int
 
 			       rt_cache_stat[i].out_hit,
 			       rt_cache_stat[i].out_slow_tot,
-			       rt_cache_stat[i].out_slow_mc
+			       rt_cache_stat[i].out_slow_mc,
+
+			       rt_cache_stat[i].in_lookup,
+			       rt_cache_stat[i].out_lookup,
+
+			       rt_cache_stat[i].gc_total,
+			       rt_cache_stat[i].gc_evict,
+			       rt_cache_stat[i].chain_evict
 			);
 	}
 	len -= offset;
@@ -418,6 +432,11 @@ static void SMP_TIMER_NAME(rt_run_flush)(unsigned long dummy)
 
 	rt_deadline = 0;
 
+	/* Entries hashed with the old key are all about to go, so this
+	 * is the one moment a new key costs nothing.
+	 */
+	get_random_bytes(&rt_hash_rnd, sizeof(rt_hash_rnd));
+
 	for (i = rt_hash_mask; i >= 0; i--) {
 		write_lock_bh(&rt_hash_table[i].lock);
 		rth = rt_hash_table[i].chain;
@@ -476,6 +495,20 @@ void rt_cache_flush(int delay)
 	spin_unlock_bh(&rt_flush_lock);
 }
 
+/* Flush the cache, and with it the hash key, every secret_interval. */
+static void rt_secret_rebuild(unsigned long dummy)
+{
+	unsigned long now = jiffies;
+
+	if (ip_rt_secret_interval <= 0) {
+		/* Disabled; look again later in case it is turned on. */
+		mod_timer(&rt_secret_timer, now + ip_rt_gc_interval);
+		return;
+	}
+	rt_cache_flush(0);
+	mod_timer(&rt_secret_timer, now + ip_rt_secret_interval);
+}
+
 /*
    Short description of GC goals.
 
@@ -526,6 +559,8 @@ static int rt_garbage_collect(void)
 		equilibrium = atomic_read(&ipv4_dst_ops.entries) - goal;
 	}
 
+	rt_cache_stat[smp_processor_id()].gc_total++;
+
 	if (now - last_gc >= ip_rt_gc_min_interval)
 		last_gc = now;
 
@@ -551,6 +586,7 @@ static int rt_garbage_collect(void)
 				}
 				*rthp = rth->u.rt_next;
 				rt_free(rth);
+				rt_cache_stat[smp_processor_id()].gc_evict++;
 				goal--;
 			}
 			write_unlock_bh(&rt_hash_table[k].lock);
@@ -602,14 +638,34 @@ work_done:
 out:	return 0;
 }
 
+/*
+ * Is rth a better victim than cand when a chain is full?  Prefer the
+ * entry used least, then the one idle longest.  A burst of new flows
+ * thus displaces its own members rather than established routes.
+ */
+static __inline__ int rt_chain_victim(struct rtable *rth, struct rtable *cand)
+{
+	if (atomic_read(&rth->u.dst.__refcnt))
+		return 0;
+	if (cand == NULL || rth->u.dst.__use < cand->u.dst.__use)
+		return 1;
+	return rth->u.dst.__use == cand->u.dst.__use &&
+		time_before(rth->u.dst.lastuse, cand->u.dst.lastuse);
+}
+
 static int rt_intern_hash(unsigned hash, struct rtable *rt, struct rtable **rp)
 {
 	struct rtable	*rth, **rthp;
+	struct rtable	*cand, **candp;
 	unsigned long	now = jiffies;
+	int		length;
 	int attempts = !in_softirq();
 
 restart:
 	rthp = &rt_hash_table[hash].chain;
+	cand = NULL;
+	candp = NULL;
+	length = 0;
 
 	write_lock_bh(&rt_hash_table[hash].lock);
 	while ((rth = *rthp) != NULL) {
@@ -629,9 +685,23 @@ restart:
 			return 0;
 		}
 
+		if (rt_chain_victim(rth, cand)) {
+			cand = rth;
+			candp = rthp;
+		}
+		length++;
 		rthp = &rth->u.rt_next;
 	}
 
+	/* Bound the chain whatever the global GC thinks of the table:
+	 * one long chain makes every lookup hashing to it slow.
+	 */
+	if (cand && ip_rt_max_chain > 0 && length >= ip_rt_max_chain) {
+		*candp = cand->u.rt_next;
+		rt_free(cand);
+		rt_cache_stat[smp_processor_id()].chain_evict++;
+	}
+
 	/* Try to bind route to arp only if it is output
 	   route or unicast forwarding path.
 	 */
@@ -1632,6 +1702,7 @@ int ip_route_input(struct sk_buff *skb, u32 daddr, u32 saddr,
 
 	tos &= IPTOS_RT_MASK;
 	hash = rt_hash_code(daddr, saddr ^ (iif << 5), tos);
+	rt_cache_stat[smp_processor_id()].in_lookup++;
 
 	read_lock(&rt_hash_table[hash].lock);
 	for (rth = rt_hash_table[hash].chain; rth; rth = rth->u.rt_next) {
@@ -1993,6 +2064,7 @@ int ip_route_output_key(struct rtable **rp, const struct rt_key *key)
 	hash = rt_hash_code(key->dst, key->src ^ (key->oif << 5), key->tos);
 
 	read_lock_bh(&rt_hash_table[hash].lock);
+	rt_cache_stat[smp_processor_id()].out_lookup++;
 	for (rth = rt_hash_table[hash].chain; rth; rth = rth->u.rt_next) {
 		if (rth->key.dst == key->dst &&
 		    rth->key.src == key->src &&
@@ -2405,6 +2477,23 @@ ctl_table ipv4_route_table[] = {
 		maxlen:		sizeof(int),
 		mode:		0644,
 		proc_handler:	&proc_dointvec,
+	},
+	{
+		ctl_name:	NET_IPV4_ROUTE_SECRET_INTERVAL,
+		procname:	"secret_interval",
+		data:		&ip_rt_secret_interval,
+		maxlen:		sizeof(int),
+		mode:		0644,
+		proc_handler:	&proc_dointvec_jiffies,
+		strategy:	&sysctl_jiffies,
+	},
+	{
+		ctl_name:	NET_IPV4_ROUTE_MAX_CHAIN,
+		procname:	"max_chain",
+		data:		&ip_rt_max_chain,
+		maxlen:		sizeof(int),
+		mode:		0644,
+		proc_handler:	&proc_dointvec,
 	},
 	 { 0 }
 };
@@ -2504,6 +2593,7 @@ void __init ip_rt_init(void)
 		/* NOTHING */;
 
 	rt_hash_mask--;
+	get_random_bytes(&rt_hash_rnd, sizeof(rt_hash_rnd));
 	for (i = 0; i <= rt_hash_mask; i++) {
 		rt_hash_table[i].lock = RW_LOCK_UNLOCKED;
 		rt_hash_table[i].chain = NULL;
@@ -2525,6 +2615,11 @@ void __init ip_rt_init(void)
 					ip_rt_gc_interval;
 	add_timer(&rt_periodic_timer);
 
+	rt_secret_timer.function = rt_secret_rebuild;
+	rt_secret_timer.expires = jiffies + net_random() % ip_rt_secret_interval +
+					ip_rt_secret_interval;
+	add_timer(&rt_secret_timer);
+
 	proc_net_create ("rt_cache", 0, rt_cache_get_info);
 	proc_net_create ("rt_cache_stat", 0, rt_cache_stat_get_info);
 #ifdef CONFIG_NET_CLS_ROUTE
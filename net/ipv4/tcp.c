@@ -929,19 +929,23 @@ out_err:
 	return tcp_error(sk, flags, err);
 }
 
+/*
+ * Pages are attached to the skbs as fragments, without copying, as
+ * long as the device can do scatter-gather. The segments are always
+ * marked CHECKSUM_HW: the checksum is done by the card if it can, and
+ * otherwise by dev_queue_xmit() in software. Either way it is computed
+ * from the page contents at transmit time, so a page that changes
+ * while it is queued can not leave a stale checksum on retransmits.
+ * Summing the data is still a lot cheaper than copying it.
+ */
 ssize_t tcp_sendpage(struct socket *sock, struct page *page, int offset, size_t size, int flags)
 {
 	ssize_t res;
 	struct sock *sk = sock->sk;
 
-#define TCP_ZC_CSUM_FLAGS (NETIF_F_IP_CSUM|NETIF_F_NO_CSUM|NETIF_F_HW_CSUM)
-
-	if (!(sk->route_caps & NETIF_F_SG) || 
-	    !(sk->route_caps & TCP_ZC_CSUM_FLAGS))
+	if (!(sk->route_caps & NETIF_F_SG))
 		return sock_no_sendpage(sock, page, offset, size, flags);
 
-#undef TCP_ZC_CSUM_FLAGS
-
 	lock_sock(sk);
 	TCP_CHECK_TIMER(sk);
 	res = do_tcp_sendpages(sk, &page, offset, size, flags);
@@ -83,6 +83,9 @@
 #include <linux/config.h>
 #include <linux/inet.h>
 #include <linux/netdevice.h>
+#include <linux/init.h>
+#include <linux/random.h>
+#include <linux/jhash.h>
 #include <net/snmp.h>
 #include <net/ip.h>
 #include <net/protocol.h>
@@ -106,6 +109,83 @@ rwlock_t udp_hash_lock = RW_LOCK_UNLOCKED;
 /* Shared by v4/v6 udp. */
 int udp_port_rover;
 
+/*
+ * The demux table.  Readers hold only their bucket's lock.  Writers
+ * also hold udp_hash_lock, so a socket moves between buckets in one
+ * piece, and sk->hashent remembers which bucket it sits in.
+ */
+struct udp_demux_bucket {
+	rwlock_t	lock;
+	struct sock	*chain;
+} __attribute__((__aligned__(8)));
+
+static struct udp_demux_bucket	*udp_demux;
+static unsigned int		udp_demux_mask;
+static u32			udp_demux_rnd;
+
+static __inline__ int udp_demux_bound_hash(u32 laddr, unsigned short lport)
+{
+	return jhash_2words(laddr, lport, udp_demux_rnd) & udp_demux_mask;
+}
+
+static __inline__ int udp_demux_conn_hash(u32 laddr, unsigned short lport,
+					  u32 raddr, u16 rport)
+{
+	return jhash_3words(laddr, raddr, ((u32) lport << 16) | rport,
+			    udp_demux_rnd) & udp_demux_mask;
+}
+
+/* Connected sockets hash on the full 4-tuple, the rest on the local end. */
+static __inline__ int udp_demux_slot(struct sock *sk)
+{
+	if (sk->daddr && sk->dport && sk->rcv_saddr)
+		return udp_demux_conn_hash(sk->rcv_saddr, sk->num,
+					   sk->daddr, sk->dport);
+	return udp_demux_bound_hash(sk->rcv_saddr, sk->num);
+}
+
+/* Caller holds udp_hash_lock for writing. */
+void __udp_demux_hash(struct sock *sk)
+{
+	int slot = udp_demux_slot(sk);
+	struct udp_demux_bucket *b = &udp_demux[slot];
+
+	write_lock(&b->lock);
+	if ((sk->bind_next = b->chain) != NULL)
+		b->chain->bind_pprev = &sk->bind_next;
+	b->chain = sk;
+	sk->bind_pprev = &b->chain;
+	sk->hashent = slot;
+	write_unlock(&b->lock);
+}
+
+/* Caller holds udp_hash_lock for writing. */
+void __udp_demux_unhash(struct sock *sk)
+{
+	struct udp_demux_bucket *b;
+
+	if (sk->bind_pprev == NULL)
+		return;
+	b = &udp_demux[sk->hashent];
+	write_lock(&b->lock);
+	if (sk->bind_next)
+		sk->bind_next->bind_pprev = sk->bind_pprev;
+	*sk->bind_pprev = sk->bind_next;
+	sk->bind_pprev = NULL;
+	write_unlock(&b->lock);
+}
+
+/* Addresses of a bound socket changed, by connect() or disconnect(). */
+void udp_demux_rehash(struct sock *sk)
+{
+	write_lock_bh(&udp_hash_lock);
+	if (sk->pprev && sk->hashent != udp_demux_slot(sk)) {
+		__udp_demux_unhash(sk);
+		__udp_demux_hash(sk);
+	}
+	write_unlock_bh(&udp_hash_lock);
+}
+
 static int udp_v4_get_port(struct sock *sk, unsigned short snum)
 {
 	write_lock_bh(&udp_hash_lock);
@@ -174,6 +254,7 @@ gotit:
 			(*skp)->pprev = &sk->next;
 		*skp = sk;
 		sk->pprev = skp;
+		__udp_demux_hash(sk);
 		sock_prot_inc_use(sk->prot);
 		sock_hold(sk);
 	}
@@ -198,6 +279,7 @@ static void udp_v4_unhash(struct sock *sk)
 			sk->next->pprev = sk->pprev;
 		*sk->pprev = sk->next;
 		sk->pprev = NULL;
+		__udp_demux_unhash(sk);
 		sk->num = 0;
 		sock_prot_dec_use(sk->prot);
 		__sock_put(sk);
@@ -207,14 +289,14 @@ static void udp_v4_unhash(struct sock *sk)
 
 /* UDP is nearly always wildcards out the wazoo, it makes no sense to try
  * harder than this. -DaveM
+ *
+ * Score one demux chain, keeping the best match in *result.
  */
-struct sock *udp_v4_lookup_longway(u32 saddr, u16 sport, u32 daddr, u16 dport, int dif)
+static int udp_v4_score_chain(struct sock *sk, struct sock **result,
+			      int badness, u32 saddr, u16 sport,
+			      u32 daddr, unsigned short hnum, int dif)
 {
-	struct sock *sk, *result = NULL;
-	unsigned short hnum = ntohs(dport);
-	int badness = -1;
-
-	for(sk = udp_hash[hnum & (UDP_HTABLE_SIZE - 1)]; sk != NULL; sk = sk->next) {
+	for(; sk != NULL; sk = sk->bind_next) {
 		if(sk->num == hnum) {
 			int score = 0;
 			if(sk->rcv_saddr) {
@@ -237,28 +319,59 @@ struct sock *udp_v4_lookup_longway(u32 saddr, u16 sport, u32 daddr, u16 dport, i
 					continue;
 				score++;
 			}
-			if(score == 4) {
-				result = sk;
-				break;
-			} else if(score > badness) {
-				result = sk;
+			if(score > badness) {
+				*result = sk;
 				badness = score;
+				if(score == 4)
+					break;
 			}
 		}
 	}
-	return result;
+	return badness;
 }
 
-__inline__ struct sock *udp_v4_lookup(u32 saddr, u16 sport, u32 daddr, u16 dport, int dif)
+/*
+ * A connected socket scores at least three and, device bindings aside,
+ * any other at most two, so a hit in the connected bucket ends the
+ * search.  Otherwise the answer is in one of the two buckets for the
+ * local end: bound to daddr, or bound to the wildcard address.
+ */
+struct sock *udp_v4_lookup(u32 saddr, u16 sport, u32 daddr, u16 dport, int dif)
 {
-	struct sock *sk;
-
-	read_lock(&udp_hash_lock);
-	sk = udp_v4_lookup_longway(saddr, sport, daddr, dport, dif);
-	if (sk)
-		sock_hold(sk);
-	read_unlock(&udp_hash_lock);
-	return sk;
+	struct udp_demux_bucket *b, *wild;
+	struct sock *result = NULL;
+	unsigned short hnum = ntohs(dport);
+	int badness;
+
+	b = &udp_demux[udp_demux_conn_hash(daddr, hnum, saddr, sport)];
+	read_lock(&b->lock);
+	badness = udp_v4_score_chain(b->chain, &result, -1,
+				     saddr, sport, daddr, hnum, dif);
+	if (badness >= 3) {
+		sock_hold(result);
+		read_unlock(&b->lock);
+		return result;
+	}
+	read_unlock(&b->lock);
+
+	result = NULL;
+	b = &udp_demux[udp_demux_bound_hash(daddr, hnum)];
+	wild = &udp_demux[udp_demux_bound_hash(0, hnum)];
+	read_lock(&b->lock);
+	badness = udp_v4_score_chain(b->chain, &result, -1,
+				     saddr, sport, daddr, hnum, dif);
+	if (wild != b && badness < 4) {
+		/* Writers never hold two bucket locks, so readers may. */
+		read_lock(&wild->lock);
+		udp_v4_score_chain(wild->chain, &result, badness,
+				   saddr, sport, daddr, hnum, dif);
+		if (result)
+			sock_hold(result);
+		read_unlock(&wild->lock);
+	} else if (result)
+		sock_hold(result);
+	read_unlock(&b->lock);
+	return result;
 }
 
 static inline struct sock *udp_v4_mcast_next(struct sock *sk,
@@ -739,6 +852,7 @@ int udp_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 	sk->dport = usin->sin_port;
 	sk->state = TCP_ESTABLISHED;
 	sk->protinfo.af_inet.id = jiffies;
+	udp_demux_rehash(sk);
 
 	sk_dst_set(sk, &rt->u.dst);
 	return(0);
@@ -765,7 +879,8 @@ int udp_disconnect(struct sock *sk, int flags)
 	if (!(sk->userlocks&SOCK_BINDPORT_LOCK)) {
 		sk->prot->unhash(sk);
 		sk->sport = 0;
-	}
+	} else
+		udp_demux_rehash(sk);
 	sk_dst_reset(sk);
 	return 0;
 }
@@ -795,6 +910,7 @@ static int udp_queue_rcv_skb(struct sock * sk, struct sk_buff *skb)
 #endif
 
 	if (sock_queue_rcv_skb(sk,skb)<0) {
+		atomic_inc(&sk->drops);
 		UDP_INC_STATS_BH(UdpInErrors);
 		IP_INC_STATS_BH(IpInDiscards);
 		ip_statistics[smp_processor_id()*2].IpInDelivers--;
@@ -956,13 +1072,14 @@ static void get_udp_sock(struct sock *sp, char *tmpbuf, int i)
 	destp = ntohs(sp->dport);
 	srcp  = ntohs(sp->sport);
 	sprintf(tmpbuf, "%4d: %08X:%04X %08X:%04X"
-		" %02X %08X:%08X %02X:%08lX %08X %5d %8d %ld %d %p",
+		" %02X %08X:%08X %02X:%08lX %08X %5d %8d %ld %d %p %d",
 		i, src, srcp, dest, destp, sp->state, 
 		atomic_read(&sp->wmem_alloc), atomic_read(&sp->rmem_alloc),
 		0, 0L, 0,
 		sock_i_uid(sp), 0,
 		sock_i_ino(sp),
-		atomic_read(&sp->refcnt), sp);
+		atomic_read(&sp->refcnt), sp,
+		atomic_read(&sp->drops));
 }
 
 int udp_get_info(char *buffer, char **start, off_t offset, int length)
@@ -970,12 +1087,13 @@ int udp_get_info(char *buffer, char **start, off_t offset, int length)
 	int len = 0, num = 0, i;
 	off_t pos = 0;
 	off_t begin;
-	char tmpbuf[129];
+	char tmpbuf[160];
 
 	if (offset < 128) 
 		len += sprintf(buffer, "%-127s\n",
 			       "  sl  local_address rem_address   st tx_queue "
-			       "rx_queue tr tm->when retrnsmt   uid  timeout inode");
+			       "rx_queue tr tm->when retrnsmt   uid  timeout inode "
+			       "ref pointer drops");
 	pos = 128;
 	read_lock(&udp_hash_lock);
 	for (i = 0; i < UDP_HTABLE_SIZE; i++) {
@@ -1005,6 +1123,42 @@ out:
 	return len;
 }
 
+/*
+ * The demux table is sized like the TCP established hash, a page per
+ * 8Mb of memory, since it has to hold every bound socket of a busy
+ * server.
+ */
+void __init udp_init(void)
+{
+	unsigned long goal;
+	int order, i;
+
+	goal = num_physpages >> (23 - PAGE_SHIFT);
+	for (order = 0; (1UL << order) < goal; order++)
+		;
+	do {
+		udp_demux_mask = (1UL << order) * PAGE_SIZE /
+			sizeof(struct udp_demux_bucket);
+		while (udp_demux_mask & (udp_demux_mask - 1))
+			udp_demux_mask--;
+		udp_demux = (struct udp_demux_bucket *)
+			__get_free_pages(GFP_ATOMIC, order);
+	} while (udp_demux == NULL && --order >= 0);
+
+	if (!udp_demux)
+		panic("Failed to allocate UDP demux hash table\n");
+
+	for (i = 0; i < udp_demux_mask; i++) {
+		udp_demux[i].lock = RW_LOCK_UNLOCKED;
+		udp_demux[i].chain = NULL;
+	}
+	udp_demux_mask--;
+	get_random_bytes(&udp_demux_rnd, sizeof(udp_demux_rnd));
+
+	printk(KERN_INFO "UDP: demux hash table of %u buckets\n",
+	       udp_demux_mask + 1);
+}
+
 struct proto udp_prot = {
  	name:		"UDP",
 	close:		udp_close,
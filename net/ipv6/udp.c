@@ -125,6 +125,7 @@ gotit:
 			(*skp)->pprev = &sk->next;
 		*skp = sk;
 		sk->pprev = skp;
+		__udp_demux_hash(sk);
 		sock_prot_inc_use(sk->prot);
 		sock_hold(sk);
 	}
@@ -149,6 +150,7 @@ static void udp_v6_unhash(struct sock *sk)
 			sk->next->pprev = sk->pprev;
 		*sk->pprev = sk->next;
 		sk->pprev = NULL;
+		__udp_demux_unhash(sk);
 		sk->num = 0;
 		sock_prot_dec_use(sk->prot);
 		__sock_put(sk);
@@ -350,6 +352,7 @@ ipv4_connected:
 		}
 		sk->state = TCP_ESTABLISHED;
 	}
+	udp_demux_rehash(sk);
 	fl6_sock_release(flowlabel);
 
 	return err;
@@ -508,6 +511,7 @@ static inline int udpv6_queue_rcv_skb(struct sock * sk, struct sk_buff *skb)
 	}
 #endif
 	if (sock_queue_rcv_skb(sk,skb)<0) {
+		atomic_inc(&sk->drops);
 		UDP6_INC_STATS_BH(UdpInErrors);
 		IP6_INC_STATS_BH(Ip6InDiscards);
 		kfree_skb(skb);
@@ -581,10 +585,13 @@ static void udpv6_mcast_deliver(struct udphdr *uh,
 		}
 		if (sock_queue_rcv_skb(sk2, buff) >= 0)
 			buff = NULL;
+		else
+			atomic_inc(&sk2->drops);
 	}
 	if (buff)
 		kfree_skb(buff);
 	if (sock_queue_rcv_skb(sk, skb) < 0) {
+		atomic_inc(&sk->drops);
 free_skb:
 		kfree_skb(skb);
 	}
@@ -916,7 +923,7 @@ static void get_udp6_sock(struct sock *sp, char *tmpbuf, int i)
 	srcp  = ntohs(sp->sport);
 	sprintf(tmpbuf,
 		"%4d: %08X%08X%08X%08X:%04X %08X%08X%08X%08X:%04X "
-		"%02X %08X:%08X %02X:%08lX %08X %5d %8d %ld %d %p",
+		"%02X %08X:%08X %02X:%08lX %08X %5d %8d %ld %d %p %d",
 		i,
 		src->s6_addr32[0], src->s6_addr32[1],
 		src->s6_addr32[2], src->s6_addr32[3], srcp,
@@ -927,7 +934,8 @@ static void get_udp6_sock(struct sock *sp, char *tmpbuf, int i)
 		0, 0L, 0,
 		sock_i_uid(sp), 0,
 		sock_i_ino(sp),
-		atomic_read(&sp->refcnt), sp);
+		atomic_read(&sp->refcnt), sp,
+		atomic_read(&sp->drops));
 }
 
 int udp6_get_info(char *buffer, char **start, off_t offset, int length)
@@ -943,9 +951,10 @@ int udp6_get_info(char *buffer, char **start, off_t offset, int length)
 			       "local_address                         "		/* 38 */
 			       "remote_address                        "		/* 38 */
 			       "st tx_queue rx_queue tr tm->when retrnsmt"	/* 41 */
-			       "   uid  timeout inode");			/* 21 */
+			       "   uid  timeout inode "				/* 22 */
+			       "ref pointer drops");			/* 17 */
 										/*----*/
-										/*144 */
+										/*162 */
 	pos = LINE_LEN+1;
 	read_lock(&udp_hash_lock);
 	for (i = 0; i < UDP_HTABLE_SIZE; i++) {